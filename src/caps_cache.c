@@ -0,0 +1,85 @@
+#include "caps_cache.h"
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include <ctype.h>
+#include <string.h>
+
+static bool s_nvs_ready = false;
+
+// NVS is normally up already (Wi-Fi start); without Wi-Fi credentials it is
+// initialised here. Never erased from this module: a partition that needs an
+// erase leaves the cache disabled instead.
+static bool caps_cache_nvs_ready(void)
+{
+    if (!s_nvs_ready)
+    {
+        s_nvs_ready = (nvs_flash_init() == ESP_OK);
+    }
+    return s_nvs_ready;
+}
+
+static bool caps_cache_key(const char *serial, char key[CAPS_CACHE_KEY_LEN + 1U])
+{
+    size_t n = 0U;
+    for (const char *p = serial; (p != NULL) && (*p != '\0') && (n < CAPS_CACHE_KEY_LEN); p++)
+    {
+        if (isalnum((unsigned char)*p))
+        {
+            key[n++] = *p;
+        }
+    }
+    key[n] = '\0';
+    return n > 0U;
+}
+
+bool caps_cache_load(const char *serial, uint32_t signature, caps_cache_entry_t *out)
+{
+    char key[CAPS_CACHE_KEY_LEN + 1U];
+    if ((out == NULL) || !caps_cache_key(serial, key) || !caps_cache_nvs_ready())
+    {
+        return false;
+    }
+
+    nvs_handle_t h;
+    if (nvs_open(CAPS_CACHE_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+    {
+        return false;
+    }
+
+    caps_cache_entry_t entry;
+    size_t len = sizeof(entry);
+    esp_err_t const err = nvs_get_blob(h, key, &entry, &len);
+    nvs_close(h);
+    if ((err != ESP_OK) || (len != sizeof(entry)) || (entry.signature != signature))
+    {
+        return false;
+    }
+
+    *out = entry;
+    return true;
+}
+
+bool caps_cache_store(const char *serial, const caps_cache_entry_t *entry)
+{
+    char key[CAPS_CACHE_KEY_LEN + 1U];
+    if ((entry == NULL) || !caps_cache_key(serial, key) || !caps_cache_nvs_ready())
+    {
+        return false;
+    }
+
+    nvs_handle_t h;
+    if (nvs_open(CAPS_CACHE_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
+    {
+        return false;
+    }
+
+    esp_err_t err = nvs_set_blob(h, key, entry, sizeof(*entry));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(h);
+    }
+    nvs_close(h);
+    return err == ESP_OK;
+}
@@ -0,0 +1,73 @@
+#ifndef CAPS_CACHE_H_
+#define CAPS_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-UPS command support, cached in NVS so a probe runs once per device.
+//
+// Entries are keyed by the UPS serial number (letters and digits only, at
+// most CAPS_CACHE_KEY_LEN of them) in the CAPS_CACHE_NAMESPACE namespace.
+// signature identifies the LUT layout the masks refer to; an entry written
+// for another layout (firmware update) does not load.
+//
+// A single probe can miss a command (a noisy line, the UPS busy), so an
+// entry is only trusted once CAPS_CACHE_TRUSTED_PROBES probes have been
+// merged into it: until then the caller probes again and stores the union
+// of the supported masks. A command dropped from polling has therefore gone
+// unanswered on that many bootstraps, each probe with its own retries.
+
+#ifndef CAPS_CACHE_NAMESPACE
+#define CAPS_CACHE_NAMESPACE "ups_caps"
+#endif
+
+#ifndef CAPS_CACHE_TRUSTED_PROBES
+#define CAPS_CACHE_TRUSTED_PROBES 3U
+#endif
+
+// NVS keys hold at most 15 characters.
+#define CAPS_CACHE_KEY_LEN 15U
+
+typedef struct
+{
+    uint32_t signature;
+    uint32_t constant_mask; // bit i: constant LUT entry i is supported
+    uint32_t dynamic_mask;  // bit i: dynamic LUT entry i is supported
+    uint8_t probes;         // probes merged into the masks, saturates at 255
+} caps_cache_entry_t;
+
+static inline bool caps_cache_trusted(const caps_cache_entry_t *entry)
+{
+    return entry->probes >= CAPS_CACHE_TRUSTED_PROBES;
+}
+
+// Merge a probe result into prior (an entry loaded for the same signature,
+// or one with probes == 0): supported bits accumulate.
+static inline caps_cache_entry_t caps_cache_merge(const caps_cache_entry_t *prior,
+                                                  uint32_t signature,
+                                                  uint32_t constant_mask,
+                                                  uint32_t dynamic_mask)
+{
+    caps_cache_entry_t const merged = {
+        .signature = signature,
+        .constant_mask = prior->constant_mask | constant_mask,
+        .dynamic_mask = prior->dynamic_mask | dynamic_mask,
+        .probes = (uint8_t)((prior->probes < 255U) ? (prior->probes + 1U) : 255U),
+    };
+    return merged;
+}
+
+// False if serial has no usable characters, NVS is unavailable, or there is
+// no entry for serial with this signature.
+bool caps_cache_load(const char *serial, uint32_t signature, caps_cache_entry_t *out);
+bool caps_cache_store(const char *serial, const caps_cache_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAPS_CACHE_H_
@@ -0,0 +1,79 @@
+#include "lut_probe.h"
+
+#include <string.h>
+
+static void lut_probe_done(uart_engine_handle_t handle, uart_engine_result_t result, void *ctx)
+{
+    (void)handle;
+
+    lut_probe_slot_t *slot = (lut_probe_slot_t *)ctx;
+    lut_probe_t *probe = slot->probe;
+
+    if (result == UART_ENGINE_OK)
+    {
+        probe->supported |= (1UL << slot->index);
+    }
+    slot->busy = false;
+    probe->inflight--;
+    probe->refused = false; // a tracking slot is free again
+}
+
+bool lut_probe_start(lut_probe_t *probe, uint8_t unit, const uart_engine_request_t *lut, size_t count, uint32_t mask)
+{
+    if ((probe == NULL) || (lut == NULL) || (count > LUT_PROBE_MAX_ENTRIES))
+    {
+        return false;
+    }
+
+    (void)memset(probe, 0, sizeof(*probe));
+    probe->unit = unit;
+    probe->lut = lut;
+    probe->count = count;
+    probe->mask = mask & lut_probe_mask_all(count);
+    for (size_t i = 0U; i < LUT_PROBE_MAX_INFLIGHT; i++)
+    {
+        probe->slots[i].probe = probe;
+    }
+    return true;
+}
+
+bool lut_probe_tick(lut_probe_t *probe)
+{
+    while ((probe->next < probe->count) && (probe->inflight < LUT_PROBE_MAX_INFLIGHT))
+    {
+        if ((probe->mask & (1UL << probe->next)) == 0U)
+        {
+            probe->next++;
+            continue;
+        }
+
+        lut_probe_slot_t *slot = NULL;
+        for (size_t i = 0U; i < LUT_PROBE_MAX_INFLIGHT; i++)
+        {
+            if (!probe->slots[i].busy)
+            {
+                slot = &probe->slots[i];
+                break;
+            }
+        }
+
+        // The engine copies the request, so the trial's retry budget can
+        // be raised on a stack copy.
+        uart_engine_request_t req = probe->lut[probe->next];
+        req.max_retries = (req.max_retries < LUT_PROBE_RETRIES) ? LUT_PROBE_RETRIES : req.max_retries;
+        slot->index = (uint8_t)probe->next;
+        uart_engine_result_t const result =
+            uart_engine_submit(probe->unit, &req, UART_ENGINE_PRIO_BACKGROUND, lut_probe_done, slot, NULL);
+        probe->refused = (result != UART_ENGINE_OK);
+        if (probe->refused)
+        {
+            // No free tracking slot (or engine disabled): try again next tick.
+            break;
+        }
+        slot->busy = true;
+        probe->inflight++;
+        probe->next++;
+    }
+
+    return (probe->next >= probe->count) && (probe->inflight == 0U);
+}
@@ -0,0 +1,110 @@
+#ifndef LUT_PROBE_H_
+#define LUT_PROBE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uart_engine.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One read of every entry of a LUT, recording which ones the UPS answers.
+//
+// Used at bootstrap to find the commands a given UPS supports: each entry in
+// the start mask is submitted once (tracked, BACKGROUND class) and counts as
+// supported if its process_fn accepts the reply. A trial gets at least
+// LUT_PROBE_RETRIES retries, so a reply lost to line noise does not drop a
+// command for good; entries outside the mask are skipped and count as
+// unsupported. The reads update out_value like any other, so a probe doubles
+// as the bootstrap read of the LUT.
+//
+// - lut_probe_start() binds the LUT; call lut_probe_tick() from the engine
+//   task, before uart_engine_tick(), until it returns true.
+// - lut_probe_supported() is then the mask of entries that answered
+//   (bit i = lut[i]).
+
+#ifndef LUT_PROBE_MAX_ENTRIES
+#define LUT_PROBE_MAX_ENTRIES 32U
+#endif
+
+#ifndef LUT_PROBE_MAX_INFLIGHT
+#define LUT_PROBE_MAX_INFLIGHT 2U
+#endif
+
+#ifndef LUT_PROBE_RETRIES
+#define LUT_PROBE_RETRIES 2U
+#endif
+
+// Wait reported by lut_probe_time_to_next_ms() after a refused submit (no
+// free tracking slot, engine disabled), instead of 0.
+#ifndef LUT_PROBE_RETRY_MS
+#define LUT_PROBE_RETRY_MS 10U
+#endif
+
+#define LUT_PROBE_ALL 0xFFFFFFFFUL
+
+typedef struct lut_probe lut_probe_t;
+
+typedef struct
+{
+    lut_probe_t *probe;
+    uint8_t index;
+    bool busy;
+} lut_probe_slot_t;
+
+struct lut_probe
+{
+    uint8_t unit;
+    const uart_engine_request_t *lut;
+    size_t count;
+    uint32_t mask;      // entries to try
+    size_t next;        // next entry to consider
+    uint8_t inflight;
+    uint32_t supported; // entries that answered
+    bool refused;       // the last submit was refused
+    lut_probe_slot_t slots[LUT_PROBE_MAX_INFLIGHT];
+};
+
+// Returns false (and binds nothing) if count exceeds LUT_PROBE_MAX_ENTRIES.
+bool lut_probe_start(lut_probe_t *probe, uint8_t unit, const uart_engine_request_t *lut, size_t count, uint32_t mask);
+
+// True once every entry in the mask has completed.
+bool lut_probe_tick(lut_probe_t *probe);
+
+static inline uint32_t lut_probe_supported(const lut_probe_t *probe)
+{
+    return probe->supported;
+}
+
+// True while lut_probe_tick() can only wait for completions (reported from
+// the engine tick).
+static inline bool lut_probe_waiting(const lut_probe_t *probe)
+{
+    return (probe->inflight > 0U) && ((probe->next >= probe->count) || (probe->inflight >= LUT_PROBE_MAX_INFLIGHT));
+}
+
+// Milliseconds until lut_probe_tick() has work again: UINT32_MAX while
+// waiting for completions only, LUT_PROBE_RETRY_MS after a refused submit.
+static inline uint32_t lut_probe_time_to_next_ms(const lut_probe_t *probe)
+{
+    if (lut_probe_waiting(probe))
+    {
+        return UINT32_MAX;
+    }
+    return probe->refused ? LUT_PROBE_RETRY_MS : 0U;
+}
+
+// Mask with the low count bits set.
+static inline uint32_t lut_probe_mask_all(size_t count)
+{
+    return (count >= 32U) ? LUT_PROBE_ALL : ((1UL << count) - 1UL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUT_PROBE_H_
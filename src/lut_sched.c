@@ -0,0 +1,236 @@
+#include "lut_sched.h"
+
+#include "main.h"
+
+#include <string.h>
+
+static uint32_t lut_sched_ms_until(uint32_t now_ms, uint32_t due_ms)
+{
+    int32_t const delta = (int32_t)(due_ms - now_ms);
+    return (delta > 0) ? (uint32_t)delta : 0U;
+}
+
+static uint32_t lut_sched_wire_ms(uint32_t bytes)
+{
+    return ((bytes * 10000U) + (uint32_t)UPS_UART_BAUDRATE - 1U) / (uint32_t)UPS_UART_BAUDRATE;
+}
+
+static void lut_sched_done(uart_engine_handle_t handle, uart_engine_result_t result, void *ctx)
+{
+    (void)handle;
+
+    lut_sched_entry_t *e = (lut_sched_entry_t *)ctx;
+    lut_sched_t *sched = e->sched;
+    size_t const i = (size_t)(e - &sched->entries[0]);
+    uint32_t const now_ms = ups_tick_ms();
+
+    e->inflight = false;
+    sched->inflight--;
+    sched->completed = true;
+    sched->refused = false; // a queue slot is free again
+    if (result == UART_ENGINE_ERR_SUSPENDED)
+    {
+        // Nothing was read; gap_max_ms keeps growing until the probe answers.
+        e->stats.suspended++;
+    }
+    else
+    {
+        if ((e->stats.ok + e->stats.failed) != 0U)
+        {
+            uint32_t const gap = now_ms - e->stats.last_done_ms;
+            e->stats.gap_max_ms = (gap > e->stats.gap_max_ms) ? gap : e->stats.gap_max_ms;
+        }
+        e->stats.last_done_ms = now_ms;
+        if (result == UART_ENGINE_OK)
+        {
+            e->stats.ok++;
+        }
+        else if (result == UART_ENGINE_ERR_FAILED)
+        {
+            e->stats.failed++;
+        }
+    }
+
+    uint32_t const period = sched->period_ms[i];
+    uint32_t const deadline = e->release_ms + period;
+    int32_t const late = (int32_t)(now_ms - deadline);
+    if (late > 0)
+    {
+        e->stats.missed++;
+        if ((uint32_t)late > e->stats.late_max_ms)
+        {
+            e->stats.late_max_ms = (uint32_t)late;
+        }
+    }
+
+    // Next period starts at this deadline; after a whole period lost (e.g.
+    // UPS silent) restart from now instead of releasing a backlog.
+    e->release_ms = (late >= (int32_t)period) ? now_ms : deadline;
+}
+
+bool lut_sched_init(lut_sched_t *sched, uint8_t unit, const uart_engine_request_t *lut, const uint32_t *period_ms, size_t count)
+{
+    if ((sched == NULL) || (lut == NULL) || (period_ms == NULL) || (count > LUT_SCHED_MAX_ENTRIES))
+    {
+        return false;
+    }
+
+    for (size_t i = 0U; i < count; i++)
+    {
+        if (period_ms[i] == 0U)
+        {
+            return false;
+        }
+    }
+
+    (void)memset(sched, 0, sizeof(*sched));
+    sched->unit = unit;
+    sched->lut = lut;
+    sched->period_ms = period_ms;
+    sched->count = count;
+    sched->active = (count >= 32U) ? 0xFFFFFFFFUL : ((1UL << count) - 1UL);
+    for (size_t i = 0U; i < count; i++)
+    {
+        sched->entries[i].sched = sched;
+    }
+    return true;
+}
+
+static bool lut_sched_is_active(const lut_sched_t *sched, size_t i)
+{
+    return (sched->active & (1UL << i)) != 0U;
+}
+
+void lut_sched_set_active(lut_sched_t *sched, uint32_t mask)
+{
+    uint32_t const all = (sched->count >= 32U) ? 0xFFFFFFFFUL : ((1UL << sched->count) - 1UL);
+    sched->active = mask & all;
+}
+
+void lut_sched_start(lut_sched_t *sched, uint32_t now_ms)
+{
+    for (size_t i = 0U; i < sched->count; i++)
+    {
+        sched->entries[i].release_ms = now_ms + sched->period_ms[i];
+    }
+    sched->running = true;
+}
+
+void lut_sched_stop(lut_sched_t *sched)
+{
+    sched->running = false;
+}
+
+// Released entry with the earliest deadline, or -1.
+static int lut_sched_pick(const lut_sched_t *sched, uint32_t now_ms)
+{
+    int best = -1;
+    uint32_t best_left = 0U;
+    for (size_t i = 0U; i < sched->count; i++)
+    {
+        lut_sched_entry_t const *e = &sched->entries[i];
+        if (!lut_sched_is_active(sched, i) || e->inflight || ((int32_t)(now_ms - e->release_ms) < 0))
+        {
+            continue;
+        }
+
+        // Time left to the deadline, 0 once it has passed.
+        uint32_t const left = lut_sched_ms_until(now_ms, e->release_ms + sched->period_ms[i]);
+        if ((best < 0) || (left < best_left))
+        {
+            best = (int)i;
+            best_left = left;
+        }
+    }
+    return best;
+}
+
+bool lut_sched_tick(lut_sched_t *sched, uint32_t now_ms)
+{
+    while (sched->running && (sched->inflight < LUT_SCHED_MAX_INFLIGHT))
+    {
+        int const i = lut_sched_pick(sched, now_ms);
+        if (i < 0)
+        {
+            break;
+        }
+
+        lut_sched_entry_t *e = &sched->entries[i];
+        sched->refused = (uart_engine_enqueue_static_cb(sched->unit,
+                                                        &sched->lut[i],
+                                                        UART_ENGINE_PRIO_BACKGROUND,
+                                                        lut_sched_done,
+                                                        e) != UART_ENGINE_OK);
+        if (sched->refused)
+        {
+            // Queue full (or engine disabled): try again next tick.
+            break;
+        }
+        e->inflight = true;
+        sched->inflight++;
+    }
+
+    if (sched->completed && (sched->inflight == 0U))
+    {
+        sched->completed = false;
+        return true;
+    }
+    return false;
+}
+
+uint32_t lut_sched_time_to_next_ms(const lut_sched_t *sched, uint32_t now_ms)
+{
+    if (!sched->running || (sched->inflight >= LUT_SCHED_MAX_INFLIGHT))
+    {
+        return UINT32_MAX;
+    }
+
+    uint32_t next = UINT32_MAX;
+    for (size_t i = 0U; i < sched->count; i++)
+    {
+        if (!lut_sched_is_active(sched, i) || sched->entries[i].inflight)
+        {
+            continue;
+        }
+        uint32_t until = lut_sched_ms_until(now_ms, sched->entries[i].release_ms);
+        if ((until == 0U) && sched->refused)
+        {
+            until = LUT_SCHED_RETRY_MS;
+        }
+        next = (until < next) ? until : next;
+    }
+    return next;
+}
+
+uint32_t lut_sched_utilization_permille(const lut_sched_t *sched)
+{
+    uint32_t total_ppm = 0U;
+    size_t const stats_count = uart_engine_cmd_stats_count(sched->unit);
+
+    for (size_t i = 0U; i < sched->count; i++)
+    {
+        if (!lut_sched_is_active(sched, i))
+        {
+            continue;
+        }
+
+        uart_engine_request_t const *req = &sched->lut[i];
+        uint32_t const tx_bytes = (req->tx_bytes != NULL) ? req->tx_len : ((uint32_t)req->cmd_bits / 8U);
+        uint32_t reply_ms = lut_sched_wire_ms(req->expected_len) + LUT_SCHED_TURNAROUND_MS;
+
+        for (size_t s = 0U; s < stats_count; s++)
+        {
+            uart_engine_cmd_stats_t st;
+            if (uart_engine_get_cmd_stats(sched->unit, s, &st) && (st.cmd == req->cmd) &&
+                (st.cmd_bits == req->cmd_bits) && (st.success != 0U) && (st.srtt_ms != 0U))
+            {
+                reply_ms = st.srtt_ms;
+                break;
+            }
+        }
+
+        uint32_t const cost_ms = lut_sched_wire_ms(tx_bytes) + reply_ms;
+        total_ppm += (cost_ms * 1000000U) / sched->period_ms[i];
+    }
+    return total_ppm / 1000U;
+}
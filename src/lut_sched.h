@@ -0,0 +1,124 @@
+#ifndef LUT_SCHED_H_
+#define LUT_SCHED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uart_engine.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Earliest-deadline-first refresh of a LUT, one instance per unit.
+//
+// Every entry i has its own period_ms[i]. It is released once per period and
+// its deadline is the end of that period; of the released entries, the one
+// with the earliest deadline is queued next (BACKGROUND class, by reference
+// with uart_engine_enqueue_static_cb(), so completion is reported back and
+// an alert refresh of the same command merges with it). At most
+// LUT_SCHED_MAX_INFLIGHT entries are with the engine at a time, so ordering
+// decisions are taken late and a burst of alert refreshes or SNMP requests
+// does not find a whole LUT queued ahead of it.
+//
+// - lut_sched_init() binds the LUT; lut_sched_start() releases every entry
+//   one period from now (the bootstrap has just read all of them).
+// - Call lut_sched_tick() from the engine task, before uart_engine_tick().
+//   It returns true once after entries completed and nothing is pending any
+//   more: a good moment to publish a snapshot.
+// - lut_sched_set_active() limits refreshes to the entries the UPS supports
+//   (bit i = lut[i], e.g. from lut_probe); all are active after init.
+//
+// Admission: lut_sched_utilization_permille() sums cost_i / period_i over
+// the LUT, with cost_i the command's measured reply latency (engine
+// statistics) plus its wire time, or the worst case from expected_len before
+// the command has been answered once. EDF meets every deadline while the
+// total stays below 1000; the bus also carries heartbeats, alert refreshes
+// and SNMP requests, so lut_sched_admitted() wants it below
+// LUT_SCHED_MAX_UTIL_PERMILLE.
+
+#ifndef LUT_SCHED_MAX_ENTRIES
+#define LUT_SCHED_MAX_ENTRIES 32U
+#endif
+
+#ifndef LUT_SCHED_MAX_INFLIGHT
+#define LUT_SCHED_MAX_INFLIGHT 2U
+#endif
+
+#ifndef LUT_SCHED_MAX_UTIL_PERMILLE
+#define LUT_SCHED_MAX_UTIL_PERMILLE 700U
+#endif
+
+// Wait reported by lut_sched_time_to_next_ms() after the engine refused an
+// entry (queue full, engine disabled), instead of 0.
+#ifndef LUT_SCHED_RETRY_MS
+#define LUT_SCHED_RETRY_MS 10U
+#endif
+
+// UPS turnaround assumed on top of the wire time of a command not yet measured.
+#ifndef LUT_SCHED_TURNAROUND_MS
+#define LUT_SCHED_TURNAROUND_MS 30U
+#endif
+
+typedef struct
+{
+    uint32_t ok;
+    uint32_t failed;    // engine gave up after its retries
+    uint32_t suspended; // not sent, the command's circuit breaker was open
+    uint32_t missed;    // completed after the deadline
+    uint32_t late_max_ms;
+    uint32_t gap_max_ms; // longest time between two completions
+    uint32_t last_done_ms;
+} lut_sched_entry_stats_t;
+
+typedef struct lut_sched lut_sched_t;
+
+typedef struct
+{
+    lut_sched_t *sched;
+    uint32_t release_ms; // start of the current period; deadline is release_ms + period
+    bool inflight;
+    lut_sched_entry_stats_t stats;
+} lut_sched_entry_t;
+
+struct lut_sched
+{
+    uint8_t unit;
+    const uart_engine_request_t *lut;
+    const uint32_t *period_ms;
+    size_t count;
+    uint32_t active; // entries refreshed, bit i = lut[i]
+    bool running;
+    uint8_t inflight;
+    bool completed; // something finished since lut_sched_tick() last returned true
+    bool refused;   // the last enqueue was refused; cleared by a completion
+    lut_sched_entry_t entries[LUT_SCHED_MAX_ENTRIES];
+};
+
+// Returns false (and binds nothing) if count exceeds LUT_SCHED_MAX_ENTRIES or
+// a period is 0.
+bool lut_sched_init(lut_sched_t *sched, uint8_t unit, const uart_engine_request_t *lut, const uint32_t *period_ms, size_t count);
+void lut_sched_set_active(lut_sched_t *sched, uint32_t mask);
+void lut_sched_start(lut_sched_t *sched, uint32_t now_ms);
+void lut_sched_stop(lut_sched_t *sched);
+
+bool lut_sched_tick(lut_sched_t *sched, uint32_t now_ms);
+
+// Milliseconds until lut_sched_tick() has work again; UINT32_MAX while
+// waiting for completions only, at least LUT_SCHED_RETRY_MS after a refused
+// enqueue.
+uint32_t lut_sched_time_to_next_ms(const lut_sched_t *sched, uint32_t now_ms);
+
+uint32_t lut_sched_utilization_permille(const lut_sched_t *sched);
+
+static inline bool lut_sched_admitted(const lut_sched_t *sched)
+{
+    return lut_sched_utilization_permille(sched) <= LUT_SCHED_MAX_UTIL_PERMILLE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUT_SCHED_H_
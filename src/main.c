@@ -1,8 +1,13 @@
 #include "main.h"
 
+#include "caps_cache.h"
+#include "lut_probe.h"
+#include "lut_sched.h"
 #include "spm2k.h"
 #include "snmp_agent.h"
+#include "sys_health.h"
 #include "uart_engine.h"
+#include "uart_trace.h"
 #include "wifi_client.h"
 
 #include "freertos/FreeRTOS.h"
@@ -11,6 +16,7 @@
 #include "esp_log.h"
 
 #include <string.h>
+#include <sys/select.h>
 
 static const char *TAG = "ups_main";
 
@@ -24,10 +30,6 @@ static inline void ups_loop_delay_safe(uint32_t delay_ms)
     vTaskDelay(ticks);
 }
 
-#ifndef UPS_DYNAMIC_UPDATE_PERIOD_S
-#define UPS_DYNAMIC_UPDATE_PERIOD_S 10U
-#endif
-
 #ifndef UPS_INIT_RETRY_PERIOD_S
 #define UPS_INIT_RETRY_PERIOD_S 5U
 #endif
@@ -44,15 +46,45 @@ static inline void ups_loop_delay_safe(uint32_t delay_ms)
 #define UPS_BOOTSTRAP_HEARTBEAT_RX_BUF_SIZE 16U
 #endif
 
+#ifndef UPS_SERIAL_MAX_LEN
+#define UPS_SERIAL_MAX_LEN 24U
+#endif
+
+// Liveness check once bootstrapped: the engine sends the sub-adapter heartbeat
+// only after this long without an accepted reply to any command.
+#ifndef UPS_HEARTBEAT_INTERVAL_MS
+#define UPS_HEARTBEAT_INTERVAL_MS 10000U
+#endif
+
+// Repeated heartbeat failures only mark the unit's telemetry as comm_lost.
+// Set to 1 to also report the battery as exhausted and on battery, so that
+// SNMP managers shut their hosts down when the UPS stops answering (a pulled
+// serial cable then triggers the shutdown too).
+#ifndef UPS_HEARTBEAT_BATTERY_FAILSAFE
+#define UPS_HEARTBEAT_BATTERY_FAILSAFE 0
+#endif
+
 #ifndef UPS_MAIN_LOOP_DELAY_MS
 #define UPS_MAIN_LOOP_DELAY_MS 1U
 #endif
 
-#ifndef UPS_ENQUEUE_BURST_PER_TICK
-#define UPS_ENQUEUE_BURST_PER_TICK 8U
+// Main loop sleeps on the UART driver event queue until RX activity or the
+// next engine/scheduler deadline, instead of polling every UPS_MAIN_LOOP_DELAY_MS.
+#ifndef UPS_UART_EVENT_DRIVEN
+#define UPS_UART_EVENT_DRIVEN 1
+#endif
+
+// Reactor build: one select() over the SNMP socket and UART RX instead of the
+// SNMP task plus the fixed-period main loop.
+#ifndef UPS_REACTOR_ENABLED
+#define UPS_REACTOR_ENABLED 0
+#endif
+
+// Upper bound for one event-driven/reactor sleep, as a safety net against lost wakeups.
+#ifndef UPS_MAIN_LOOP_MAX_SLEEP_MS
+#define UPS_MAIN_LOOP_MAX_SLEEP_MS 1000U
 #endif
 
-#define UPS_DYNAMIC_UPDATE_PERIOD_MS ((uint32_t)(UPS_DYNAMIC_UPDATE_PERIOD_S) * 1000U)
 #define UPS_INIT_RETRY_PERIOD_MS ((uint32_t)(UPS_INIT_RETRY_PERIOD_S) * 1000U)
 
 #if (UPS_DEBUG_STATUS_PRINT_ENABLED != 0)
@@ -72,106 +104,157 @@ typedef enum
 #define UPS_ACTIVE_SUB_ADAPTER UPS_SUB_ADAPTER_SPM2K
 #endif
 
+#ifndef UPS_UNIT1_SUB_ADAPTER
+#define UPS_UNIT1_SUB_ADAPTER UPS_ACTIVE_SUB_ADAPTER
+#endif
+
+#ifndef UPS_UNIT2_SUB_ADAPTER
+#define UPS_UNIT2_SUB_ADAPTER UPS_ACTIVE_SUB_ADAPTER
+#endif
+
+// Sub-adapter (LUT set) of each unit.
+static const ups_sub_adapter_t k_unit_sub_adapter[UPS_UNIT_COUNT] = {
+    UPS_ACTIVE_SUB_ADAPTER,
+#if (UPS_UNIT_COUNT > 1)
+    UPS_UNIT1_SUB_ADAPTER,
+#endif
+#if (UPS_UNIT_COUNT > 2)
+    UPS_UNIT2_SUB_ADAPTER,
+#endif
+};
+
 typedef enum
 {
     UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT = 0,
     UPS_BOOTSTRAP_WAIT_HEARTBEAT_DRAIN,
     UPS_BOOTSTRAP_HEARTBEAT_VERIFY,
     UPS_BOOTSTRAP_WAIT_RETRY,
-    UPS_BOOTSTRAP_ENQUEUE_CONSTANT,
-    UPS_BOOTSTRAP_ENQUEUE_DYNAMIC,
+    UPS_BOOTSTRAP_ENQUEUE_SERIAL,
+    UPS_BOOTSTRAP_WAIT_SERIAL_DRAIN,
+    UPS_BOOTSTRAP_CAPS_LOAD,
+    UPS_BOOTSTRAP_READ_CONSTANT,
+    UPS_BOOTSTRAP_READ_DYNAMIC,
     UPS_BOOTSTRAP_WAIT_DRAIN,
     UPS_BOOTSTRAP_SANITY_CHECK,
     UPS_BOOTSTRAP_DONE,
 } ups_bootstrap_state_t;
 
-static const uart_engine_request_t *g_sub_adapter_constant_lut = NULL;
-static size_t g_sub_adapter_constant_lut_count = 0U;
-static const uart_engine_request_t *g_sub_adapter_dynamic_lut = NULL;
-static size_t g_sub_adapter_dynamic_lut_count = 0U;
-static const uart_engine_request_t *g_sub_adapter_constant_heartbeat = NULL;
-static const uint8_t *g_sub_adapter_constant_heartbeat_expect_return = NULL;
-static size_t g_sub_adapter_constant_heartbeat_expect_return_len = 0U;
-
-static ups_bootstrap_state_t s_ups_bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT;
-static size_t s_bootstrap_constant_idx = 0U;
-static size_t s_bootstrap_dynamic_idx = 0U;
-static uint32_t s_init_retry_not_before_ms = 0U;
-static uint32_t s_init_bootstrap_start_ms = 0U;
-static bool s_init_bootstrap_started = false;
-static uint32_t s_last_dynamic_cycle_start_ms = 0U;
-
-static uint8_t s_bootstrap_heartbeat_rx[UPS_BOOTSTRAP_HEARTBEAT_RX_BUF_SIZE];
-static uint16_t s_bootstrap_heartbeat_rx_len = 0U;
-static bool s_bootstrap_heartbeat_done = false;
-
-static bool s_dynamic_update_cycle_active = false;
-static size_t s_dynamic_update_idx = 0U;
-static uint32_t s_next_dynamic_update_ms = 0U;
+// Sub-adapter binding of one unit: LUT set, heartbeat and alert handling.
+typedef struct
+{
+    const uart_engine_request_t *constant_lut;
+    size_t constant_lut_count;
+    const uart_engine_request_t *dynamic_lut;
+    size_t dynamic_lut_count;
+    const uint32_t *dynamic_period_ms; // per dynamic_lut entry
+    const uart_engine_request_t *serial_request; // keys the command support cache
+    const uart_engine_request_t *constant_heartbeat;
+    const uint8_t *constant_heartbeat_expect_return;
+    size_t constant_heartbeat_expect_return_len;
+    uart_engine_oob_fn alert_fn;
+    const uart_engine_request_t *alert_refresh_lut;
+    size_t alert_refresh_lut_count;
+} ups_sub_adapter_cfg_t;
+
+// Bootstrap and refresh scheduling of one UPS unit.
+typedef struct
+{
+    uint8_t unit;
+    ups_sub_adapter_cfg_t adapter;
 
-#ifndef UART_ENGINE_DEFAULT_ENABLED
-#define UART_ENGINE_DEFAULT_ENABLED 1
-#endif
+    ups_bootstrap_state_t bootstrap_state;
+    uint32_t init_retry_not_before_ms;
+    uint32_t init_bootstrap_start_ms;
+    bool init_bootstrap_started;
+    bool bootstrap_enqueue_refused; // last heartbeat/serial enqueue was refused
 
-static bool s_uart_engine_enabled = (UART_ENGINE_DEFAULT_ENABLED != 0);
+    uint8_t bootstrap_heartbeat_rx[UPS_BOOTSTRAP_HEARTBEAT_RX_BUF_SIZE];
+    uint16_t bootstrap_heartbeat_rx_len;
+    bool bootstrap_heartbeat_done;
 
-ups_present_status_t g_power_summary_present_status = {
-    .ac_present = false,
-    .charging = false,
-    .discharging = false,
-    .fully_charged = false,
-    .need_replacement = false,
-    .below_remaining_capacity_limit = false,
-    .battery_present = false,
-    .overload = false,
-    .shutdown_imminent = false,
-};
+    // Command support: the bootstrap read of each LUT is a probe (lut_probe)
+    // unless the masks for this serial number are cached in NVS.
+    char serial[UPS_SERIAL_MAX_LEN + 1U]; // "" if the UPS did not answer
+    lut_probe_t probe;
+    uint32_t constant_active; // bit i: constant LUT entry i is read
+    uint32_t dynamic_active;  // bit i: dynamic LUT entry i is refreshed
+    bool caps_cached;         // masks loaded from the cache, not probed
+    caps_cache_entry_t caps_prior; // untrusted cache entry the probe is merged into (probes 0: none)
+    bool caps_reprobe;        // bootstrap with cached masks failed: probe next time
 
-ups_summary_t g_power_summary = {
-    .rechargeable = true,
-    .capacity_mode = 2U,
-    .design_capacity = 100U,
-    .full_charge_capacity = 100U,
-    .warning_capacity_limit = 20U,
-    .remaining_capacity_limit = 10U,
-    .i_device_chemistry = 0x05U,
-    .capacity_granularity_1 = 1U,
-    .capacity_granularity_2 = 1U,
-    .i_manufacturer_2bit = 1U,
-    .i_product_2bit = 2U,
-    .i_serial_number_2bit = 3U,
-    .i_name_2bit = 2U,
-};
+    lut_sched_t dynamic_sched; // dynamic LUT refresh once bootstrapped
+    uart_engine_expect_bytes_t heartbeat_expect; // out_value of the engine heartbeat
+} ups_unit_t;
 
-ups_battery_t g_battery = {
-    .battery_voltage = 0,
-    .battery_current = 0,
-    .config_voltage = 0,
-    .run_time_to_empty_s = 0,
-    .remaining_time_limit_s = 0,
-    .temperature = 0,
-    .manufacturer_date = 0,
-    .remaining_capacity = 0,
-};
+static ups_unit_t s_units[UPS_UNIT_COUNT];
 
-ups_input_t g_input = {
-    .voltage = 0,
-    .frequency = 0,
-    .config_voltage = 0,
-    .low_voltage_transfer = 0,
-    .high_voltage_transfer = 0,
-};
+static uint32_t s_next_debug_print_ms = 0U;
+
+#ifndef UART_ENGINE_DEFAULT_ENABLED
+#define UART_ENGINE_DEFAULT_ENABLED 1
+#endif
+
+static bool s_uart_engine_enabled = (UART_ENGINE_DEFAULT_ENABLED != 0);
 
-ups_output_t g_output = {
-    .percent_load = 0,
-    .config_active_power = 0,
-    .config_voltage = 0,
-    .voltage = 0,
-    .current = 0,
-    .frequency = 0,
+ups_telemetry_t g_ups[UPS_UNIT_COUNT];
+
+// Power-on contents of every unit's telemetry block.
+static const ups_telemetry_t k_ups_telemetry_defaults = {
+    .present_status = {
+        .ac_present = false,
+        .charging = false,
+        .discharging = false,
+        .fully_charged = false,
+        .need_replacement = false,
+        .below_remaining_capacity_limit = false,
+        .battery_present = false,
+        .overload = false,
+        .shutdown_imminent = false,
+        .comm_lost = false,
+    },
+    .summary = {
+        .rechargeable = true,
+        .capacity_mode = 2U,
+        .design_capacity = 100U,
+        .full_charge_capacity = 100U,
+        .warning_capacity_limit = 20U,
+        .remaining_capacity_limit = 10U,
+        .i_device_chemistry = 0x05U,
+        .capacity_granularity_1 = 1U,
+        .capacity_granularity_2 = 1U,
+        .i_manufacturer_2bit = 1U,
+        .i_product_2bit = 2U,
+        .i_serial_number_2bit = 3U,
+        .i_name_2bit = 2U,
+    },
+    .battery = {
+        .battery_voltage = 0,
+        .battery_current = 0,
+        .config_voltage = 0,
+        .run_time_to_empty_s = 0,
+        .remaining_time_limit_s = 0,
+        .temperature = 0,
+        .manufacturer_date = 0,
+        .remaining_capacity = 0,
+    },
+    .input = {
+        .voltage = 0,
+        .frequency = 0,
+        .config_voltage = 0,
+        .low_voltage_transfer = 0,
+        .high_voltage_transfer = 0,
+    },
+    .output = {
+        .percent_load = 0,
+        .config_active_power = 0,
+        .config_voltage = 0,
+        .voltage = 0,
+        .current = 0,
+        .frequency = 0,
+    },
 };
 
-void UPS_DebugPrintTxCommand(const uint8_t *data, uint16_t len)
+void UPS_DebugPrintTxCommand(uint8_t unit, const uint8_t *data, uint16_t len)
 {
 #if (UPS_DEBUG_STATUS_PRINT_ENABLED != 0)
     if ((data == NULL) || (len < 1U))
@@ -179,7 +262,7 @@ void UPS_DebugPrintTxCommand(const uint8_t *data, uint16_t len)
         return;
     }
 
-    printf("UART_TX cmd len=%u data=", (unsigned int)len);
+    printf("UART_TX unit=%u cmd len=%u data=", (unsigned int)unit, (unsigned int)len);
     for (uint16_t i = 0U; i < len; i++)
     {
         printf("%02X", data[i]);
@@ -190,220 +273,428 @@ void UPS_DebugPrintTxCommand(const uint8_t *data, uint16_t len)
     }
     printf("\r\n");
 #else
+    (void)unit;
     (void)data;
     (void)len;
 #endif
 }
 
-static void ups_sub_adapter_select(void)
+static void ups_sub_adapter_select(ups_unit_t *u, ups_sub_adapter_t sub_adapter)
 {
-    switch ((ups_sub_adapter_t)UPS_ACTIVE_SUB_ADAPTER)
+    switch (sub_adapter)
     {
     case UPS_SUB_ADAPTER_SPM2K:
-        g_sub_adapter_constant_lut = g_spm2k_constant_lut;
-        g_sub_adapter_constant_lut_count = g_spm2k_constant_lut_count;
-        g_sub_adapter_dynamic_lut = g_spm2k_dynamic_lut;
-        g_sub_adapter_dynamic_lut_count = g_spm2k_dynamic_lut_count;
-        g_sub_adapter_constant_heartbeat = &g_spm2k_constant_heartbeat;
-        g_sub_adapter_constant_heartbeat_expect_return = g_spm2k_constant_heartbeat_expect_return;
-        g_sub_adapter_constant_heartbeat_expect_return_len = g_spm2k_constant_heartbeat_expect_return_len;
+        u->adapter.constant_lut = g_spm2k_constant_lut;
+        u->adapter.constant_lut_count = g_spm2k_constant_lut_count;
+        u->adapter.dynamic_lut = g_spm2k_dynamic_lut;
+        u->adapter.dynamic_lut_count = g_spm2k_dynamic_lut_count;
+        u->adapter.dynamic_period_ms = g_spm2k_dynamic_period_ms;
+        u->adapter.serial_request = &g_spm2k_serial_number;
+        u->adapter.constant_heartbeat = &g_spm2k_constant_heartbeat;
+        u->adapter.constant_heartbeat_expect_return = g_spm2k_constant_heartbeat_expect_return;
+        u->adapter.constant_heartbeat_expect_return_len = g_spm2k_constant_heartbeat_expect_return_len;
+        u->adapter.alert_fn = spm2k_process_alert_byte;
+        u->adapter.alert_refresh_lut = g_spm2k_alert_refresh_lut;
+        u->adapter.alert_refresh_lut_count = g_spm2k_alert_refresh_lut_count;
         break;
     default:
-        g_sub_adapter_constant_lut = NULL;
-        g_sub_adapter_constant_lut_count = 0U;
-        g_sub_adapter_dynamic_lut = NULL;
-        g_sub_adapter_dynamic_lut_count = 0U;
-        g_sub_adapter_constant_heartbeat = NULL;
-        g_sub_adapter_constant_heartbeat_expect_return = NULL;
-        g_sub_adapter_constant_heartbeat_expect_return_len = 0U;
+        u->adapter.constant_lut = NULL;
+        u->adapter.constant_lut_count = 0U;
+        u->adapter.dynamic_lut = NULL;
+        u->adapter.dynamic_lut_count = 0U;
+        u->adapter.dynamic_period_ms = NULL;
+        u->adapter.serial_request = NULL;
+        u->adapter.constant_heartbeat = NULL;
+        u->adapter.constant_heartbeat_expect_return = NULL;
+        u->adapter.constant_heartbeat_expect_return_len = 0U;
+        u->adapter.alert_fn = NULL;
+        u->adapter.alert_refresh_lut = NULL;
+        u->adapter.alert_refresh_lut_count = 0U;
         break;
     }
+
+    uart_engine_set_oob_handler(u->unit,
+                                u->adapter.alert_fn,
+                                &g_ups[u->unit],
+                                u->adapter.alert_refresh_lut,
+                                u->adapter.alert_refresh_lut_count);
+
+    if ((u->adapter.dynamic_lut != NULL) &&
+        !lut_sched_init(&u->dynamic_sched,
+                        u->unit,
+                        u->adapter.dynamic_lut,
+                        u->adapter.dynamic_period_ms,
+                        u->adapter.dynamic_lut_count))
+    {
+        ESP_LOGE(TAG, "unit %u: dynamic LUT periods invalid, no periodic refresh", (unsigned int)u->unit);
+    }
+
+    if ((u->adapter.constant_lut_count > LUT_PROBE_MAX_ENTRIES) || (u->adapter.dynamic_lut_count > LUT_PROBE_MAX_ENTRIES))
+    {
+        ESP_LOGE(TAG, "unit %u: LUT longer than %u entries, bootstrap cannot complete", (unsigned int)u->unit,
+                 (unsigned int)LUT_PROBE_MAX_ENTRIES);
+    }
+}
+
+// Identifies the LUT layout the cached support masks refer to (FNV-1a over
+// the commands of both LUTs).
+static uint32_t ups_caps_signature(const ups_sub_adapter_cfg_t *a)
+{
+    uint32_t h = 2166136261UL;
+    const uart_engine_request_t *const luts[2] = {a->constant_lut, a->dynamic_lut};
+    size_t const counts[2] = {a->constant_lut_count, a->dynamic_lut_count};
+    for (size_t l = 0U; l < 2U; l++)
+    {
+        for (size_t i = 0U; i < counts[l]; i++)
+        {
+            uint8_t const bytes[3] = {(uint8_t)(luts[l][i].cmd >> 8), (uint8_t)luts[l][i].cmd, luts[l][i].cmd_bits};
+            for (size_t b = 0U; b < sizeof(bytes); b++)
+            {
+                h = (h ^ bytes[b]) * 16777619UL;
+            }
+        }
+        h = (h ^ 0xFFU) * 16777619UL;
+    }
+    return h;
+}
+
+static uint8_t ups_mask_count(uint32_t mask)
+{
+    uint8_t n = 0U;
+    for (; mask != 0U; mask &= (mask - 1U))
+    {
+        n++;
+    }
+    return n;
+}
+
+static void ups_caps_report(const ups_unit_t *u)
+{
+    for (size_t i = 0U; i < u->adapter.dynamic_lut_count; i++)
+    {
+        if ((u->dynamic_active & (1UL << i)) == 0U)
+        {
+            ESP_LOGI(TAG, "unit %u: UPS %s does not answer 0x%X, not polled",
+                     (unsigned int)u->unit,
+                     (u->serial[0] != '\0') ? u->serial : "(no serial)",
+                     (unsigned int)u->adapter.dynamic_lut[i].cmd);
+        }
+    }
+    UPS_DEBUG_PRINTF("U%u INIT commands: constant %u/%u dynamic %u/%u (%s)\r\n",
+                     (unsigned int)u->unit,
+                     (unsigned int)ups_mask_count(u->constant_active),
+                     (unsigned int)u->adapter.constant_lut_count,
+                     (unsigned int)ups_mask_count(u->dynamic_active),
+                     (unsigned int)u->adapter.dynamic_lut_count,
+                     u->caps_cached ? "cached" : "probed");
 }
 
-static bool ups_bootstrap_heartbeat_capture(uint16_t cmd,
-                                            const uint8_t *rx,
-                                            uint16_t rx_len,
-                                            void *out_value)
+static bool ups_bootstrap_serial_capture(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
-    (void)out_value;
 
-    s_bootstrap_heartbeat_done = false;
-    s_bootstrap_heartbeat_rx_len = 0U;
+    ups_unit_t *u = (ups_unit_t *)out_value;
+    if ((u == NULL) || (rx == NULL) || (uart_engine_span_len(rx) < 3U))
+    {
+        return false;
+    }
+    uint16_t const rx_len = uart_engine_span_len(rx);
+
+    // Printable payload before the CR LF terminator.
+    size_t n = 0U;
+    for (uint16_t i = 0U; (i < (uint16_t)(rx_len - 2U)) && (n < UPS_SERIAL_MAX_LEN); i++)
+    {
+        uint8_t const c = uart_engine_span_at(rx, i);
+        if ((c > 0x20U) && (c < 0x7FU))
+        {
+            u->serial[n++] = (char)c;
+        }
+    }
+    u->serial[n] = '\0';
+    return n > 0U;
+}
+
+static bool ups_bootstrap_heartbeat_capture(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
+{
+    (void)cmd;
+
+    ups_unit_t *u = (ups_unit_t *)out_value;
+    if (u == NULL)
+    {
+        return false;
+    }
+
+    u->bootstrap_heartbeat_done = false;
+    u->bootstrap_heartbeat_rx_len = 0U;
 
     if (rx == NULL)
     {
         return false;
     }
 
-    if (rx_len > (uint16_t)sizeof(s_bootstrap_heartbeat_rx))
+    uint16_t const rx_len = uart_engine_span_len(rx);
+    if (rx_len > (uint16_t)sizeof(u->bootstrap_heartbeat_rx))
     {
         return false;
     }
 
-    memcpy(s_bootstrap_heartbeat_rx, rx, rx_len);
-    s_bootstrap_heartbeat_rx_len = rx_len;
-    s_bootstrap_heartbeat_done = true;
+    (void)uart_engine_span_copy(rx, u->bootstrap_heartbeat_rx, rx_len);
+    u->bootstrap_heartbeat_rx_len = rx_len;
+    u->bootstrap_heartbeat_done = true;
     return true;
 }
 
-static bool ups_bootstrap_heartbeat_matches_expected(void)
+static bool ups_bootstrap_heartbeat_matches_expected(const ups_unit_t *u)
 {
-    if (!s_bootstrap_heartbeat_done ||
-        (g_sub_adapter_constant_heartbeat_expect_return == NULL) ||
-        (g_sub_adapter_constant_heartbeat_expect_return_len == 0U))
+    if (!u->bootstrap_heartbeat_done ||
+        (u->adapter.constant_heartbeat_expect_return == NULL) ||
+        (u->adapter.constant_heartbeat_expect_return_len == 0U))
     {
         return false;
     }
 
-    if (s_bootstrap_heartbeat_rx_len != g_sub_adapter_constant_heartbeat_expect_return_len)
+    if (u->bootstrap_heartbeat_rx_len != u->adapter.constant_heartbeat_expect_return_len)
     {
         return false;
     }
 
-    return (memcmp(s_bootstrap_heartbeat_rx,
-                   g_sub_adapter_constant_heartbeat_expect_return,
-                   s_bootstrap_heartbeat_rx_len) == 0);
-}
-
-static void ups_bootstrap_reset_for_retry(uint32_t now_ms)
-{
-    s_bootstrap_constant_idx = 0U;
-    s_bootstrap_dynamic_idx = 0U;
-    s_bootstrap_heartbeat_rx_len = 0U;
-    s_bootstrap_heartbeat_done = false;
-    s_init_retry_not_before_ms = now_ms + UPS_INIT_RETRY_PERIOD_MS;
-    s_ups_bootstrap_state = UPS_BOOTSTRAP_WAIT_RETRY;
+    return (memcmp(u->bootstrap_heartbeat_rx,
+                   u->adapter.constant_heartbeat_expect_return,
+                   u->bootstrap_heartbeat_rx_len) == 0);
 }
 
-static void ups_enqueue_full_lut_step(const uart_engine_request_t *lut,
-                                      size_t lut_count,
-                                      size_t *inout_index)
+// Hands liveness over to the engine: regular polling proves the link, the
+// heartbeat only covers intervals without any accepted reply.
+static void ups_heartbeat_enable(ups_unit_t *u)
 {
-    if ((lut == NULL) || (inout_index == NULL))
+    if (u->adapter.constant_heartbeat == NULL)
     {
         return;
     }
 
-    if (*inout_index >= lut_count)
-    {
-        return;
-    }
+    u->heartbeat_expect.expected = u->adapter.constant_heartbeat_expect_return;
+    u->heartbeat_expect.expected_len = (uint16_t)u->adapter.constant_heartbeat_expect_return_len;
 
-    uint8_t burst = 0U;
-    while ((*inout_index < lut_count) && (burst < UPS_ENQUEUE_BURST_PER_TICK))
+    uart_engine_heartbeat_cfg_t cfg = {
+        .req = *u->adapter.constant_heartbeat,
+        .interval_ms = UPS_HEARTBEAT_INTERVAL_MS,
+        .failure_threshold = 0U,
+        .battery_failsafe = (UPS_HEARTBEAT_BATTERY_FAILSAFE != 0),
+    };
+    if (u->heartbeat_expect.expected != NULL)
     {
-        uart_engine_result_t const result = uart_engine_enqueue(&lut[*inout_index]);
-        if (result != UART_ENGINE_OK)
-        {
-            break;
-        }
-
-        (*inout_index)++;
-        burst++;
+        cfg.req.out_value = &u->heartbeat_expect;
+        cfg.req.process_fn = uart_engine_process_expect_exact;
     }
+    uart_engine_set_heartbeat(u->unit, &cfg);
 }
 
-static void ups_bootstrap_task(void)
+static void ups_bootstrap_reset_for_retry(ups_unit_t *u, uint32_t now_ms)
+{
+    u->serial[0] = '\0';
+    u->bootstrap_heartbeat_rx_len = 0U;
+    u->bootstrap_heartbeat_done = false;
+    u->init_retry_not_before_ms = now_ms + UPS_INIT_RETRY_PERIOD_MS;
+    u->bootstrap_state = UPS_BOOTSTRAP_WAIT_RETRY;
+}
+
+static void ups_bootstrap_task(ups_unit_t *u)
 {
     uint32_t const now_ms = ups_tick_ms();
 
-    if (!s_init_bootstrap_started)
+    if (!u->init_bootstrap_started)
     {
-        s_init_bootstrap_started = true;
-        s_init_bootstrap_start_ms = now_ms;
+        u->init_bootstrap_started = true;
+        u->init_bootstrap_start_ms = now_ms;
     }
 
-    switch (s_ups_bootstrap_state)
+    switch (u->bootstrap_state)
     {
     case UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT:
     {
-        if (g_sub_adapter_constant_heartbeat == NULL)
+        if (u->adapter.constant_heartbeat == NULL)
         {
-            ups_bootstrap_reset_for_retry(now_ms);
+            ups_bootstrap_reset_for_retry(u, now_ms);
             break;
         }
 
-        uart_engine_request_t hb_req = *g_sub_adapter_constant_heartbeat;
-        hb_req.out_value = NULL;
+        uart_engine_request_t hb_req = *u->adapter.constant_heartbeat;
+        hb_req.out_value = u;
         hb_req.process_fn = ups_bootstrap_heartbeat_capture;
 
-        uart_engine_result_t const result = uart_engine_enqueue(&hb_req);
+        uart_engine_result_t const result = uart_engine_enqueue(u->unit, &hb_req, UART_ENGINE_PRIO_CRITICAL);
+        u->bootstrap_enqueue_refused = (result != UART_ENGINE_OK);
         if (result == UART_ENGINE_OK)
         {
-            s_bootstrap_heartbeat_done = false;
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_WAIT_HEARTBEAT_DRAIN;
+            u->bootstrap_heartbeat_done = false;
+            u->bootstrap_state = UPS_BOOTSTRAP_WAIT_HEARTBEAT_DRAIN;
         }
         break;
     }
 
     case UPS_BOOTSTRAP_WAIT_HEARTBEAT_DRAIN:
-        if (!uart_engine_is_busy())
+        if (!uart_engine_is_busy(u->unit))
         {
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_HEARTBEAT_VERIFY;
+            u->bootstrap_state = UPS_BOOTSTRAP_HEARTBEAT_VERIFY;
         }
         break;
 
     case UPS_BOOTSTRAP_HEARTBEAT_VERIFY:
-        if (ups_bootstrap_heartbeat_matches_expected())
+        if (ups_bootstrap_heartbeat_matches_expected(u))
         {
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_CONSTANT;
+            u->bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_SERIAL;
         }
         else
         {
-            UPS_DEBUG_PRINTF("INIT heartbeat failed, retry in %lu ms\r\n",
+            UPS_DEBUG_PRINTF("U%u INIT heartbeat failed, retry in %lu ms\r\n",
+                             (unsigned int)u->unit,
                              (unsigned long)UPS_INIT_RETRY_PERIOD_MS);
-            ups_bootstrap_reset_for_retry(now_ms);
+            ups_bootstrap_reset_for_retry(u, now_ms);
         }
         break;
 
     case UPS_BOOTSTRAP_WAIT_RETRY:
-        if ((int32_t)(now_ms - s_init_retry_not_before_ms) >= 0)
+        if ((int32_t)(now_ms - u->init_retry_not_before_ms) >= 0)
+        {
+            u->bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT;
+        }
+        break;
+
+    case UPS_BOOTSTRAP_ENQUEUE_SERIAL:
+    {
+        u->serial[0] = '\0';
+        if (u->adapter.serial_request == NULL)
+        {
+            u->bootstrap_state = UPS_BOOTSTRAP_CAPS_LOAD;
+            break;
+        }
+
+        uart_engine_request_t serial_req = *u->adapter.serial_request;
+        serial_req.out_value = u;
+        serial_req.process_fn = ups_bootstrap_serial_capture;
+        uart_engine_result_t const result = uart_engine_enqueue(u->unit, &serial_req, UART_ENGINE_PRIO_CRITICAL);
+        u->bootstrap_enqueue_refused = (result != UART_ENGINE_OK);
+        if (result == UART_ENGINE_OK)
         {
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT;
+            u->bootstrap_state = UPS_BOOTSTRAP_WAIT_SERIAL_DRAIN;
         }
         break;
+    }
 
-    case UPS_BOOTSTRAP_ENQUEUE_CONSTANT:
-        ups_enqueue_full_lut_step(g_sub_adapter_constant_lut,
-                                  g_sub_adapter_constant_lut_count,
-                                  &s_bootstrap_constant_idx);
-        if (s_bootstrap_constant_idx >= g_sub_adapter_constant_lut_count)
+    case UPS_BOOTSTRAP_WAIT_SERIAL_DRAIN:
+        if (!uart_engine_is_busy(u->unit))
+        {
+            u->bootstrap_state = UPS_BOOTSTRAP_CAPS_LOAD;
+        }
+        break;
+
+    case UPS_BOOTSTRAP_CAPS_LOAD:
+    {
+        // Without a serial number nothing is cached: probe every time. An
+        // entry not yet trusted is probed again and merged on store.
+        caps_cache_entry_t caps;
+        bool const loaded = !u->caps_reprobe && (u->serial[0] != '\0') &&
+                            caps_cache_load(u->serial, ups_caps_signature(&u->adapter), &caps);
+        u->caps_cached = loaded && caps_cache_trusted(&caps);
+        (void)memset(&u->caps_prior, 0, sizeof(u->caps_prior));
+        if (loaded && !u->caps_cached)
         {
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_DYNAMIC;
+            u->caps_prior = caps;
+        }
+        u->constant_active = u->caps_cached ? caps.constant_mask : lut_probe_mask_all(u->adapter.constant_lut_count);
+        u->dynamic_active = u->caps_cached ? caps.dynamic_mask : lut_probe_mask_all(u->adapter.dynamic_lut_count);
+        if (lut_probe_start(&u->probe, u->unit, u->adapter.constant_lut, u->adapter.constant_lut_count, u->constant_active))
+        {
+            u->bootstrap_state = UPS_BOOTSTRAP_READ_CONSTANT;
+        }
+        else
+        {
+            ups_bootstrap_reset_for_retry(u, now_ms);
         }
         break;
+    }
 
-    case UPS_BOOTSTRAP_ENQUEUE_DYNAMIC:
-        ups_enqueue_full_lut_step(g_sub_adapter_dynamic_lut,
-                                  g_sub_adapter_dynamic_lut_count,
-                                  &s_bootstrap_dynamic_idx);
-        if (s_bootstrap_dynamic_idx >= g_sub_adapter_dynamic_lut_count)
+    case UPS_BOOTSTRAP_READ_CONSTANT:
+        if (lut_probe_tick(&u->probe))
         {
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_WAIT_DRAIN;
+            if (!u->caps_cached)
+            {
+                u->constant_active = lut_probe_supported(&u->probe);
+            }
+            if (lut_probe_start(&u->probe, u->unit, u->adapter.dynamic_lut, u->adapter.dynamic_lut_count, u->dynamic_active))
+            {
+                u->bootstrap_state = UPS_BOOTSTRAP_READ_DYNAMIC;
+            }
+            else
+            {
+                ups_bootstrap_reset_for_retry(u, now_ms);
+            }
+        }
+        break;
+
+    case UPS_BOOTSTRAP_READ_DYNAMIC:
+        if (lut_probe_tick(&u->probe))
+        {
+            if (!u->caps_cached)
+            {
+                u->dynamic_active = lut_probe_supported(&u->probe);
+            }
+            lut_sched_set_active(&u->dynamic_sched, u->dynamic_active);
+            u->bootstrap_state = UPS_BOOTSTRAP_WAIT_DRAIN;
         }
         break;
 
     case UPS_BOOTSTRAP_WAIT_DRAIN:
-        if (!uart_engine_is_busy())
+        if (!uart_engine_is_busy(u->unit))
         {
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_SANITY_CHECK;
+            u->bootstrap_state = UPS_BOOTSTRAP_SANITY_CHECK;
         }
         break;
 
     case UPS_BOOTSTRAP_SANITY_CHECK:
-        if (g_battery.remaining_capacity > 0U)
+        if (g_ups[u->unit].battery.remaining_capacity > 0U)
         {
-            s_next_dynamic_update_ms = ups_tick_ms() + UPS_DYNAMIC_UPDATE_PERIOD_MS;
-            s_ups_bootstrap_state = UPS_BOOTSTRAP_DONE;
-            UPS_DEBUG_PRINTF("INIT full bootstrap done in %lu ms\r\n",
-                             (unsigned long)(now_ms - s_init_bootstrap_start_ms));
+            // Every command has been answered once: the admission check
+            // works from measured reply times.
+            uint32_t const util = lut_sched_utilization_permille(&u->dynamic_sched);
+            if (util > LUT_SCHED_MAX_UTIL_PERMILLE)
+            {
+                ESP_LOGW(TAG,
+                         "unit %u: dynamic LUT periods need %lu.%lu%% of the bus (budget %lu%%), deadlines will slip",
+                         (unsigned int)u->unit,
+                         (unsigned long)(util / 10U),
+                         (unsigned long)(util % 10U),
+                         (unsigned long)(LUT_SCHED_MAX_UTIL_PERMILLE / 10U));
+            }
+            if (!u->caps_cached && (u->serial[0] != '\0'))
+            {
+                caps_cache_entry_t const caps = caps_cache_merge(&u->caps_prior,
+                                                                 ups_caps_signature(&u->adapter),
+                                                                 u->constant_active,
+                                                                 u->dynamic_active);
+                if (!caps_cache_store(u->serial, &caps))
+                {
+                    ESP_LOGW(TAG, "unit %u: command support not cached", (unsigned int)u->unit);
+                }
+            }
+            u->caps_reprobe = false;
+            ups_caps_report(u);
+            lut_sched_start(&u->dynamic_sched, ups_tick_ms());
+            ups_heartbeat_enable(u);
+            u->bootstrap_state = UPS_BOOTSTRAP_DONE;
+            snmp_agent_publish_snapshot(u->unit);
+            UPS_DEBUG_PRINTF("U%u INIT full bootstrap done in %lu ms\r\n",
+                             (unsigned int)u->unit,
+                             (unsigned long)(now_ms - u->init_bootstrap_start_ms));
         }
         else
         {
-            UPS_DEBUG_PRINTF("INIT sanity failed (remaining_capacity=0), retry in %lu ms\r\n",
+            UPS_DEBUG_PRINTF("U%u INIT sanity failed (remaining_capacity=0), retry in %lu ms\r\n",
+                             (unsigned int)u->unit,
                              (unsigned long)UPS_INIT_RETRY_PERIOD_MS);
-            ups_bootstrap_reset_for_retry(now_ms);
+            // Cached masks may no longer fit this UPS (e.g. new firmware).
+            u->caps_reprobe = u->caps_cached;
+            ups_bootstrap_reset_for_retry(u, now_ms);
         }
         break;
 
@@ -413,119 +704,378 @@ static void ups_bootstrap_task(void)
     }
 }
 
-static void ups_dynamic_update_task(void)
+static void ups_dynamic_update_task(ups_unit_t *u)
 {
-    if (s_ups_bootstrap_state != UPS_BOOTSTRAP_DONE)
+    if (u->bootstrap_state != UPS_BOOTSTRAP_DONE)
     {
         return;
     }
 
-    uint32_t const now_ms = ups_tick_ms();
-    if (!s_dynamic_update_cycle_active)
+    // Publish once a burst of refreshes has completed, not per field.
+    if (lut_sched_tick(&u->dynamic_sched, ups_tick_ms()))
     {
-        if ((int32_t)(now_ms - s_next_dynamic_update_ms) < 0)
+        snmp_agent_publish_snapshot(u->unit);
+    }
+}
+
+#if (UPS_DEBUG_STATUS_PRINT_ENABLED != 0)
+static void ups_debug_status_print_unit(uint8_t unit)
+{
+    ups_telemetry_t const *t = &g_ups[unit];
+
+    printf("U%u PS: ac=%u chg=%u dis=%u full=%u repl=%u low=%u bpres=%u ovl=%u shut=%u lost=%u\r\n",
+           (unsigned)unit,
+           (unsigned)t->present_status.ac_present,
+           (unsigned)t->present_status.charging,
+           (unsigned)t->present_status.discharging,
+           (unsigned)t->present_status.fully_charged,
+           (unsigned)t->present_status.need_replacement,
+           (unsigned)t->present_status.below_remaining_capacity_limit,
+           (unsigned)t->present_status.battery_present,
+           (unsigned)t->present_status.overload,
+           (unsigned)t->present_status.shutdown_imminent,
+           (unsigned)t->present_status.comm_lost);
+
+    printf("U%u SUM: rech=%u mode=%u des=%u full=%u warn=%u rem=%u chem=%u g1=%u g2=%u iM=%u iP=%u iS=%u iN=%u\r\n",
+           (unsigned)unit,
+           (unsigned)t->summary.rechargeable,
+           (unsigned)t->summary.capacity_mode,
+           (unsigned)t->summary.design_capacity,
+           (unsigned)t->summary.full_charge_capacity,
+           (unsigned)t->summary.warning_capacity_limit,
+           (unsigned)t->summary.remaining_capacity_limit,
+           (unsigned)t->summary.i_device_chemistry,
+           (unsigned)t->summary.capacity_granularity_1,
+           (unsigned)t->summary.capacity_granularity_2,
+           (unsigned)t->summary.i_manufacturer_2bit,
+           (unsigned)t->summary.i_product_2bit,
+           (unsigned)t->summary.i_serial_number_2bit,
+           (unsigned)t->summary.i_name_2bit);
+
+    printf("U%u BAT: cap=%u rt=%u rtl=%u vb=%u ib=%d cfgv=%u temp=%u mfg=%u\r\n",
+           (unsigned)unit,
+           (unsigned)t->battery.remaining_capacity,
+           (unsigned)t->battery.run_time_to_empty_s,
+           (unsigned)t->battery.remaining_time_limit_s,
+           (unsigned)t->battery.battery_voltage,
+           (int)t->battery.battery_current,
+           (unsigned)t->battery.config_voltage,
+           (unsigned)t->battery.temperature,
+           (unsigned)t->battery.manufacturer_date);
+
+    printf("U%u IN: v=%u f=%u cfgv=%u low=%u high=%u\r\n",
+           (unsigned)unit,
+           (unsigned)t->input.voltage,
+           (unsigned)t->input.frequency,
+           (unsigned)t->input.config_voltage,
+           (unsigned)t->input.low_voltage_transfer,
+           (unsigned)t->input.high_voltage_transfer);
+
+    printf("U%u OUT: load=%u cfgp=%u cfgv=%u v=%u i=%d f=%u\r\n",
+           (unsigned)unit,
+           (unsigned)t->output.percent_load,
+           (unsigned)t->output.config_active_power,
+           (unsigned)t->output.config_voltage,
+           (unsigned)t->output.voltage,
+           (int)t->output.current,
+           (unsigned)t->output.frequency);
+
+    static char const *const k_class_names[UART_ENGINE_PRIO_COUNT] = {"crit", "inter", "bg"};
+    for (uint8_t c = 0U; c < (uint8_t)UART_ENGINE_PRIO_COUNT; c++)
+    {
+        uart_engine_class_stats_t st;
+        if (!uart_engine_get_class_stats(unit, (uart_engine_priority_t)c, &st))
         {
-            return;
+            continue;
         }
 
-        s_dynamic_update_cycle_active = true;
-        s_dynamic_update_idx = 0U;
-        s_last_dynamic_cycle_start_ms = now_ms;
+        printf("U%u UQ %s: depth=%u/%u n=%lu wait_avg=%lu wait_max=%lu aged=%lu merged=%lu full=%lu\r\n",
+               (unsigned)unit,
+               k_class_names[c],
+               (unsigned)st.depth,
+               (unsigned)st.depth_max,
+               (unsigned long)st.dispatched,
+               (unsigned long)((st.dispatched != 0U) ? (st.wait_total_ms / st.dispatched) : 0U),
+               (unsigned long)st.wait_max_ms,
+               (unsigned long)st.aged,
+               (unsigned long)st.merged,
+               (unsigned long)st.rejected_full);
     }
 
-    if (s_dynamic_update_idx < g_sub_adapter_dynamic_lut_count)
+    uart_engine_bus_stats_t bus;
+    uart_engine_get_bus_stats(unit, &bus);
+    printf("U%u UBUS: busy=%u%%/%lus idle=%lu tx=%lu rx=%lu proc=%lu ms\r\n",
+           (unsigned)unit,
+           (unsigned)bus.busy_percent,
+           (unsigned long)(bus.busy_window_ms / 1000U),
+           (unsigned long)bus.state_ms[UART_ENGINE_STATE_IDLE],
+           (unsigned long)(bus.state_ms[UART_ENGINE_STATE_TX_START] + bus.state_ms[UART_ENGINE_STATE_TX_WAIT]),
+           (unsigned long)bus.state_ms[UART_ENGINE_STATE_RX_WAIT],
+           (unsigned long)bus.state_ms[UART_ENGINE_STATE_PROCESS]);
+
+    lut_sched_t const *sched = &s_units[unit].dynamic_sched;
+    uint32_t ok = 0U;
+    uint32_t failed = 0U;
+    uint32_t suspended = 0U;
+    uint32_t missed = 0U;
+    uint32_t late_max_ms = 0U;
+    for (size_t i = 0U; i < sched->count; i++)
     {
-        ups_enqueue_full_lut_step(g_sub_adapter_dynamic_lut,
-                                  g_sub_adapter_dynamic_lut_count,
-                                  &s_dynamic_update_idx);
-        return;
+        lut_sched_entry_stats_t const *st = &sched->entries[i].stats;
+        ok += st->ok;
+        failed += st->failed;
+        suspended += st->suspended;
+        missed += st->missed;
+        late_max_ms = (st->late_max_ms > late_max_ms) ? st->late_max_ms : late_max_ms;
     }
-
-    if (uart_engine_is_busy())
+    uint32_t const util = lut_sched_utilization_permille(sched);
+    printf("U%u EDF: cmds=%u/%u util=%lu.%lu%% ok=%lu failed=%lu suspended=%lu missed=%lu late_max=%lu ms\r\n",
+           (unsigned)unit,
+           (unsigned)ups_mask_count(sched->active),
+           (unsigned)sched->count,
+           (unsigned long)(util / 10U),
+           (unsigned long)(util % 10U),
+           (unsigned long)ok,
+           (unsigned long)failed,
+           (unsigned long)suspended,
+           (unsigned long)missed,
+           (unsigned long)late_max_ms);
+
+    // Commands whose fields are stale because their breaker is not closed.
+    static const char *const k_breaker_names[] = {"closed", "open", "probe"};
+    static const char *const k_fail_names[] = {"-", "timeout", "parse", "tx"};
+    size_t const cmd_count = uart_engine_cmd_stats_count(unit);
+    for (size_t i = 0U; i < cmd_count; i++)
     {
-        return;
-    }
+        uart_engine_cmd_stats_t cs;
+        if (!uart_engine_get_cmd_stats(unit, i, &cs) || (cs.breaker == (uint8_t)UART_ENGINE_BREAKER_CLOSED))
+        {
+            continue;
+        }
 
-    s_dynamic_update_cycle_active = false;
-    s_next_dynamic_update_ms = now_ms + UPS_DYNAMIC_UPDATE_PERIOD_MS;
-    UPS_DEBUG_PRINTF("DYN refresh done in %lu ms\r\n",
-                     (unsigned long)(now_ms - s_last_dynamic_cycle_start_ms));
+        printf("U%u BRK 0x%X: %s last=%s streak=%u trips=%lu suspended=%lu probe_in=%lu ms\r\n",
+               (unsigned)unit,
+               (unsigned)cs.cmd,
+               k_breaker_names[cs.breaker],
+               k_fail_names[cs.last_fail],
+               (unsigned)cs.fail_streak,
+               (unsigned long)cs.breaker_trips,
+               (unsigned long)cs.suspended,
+               (unsigned long)cs.probe_in_ms);
+    }
 }
+#endif
 
 static void ups_debug_status_print_task(void)
 {
 #if (UPS_DEBUG_STATUS_PRINT_ENABLED != 0)
-    static uint32_t next_print_ms = 0U;
     uint32_t const now_ms = ups_tick_ms();
-    if ((int32_t)(now_ms - next_print_ms) < 0)
+    if ((int32_t)(now_ms - s_next_debug_print_ms) < 0)
     {
         return;
     }
 
-    next_print_ms = now_ms + UPS_DEBUG_STATUS_PRINT_PERIOD_MS;
-
-    printf("PS: ac=%u chg=%u dis=%u full=%u repl=%u low=%u bpres=%u ovl=%u shut=%u\r\n",
-           (unsigned)g_power_summary_present_status.ac_present,
-           (unsigned)g_power_summary_present_status.charging,
-           (unsigned)g_power_summary_present_status.discharging,
-           (unsigned)g_power_summary_present_status.fully_charged,
-           (unsigned)g_power_summary_present_status.need_replacement,
-           (unsigned)g_power_summary_present_status.below_remaining_capacity_limit,
-           (unsigned)g_power_summary_present_status.battery_present,
-           (unsigned)g_power_summary_present_status.overload,
-           (unsigned)g_power_summary_present_status.shutdown_imminent);
-
-    printf("SUM: rech=%u mode=%u des=%u full=%u warn=%u rem=%u chem=%u g1=%u g2=%u iM=%u iP=%u iS=%u iN=%u\r\n",
-           (unsigned)g_power_summary.rechargeable,
-           (unsigned)g_power_summary.capacity_mode,
-           (unsigned)g_power_summary.design_capacity,
-           (unsigned)g_power_summary.full_charge_capacity,
-           (unsigned)g_power_summary.warning_capacity_limit,
-           (unsigned)g_power_summary.remaining_capacity_limit,
-           (unsigned)g_power_summary.i_device_chemistry,
-           (unsigned)g_power_summary.capacity_granularity_1,
-           (unsigned)g_power_summary.capacity_granularity_2,
-           (unsigned)g_power_summary.i_manufacturer_2bit,
-           (unsigned)g_power_summary.i_product_2bit,
-           (unsigned)g_power_summary.i_serial_number_2bit,
-           (unsigned)g_power_summary.i_name_2bit);
-
-    printf("BAT: cap=%u rt=%u rtl=%u vb=%u ib=%d cfgv=%u temp=%u mfg=%u\r\n",
-           (unsigned)g_battery.remaining_capacity,
-           (unsigned)g_battery.run_time_to_empty_s,
-           (unsigned)g_battery.remaining_time_limit_s,
-           (unsigned)g_battery.battery_voltage,
-           (int)g_battery.battery_current,
-           (unsigned)g_battery.config_voltage,
-           (unsigned)g_battery.temperature,
-           (unsigned)g_battery.manufacturer_date);
-
-    printf("IN: v=%u f=%u cfgv=%u low=%u high=%u\r\n",
-           (unsigned)g_input.voltage,
-           (unsigned)g_input.frequency,
-           (unsigned)g_input.config_voltage,
-           (unsigned)g_input.low_voltage_transfer,
-           (unsigned)g_input.high_voltage_transfer);
-
-    printf("OUT: load=%u cfgp=%u cfgv=%u v=%u i=%d f=%u\r\n",
-           (unsigned)g_output.percent_load,
-           (unsigned)g_output.config_active_power,
-           (unsigned)g_output.config_voltage,
-           (unsigned)g_output.voltage,
-           (int)g_output.current,
-           (unsigned)g_output.frequency);
+    s_next_debug_print_ms = now_ms + UPS_DEBUG_STATUS_PRINT_PERIOD_MS;
+
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        ups_debug_status_print_unit(unit);
+    }
 #endif
 }
 
+// One main-loop pass. Units are stepped in turn; each engine only advances
+// its own bus, so the UARTs work in parallel. Returns true if a unit's
+// bootstrap moved to another state, whose work may be due at once.
+static bool ups_loop_step(void)
+{
+    bool progressed = false;
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        ups_bootstrap_state_t const state = s_units[unit].bootstrap_state;
+        ups_bootstrap_task(&s_units[unit]);
+        progressed = progressed || (s_units[unit].bootstrap_state != state);
+        ups_dynamic_update_task(&s_units[unit]);
+    }
+    ups_debug_status_print_task();
+    sys_health_tick();
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        uart_engine_tick(unit);
+    }
+    return progressed;
+}
+
+#if (UPS_REACTOR_ENABLED != 0) || (UPS_UART_EVENT_DRIVEN != 0)
+static uint32_t ups_ms_until(uint32_t now_ms, uint32_t due_ms)
+{
+    int32_t const delta = (int32_t)(due_ms - now_ms);
+    return (delta > 0) ? (uint32_t)delta : 0U;
+}
+
+static uint32_t ups_min_ms(uint32_t a, uint32_t b)
+{
+    return (a < b) ? a : b;
+}
+
+// Milliseconds until the bootstrap/refresh tasks of u have work again.
+static uint32_t ups_unit_time_to_next_ms(const ups_unit_t *u, uint32_t now_ms)
+{
+    uint32_t next = UINT32_MAX;
+
+    switch (u->bootstrap_state)
+    {
+    case UPS_BOOTSTRAP_WAIT_RETRY:
+        next = ups_ms_until(now_ms, u->init_retry_not_before_ms);
+        break;
+    case UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT:
+    case UPS_BOOTSTRAP_ENQUEUE_SERIAL:
+        // A refused enqueue (engine disabled, CRITICAL class full) is retried
+        // at the polling period rather than spinning on it.
+        next = u->bootstrap_enqueue_refused ? UPS_MAIN_LOOP_DELAY_MS : 0U;
+        break;
+    case UPS_BOOTSTRAP_WAIT_HEARTBEAT_DRAIN:
+    case UPS_BOOTSTRAP_WAIT_SERIAL_DRAIN:
+    case UPS_BOOTSTRAP_WAIT_DRAIN:
+        // The engine tick that drains the queue wakes us up.
+        next = uart_engine_is_busy(u->unit) ? UINT32_MAX : 0U;
+        break;
+    case UPS_BOOTSTRAP_READ_CONSTANT:
+    case UPS_BOOTSTRAP_READ_DYNAMIC:
+        // Completions arrive from the engine tick, which wakes us up.
+        next = lut_probe_time_to_next_ms(&u->probe);
+        break;
+    case UPS_BOOTSTRAP_DONE:
+        // Completions arrive from the engine tick, which wakes us up.
+        next = lut_sched_time_to_next_ms(&u->dynamic_sched, now_ms);
+        break;
+    default:
+        next = 0U;
+        break;
+    }
+
+    return next;
+}
+
+// Milliseconds until one of the main-loop tasks has work again.
+static uint32_t ups_tasks_time_to_next_ms(uint32_t now_ms)
+{
+    uint32_t next = UINT32_MAX;
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        next = ups_min_ms(next, ups_unit_time_to_next_ms(&s_units[unit], now_ms));
+    }
+
+#if (UPS_DEBUG_STATUS_PRINT_ENABLED != 0)
+    next = ups_min_ms(next, ups_ms_until(now_ms, s_next_debug_print_ms));
+#endif
+    next = ups_min_ms(next, sys_health_time_to_next_ms(now_ms));
+    return next;
+}
+
+static uint32_t ups_loop_time_to_next_ms(void)
+{
+    uint32_t const now_ms = ups_tick_ms();
+    uint32_t timeout_ms = ups_tasks_time_to_next_ms(now_ms);
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        timeout_ms = ups_min_ms(timeout_ms, uart_engine_time_to_next_ms(unit, now_ms));
+    }
+    return ups_min_ms(timeout_ms, UPS_MAIN_LOOP_MAX_SLEEP_MS);
+}
+#endif
+
+#if (UPS_REACTOR_ENABLED != 0)
+
+static void ups_reactor_run(int snmp_sock)
+{
+    int uart_fds[UPS_UNIT_COUNT];
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        uart_fds[unit] = UART2_SelectFd(unit);
+        if (uart_fds[unit] < 0)
+        {
+            ESP_LOGW(TAG, "unit %u: UART select fd unavailable, RX falls back to timed wakeups", (unsigned int)unit);
+        }
+    }
+
+    while (1)
+    {
+        bool const progressed = ups_loop_step();
+
+        uint32_t timeout_ms = ups_loop_time_to_next_ms();
+        if (timeout_ms == 0U)
+        {
+            if (progressed)
+            {
+                continue;
+            }
+            // Work is due but the pass could not do it (engine disabled, queue
+            // full): wait a tick so SNMP is served and IDLE runs.
+            timeout_ms = portTICK_PERIOD_MS;
+        }
+
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        int max_fd = -1;
+        if (snmp_sock >= 0)
+        {
+            FD_SET(snmp_sock, &read_fds);
+            max_fd = snmp_sock;
+        }
+        // Only watch RX while the engine consumes it (reply expected, or idle
+        // with an alert handler); stray bytes would otherwise keep the fd
+        // readable until the next TX discards them.
+        for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+        {
+            int const uart_fd = uart_fds[unit];
+            if ((uart_fd >= 0) && uart_engine_wants_rx(unit))
+            {
+                FD_SET(uart_fd, &read_fds);
+                if (uart_fd > max_fd)
+                {
+                    max_fd = uart_fd;
+                }
+            }
+        }
+
+        struct timeval tv = {
+            .tv_sec = (time_t)(timeout_ms / 1000U),
+            .tv_usec = (suseconds_t)((timeout_ms % 1000U) * 1000U),
+        };
+        int const ready = select(max_fd + 1, &read_fds, NULL, NULL, &tv);
+        if ((ready > 0) && (snmp_sock >= 0) && FD_ISSET(snmp_sock, &read_fds))
+        {
+            snmp_agent_service(snmp_sock);
+        }
+
+        // Keep the driver event queues drained (overflow handling, stats).
+        (void)UART2_WaitEvent(0U);
+    }
+}
+#endif
+
 void app_main(void)
 {
     ESP_LOGI(TAG,
-             "Starting UPS UART bridge: UART%u tx=%d rx=%d baud=%d",
+             "Starting UPS UART bridge: units=%u UART%u tx=%d rx=%d baud=%d",
+             (unsigned int)UPS_UNIT_COUNT,
              (unsigned int)UPS_UART_PORT,
              UPS_UART_TX_GPIO,
              UPS_UART_RX_GPIO,
              UPS_UART_BAUDRATE);
 
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        g_ups[unit] = k_ups_telemetry_defaults;
+        s_units[unit].unit = unit;
+        s_units[unit].bootstrap_state = UPS_BOOTSTRAP_ENQUEUE_HEARTBEAT;
+    }
+
+#if (UPS_REACTOR_ENABLED != 0)
+    int snmp_sock = -1;
+#endif
+
     esp_err_t const wifi_err = wifi_client_start();
     if (wifi_err != ESP_OK)
     {
@@ -533,25 +1083,51 @@ void app_main(void)
     }
     else
     {
+#if (UPS_REACTOR_ENABLED != 0)
+        snmp_sock = snmp_agent_open();
+        if (snmp_sock < 0)
+        {
+            ESP_LOGW(TAG, "SNMP agent socket open failed");
+        }
+#else
         esp_err_t const snmp_err = snmp_agent_start();
         if (snmp_err != ESP_OK)
         {
             ESP_LOGW(TAG, "SNMP agent start failed (%s)", esp_err_to_name(snmp_err));
         }
+#endif
+
+        esp_err_t const trace_err = uart_trace_server_start();
+        if (trace_err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "UART trace server start failed (%s)", esp_err_to_name(trace_err));
+        }
     }
 
-    UART2_RxStartIT();
     uart_engine_init();
-    uart_engine_set_enabled(s_uart_engine_enabled);
-    ups_sub_adapter_select();
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        UART2_RxStartIT(unit);
+        uart_engine_set_enabled(unit, s_uart_engine_enabled);
+        ups_sub_adapter_select(&s_units[unit], k_unit_sub_adapter[unit]);
+    }
 
+#if (UPS_REACTOR_ENABLED != 0)
+    ups_reactor_run(snmp_sock);
+#else
     while (1)
     {
-        ups_bootstrap_task();
-        ups_dynamic_update_task();
-        ups_debug_status_print_task();
-        uart_engine_tick();
+        (void)ups_loop_step();
 
+#if (UPS_UART_EVENT_DRIVEN != 0)
+        uint32_t const timeout_ms = ups_loop_time_to_next_ms();
+        if (timeout_ms > 0U)
+        {
+            (void)UART2_WaitEvent(timeout_ms);
+        }
+#else
         ups_loop_delay_safe(UPS_MAIN_LOOP_DELAY_MS);
+#endif
     }
+#endif
 }
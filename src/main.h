@@ -12,6 +12,8 @@ extern "C" {
 #include <stdint.h>
 #include <stdio.h>
 
+#include "uart_backend.h"
+#include "ups_clock.h"
 #include "ups_data.h"
 
 #ifndef UPS_UART_PORT
@@ -30,10 +32,65 @@ extern "C" {
 #define UPS_UART_RX_GPIO 1
 #endif
 
+// Further units (UPS_UNIT_COUNT > 1). The ESP32-C3 has two UARTs, so a
+// second unit takes UART0 and the console must move to USB-Serial-JTAG.
+#if (UPS_UNIT_COUNT > 1)
+#ifndef UPS_UNIT1_UART_PORT
+#define UPS_UNIT1_UART_PORT UART_NUM_0
+#endif
+
+#ifndef UPS_UNIT1_UART_TX_GPIO
+#define UPS_UNIT1_UART_TX_GPIO 21
+#endif
+
+#ifndef UPS_UNIT1_UART_RX_GPIO
+#define UPS_UNIT1_UART_RX_GPIO 20
+#endif
+#endif
+
+#if (UPS_UNIT_COUNT > 2)
+#ifndef UPS_UNIT2_UART_PORT
+#define UPS_UNIT2_UART_PORT UART_NUM_2
+#endif
+
+#if !defined(UPS_UNIT2_UART_TX_GPIO) || !defined(UPS_UNIT2_UART_RX_GPIO)
+#error "UPS_UNIT_COUNT > 2 needs UPS_UNIT2_UART_TX_GPIO and UPS_UNIT2_UART_RX_GPIO"
+#endif
+#endif
+
+#if (UPS_UNIT_COUNT > 3)
+#error "UPS_UNIT_COUNT > 3 is not supported"
+#endif
+
 #ifndef UPS_UART_BUFFER_SIZE
 #define UPS_UART_BUFFER_SIZE 512
 #endif
 
+// Depth of the ESP-IDF UART driver event queue.
+#ifndef UPS_UART_EVENT_QUEUE_LEN
+#define UPS_UART_EVENT_QUEUE_LEN 16
+#endif
+
+// RX idle timeout in symbol times before the driver flushes the HW FIFO and
+// posts UART_DATA (driver default is 10, i.e. ~42 ms at 2400 baud).
+#ifndef UPS_UART_RX_TOUT_SYMBOLS
+#define UPS_UART_RX_TOUT_SYMBOLS 2
+#endif
+
+// Hardware pattern detection of the response terminator byte (LF). Lets the
+// engine read a whole line once the driver reports its position.
+#ifndef UPS_UART_PATTERN_DETECT
+#define UPS_UART_PATTERN_DETECT 1
+#endif
+
+#ifndef UPS_UART_PATTERN_CHAR
+#define UPS_UART_PATTERN_CHAR 0x0AU
+#endif
+
+#ifndef UPS_UART_PATTERN_QUEUE_LEN
+#define UPS_UART_PATTERN_QUEUE_LEN 16
+#endif
+
 #ifndef UPS_UART_TX_INVERT
 #define UPS_UART_TX_INVERT 0
 #endif
@@ -42,24 +99,8 @@ extern "C" {
 #define UPS_UART_RX_INVERT 0
 #endif
 
-uint32_t ups_tick_ms(void);
-
-void UART2_RxStartIT(void);
-esp_err_t UART2_SendBytes(const uint8_t *data, uint16_t len, uint32_t timeout_ms);
-// Async TX using ESP-IDF UART driver TX ring-buffer + ISR path.
-esp_err_t UART2_SendBytesDMA(const uint8_t *data, uint16_t len);
-bool UART2_TxDone(void);
-void UART2_TxDoneClear(void);
-uint16_t UART2_Available(void);
-int UART2_ReadByte(uint8_t *out);
-uint16_t UART2_Read(uint8_t *dst, uint16_t len);
-void UART2_DiscardBuffered(void);
-bool UART2_ReadExactTimeout(uint8_t *dst, uint16_t len, uint32_t timeout_ms);
-bool UART2_TryLock(void);
-void UART2_Unlock(void);
-
 extern const bool g_ups_debug_status_print_enabled;
-void UPS_DebugPrintTxCommand(const uint8_t *data, uint16_t len);
+void UPS_DebugPrintTxCommand(uint8_t unit, const uint8_t *data, uint16_t len);
 
 #ifdef __cplusplus
 }
@@ -1,5 +1,7 @@
 #include "snmp_agent.h"
 
+#include "sys_health.h"
+#include "ups_clock.h"
 #include "ups_data.h"
 
 #include "freertos/FreeRTOS.h"
@@ -14,6 +16,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "snmp_agent";
@@ -30,6 +33,26 @@ static const char *TAG = "snmp_agent";
 #define UPS_SNMP_AGENT_TASK_PRIO 4U
 #endif
 
+// Max datagrams answered per snmp_agent_service() call (reactor build).
+#ifndef UPS_SNMP_SERVICE_BURST
+#define UPS_SNMP_SERVICE_BURST 4U
+#endif
+
+// Number of published telemetry generations kept for in-progress walks.
+#ifndef UPS_SNMP_SNAPSHOT_DEPTH
+#define UPS_SNMP_SNAPSHOT_DEPTH 3U
+#endif
+
+// Number of concurrent GETNEXT walkers tracked by source address/port.
+#ifndef UPS_SNMP_WALKER_SLOTS
+#define UPS_SNMP_WALKER_SLOTS 4U
+#endif
+
+// A walker that has been silent this long is forgotten and re-pinned.
+#ifndef UPS_SNMP_WALKER_IDLE_MS
+#define UPS_SNMP_WALKER_IDLE_MS 3000U
+#endif
+
 typedef enum
 {
     SNMP_TYPE_INTEGER = 0x02,
@@ -69,6 +92,7 @@ typedef enum
 {
     VALUE_KIND_INT32,
     VALUE_KIND_OCTETS,
+    VALUE_KIND_OID,
 } value_kind_t;
 
 typedef struct
@@ -79,8 +103,35 @@ typedef struct
     size_t octets_len;
 } snmp_value_t;
 
+typedef struct
+{
+    bool in_use;
+    uint32_t addr;
+    uint16_t port;
+    uint8_t unit;
+    uint32_t generation;
+    uint32_t last_seen_ms;
+} snmp_walker_t;
+
 static bool s_snmp_started = false;
 
+// Snapshot rings (one per unit) are written by the sampling task and read by
+// the agent task.
+static portMUX_TYPE s_snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+static ups_snapshot_t s_snapshots[UPS_UNIT_COUNT][UPS_SNMP_SNAPSHOT_DEPTH];
+static uint32_t s_snapshot_latest_generation[UPS_UNIT_COUNT];
+
+// Datagram buffers, owned by whichever context services the socket.
+static uint8_t s_rx_buf[512];
+static uint8_t s_tx_buf[512];
+
+// Walker table is only touched by the agent task.
+static snmp_walker_t s_walkers[UPS_SNMP_WALKER_SLOTS];
+
+// Device health copy and text scratch for the request being served (agent task only).
+static sys_health_sample_t s_health;
+static char s_value_text[48];
+
 static const uint8_t OID_SYS_DESCR[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x01, 0x01, 0x00};
 static const uint8_t OID_SYS_NAME[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x01, 0x05, 0x00};
 
@@ -120,6 +171,32 @@ static const uint8_t OID_UPS_CONFIG_LOW_BATT_TIME_STD[] = {0x2B, 0x06, 0x01, 0x0
 static const uint8_t OID_UPS_CONFIG_LOW_XFER_STD[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x21, 0x01, 0x09, 0x09, 0x00};
 static const uint8_t OID_UPS_CONFIG_HIGH_XFER_STD[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x21, 0x01, 0x09, 0x0A, 0x00};
 
+// RFC2790 HOST-RESOURCES-MIB (1.3.6.1.2.1.25), table columns without instance.
+// Rows are appended as a single sub-identifier (1..127).
+static const uint8_t OID_HR_STORAGE_INDEX[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x03, 0x01, 0x01};
+static const uint8_t OID_HR_STORAGE_TYPE[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x03, 0x01, 0x02};
+static const uint8_t OID_HR_STORAGE_DESCR[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x03, 0x01, 0x03};
+static const uint8_t OID_HR_STORAGE_UNITS[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x03, 0x01, 0x04};
+static const uint8_t OID_HR_STORAGE_SIZE[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x03, 0x01, 0x05};
+static const uint8_t OID_HR_STORAGE_USED[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x03, 0x01, 0x06};
+static const uint8_t OID_HR_PROCESSOR_FRW_ID[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x03, 0x03, 0x01, 0x01};
+static const uint8_t OID_HR_PROCESSOR_LOAD[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x03, 0x03, 0x01, 0x02};
+static const uint8_t OID_HR_SWRUN_INDEX[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x04, 0x02, 0x01, 0x01};
+static const uint8_t OID_HR_SWRUN_NAME[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x04, 0x02, 0x01, 0x02};
+static const uint8_t OID_HR_SWRUN_PARAMETERS[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x04, 0x02, 0x01, 0x05};
+static const uint8_t OID_HR_SWRUN_STATUS[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x04, 0x02, 0x01, 0x07};
+static const uint8_t OID_HR_SWRUN_PERF_CPU[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x05, 0x01, 0x01, 0x01};
+
+// Value OIDs: hrStorageRam (1.3.6.1.2.1.25.2.1.2) and zeroDotZero.
+static const uint8_t VALUE_HR_STORAGE_TYPE_RAM[] = {0x2B, 0x06, 0x01, 0x02, 0x01, 0x19, 0x02, 0x01, 0x02};
+static const uint8_t VALUE_ZERO_DOT_ZERO[] = {0x00};
+
+// hrStorage rows. Min-free and largest-block are reported as "used" of the
+// same heap so a standard hrStorage view shows peak usage and fragmentation.
+static const uint8_t VALUE_HR_STORAGE_DESCR_HEAP[] = "internal heap";
+static const uint8_t VALUE_HR_STORAGE_DESCR_HEAP_PEAK[] = "internal heap (peak, from min-free)";
+static const uint8_t VALUE_HR_STORAGE_DESCR_HEAP_FRAG[] = "internal heap (not in largest free block)";
+
 static const uint8_t VALUE_SYS_DESCR[] = "ESP32 UPS bridge";
 static const uint8_t VALUE_SYS_NAME[] = "esp32-ups";
 static const uint8_t VALUE_UPS_IDENT_MANUFACTURER[] = "APC";
@@ -170,6 +247,68 @@ static const oid_entry_t k_oid_table[] = {
     {OID_UPS_CONFIG_HIGH_XFER_STD, sizeof(OID_UPS_CONFIG_HIGH_XFER_STD)},
 };
 
+typedef enum
+{
+    HR_TABLE_STORAGE = 0,
+    HR_TABLE_PROCESSOR,
+    HR_TABLE_SWRUN,
+} hr_table_t;
+
+typedef enum
+{
+    HR_COL_STORAGE_INDEX = 0,
+    HR_COL_STORAGE_TYPE,
+    HR_COL_STORAGE_DESCR,
+    HR_COL_STORAGE_UNITS,
+    HR_COL_STORAGE_SIZE,
+    HR_COL_STORAGE_USED,
+    HR_COL_PROCESSOR_FRW_ID,
+    HR_COL_PROCESSOR_LOAD,
+    HR_COL_SWRUN_INDEX,
+    HR_COL_SWRUN_NAME,
+    HR_COL_SWRUN_PARAMETERS,
+    HR_COL_SWRUN_STATUS,
+    HR_COL_SWRUN_PERF_CPU,
+} hr_column_t;
+
+typedef struct
+{
+    const uint8_t *oid;
+    size_t oid_len;
+    hr_table_t table;
+    hr_column_t column;
+} column_entry_t;
+
+// Must stay sorted by OID (GETNEXT walks it in order).
+static const column_entry_t k_column_table[] = {
+    {OID_HR_STORAGE_INDEX, sizeof(OID_HR_STORAGE_INDEX), HR_TABLE_STORAGE, HR_COL_STORAGE_INDEX},
+    {OID_HR_STORAGE_TYPE, sizeof(OID_HR_STORAGE_TYPE), HR_TABLE_STORAGE, HR_COL_STORAGE_TYPE},
+    {OID_HR_STORAGE_DESCR, sizeof(OID_HR_STORAGE_DESCR), HR_TABLE_STORAGE, HR_COL_STORAGE_DESCR},
+    {OID_HR_STORAGE_UNITS, sizeof(OID_HR_STORAGE_UNITS), HR_TABLE_STORAGE, HR_COL_STORAGE_UNITS},
+    {OID_HR_STORAGE_SIZE, sizeof(OID_HR_STORAGE_SIZE), HR_TABLE_STORAGE, HR_COL_STORAGE_SIZE},
+    {OID_HR_STORAGE_USED, sizeof(OID_HR_STORAGE_USED), HR_TABLE_STORAGE, HR_COL_STORAGE_USED},
+    {OID_HR_PROCESSOR_FRW_ID, sizeof(OID_HR_PROCESSOR_FRW_ID), HR_TABLE_PROCESSOR, HR_COL_PROCESSOR_FRW_ID},
+    {OID_HR_PROCESSOR_LOAD, sizeof(OID_HR_PROCESSOR_LOAD), HR_TABLE_PROCESSOR, HR_COL_PROCESSOR_LOAD},
+    {OID_HR_SWRUN_INDEX, sizeof(OID_HR_SWRUN_INDEX), HR_TABLE_SWRUN, HR_COL_SWRUN_INDEX},
+    {OID_HR_SWRUN_NAME, sizeof(OID_HR_SWRUN_NAME), HR_TABLE_SWRUN, HR_COL_SWRUN_NAME},
+    {OID_HR_SWRUN_PARAMETERS, sizeof(OID_HR_SWRUN_PARAMETERS), HR_TABLE_SWRUN, HR_COL_SWRUN_PARAMETERS},
+    {OID_HR_SWRUN_STATUS, sizeof(OID_HR_SWRUN_STATUS), HR_TABLE_SWRUN, HR_COL_SWRUN_STATUS},
+    {OID_HR_SWRUN_PERF_CPU, sizeof(OID_HR_SWRUN_PERF_CPU), HR_TABLE_SWRUN, HR_COL_SWRUN_PERF_CPU},
+};
+
+#define SNMP_MAX_OID_LEN 32U
+#define HR_STORAGE_ROWS 3U
+
+// Resolved MIB object: a scalar from k_oid_table or a row of a column.
+typedef struct
+{
+    bool is_column;
+    size_t index;
+    uint8_t row;
+    uint8_t oid[SNMP_MAX_OID_LEN];
+    size_t oid_len;
+} snmp_object_t;
+
 typedef struct
 {
     int32_t version;
@@ -180,6 +319,132 @@ typedef struct
     snmp_oid_view_t request_oid;
 } snmp_request_t;
 
+static void snmp_snapshot_from_live(uint8_t unit, ups_snapshot_t *out)
+{
+    ups_telemetry_t const *t = &g_ups[unit];
+    out->generation = 0U;
+    out->present_status = t->present_status;
+    out->summary = t->summary;
+    out->battery = t->battery;
+    out->input = t->input;
+    out->output = t->output;
+}
+
+void snmp_agent_publish_snapshot(uint8_t unit)
+{
+    if (unit >= (uint8_t)UPS_UNIT_COUNT)
+    {
+        return;
+    }
+
+    ups_snapshot_t snap;
+    snmp_snapshot_from_live(unit, &snap);
+
+    portENTER_CRITICAL(&s_snapshot_lock);
+    uint32_t generation = s_snapshot_latest_generation[unit] + 1U;
+    if (generation == 0U)
+    {
+        generation = 1U;
+    }
+    snap.generation = generation;
+    s_snapshots[unit][generation % UPS_SNMP_SNAPSHOT_DEPTH] = snap;
+    s_snapshot_latest_generation[unit] = generation;
+    portEXIT_CRITICAL(&s_snapshot_lock);
+}
+
+// Copy out the requested generation of a unit. generation==0 selects the
+// latest one. Returns false if the generation has already been overwritten.
+static bool snmp_snapshot_get(uint8_t unit, uint32_t generation, ups_snapshot_t *out)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_snapshot_lock);
+    uint32_t const latest = s_snapshot_latest_generation[unit];
+    if (latest == 0U)
+    {
+        portEXIT_CRITICAL(&s_snapshot_lock);
+        // Nothing published yet (bootstrap still running): serve live values.
+        snmp_snapshot_from_live(unit, out);
+        return (generation == 0U);
+    }
+
+    if (generation == 0U)
+    {
+        generation = latest;
+    }
+
+    ups_snapshot_t const *slot = &s_snapshots[unit][generation % UPS_SNMP_SNAPSHOT_DEPTH];
+    if (slot->generation == generation)
+    {
+        *out = *slot;
+        found = true;
+    }
+    portEXIT_CRITICAL(&s_snapshot_lock);
+
+    return found;
+}
+
+// Resolve the snapshot a GETNEXT from src should be answered from.
+// A known walker keeps its pinned generation while it is still retained;
+// otherwise the source is (re)pinned to the latest generation. Walks of
+// different units from one source are tracked separately.
+static void snmp_walker_resolve(const struct sockaddr_in *src,
+                                uint8_t unit,
+                                uint32_t now_ms,
+                                ups_snapshot_t *out)
+{
+    uint32_t const addr = src->sin_addr.s_addr;
+    uint16_t const port = src->sin_port;
+    snmp_walker_t *slot = NULL;
+    snmp_walker_t *victim = &s_walkers[0];
+
+    for (size_t i = 0U; i < UPS_SNMP_WALKER_SLOTS; i++)
+    {
+        snmp_walker_t *w = &s_walkers[i];
+        if (w->in_use && ((now_ms - w->last_seen_ms) >= UPS_SNMP_WALKER_IDLE_MS))
+        {
+            w->in_use = false;
+        }
+
+        if (w->in_use && (w->addr == addr) && (w->port == port) && (w->unit == unit))
+        {
+            slot = w;
+            break;
+        }
+
+        if (!w->in_use)
+        {
+            if (victim->in_use)
+            {
+                victim = w;
+            }
+        }
+        else if (victim->in_use && ((int32_t)(w->last_seen_ms - victim->last_seen_ms) < 0))
+        {
+            victim = w;
+        }
+    }
+
+    if ((slot != NULL) && snmp_snapshot_get(unit, slot->generation, out))
+    {
+        slot->last_seen_ms = now_ms;
+        return;
+    }
+
+    (void)snmp_snapshot_get(unit, 0U, out);
+
+    if (slot == NULL)
+    {
+        slot = victim;
+    }
+    slot->in_use = true;
+    slot->addr = addr;
+    slot->port = port;
+    slot->unit = unit;
+    slot->generation = out->generation;
+    slot->last_seen_ms = now_ms;
+}
+
 static int snmp_oid_compare(const uint8_t *lhs, size_t lhs_len, const uint8_t *rhs, size_t rhs_len)
 {
     size_t const min_len = (lhs_len < rhs_len) ? lhs_len : rhs_len;
@@ -528,9 +793,243 @@ static bool snmp_lookup_next(snmp_oid_view_t oid, size_t *out_index)
     return false;
 }
 
-static bool snmp_get_value_by_index(size_t index, snmp_value_t *out_value)
+static uint8_t snmp_column_rows(const column_entry_t *col)
+{
+    switch (col->table)
+    {
+    case HR_TABLE_STORAGE:
+        return (s_health.generation != 0U) ? HR_STORAGE_ROWS : 0U;
+    case HR_TABLE_PROCESSOR:
+        return (s_health.generation != 0U) ? 1U : 0U;
+    case HR_TABLE_SWRUN:
+        return s_health.task_count;
+    default:
+        return 0U;
+    }
+}
+
+static void snmp_object_set_oid(snmp_object_t *obj, const uint8_t *oid, size_t oid_len, uint8_t row)
+{
+    memcpy(obj->oid, oid, oid_len);
+    obj->oid_len = oid_len;
+    if (row != 0U)
+    {
+        obj->oid[obj->oid_len++] = row;
+    }
+}
+
+static bool snmp_column_lookup_exact(snmp_oid_view_t oid, snmp_object_t *out)
+{
+    for (size_t i = 0U; i < (sizeof(k_column_table) / sizeof(k_column_table[0])); i++)
+    {
+        column_entry_t const *col = &k_column_table[i];
+        if ((oid.oid_len != (col->oid_len + 1U)) || (memcmp(oid.oid, col->oid, col->oid_len) != 0))
+        {
+            continue;
+        }
+
+        uint8_t const row = oid.oid[col->oid_len];
+        if ((row == 0U) || (row > snmp_column_rows(col)))
+        {
+            return false;
+        }
+
+        out->is_column = true;
+        out->index = i;
+        out->row = row;
+        snmp_object_set_oid(out, col->oid, col->oid_len, row);
+        return true;
+    }
+
+    return false;
+}
+
+static bool snmp_column_lookup_next(snmp_oid_view_t oid, snmp_object_t *out)
+{
+    uint8_t candidate[SNMP_MAX_OID_LEN];
+
+    for (size_t i = 0U; i < (sizeof(k_column_table) / sizeof(k_column_table[0])); i++)
+    {
+        column_entry_t const *col = &k_column_table[i];
+        uint8_t const rows = snmp_column_rows(col);
+        memcpy(candidate, col->oid, col->oid_len);
+
+        for (uint8_t row = 1U; row <= rows; row++)
+        {
+            candidate[col->oid_len] = row;
+            if (snmp_oid_compare(candidate, col->oid_len + 1U, oid.oid, oid.oid_len) > 0)
+            {
+                out->is_column = true;
+                out->index = i;
+                out->row = row;
+                snmp_object_set_oid(out, col->oid, col->oid_len, row);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool snmp_resolve_exact(snmp_oid_view_t oid, snmp_object_t *out)
+{
+    size_t index = 0U;
+    if (snmp_lookup_exact(oid, &index))
+    {
+        out->is_column = false;
+        out->index = index;
+        out->row = 0U;
+        snmp_object_set_oid(out, k_oid_table[index].oid, k_oid_table[index].oid_len, 0U);
+        return true;
+    }
+
+    return snmp_column_lookup_exact(oid, out);
+}
+
+// GETNEXT across the scalar table and the column tables: lowest OID wins.
+static bool snmp_resolve_next(snmp_oid_view_t oid, snmp_object_t *out)
+{
+    size_t index = 0U;
+    bool const have_scalar = snmp_lookup_next(oid, &index);
+    bool const have_column = snmp_column_lookup_next(oid, out);
+
+    if (have_scalar &&
+        (!have_column ||
+         (snmp_oid_compare(k_oid_table[index].oid, k_oid_table[index].oid_len, out->oid, out->oid_len) < 0)))
+    {
+        out->is_column = false;
+        out->index = index;
+        out->row = 0U;
+        snmp_object_set_oid(out, k_oid_table[index].oid, k_oid_table[index].oid_len, 0U);
+        return true;
+    }
+
+    return have_column;
+}
+
+static void snmp_value_set_octets(snmp_value_t *out_value, const uint8_t *octets, size_t len)
+{
+    out_value->kind = VALUE_KIND_OCTETS;
+    out_value->octets = octets;
+    out_value->octets_len = len;
+}
+
+static void snmp_value_set_oid(snmp_value_t *out_value, const uint8_t *oid, size_t len)
+{
+    out_value->kind = VALUE_KIND_OID;
+    out_value->octets = oid;
+    out_value->octets_len = len;
+}
+
+static int32_t snmp_clamp_i32(uint32_t value)
+{
+    return (value > (uint32_t)INT32_MAX) ? INT32_MAX : (int32_t)value;
+}
+
+static bool snmp_get_column_value(size_t index, uint8_t row, snmp_value_t *out_value)
+{
+    if ((out_value == NULL) || (index >= (sizeof(k_column_table) / sizeof(k_column_table[0]))))
+    {
+        return false;
+    }
+
+    memset(out_value, 0, sizeof(*out_value));
+    out_value->kind = VALUE_KIND_INT32;
+
+    uint32_t const heap_total = s_health.heap_total_bytes;
+    sys_health_task_t const *task = NULL;
+    if (k_column_table[index].table == HR_TABLE_SWRUN)
+    {
+        if ((row == 0U) || (row > s_health.task_count))
+        {
+            return false;
+        }
+        task = &s_health.tasks[row - 1U];
+    }
+
+    switch (k_column_table[index].column)
+    {
+    case HR_COL_STORAGE_INDEX:
+    case HR_COL_SWRUN_INDEX:
+        out_value->i32 = (int32_t)row;
+        return true;
+    case HR_COL_STORAGE_TYPE:
+        snmp_value_set_oid(out_value, VALUE_HR_STORAGE_TYPE_RAM, sizeof(VALUE_HR_STORAGE_TYPE_RAM));
+        return true;
+    case HR_COL_STORAGE_DESCR:
+        if (row == 1U)
+        {
+            snmp_value_set_octets(out_value, VALUE_HR_STORAGE_DESCR_HEAP, sizeof(VALUE_HR_STORAGE_DESCR_HEAP) - 1U);
+        }
+        else if (row == 2U)
+        {
+            snmp_value_set_octets(out_value, VALUE_HR_STORAGE_DESCR_HEAP_PEAK, sizeof(VALUE_HR_STORAGE_DESCR_HEAP_PEAK) - 1U);
+        }
+        else
+        {
+            snmp_value_set_octets(out_value, VALUE_HR_STORAGE_DESCR_HEAP_FRAG, sizeof(VALUE_HR_STORAGE_DESCR_HEAP_FRAG) - 1U);
+        }
+        return true;
+    case HR_COL_STORAGE_UNITS:
+        out_value->i32 = 1;
+        return true;
+    case HR_COL_STORAGE_SIZE:
+        out_value->i32 = snmp_clamp_i32(heap_total);
+        return true;
+    case HR_COL_STORAGE_USED:
+    {
+        uint32_t remaining = s_health.heap_free_bytes;
+        if (row == 2U)
+        {
+            remaining = s_health.heap_min_free_bytes;
+        }
+        else if (row == 3U)
+        {
+            remaining = s_health.heap_largest_free_block_bytes;
+        }
+        out_value->i32 = snmp_clamp_i32((heap_total >= remaining) ? (heap_total - remaining) : 0U);
+        return true;
+    }
+    case HR_COL_PROCESSOR_FRW_ID:
+        snmp_value_set_oid(out_value, VALUE_ZERO_DOT_ZERO, sizeof(VALUE_ZERO_DOT_ZERO));
+        return true;
+    case HR_COL_PROCESSOR_LOAD:
+        out_value->i32 = (int32_t)s_health.cpu_load_percent;
+        return true;
+    case HR_COL_SWRUN_NAME:
+        snmp_value_set_octets(out_value,
+                              (const uint8_t *)task->name,
+                              strnlen(task->name, sizeof(task->name)));
+        return true;
+    case HR_COL_SWRUN_PARAMETERS:
+    {
+        int const n = snprintf(s_value_text,
+                               sizeof(s_value_text),
+                               "stack_free_min=%lu cpu=%u%%",
+                               (unsigned long)task->stack_free_min_bytes,
+                               (unsigned int)task->cpu_percent);
+        if (n < 0)
+        {
+            return false;
+        }
+        size_t const len = ((size_t)n < sizeof(s_value_text)) ? (size_t)n : (sizeof(s_value_text) - 1U);
+        snmp_value_set_octets(out_value, (const uint8_t *)s_value_text, len);
+        return true;
+    }
+    case HR_COL_SWRUN_STATUS:
+        out_value->i32 = (int32_t)task->state;
+        return true;
+    case HR_COL_SWRUN_PERF_CPU:
+        out_value->i32 = snmp_clamp_i32(task->cpu_time_cs);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool snmp_get_value_by_index(size_t index, const ups_snapshot_t *snap, snmp_value_t *out_value)
 {
-    if (out_value == NULL)
+    if ((out_value == NULL) || (snap == NULL))
     {
         return false;
     }
@@ -581,17 +1080,21 @@ static bool snmp_get_value_by_index(size_t index, snmp_value_t *out_value)
         return true;
     case 8U:
         out_value->kind = VALUE_KIND_INT32;
-        if ((g_battery.remaining_capacity == 0U) ||
-            g_power_summary_present_status.shutdown_imminent)
+        if ((snap->battery.remaining_capacity == 0U) ||
+            snap->present_status.shutdown_imminent)
         {
             out_value->i32 = 4;
         }
-        else if (g_power_summary_present_status.need_replacement)
+        else if (snap->present_status.need_replacement)
         {
             out_value->i32 = 4;
         }
-        else if (g_power_summary_present_status.below_remaining_capacity_limit ||
-                 (g_battery.remaining_capacity <= g_power_summary.remaining_capacity_limit))
+        else if (snap->present_status.comm_lost)
+        {
+            out_value->i32 = 1;
+        }
+        else if (snap->present_status.below_remaining_capacity_limit ||
+                 (snap->battery.remaining_capacity <= snap->summary.remaining_capacity_limit))
         {
             out_value->i32 = 3;
         }
@@ -602,29 +1105,29 @@ static bool snmp_get_value_by_index(size_t index, snmp_value_t *out_value)
         return true;
     case 9U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = g_power_summary_present_status.ac_present ? 0 : (int32_t)g_battery.run_time_to_empty_s;
+        out_value->i32 = snap->present_status.ac_present ? 0 : (int32_t)snap->battery.run_time_to_empty_s;
         return true;
     case 10U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_battery.run_time_to_empty_s / 60U);
+        out_value->i32 = (int32_t)(snap->battery.run_time_to_empty_s / 60U);
         return true;
     case 11U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)g_battery.remaining_capacity;
+        out_value->i32 = (int32_t)snap->battery.remaining_capacity;
         return true;
     case 12U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_battery.battery_voltage / 10U);
+        out_value->i32 = (int32_t)(snap->battery.battery_voltage / 10U);
         return true;
     case 13U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_battery.battery_current / 10);
+        out_value->i32 = (int32_t)(snap->battery.battery_current / 10);
         return true;
     case 14U:
         out_value->kind = VALUE_KIND_INT32;
-        if (g_battery.temperature >= 2731U)
+        if (snap->battery.temperature >= 2731U)
         {
-            out_value->i32 = (int32_t)((g_battery.temperature - 2731U) / 10U);
+            out_value->i32 = (int32_t)((snap->battery.temperature - 2731U) / 10U);
         }
         else
         {
@@ -641,19 +1144,19 @@ static bool snmp_get_value_by_index(size_t index, snmp_value_t *out_value)
         return true;
     case 17U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_input.frequency / 10U);
+        out_value->i32 = (int32_t)(snap->input.frequency / 10U);
         return true;
     case 18U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)((g_input.voltage + 50U) / 100U);
+        out_value->i32 = (int32_t)((snap->input.voltage + 50U) / 100U);
         return true;
     case 19U:
         out_value->kind = VALUE_KIND_INT32;
-        if (g_power_summary_present_status.ac_present)
+        if (snap->present_status.ac_present)
         {
             out_value->i32 = 3;
         }
-        else if (g_power_summary_present_status.discharging)
+        else if (snap->present_status.discharging)
         {
             out_value->i32 = 5;
         }
@@ -664,7 +1167,7 @@ static bool snmp_get_value_by_index(size_t index, snmp_value_t *out_value)
         return true;
     case 20U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_output.frequency / 10U);
+        out_value->i32 = (int32_t)(snap->output.frequency / 10U);
         return true;
     case 21U:
         out_value->kind = VALUE_KIND_INT32;
@@ -672,45 +1175,45 @@ static bool snmp_get_value_by_index(size_t index, snmp_value_t *out_value)
         return true;
     case 22U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)((g_output.voltage + 50U) / 100U);
+        out_value->i32 = (int32_t)((snap->output.voltage + 50U) / 100U);
         return true;
     case 23U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_output.current / 10);
+        out_value->i32 = (int32_t)(snap->output.current / 10);
         return true;
     case 24U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(((uint32_t)g_output.config_active_power *
-                                    (uint32_t)g_output.percent_load) /
+        out_value->i32 = (int32_t)(((uint32_t)snap->output.config_active_power *
+                                    (uint32_t)snap->output.percent_load) /
                                    100U);
         return true;
     case 25U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)g_output.percent_load;
+        out_value->i32 = (int32_t)snap->output.percent_load;
         return true;
     case 26U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)((g_input.config_voltage + 50U) / 100U);
+        out_value->i32 = (int32_t)((snap->input.config_voltage + 50U) / 100U);
         return true;
     case 27U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)((g_output.config_voltage + 50U) / 100U);
+        out_value->i32 = (int32_t)((snap->output.config_voltage + 50U) / 100U);
         return true;
     case 28U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)g_output.config_active_power;
+        out_value->i32 = (int32_t)snap->output.config_active_power;
         return true;
     case 29U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)(g_battery.remaining_time_limit_s / 60U);
+        out_value->i32 = (int32_t)(snap->battery.remaining_time_limit_s / 60U);
         return true;
     case 30U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)((g_input.low_voltage_transfer + 50U) / 100U);
+        out_value->i32 = (int32_t)((snap->input.low_voltage_transfer + 50U) / 100U);
         return true;
     case 31U:
         out_value->kind = VALUE_KIND_INT32;
-        out_value->i32 = (int32_t)((g_input.high_voltage_transfer + 50U) / 100U);
+        out_value->i32 = (int32_t)((snap->input.high_voltage_transfer + 50U) / 100U);
         return true;
     default:
         return false;
@@ -833,6 +1336,13 @@ static bool snmp_build_response(const snmp_request_t *req,
                 return false;
             }
         }
+        else if (value->kind == VALUE_KIND_OID)
+        {
+            if (!snmp_put_oid(&w, value->octets, value->octets_len))
+            {
+                return false;
+            }
+        }
         else
         {
             if (!snmp_put_octets(&w, value->octets, value->octets_len))
@@ -853,16 +1363,164 @@ static bool snmp_build_response(const snmp_request_t *req,
     return true;
 }
 
-static void snmp_agent_task(void *arg)
+// Community string indexing: UPS_SNMP_COMMUNITY selects unit 0 and
+// UPS_SNMP_COMMUNITY "@<n>" selects unit n, so every unit is served under the
+// same OIDs in its own context.
+static bool snmp_community_unit(const uint8_t *community, size_t len, uint8_t *out_unit)
 {
-    (void)arg;
+    size_t const base_len = strlen(UPS_SNMP_COMMUNITY);
+    if ((len < base_len) || (memcmp(community, UPS_SNMP_COMMUNITY, base_len) != 0))
+    {
+        return false;
+    }
 
+    if (len == base_len)
+    {
+        *out_unit = 0U;
+        return true;
+    }
+
+    // "@" plus one to three digits.
+    if ((community[base_len] != (uint8_t)'@') || (len < (base_len + 2U)) || (len > (base_len + 4U)))
+    {
+        return false;
+    }
+
+    uint32_t unit = 0U;
+    for (size_t i = base_len + 1U; i < len; i++)
+    {
+        if ((community[i] < (uint8_t)'0') || (community[i] > (uint8_t)'9'))
+        {
+            return false;
+        }
+        unit = (unit * 10U) + (uint32_t)(community[i] - (uint8_t)'0');
+    }
+
+    if (unit >= (uint32_t)UPS_UNIT_COUNT)
+    {
+        return false;
+    }
+
+    *out_unit = (uint8_t)unit;
+    return true;
+}
+
+// Receive and answer one datagram. Returns false if nothing was received.
+static bool snmp_agent_handle_one(int sock, int recv_flags)
+{
+    struct sockaddr_in src_addr;
+    socklen_t src_len = sizeof(src_addr);
+    int const rlen = lwip_recvfrom(sock,
+                                   s_rx_buf,
+                                   sizeof(s_rx_buf),
+                                   recv_flags,
+                                   (struct sockaddr *)&src_addr,
+                                   &src_len);
+    if (rlen <= 0)
+    {
+        return false;
+    }
+
+    snmp_request_t req;
+    memset(&req, 0, sizeof(req));
+    if (!snmp_decode_request(s_rx_buf, (size_t)rlen, &req))
+    {
+        return true;
+    }
+
+    if (!((req.version == 0) || (req.version == 1)))
+    {
+        return true;
+    }
+
+    uint8_t unit = 0U;
+    if (!snmp_community_unit(req.community, req.community_len, &unit))
+    {
+        return true;
+    }
+
+    // Row counts of the HOST-RESOURCES tables come from this copy, so
+    // lookup and value always agree within one request.
+    (void)sys_health_get(&s_health);
+
+    snmp_object_t obj;
+    bool found = false;
+    if (req.pdu_type == SNMP_TYPE_GET_REQUEST)
+    {
+        found = snmp_resolve_exact(req.request_oid, &obj);
+    }
+    else
+    {
+        found = snmp_resolve_next(req.request_oid, &obj);
+    }
+
+    ups_snapshot_t snap;
+    if (req.pdu_type == SNMP_TYPE_GET_NEXT_REQUEST)
+    {
+        snmp_walker_resolve(&src_addr, unit, ups_tick_ms(), &snap);
+    }
+    else
+    {
+        (void)snmp_snapshot_get(unit, 0U, &snap);
+    }
+
+    snmp_value_t resp_value;
+    memset(&resp_value, 0, sizeof(resp_value));
+
+    int32_t error_status = SNMP_ERR_NOERROR;
+    int32_t error_index = 0;
+    const uint8_t *resp_oid = req.request_oid.oid;
+    size_t resp_oid_len = req.request_oid.oid_len;
+
+    if (!found)
+    {
+        error_status = SNMP_ERR_NOSUCHNAME;
+        error_index = 1;
+    }
+    else
+    {
+        resp_oid = obj.oid;
+        resp_oid_len = obj.oid_len;
+        bool const value_ok = obj.is_column
+                                  ? snmp_get_column_value(obj.index, obj.row, &resp_value)
+                                  : snmp_get_value_by_index(obj.index, &snap, &resp_value);
+        if (!value_ok)
+        {
+            error_status = SNMP_ERR_GENERR;
+            error_index = 1;
+        }
+    }
+
+    size_t tx_len = 0U;
+    if (!snmp_build_response(&req,
+                             error_status,
+                             error_index,
+                             resp_oid,
+                             resp_oid_len,
+                             &resp_value,
+                             s_tx_buf,
+                             sizeof(s_tx_buf),
+                             &tx_len))
+    {
+        return true;
+    }
+
+    lwip_sendto(sock,
+                s_tx_buf,
+                tx_len,
+                0,
+                (struct sockaddr *)&src_addr,
+                src_len);
+    return true;
+}
+
+int snmp_agent_open(void)
+{
     int sock = lwip_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (sock < 0)
     {
         ESP_LOGE(TAG, "Failed to create SNMP UDP socket");
-        vTaskDelete(NULL);
-        return;
+        return -1;
     }
 
     struct sockaddr_in bind_addr;
@@ -875,103 +1533,43 @@ static void snmp_agent_task(void *arg)
     {
         ESP_LOGE(TAG, "Failed to bind SNMP socket to UDP/161");
         lwip_close(sock);
-        vTaskDelete(NULL);
-        return;
+        return -1;
     }
 
     ESP_LOGI(TAG, "SNMP agent listening on UDP/161");
+    return sock;
+}
 
-    uint8_t rx_buf[512];
-    uint8_t tx_buf[512];
-
-    while (1)
+void snmp_agent_service(int sock)
+{
+    if (sock < 0)
     {
-        struct sockaddr_in src_addr;
-        socklen_t src_len = sizeof(src_addr);
-        int const rlen = lwip_recvfrom(sock,
-                                       rx_buf,
-                                       sizeof(rx_buf),
-                                       0,
-                                       (struct sockaddr *)&src_addr,
-                                       &src_len);
-        if (rlen <= 0)
-        {
-            continue;
-        }
-
-        snmp_request_t req;
-        memset(&req, 0, sizeof(req));
-        if (!snmp_decode_request(rx_buf, (size_t)rlen, &req))
-        {
-            continue;
-        }
-
-        if (!((req.version == 0) || (req.version == 1)))
-        {
-            continue;
-        }
-
-        if ((req.community_len != strlen(UPS_SNMP_COMMUNITY)) ||
-            (memcmp(req.community, UPS_SNMP_COMMUNITY, req.community_len) != 0))
-        {
-            continue;
-        }
+        return;
+    }
 
-        size_t oid_index = 0U;
-        bool found = false;
-        if (req.pdu_type == SNMP_TYPE_GET_REQUEST)
-        {
-            found = snmp_lookup_exact(req.request_oid, &oid_index);
-        }
-        else
+    for (uint8_t i = 0U; i < UPS_SNMP_SERVICE_BURST; i++)
+    {
+        if (!snmp_agent_handle_one(sock, MSG_DONTWAIT))
         {
-            found = snmp_lookup_next(req.request_oid, &oid_index);
+            break;
         }
+    }
+}
 
-        snmp_value_t resp_value;
-        memset(&resp_value, 0, sizeof(resp_value));
-
-        int32_t error_status = SNMP_ERR_NOERROR;
-        int32_t error_index = 0;
-        const uint8_t *resp_oid = req.request_oid.oid;
-        size_t resp_oid_len = req.request_oid.oid_len;
-
-        if (!found)
-        {
-            error_status = SNMP_ERR_NOSUCHNAME;
-            error_index = 1;
-        }
-        else
-        {
-            resp_oid = k_oid_table[oid_index].oid;
-            resp_oid_len = k_oid_table[oid_index].oid_len;
-            if (!snmp_get_value_by_index(oid_index, &resp_value))
-            {
-                error_status = SNMP_ERR_GENERR;
-                error_index = 1;
-            }
-        }
+static void snmp_agent_task(void *arg)
+{
+    (void)arg;
 
-        size_t tx_len = 0U;
-        if (!snmp_build_response(&req,
-                                 error_status,
-                                 error_index,
-                                 resp_oid,
-                                 resp_oid_len,
-                                 &resp_value,
-                                 tx_buf,
-                                 sizeof(tx_buf),
-                                 &tx_len))
-        {
-            continue;
-        }
+    int const sock = snmp_agent_open();
+    if (sock < 0)
+    {
+        vTaskDelete(NULL);
+        return;
+    }
 
-        lwip_sendto(sock,
-                    tx_buf,
-                    tx_len,
-                    0,
-                    (struct sockaddr *)&src_addr,
-                    src_len);
+    while (1)
+    {
+        (void)snmp_agent_handle_one(sock, 0);
     }
 }
 
@@ -7,8 +7,22 @@ extern "C" {
 
 #include "esp_err.h"
 
+#include <stdint.h>
+
+// Start the agent in its own task (blocking recvfrom on UDP/161).
 esp_err_t snmp_agent_start(void);
 
+// Reactor build: open/bind UDP/161 without a task, then call
+// snmp_agent_service() whenever the returned socket is readable.
+int snmp_agent_open(void);
+void snmp_agent_service(int sock);
+
+// Publish g_ups[unit] as a new snapshot generation of that unit.
+// Call from the sampling task once a refresh cycle has completed.
+// Unit n is read with community UPS_SNMP_COMMUNITY "@n" ("@0" or the plain
+// community for unit 0).
+void snmp_agent_publish_snapshot(uint8_t unit);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,122 +6,187 @@
 #include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
-#include <string.h>
 
 #define SPM2K_CMD_LINE_TIMEOUT_MS 500U
 #define SPM2K_CMD_LINE_RETRIES 0U
 #define SPM2K_LINE_MAX_LEN 40U
 
-static bool spm2k_rx_has_crlf(const uint8_t *rx, uint16_t rx_len);
-static bool spm2k_extract_text(const uint8_t *rx,
-                               uint16_t rx_len,
+// Refresh periods of the dynamic LUT entries (see lut_sched.h). Line and
+// status flags change within seconds, battery values within a minute, the
+// rest hardly at all; about the command rate of one full pass every 10 s.
+#define SPM2K_PERIOD_FAST_MS 2500U
+#define SPM2K_PERIOD_NORMAL_MS 10000U
+#define SPM2K_PERIOD_SLOW_MS 30000U
+#define SPM2K_PERIOD_IDLE_MS 60000U
+
+// Reply payload (CRLF stripped) as a range of the RX span. Parsers read it in
+// place instead of copying it into a NUL-terminated buffer.
+typedef struct
+{
+    const uart_engine_span_t *rx;
+    uint16_t off;
+    uint16_t len;
+} spm2k_text_t;
+
+static bool spm2k_rx_has_crlf(const uart_engine_span_t *rx);
+static bool spm2k_extract_text(const uart_engine_span_t *rx,
                                bool require_crlf,
-                               char *out,
-                               size_t out_size);
-static bool spm2k_parse_scaled_int(const char *text,
+                               uint16_t max_len,
+                               spm2k_text_t *out);
+static bool spm2k_parse_scaled_int(const spm2k_text_t *text,
                                    int32_t scale,
                                    int32_t min_value,
                                    int32_t max_value,
                                    int32_t *out_value);
-static bool spm2k_parse_hex_byte(const char *text, uint8_t *out_value);
-static bool spm2k_get_csv_field(const char *csv,
+static bool spm2k_parse_hex_byte(const spm2k_text_t *text, uint8_t *out_value);
+static bool spm2k_get_csv_field(const spm2k_text_t *csv,
                                 uint8_t field_index,
-                                char *out,
-                                size_t out_size);
-static bool spm2k_pack_date_mmddyy(const char *text, uint16_t *out_value);
+                                uint16_t max_len,
+                                spm2k_text_t *out);
+static bool spm2k_pack_date_mmddyy(const spm2k_text_t *text, uint16_t *out_value);
 
 const uart_engine_request_t g_spm2k_constant_lut[] = {
-    { .out_value = &g_power_summary.i_product_2bit, .cmd = (uint16_t)0x01U, .cmd_bits = 8U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_string },
-    { .out_value = &g_power_summary.i_serial_number_2bit, .cmd = (uint16_t)0x6EU, .cmd_bits = 8U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_string },
+    { UART_ENGINE_OUT_FIELD(summary.i_product_2bit), .cmd = (uint16_t)0x01U, .cmd_bits = 8U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_string },
+    { UART_ENGINE_OUT_FIELD(summary.i_serial_number_2bit), .cmd = (uint16_t)0x6EU, .cmd_bits = 8U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_string },
 
-    { .out_value = NULL, .cmd = (uint16_t)0x9FD1U, .cmd_bits = 16U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_rated_info },
+    { UART_ENGINE_OUT_TELEMETRY, .cmd = (uint16_t)0x9FD1U, .cmd_bits = 16U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_rated_info },
 
-    { .out_value = &g_battery.manufacturer_date, .cmd = (uint16_t)0x78U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_manufacturer_date },
+    { UART_ENGINE_OUT_FIELD(battery.manufacturer_date), .cmd = (uint16_t)0x78U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_manufacturer_date },
 
-    { .out_value = &g_input.low_voltage_transfer, .cmd = (uint16_t)0x6CU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
-    { .out_value = &g_input.high_voltage_transfer, .cmd = (uint16_t)0x75U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
+    { UART_ENGINE_OUT_FIELD(input.low_voltage_transfer), .cmd = (uint16_t)0x6CU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
+    { UART_ENGINE_OUT_FIELD(input.high_voltage_transfer), .cmd = (uint16_t)0x75U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
 };
 
 const size_t g_spm2k_constant_lut_count = sizeof(g_spm2k_constant_lut) / sizeof(g_spm2k_constant_lut[0]);
 
 const uart_engine_request_t g_spm2k_dynamic_lut[] = {
-    { .out_value = NULL, .cmd = (uint16_t)0x59U, .cmd_bits = 8U, .expected_len = 4U, .expected_ending = false, .expected_ending_len = 0U, .expected_ending_bytes = {0}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = NULL },
-    { .out_value = &g_battery.battery_voltage, .cmd = (uint16_t)0x42U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
-    { .out_value = &g_battery.battery_current, .cmd = (uint16_t)0x9FD4U, .cmd_bits = 16U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_bat_current },
-    { .out_value = &g_battery.run_time_to_empty_s, .cmd = (uint16_t)0x6AU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_runtime_minutes_to_seconds },
-    { .out_value = &g_battery.temperature, .cmd = (uint16_t)0x43U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_temperature_c_to_kelvin },
-    { .out_value = &g_battery.remaining_capacity, .cmd = (uint16_t)0x66U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_remaining_capacity },
-
-    { .out_value = &g_power_summary_present_status.ac_present, .cmd = (uint16_t)0x39U, .cmd_bits = 8U, .expected_len = 2U, .expected_ending = false, .expected_ending_len = 0U, .expected_ending_bytes = {0}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_ac_present },
-    { .out_value = NULL, .cmd = (uint16_t)0x51U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_status_flags },
-
-    { .out_value = &g_input.voltage, .cmd = (uint16_t)0x4CU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
-    { .out_value = &g_input.frequency, .cmd = (uint16_t)0x9FD3U, .cmd_bits = 16U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_frequency },
-
-    { .out_value = &g_output.percent_load, .cmd = (uint16_t)0x5CU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_percent_load },
-    { .out_value = &g_output.voltage, .cmd = (uint16_t)0x4FU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
-    { .out_value = &g_output.current, .cmd = (uint16_t)0x2FU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_ac_current },
-    { .out_value = &g_output.frequency, .cmd = (uint16_t)0x46U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_frequency },
+    { UART_ENGINE_OUT_FIELD(battery.battery_voltage), .cmd = (uint16_t)0x42U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
+    { UART_ENGINE_OUT_TELEMETRY, .cmd = (uint16_t)0x9FD4U, .cmd_bits = 16U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_bat_current },
+    { UART_ENGINE_OUT_FIELD(battery.run_time_to_empty_s), .cmd = (uint16_t)0x6AU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_runtime_minutes_to_seconds },
+    { UART_ENGINE_OUT_FIELD(battery.temperature), .cmd = (uint16_t)0x43U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_temperature_c_to_kelvin },
+    { UART_ENGINE_OUT_TELEMETRY, .cmd = (uint16_t)0x66U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_remaining_capacity },
+
+    { UART_ENGINE_OUT_FIELD(present_status.ac_present), .cmd = (uint16_t)0x39U, .cmd_bits = 8U, .expected_len = 2U, .expected_ending = false, .expected_ending_len = 0U, .expected_ending_bytes = {0}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_ac_present },
+    { UART_ENGINE_OUT_TELEMETRY, .cmd = (uint16_t)0x51U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_status_flags },
+
+    { UART_ENGINE_OUT_FIELD(input.voltage), .cmd = (uint16_t)0x4CU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
+    { UART_ENGINE_OUT_FIELD(input.frequency), .cmd = (uint16_t)0x9FD3U, .cmd_bits = 16U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_frequency },
+
+    { UART_ENGINE_OUT_FIELD(output.percent_load), .cmd = (uint16_t)0x5CU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_percent_load },
+    { UART_ENGINE_OUT_FIELD(output.voltage), .cmd = (uint16_t)0x4FU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_voltage },
+    { UART_ENGINE_OUT_FIELD(output.current), .cmd = (uint16_t)0x2FU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_ac_current },
+    { UART_ENGINE_OUT_FIELD(output.frequency), .cmd = (uint16_t)0x46U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_frequency },
 };
 
 const uart_engine_request_t g_spm2k_constant_heartbeat =
     { .out_value = NULL, .cmd = (uint16_t)0x59U, .cmd_bits = 8U, .expected_len = 4U, .expected_ending = false, .expected_ending_len = 0U, .expected_ending_bytes = {0}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = NULL };
 
+const uart_engine_request_t g_spm2k_serial_number =
+    { .out_value = NULL, .cmd = (uint16_t)0x6EU, .cmd_bits = 8U, .expected_len = SPM2K_LINE_MAX_LEN, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = 2U, .process_fn = NULL };
+
+// Focused refresh after an alert character: status flags, charge, runtime.
+const uart_engine_request_t g_spm2k_alert_refresh_lut[] = {
+    { UART_ENGINE_OUT_TELEMETRY, .cmd = (uint16_t)0x51U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_status_flags },
+    { UART_ENGINE_OUT_TELEMETRY, .cmd = (uint16_t)0x66U, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_remaining_capacity },
+    { UART_ENGINE_OUT_FIELD(battery.run_time_to_empty_s), .cmd = (uint16_t)0x6AU, .cmd_bits = 8U, .expected_len = 16U, .expected_ending = true, .expected_ending_len = 2U, .expected_ending_bytes = {0x0DU, 0x0AU}, .timeout_ms = SPM2K_CMD_LINE_TIMEOUT_MS, .max_retries = SPM2K_CMD_LINE_RETRIES, .process_fn = spm2k_process_runtime_minutes_to_seconds },
+};
+const size_t g_spm2k_alert_refresh_lut_count = sizeof(g_spm2k_alert_refresh_lut) / sizeof(g_spm2k_alert_refresh_lut[0]);
+
 const uint8_t g_spm2k_constant_heartbeat_expect_return[] = {0x53U, 0x4DU, 0x0DU, 0x0AU}; // "SM\r\n"
 const size_t g_spm2k_constant_heartbeat_expect_return_len = sizeof(g_spm2k_constant_heartbeat_expect_return);
 
 const size_t g_spm2k_dynamic_lut_count = sizeof(g_spm2k_dynamic_lut) / sizeof(g_spm2k_dynamic_lut[0]);
 
-static bool spm2k_rx_has_crlf(const uint8_t *rx, uint16_t rx_len)
+const uint32_t g_spm2k_dynamic_period_ms[sizeof(g_spm2k_dynamic_lut) / sizeof(g_spm2k_dynamic_lut[0])] = {
+    SPM2K_PERIOD_SLOW_MS,   // 'B' battery voltage
+    SPM2K_PERIOD_NORMAL_MS, // 0x9FD4 battery current
+    SPM2K_PERIOD_NORMAL_MS, // 'j' runtime
+    SPM2K_PERIOD_IDLE_MS,   // 'C' temperature
+    SPM2K_PERIOD_NORMAL_MS, // 'f' remaining capacity
+    SPM2K_PERIOD_FAST_MS,   // '9' line quality
+    SPM2K_PERIOD_FAST_MS,   // 'Q' status flags
+    SPM2K_PERIOD_SLOW_MS,   // 'L' input voltage
+    SPM2K_PERIOD_IDLE_MS,   // 0x9FD3 input frequency
+    SPM2K_PERIOD_SLOW_MS,   // '\' load
+    SPM2K_PERIOD_SLOW_MS,   // 'O' output voltage
+    SPM2K_PERIOD_SLOW_MS,   // '/' output current
+    SPM2K_PERIOD_IDLE_MS,   // 'F' output frequency
+};
+
+// Character at index, or '\0' past the end (the payload never contains NUL).
+static char spm2k_text_char(const spm2k_text_t *text, uint16_t index)
 {
-    if ((rx == NULL) || (rx_len < 2U))
+    if (index >= text->len)
+    {
+        return '\0';
+    }
+
+    return (char)uart_engine_span_at(text->rx, (uint16_t)(text->off + index));
+}
+
+static bool spm2k_rx_has_crlf(const uart_engine_span_t *rx)
+{
+    if (rx == NULL)
+    {
+        return false;
+    }
+
+    uint16_t const rx_len = uart_engine_span_len(rx);
+    if (rx_len < 2U)
     {
         return false;
     }
 
-    return (rx[rx_len - 2U] == 0x0DU) && (rx[rx_len - 1U] == 0x0AU);
+    return (uart_engine_span_at(rx, (uint16_t)(rx_len - 2U)) == 0x0DU) &&
+           (uart_engine_span_at(rx, (uint16_t)(rx_len - 1U)) == 0x0AU);
 }
 
-static bool spm2k_extract_text(const uint8_t *rx,
-                               uint16_t rx_len,
+// Payload of 1..max_len printable characters.
+static bool spm2k_extract_text(const uart_engine_span_t *rx,
                                bool require_crlf,
-                               char *out,
-                               size_t out_size)
+                               uint16_t max_len,
+                               spm2k_text_t *out)
 {
-    if ((rx == NULL) || (out == NULL) || (out_size < 2U) || (rx_len == 0U))
+    if ((rx == NULL) || (out == NULL))
+    {
+        return false;
+    }
+
+    uint16_t payload_len = uart_engine_span_len(rx);
+    if (payload_len == 0U)
     {
         return false;
     }
 
-    size_t payload_len = (size_t)rx_len;
     if (require_crlf)
     {
-        if (!spm2k_rx_has_crlf(rx, rx_len))
+        if (!spm2k_rx_has_crlf(rx))
         {
             return false;
         }
-        payload_len -= 2U;
+        payload_len = (uint16_t)(payload_len - 2U);
     }
 
-    if ((payload_len == 0U) || (payload_len >= out_size))
+    if ((payload_len == 0U) || (payload_len > max_len))
     {
         return false;
     }
 
-    for (size_t i = 0U; i < payload_len; ++i)
+    for (uint16_t i = 0U; i < payload_len; ++i)
     {
-        if (!isprint((int)rx[i]))
+        if (!isprint((int)uart_engine_span_at(rx, i)))
         {
             return false;
         }
     }
 
-    memcpy(out, rx, payload_len);
-    out[payload_len] = '\0';
+    out->rx = rx;
+    out->off = 0U;
+    out->len = payload_len;
     return true;
 }
 
-static bool spm2k_parse_scaled_int(const char *text,
+static bool spm2k_parse_scaled_int(const spm2k_text_t *text,
                                    int32_t scale,
                                    int32_t min_value,
                                    int32_t max_value,
@@ -144,27 +209,27 @@ static bool spm2k_parse_scaled_int(const char *text,
         return false;
     }
 
-    char const *cursor = text;
+    uint16_t cursor = 0U;
     int sign = 1;
-    if (*cursor == '-')
+    if (spm2k_text_char(text, cursor) == '-')
     {
         sign = -1;
         cursor++;
     }
-    else if (*cursor == '+')
+    else if (spm2k_text_char(text, cursor) == '+')
     {
         cursor++;
     }
 
-    if (!isdigit((int)*cursor))
+    if (!isdigit((int)spm2k_text_char(text, cursor)))
     {
         return false;
     }
 
     int64_t integral = 0;
-    while (isdigit((int)*cursor))
+    while (isdigit((int)spm2k_text_char(text, cursor)))
     {
-        integral = (integral * 10) + (*cursor - '0');
+        integral = (integral * 10) + (spm2k_text_char(text, cursor) - '0');
         if (integral > (INT32_MAX / scale))
         {
             return false;
@@ -174,19 +239,19 @@ static bool spm2k_parse_scaled_int(const char *text,
 
     int64_t fraction = 0;
     int32_t captured_fraction_digits = 0;
-    if (*cursor == '.')
+    if (spm2k_text_char(text, cursor) == '.')
     {
         cursor++;
-        if (!isdigit((int)*cursor))
+        if (!isdigit((int)spm2k_text_char(text, cursor)))
         {
             return false;
         }
 
-        while (isdigit((int)*cursor))
+        while (isdigit((int)spm2k_text_char(text, cursor)))
         {
             if (captured_fraction_digits < fraction_digits)
             {
-                fraction = (fraction * 10) + (*cursor - '0');
+                fraction = (fraction * 10) + (spm2k_text_char(text, cursor) - '0');
                 captured_fraction_digits++;
             }
             cursor++;
@@ -199,7 +264,7 @@ static bool spm2k_parse_scaled_int(const char *text,
         captured_fraction_digits++;
     }
 
-    if (*cursor != '\0')
+    if (cursor != text->len)
     {
         return false;
     }
@@ -219,20 +284,22 @@ static bool spm2k_parse_scaled_int(const char *text,
     return true;
 }
 
-static bool spm2k_parse_hex_byte(const char *text, uint8_t *out_value)
+static bool spm2k_parse_hex_byte(const spm2k_text_t *text, uint8_t *out_value)
 {
     if ((text == NULL) || (out_value == NULL))
     {
         return false;
     }
 
-    if ((text[0] == '\0') || (text[1] == '\0') || (text[2] != '\0'))
+    if (text->len != 2U)
     {
         return false;
     }
 
-    int hi = isdigit((int)text[0]) ? (text[0] - '0') : (tolower((int)text[0]) - 'a' + 10);
-    int lo = isdigit((int)text[1]) ? (text[1] - '0') : (tolower((int)text[1]) - 'a' + 10);
+    char const c0 = spm2k_text_char(text, 0U);
+    char const c1 = spm2k_text_char(text, 1U);
+    int hi = isdigit((int)c0) ? (c0 - '0') : (tolower((int)c0) - 'a' + 10);
+    int lo = isdigit((int)c1) ? (c1 - '0') : (tolower((int)c1) - 'a' + 10);
 
     if ((hi < 0) || (hi > 15) || (lo < 0) || (lo > 15))
     {
@@ -243,70 +310,79 @@ static bool spm2k_parse_hex_byte(const char *text, uint8_t *out_value)
     return true;
 }
 
-static bool spm2k_get_csv_field(const char *csv,
+// Field field_index of a comma-separated payload, 1..max_len characters.
+static bool spm2k_get_csv_field(const spm2k_text_t *csv,
                                 uint8_t field_index,
-                                char *out,
-                                size_t out_size)
+                                uint16_t max_len,
+                                spm2k_text_t *out)
 {
-    if ((csv == NULL) || (out == NULL) || (out_size < 2U))
+    if ((csv == NULL) || (out == NULL))
     {
         return false;
     }
 
     uint8_t current_field = 0U;
-    char const *field_start = csv;
+    uint16_t field_start = 0U;
 
-    for (char const *cursor = csv;; ++cursor)
+    for (uint16_t cursor = 0U;; ++cursor)
     {
-        if ((*cursor == ',') || (*cursor == '\0'))
+        char const c = spm2k_text_char(csv, cursor);
+        if ((c == ',') || (c == '\0'))
         {
             if (current_field == field_index)
             {
-                size_t len = (size_t)(cursor - field_start);
-                if ((len == 0U) || (len >= out_size))
+                uint16_t const len = (uint16_t)(cursor - field_start);
+                if ((len == 0U) || (len > max_len))
                 {
                     return false;
                 }
 
-                memcpy(out, field_start, len);
-                out[len] = '\0';
+                out->rx = csv->rx;
+                out->off = (uint16_t)(csv->off + field_start);
+                out->len = len;
                 return true;
             }
 
-            if (*cursor == '\0')
+            if (c == '\0')
             {
                 return false;
             }
 
             current_field++;
-            field_start = cursor + 1;
+            field_start = (uint16_t)(cursor + 1U);
         }
     }
 }
 
-static bool spm2k_pack_date_mmddyy(const char *text, uint16_t *out_value)
+static bool spm2k_pack_date_mmddyy(const spm2k_text_t *text, uint16_t *out_value)
 {
     if ((text == NULL) || (out_value == NULL))
     {
         return false;
     }
 
-    if ((strlen(text) != 8U) ||
-        (text[2] != '/') ||
-        (text[5] != '/') ||
-        !isdigit((int)text[0]) ||
-        !isdigit((int)text[1]) ||
-        !isdigit((int)text[3]) ||
-        !isdigit((int)text[4]) ||
-        !isdigit((int)text[6]) ||
-        !isdigit((int)text[7]))
+    char d[8];
+    for (uint16_t i = 0U; i < (uint16_t)sizeof(d); i++)
+    {
+        d[i] = spm2k_text_char(text, i);
+    }
+
+    if ((text->len != 8U) ||
+        (d[2] != '/') ||
+        (d[5] != '/') ||
+        !isdigit((int)d[0]) ||
+        !isdigit((int)d[1]) ||
+        !isdigit((int)d[3]) ||
+        !isdigit((int)d[4]) ||
+        !isdigit((int)d[6]) ||
+        !isdigit((int)d[7]))
     {
         return false;
     }
 
-    uint8_t const mm = (uint8_t)(((uint8_t)(text[0] - '0') * 10U) + (uint8_t)(text[1] - '0'));
-    uint8_t const dd = (uint8_t)(((uint8_t)(text[3] - '0') * 10U) + (uint8_t)(text[4] - '0'));
-    uint8_t const yy = (uint8_t)(((uint8_t)(text[6] - '0') * 10U) + (uint8_t)(text[7] - '0'));
+    uint8_t const mm = (uint8_t)(((uint8_t)(d[0] - '0') * 10U) + (uint8_t)(d[1] - '0'));
+    uint8_t const dd = (uint8_t)(((uint8_t)(d[3] - '0') * 10U) + (uint8_t)(d[4] - '0'));
+    uint8_t const yy = (uint8_t)(((uint8_t)(d[6] - '0') * 10U) + (uint8_t)(d[7] - '0'));
 
     if ((mm < 1U) || (mm > 12U) || (dd < 1U) || (dd > 31U))
     {
@@ -324,12 +400,12 @@ static bool spm2k_pack_date_mmddyy(const char *text, uint16_t *out_value)
     return true;
 }
 
-bool spm2k_process_string(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_string(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)out_value;
 
-    char text[33];
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    spm2k_text_t text;
+    if (!spm2k_extract_text(rx, true, 32U, &text))
     {
         return false;
     }
@@ -344,59 +420,61 @@ bool spm2k_process_string(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void
     }
 }
 
-bool spm2k_process_rated_info(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_rated_info(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
-    (void)out_value;
 
-    char text[48];
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    ups_telemetry_t *const t = (ups_telemetry_t *)out_value;
+    if (t == NULL)
     {
         return false;
     }
 
-    char token[16];
+    spm2k_text_t text;
+    if (!spm2k_extract_text(rx, true, 47U, &text))
+    {
+        return false;
+    }
+
+    spm2k_text_t token;
     int32_t parsed_config_active_power = 0;
     int32_t parsed_input_config_voltage = 0;
     int32_t parsed_output_config_voltage = 0;
     int32_t parsed_battery_config_voltage = 0;
 
-    if (!spm2k_get_csv_field(text, 0U, token, sizeof(token)) ||
-        !spm2k_parse_scaled_int(token, 1, 0, UINT16_MAX, &parsed_config_active_power))
+    if (!spm2k_get_csv_field(&text, 0U, 15U, &token) ||
+        !spm2k_parse_scaled_int(&token, 1, 0, UINT16_MAX, &parsed_config_active_power))
     {
         return false;
     }
 
-    if (!spm2k_get_csv_field(text, 1U, token, sizeof(token)) ||
-        !spm2k_parse_scaled_int(token, 100, 0, UINT16_MAX, &parsed_input_config_voltage))
+    if (!spm2k_get_csv_field(&text, 1U, 15U, &token) ||
+        !spm2k_parse_scaled_int(&token, 100, 0, UINT16_MAX, &parsed_input_config_voltage))
     {
         return false;
     }
 
-    if (!spm2k_get_csv_field(text, 2U, token, sizeof(token)) ||
-        !spm2k_parse_scaled_int(token, 100, 0, UINT16_MAX, &parsed_output_config_voltage))
+    if (!spm2k_get_csv_field(&text, 2U, 15U, &token) ||
+        !spm2k_parse_scaled_int(&token, 100, 0, UINT16_MAX, &parsed_output_config_voltage))
     {
         return false;
     }
 
-    if (!spm2k_get_csv_field(text, 5U, token, sizeof(token)) ||
-        !spm2k_parse_scaled_int(token, 100, 0, UINT16_MAX, &parsed_battery_config_voltage))
+    if (!spm2k_get_csv_field(&text, 5U, 15U, &token) ||
+        !spm2k_parse_scaled_int(&token, 100, 0, UINT16_MAX, &parsed_battery_config_voltage))
     {
         return false;
     }
 
-    g_output.config_active_power = (uint16_t)parsed_config_active_power;
-    g_input.config_voltage = (uint16_t)parsed_input_config_voltage;
-    g_output.config_voltage = (uint16_t)parsed_output_config_voltage;
-    g_battery.config_voltage = (uint16_t)parsed_battery_config_voltage;
+    t->output.config_active_power = (uint16_t)parsed_config_active_power;
+    t->input.config_voltage = (uint16_t)parsed_input_config_voltage;
+    t->output.config_voltage = (uint16_t)parsed_output_config_voltage;
+    t->battery.config_voltage = (uint16_t)parsed_battery_config_voltage;
 
     return true;
 }
 
-bool spm2k_process_manufacturer_date(uint16_t cmd,
-                                     const uint8_t *rx,
-                                     uint16_t rx_len,
-                                     void *out_value)
+bool spm2k_process_manufacturer_date(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -405,14 +483,14 @@ bool spm2k_process_manufacturer_date(uint16_t cmd,
         return false;
     }
 
-    char text[16];
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    spm2k_text_t text;
+    if (!spm2k_extract_text(rx, true, 15U, &text))
     {
         return false;
     }
 
     uint16_t packed_date = 0U;
-    if (!spm2k_pack_date_mmddyy(text, &packed_date))
+    if (!spm2k_pack_date_mmddyy(&text, &packed_date))
     {
         return false;
     }
@@ -421,7 +499,7 @@ bool spm2k_process_manufacturer_date(uint16_t cmd,
     return true;
 }
 
-bool spm2k_process_voltage(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_voltage(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -430,14 +508,14 @@ bool spm2k_process_voltage(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, voi
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t parsed = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    if (!spm2k_extract_text(rx, true, 15U, &text))
     {
         return false;
     }
 
-    if (!spm2k_parse_scaled_int(text, 100, 0, UINT16_MAX, &parsed))
+    if (!spm2k_parse_scaled_int(&text, 100, 0, UINT16_MAX, &parsed))
     {
         return false;
     }
@@ -446,7 +524,7 @@ bool spm2k_process_voltage(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, voi
     return true;
 }
 
-bool spm2k_process_frequency(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_frequency(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -455,14 +533,14 @@ bool spm2k_process_frequency(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, v
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t parsed = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    if (!spm2k_extract_text(rx, true, 15U, &text))
     {
         return false;
     }
 
-    if (!spm2k_parse_scaled_int(text, 100, 0, UINT16_MAX, &parsed))
+    if (!spm2k_parse_scaled_int(&text, 100, 0, UINT16_MAX, &parsed))
     {
         return false;
     }
@@ -471,7 +549,7 @@ bool spm2k_process_frequency(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, v
     return true;
 }
 
-bool spm2k_process_percent_load(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_percent_load(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -480,10 +558,10 @@ bool spm2k_process_percent_load(uint16_t cmd, const uint8_t *rx, uint16_t rx_len
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t parsed_x100 = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)) ||
-        !spm2k_parse_scaled_int(text, 100, 0, 10000, &parsed_x100))
+    if (!spm2k_extract_text(rx, true, 15U, &text) ||
+        !spm2k_parse_scaled_int(&text, 100, 0, 10000, &parsed_x100))
     {
         return false;
     }
@@ -493,10 +571,7 @@ bool spm2k_process_percent_load(uint16_t cmd, const uint8_t *rx, uint16_t rx_len
     return true;
 }
 
-bool spm2k_process_runtime_minutes_to_seconds(uint16_t cmd,
-                                              const uint8_t *rx,
-                                              uint16_t rx_len,
-                                              void *out_value)
+bool spm2k_process_runtime_minutes_to_seconds(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -505,21 +580,26 @@ bool spm2k_process_runtime_minutes_to_seconds(uint16_t cmd,
         return false;
     }
 
-    char text[16];
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    spm2k_text_t text;
+    if (!spm2k_extract_text(rx, true, 15U, &text))
     {
         return false;
     }
 
-    char *colon = strchr(text, ':');
-    if (colon == NULL)
+    // Minutes are the part before the ':'.
+    uint16_t colon = 0U;
+    while ((colon < text.len) && (spm2k_text_char(&text, colon) != ':'))
+    {
+        colon++;
+    }
+    if (colon == text.len)
     {
         return false;
     }
-    *colon = '\0';
+    text.len = colon;
 
     int32_t minutes = 0;
-    if (!spm2k_parse_scaled_int(text, 1, 0, (INT32_MAX / 60), &minutes))
+    if (!spm2k_parse_scaled_int(&text, 1, 0, (INT32_MAX / 60), &minutes))
     {
         return false;
     }
@@ -534,10 +614,7 @@ bool spm2k_process_runtime_minutes_to_seconds(uint16_t cmd,
     return true;
 }
 
-bool spm2k_process_temperature_c_to_kelvin(uint16_t cmd,
-                                           const uint8_t *rx,
-                                           uint16_t rx_len,
-                                           void *out_value)
+bool spm2k_process_temperature_c_to_kelvin(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -546,10 +623,10 @@ bool spm2k_process_temperature_c_to_kelvin(uint16_t cmd,
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t celsius_x10 = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)) ||
-        !spm2k_parse_scaled_int(text, 10, -2731, 5000, &celsius_x10))
+    if (!spm2k_extract_text(rx, true, 15U, &text) ||
+        !spm2k_parse_scaled_int(&text, 10, -2731, 5000, &celsius_x10))
     {
         return false;
     }
@@ -568,46 +645,49 @@ bool spm2k_process_temperature_c_to_kelvin(uint16_t cmd,
     return true;
 }
 
-bool spm2k_process_remaining_capacity(uint16_t cmd,
-                                      const uint8_t *rx,
-                                      uint16_t rx_len,
-                                      void *out_value)
+bool spm2k_process_remaining_capacity(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
-    if (out_value == NULL)
+    ups_telemetry_t *const t = (ups_telemetry_t *)out_value;
+    if (t == NULL)
     {
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t capacity_x10 = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)) ||
-        !spm2k_parse_scaled_int(text, 10, 0, 1000, &capacity_x10))
+    if (!spm2k_extract_text(rx, true, 15U, &text) ||
+        !spm2k_parse_scaled_int(&text, 10, 0, 1000, &capacity_x10))
     {
         return false;
     }
 
     uint8_t const capacity_percent = (uint8_t)(capacity_x10 / 10);
-    *(uint8_t *)out_value = capacity_percent;
+    t->battery.remaining_capacity = capacity_percent;
 
-    g_power_summary_present_status.fully_charged = (capacity_percent >= 100U);
+    t->present_status.fully_charged = (capacity_percent >= 100U);
     return true;
 }
 
-bool spm2k_process_status_flags(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_status_flags(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
-    (void)out_value;
 
-    char text[8];
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    ups_telemetry_t *const t = (ups_telemetry_t *)out_value;
+    if (t == NULL)
+    {
+        return false;
+    }
+
+    spm2k_text_t text;
+    if (!spm2k_extract_text(rx, true, 7U, &text))
     {
         return false;
     }
 
     uint8_t flags = 0U;
-    if (!spm2k_parse_hex_byte(text, &flags))
+    if (!spm2k_parse_hex_byte(&text, &flags))
     {
         return false;
     }
@@ -618,28 +698,28 @@ bool spm2k_process_status_flags(uint16_t cmd, const uint8_t *rx, uint16_t rx_len
     bool const battery_low = ((flags & (1U << 6)) != 0U);
     bool const replace_battery = ((flags & (1U << 7)) != 0U);
 
-    g_power_summary_present_status.ac_present = on_line && !on_battery;
-    g_power_summary_present_status.charging = on_line && !on_battery && (g_battery.remaining_capacity < 100U);
-    g_power_summary_present_status.discharging = on_battery;
-    g_power_summary_present_status.overload = overload;
-    g_power_summary_present_status.below_remaining_capacity_limit = battery_low;
-    g_power_summary_present_status.shutdown_imminent = battery_low;
-    g_power_summary_present_status.need_replacement = replace_battery;
-    g_power_summary_present_status.battery_present = true;
+    t->present_status.ac_present = on_line && !on_battery;
+    t->present_status.charging = on_line && !on_battery && (t->battery.remaining_capacity < 100U);
+    t->present_status.discharging = on_battery;
+    t->present_status.overload = overload;
+    t->present_status.below_remaining_capacity_limit = battery_low;
+    t->present_status.shutdown_imminent = battery_low;
+    t->present_status.need_replacement = replace_battery;
+    t->present_status.battery_present = true;
 
     return true;
 }
 
-bool spm2k_process_ac_present(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_ac_present(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
-    if ((out_value == NULL) || (rx == NULL) || (rx_len != 2U))
+    if ((out_value == NULL) || (rx == NULL) || (uart_engine_span_len(rx) != 2U))
     {
         return false;
     }
 
-    char text[3] = {(char)rx[0], (char)rx[1], '\0'};
+    char const text[2] = {(char)uart_engine_span_at(rx, 0U), (char)uart_engine_span_at(rx, 1U)};
     bool is_ff = ((text[0] == 'F') || (text[0] == 'f')) && ((text[1] == 'F') || (text[1] == 'f'));
     bool is_00 = (text[0] == '0') && (text[1] == '0');
 
@@ -652,44 +732,45 @@ bool spm2k_process_ac_present(uint16_t cmd, const uint8_t *rx, uint16_t rx_len,
     return true;
 }
 
-bool spm2k_process_bat_current(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_bat_current(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
-    if (out_value == NULL)
+    ups_telemetry_t *const t = (ups_telemetry_t *)out_value;
+    if (t == NULL)
     {
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t parsed = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)))
+    if (!spm2k_extract_text(rx, true, 15U, &text))
     {
         return false;
     }
 
-    if (!spm2k_parse_scaled_int(text, 100, INT16_MIN, INT16_MAX, &parsed))
+    if (!spm2k_parse_scaled_int(&text, 100, INT16_MIN, INT16_MAX, &parsed))
     {
         return false;
     }
 
-    *(int16_t *)out_value = (int16_t)parsed;
+    t->battery.battery_current = (int16_t)parsed;
 
     if (parsed < 0)
     {
-        g_power_summary_present_status.charging = false;
-        g_power_summary_present_status.discharging = true;
+        t->present_status.charging = false;
+        t->present_status.discharging = true;
     }
     else if (parsed > 0)
     {
-        g_power_summary_present_status.charging = true;
-        g_power_summary_present_status.discharging = false;
+        t->present_status.charging = true;
+        t->present_status.discharging = false;
     }
 
     return true;
 }
 
-bool spm2k_process_ac_current(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool spm2k_process_ac_current(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
     (void)cmd;
 
@@ -698,10 +779,10 @@ bool spm2k_process_ac_current(uint16_t cmd, const uint8_t *rx, uint16_t rx_len,
         return false;
     }
 
-    char text[16];
+    spm2k_text_t text;
     int32_t parsed = 0;
-    if (!spm2k_extract_text(rx, rx_len, true, text, sizeof(text)) ||
-        !spm2k_parse_scaled_int(text, 100, INT16_MIN, INT16_MAX, &parsed))
+    if (!spm2k_extract_text(rx, true, 15U, &text) ||
+        !spm2k_parse_scaled_int(&text, 100, INT16_MIN, INT16_MAX, &parsed))
     {
         return false;
     }
@@ -709,3 +790,50 @@ bool spm2k_process_ac_current(uint16_t cmd, const uint8_t *rx, uint16_t rx_len,
     *(int16_t *)out_value = (int16_t)parsed;
     return true;
 }
+
+bool spm2k_process_alert_byte(uint8_t byte, bool in_response, void *ctx)
+{
+    ups_telemetry_t *const t = (ups_telemetry_t *)ctx;
+    if (t == NULL)
+    {
+        return false;
+    }
+
+    switch (byte)
+    {
+    case '!': // line fail, running on battery
+        t->present_status.ac_present = false;
+        t->present_status.charging = false;
+        t->present_status.discharging = true;
+        return true;
+    case '$': // back on line
+        t->present_status.ac_present = true;
+        t->present_status.discharging = false;
+        return true;
+    case '%': // battery low
+        t->present_status.below_remaining_capacity_limit = true;
+        t->present_status.shutdown_imminent = true;
+        return true;
+    case '+': // battery back above low limit
+        if (in_response)
+        {
+            return false;
+        }
+        t->present_status.below_remaining_capacity_limit = false;
+        t->present_status.shutdown_imminent = false;
+        return true;
+    case '*': // about to turn off
+        t->present_status.shutdown_imminent = true;
+        return true;
+    case '#': // replace battery
+        t->present_status.need_replacement = true;
+        return true;
+    case '?': // abnormal condition
+    case '=': // abnormal condition cleared
+    case '&': // check alarm register
+    case '|': // EEPROM variable changed
+        return true;
+    default:
+        return false;
+    }
+}
@@ -17,6 +17,10 @@ extern "C" {
 // - "dynamic" (telemetry values updated continuously).
 //
 // Each LUT item fully defines command bytes, response mode and parser callback.
+// Entries are bound to fields of the polled unit's ups_telemetry_t with
+// UART_ENGINE_OUT_FIELD(). Parsers that update several fields (rated info,
+// status flags, remaining capacity, battery current) take the whole block
+// (UART_ENGINE_OUT_TELEMETRY).
 
 // Lookup table: initialized/constant values.
 extern const uart_engine_request_t g_spm2k_constant_lut[];
@@ -25,6 +29,8 @@ extern const size_t g_spm2k_constant_lut_count;
 // Lookup table: dynamic/telemetry values.
 extern const uart_engine_request_t g_spm2k_dynamic_lut[];
 extern const size_t g_spm2k_dynamic_lut_count;
+// Refresh period of each dynamic LUT entry, for lut_sched.
+extern const uint32_t g_spm2k_dynamic_period_ms[];
 
 // Heartbeat definition for SPM2K sub-adapter.
 // Expected response must fully match g_spm2k_constant_heartbeat_expect_return.
@@ -32,28 +38,36 @@ extern const uart_engine_request_t g_spm2k_constant_heartbeat;
 extern const uint8_t g_spm2k_constant_heartbeat_expect_return[];
 extern const size_t g_spm2k_constant_heartbeat_expect_return_len;
 
-bool spm2k_process_string(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_rated_info(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_manufacturer_date(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_voltage(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_frequency(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_percent_load(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_runtime_minutes_to_seconds(uint16_t cmd,
-                                              const uint8_t *rx,
-                                              uint16_t rx_len,
-                                              void *out_value);
-bool spm2k_process_temperature_c_to_kelvin(uint16_t cmd,
-                                           const uint8_t *rx,
-                                           uint16_t rx_len,
-                                           void *out_value);
-bool spm2k_process_remaining_capacity(uint16_t cmd,
-                                      const uint8_t *rx,
-                                      uint16_t rx_len,
-                                      void *out_value);
-bool spm2k_process_status_flags(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_ac_present(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_bat_current(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
-bool spm2k_process_ac_current(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
+// Serial number query ('n'), read before the LUTs: the reply keys the
+// per-UPS command support cache.
+extern const uart_engine_request_t g_spm2k_serial_number;
+
+// Asynchronous alert characters (APC smart signalling: '!', '$', '%', '+',
+// '*', '#', '?', '=', '&', '|'). Updates the present status of ctx (the
+// unit's ups_telemetry_t) immediately and returns true if byte is an alert,
+// so the engine removes it from the stream.
+// Ahead of a reply '+' may be a number sign and is left as data; the refresh
+// queued after any other alert re-reads the battery state anyway. The engine
+// does not classify bytes once a reply has started.
+bool spm2k_process_alert_byte(uint8_t byte, bool in_response, void *ctx);
+
+// Requests to run right after an alert (see uart_engine_set_oob_handler()).
+extern const uart_engine_request_t g_spm2k_alert_refresh_lut[];
+extern const size_t g_spm2k_alert_refresh_lut_count;
+
+bool spm2k_process_string(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_rated_info(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_manufacturer_date(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_voltage(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_frequency(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_percent_load(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_runtime_minutes_to_seconds(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_temperature_c_to_kelvin(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_remaining_capacity(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_status_flags(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_ac_present(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_bat_current(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
+bool spm2k_process_ac_current(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
 
 #ifdef __cplusplus
 }
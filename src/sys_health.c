@@ -0,0 +1,267 @@
+#include "sys_health.h"
+
+#include "main.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include <string.h>
+
+#ifndef SYS_HEALTH_SAMPLE_PERIOD_MS
+#define SYS_HEALTH_SAMPLE_PERIOD_MS 5000U
+#endif
+
+#if (configUSE_TRACE_FACILITY == 1) && (configGENERATE_RUN_TIME_STATS == 1)
+#define SYS_HEALTH_HAVE_TASK_STATS 1
+#else
+#define SYS_HEALTH_HAVE_TASK_STATS 0
+#endif
+
+typedef enum
+{
+    SYS_HEALTH_PHASE_WAIT = 0,
+    SYS_HEALTH_PHASE_HEAP,
+    SYS_HEALTH_PHASE_TASKS,
+    SYS_HEALTH_PHASE_ROWS,
+    SYS_HEALTH_PHASE_PUBLISH,
+} sys_health_phase_t;
+
+static sys_health_phase_t s_phase = SYS_HEALTH_PHASE_WAIT;
+static uint32_t s_next_sample_ms = 0U;
+
+// Sample under construction (main loop only).
+static sys_health_sample_t s_work;
+// Last complete sample (shared with readers).
+static portMUX_TYPE s_published_lock = portMUX_INITIALIZER_UNLOCKED;
+static sys_health_sample_t s_published;
+
+#if (SYS_HEALTH_HAVE_TASK_STATS != 0)
+static const char *TAG = "sys_health";
+
+typedef struct
+{
+    TaskHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} sys_health_prev_t;
+
+static TaskStatus_t s_status[SYS_HEALTH_MAX_TASKS];
+static UBaseType_t s_status_count = 0U;
+static size_t s_row_idx = 0U;
+static configRUN_TIME_COUNTER_TYPE s_total_run_time = 0U;
+static configRUN_TIME_COUNTER_TYPE s_prev_total_run_time = 0U;
+static sys_health_prev_t s_prev[SYS_HEALTH_MAX_TASKS];
+static size_t s_prev_count = 0U;
+static sys_health_prev_t s_next_prev[SYS_HEALTH_MAX_TASKS];
+static bool s_have_baseline = false; // s_prev holds a sample to diff against
+static bool s_overflow_logged = false;
+
+static configRUN_TIME_COUNTER_TYPE sys_health_prev_run_time(TaskHandle_t handle)
+{
+    for (size_t i = 0U; i < s_prev_count; i++)
+    {
+        if (s_prev[i].handle == handle)
+        {
+            return s_prev[i].run_time;
+        }
+    }
+
+    return 0U;
+}
+
+static uint8_t sys_health_map_state(eTaskState state)
+{
+    switch (state)
+    {
+    case eRunning:
+        return SYS_HEALTH_TASK_RUNNING;
+    case eReady:
+        return SYS_HEALTH_TASK_RUNNABLE;
+    case eBlocked:
+    case eSuspended:
+        return SYS_HEALTH_TASK_NOT_RUNNABLE;
+    default:
+        return SYS_HEALTH_TASK_INVALID;
+    }
+}
+
+static uint8_t sys_health_percent(configRUN_TIME_COUNTER_TYPE part, configRUN_TIME_COUNTER_TYPE whole)
+{
+    if (whole == 0U)
+    {
+        return 0U;
+    }
+
+    uint64_t pct = ((uint64_t)part * 100U) / (uint64_t)whole;
+    if (pct > 100U)
+    {
+        pct = 100U;
+    }
+    return (uint8_t)pct;
+}
+
+// Fill one row of s_work from s_status[idx].
+static void sys_health_build_row(size_t idx)
+{
+    TaskStatus_t const *st = &s_status[idx];
+    sys_health_task_t *row = &s_work.tasks[idx];
+
+    (void)memset(row, 0, sizeof(*row));
+    if (st->pcTaskName != NULL)
+    {
+        (void)strncpy(row->name, st->pcTaskName, sizeof(row->name) - 1U);
+    }
+
+    configRUN_TIME_COUNTER_TYPE const run_time = st->ulRunTimeCounter;
+    configRUN_TIME_COUNTER_TYPE const delta_task = run_time - sys_health_prev_run_time(st->xHandle);
+    configRUN_TIME_COUNTER_TYPE const delta_total = s_total_run_time - s_prev_total_run_time;
+
+    // Run-time counter is driven by esp_timer, i.e. microseconds.
+    row->cpu_time_cs = (uint32_t)(run_time / 10000U);
+    row->cpu_percent = sys_health_percent(delta_task, delta_total);
+    row->stack_free_min_bytes = (uint32_t)st->usStackHighWaterMark;
+    row->state = sys_health_map_state(st->eCurrentState);
+
+    if ((st->pcTaskName != NULL) && (strncmp(st->pcTaskName, "IDLE", 4U) == 0))
+    {
+        uint8_t const idle = row->cpu_percent;
+        s_work.cpu_load_percent = (uint8_t)(100U - idle);
+    }
+
+    s_next_prev[idx].handle = st->xHandle;
+    s_next_prev[idx].run_time = run_time;
+}
+
+// Snapshot of every task into s_status; 0 if they do not all fit, as
+// uxTaskGetSystemState() then fills nothing.
+static UBaseType_t sys_health_read_tasks(void)
+{
+    UBaseType_t const tasks = uxTaskGetNumberOfTasks();
+    if (tasks > (UBaseType_t)SYS_HEALTH_MAX_TASKS)
+    {
+        if (!s_overflow_logged)
+        {
+            s_overflow_logged = true;
+            ESP_LOGW(TAG,
+                     "%u tasks, SYS_HEALTH_MAX_TASKS is %u: task table and CPU load left empty",
+                     (unsigned int)tasks,
+                     (unsigned int)SYS_HEALTH_MAX_TASKS);
+        }
+        return 0U;
+    }
+
+    return uxTaskGetSystemState(s_status, SYS_HEALTH_MAX_TASKS, &s_total_run_time);
+}
+#endif
+
+void sys_health_tick(void)
+{
+    uint32_t const now_ms = ups_tick_ms();
+
+    // One bounded step per call so sampling never stalls the UART engine.
+    switch (s_phase)
+    {
+    case SYS_HEALTH_PHASE_WAIT:
+        if ((int32_t)(now_ms - s_next_sample_ms) >= 0)
+        {
+            s_next_sample_ms = now_ms + SYS_HEALTH_SAMPLE_PERIOD_MS;
+            s_phase = SYS_HEALTH_PHASE_HEAP;
+        }
+        break;
+
+    case SYS_HEALTH_PHASE_HEAP:
+        s_work.heap_total_bytes = (uint32_t)heap_caps_get_total_size(MALLOC_CAP_INTERNAL);
+        s_work.heap_free_bytes = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        s_work.heap_min_free_bytes = (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+        s_work.heap_largest_free_block_bytes = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+        s_phase = SYS_HEALTH_PHASE_TASKS;
+        break;
+
+    case SYS_HEALTH_PHASE_TASKS:
+#if (SYS_HEALTH_HAVE_TASK_STATS != 0)
+        s_status_count = sys_health_read_tasks();
+        s_row_idx = 0U;
+        s_work.task_count = (uint8_t)s_status_count;
+        s_work.cpu_load_percent = 0U;
+        s_phase = SYS_HEALTH_PHASE_ROWS;
+#else
+        s_work.task_count = 0U;
+        s_work.cpu_load_percent = 0U;
+        s_phase = SYS_HEALTH_PHASE_PUBLISH;
+#endif
+        break;
+
+    case SYS_HEALTH_PHASE_ROWS:
+#if (SYS_HEALTH_HAVE_TASK_STATS != 0)
+        if (s_row_idx < (size_t)s_status_count)
+        {
+            sys_health_build_row(s_row_idx);
+            s_row_idx++;
+            break;
+        }
+
+        if (s_status_count == 0U)
+        {
+            // No task data: publish heap figures only, keep the old baseline.
+            s_phase = SYS_HEALTH_PHASE_PUBLISH;
+            break;
+        }
+
+        memcpy(s_prev, s_next_prev, sizeof(s_prev));
+        s_prev_count = (size_t)s_status_count;
+        s_prev_total_run_time = s_total_run_time;
+        if (!s_have_baseline)
+        {
+            // CPU shares of the first sample would be averages since boot:
+            // it only becomes the baseline.
+            s_have_baseline = true;
+            s_phase = SYS_HEALTH_PHASE_WAIT;
+            break;
+        }
+#endif
+        s_phase = SYS_HEALTH_PHASE_PUBLISH;
+        break;
+
+    case SYS_HEALTH_PHASE_PUBLISH:
+    default:
+        s_work.generation = s_published.generation + 1U;
+        if (s_work.generation == 0U)
+        {
+            s_work.generation = 1U;
+        }
+
+        portENTER_CRITICAL(&s_published_lock);
+        s_published = s_work;
+        portEXIT_CRITICAL(&s_published_lock);
+
+        s_phase = SYS_HEALTH_PHASE_WAIT;
+        break;
+    }
+}
+
+uint32_t sys_health_time_to_next_ms(uint32_t now_ms)
+{
+    if (s_phase != SYS_HEALTH_PHASE_WAIT)
+    {
+        return 0U;
+    }
+
+    int32_t const delta = (int32_t)(s_next_sample_ms - now_ms);
+    return (delta > 0) ? (uint32_t)delta : 0U;
+}
+
+bool sys_health_get(sys_health_sample_t *out)
+{
+    if (out == NULL)
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&s_published_lock);
+    *out = s_published;
+    portEXIT_CRITICAL(&s_published_lock);
+
+    return (out->generation != 0U);
+}
@@ -0,0 +1,70 @@
+#ifndef SYS_HEALTH_H_
+#define SYS_HEALTH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SYS_HEALTH_MAX_TASKS
+#define SYS_HEALTH_MAX_TASKS 16U
+#endif
+
+#ifndef SYS_HEALTH_TASK_NAME_LEN
+#define SYS_HEALTH_TASK_NAME_LEN 16U
+#endif
+
+// Device health sampler (heap, CPU load, per-task stack/CPU).
+//
+// - Call sys_health_tick() from the main loop. Sampling runs once per
+//   SYS_HEALTH_SAMPLE_PERIOD_MS and is split over several ticks.
+// - Readers (e.g. the SNMP task) copy the last published sample with
+//   sys_health_get(); they never trigger sampling themselves.
+// - The first sample at start-up only sets the CPU baseline, so the first
+//   publish is one period later. With more than SYS_HEALTH_MAX_TASKS tasks
+//   the task table and CPU load stay empty (logged once).
+
+typedef enum
+{
+    SYS_HEALTH_TASK_RUNNING = 1,
+    SYS_HEALTH_TASK_RUNNABLE = 2,
+    SYS_HEALTH_TASK_NOT_RUNNABLE = 3,
+    SYS_HEALTH_TASK_INVALID = 4,
+} sys_health_task_state_t;
+
+typedef struct
+{
+    char name[SYS_HEALTH_TASK_NAME_LEN];
+    uint32_t stack_free_min_bytes; // stack high-water mark (lowest free space seen)
+    uint32_t cpu_time_cs;          // cumulative CPU time, centi-seconds
+    uint8_t cpu_percent;           // share of CPU over the last sample period
+    uint8_t state;                 // sys_health_task_state_t
+} sys_health_task_t;
+
+typedef struct
+{
+    uint32_t generation; // 0 until the first complete sample is published
+    uint32_t heap_total_bytes;
+    uint32_t heap_free_bytes;
+    uint32_t heap_min_free_bytes;
+    uint32_t heap_largest_free_block_bytes;
+    uint8_t cpu_load_percent; // 100 - idle share over the last sample period
+    uint8_t task_count;
+    sys_health_task_t tasks[SYS_HEALTH_MAX_TASKS];
+} sys_health_sample_t;
+
+void sys_health_tick(void);
+
+// Milliseconds until sys_health_tick() has work again (0 while mid-sample).
+uint32_t sys_health_time_to_next_ms(uint32_t now_ms);
+
+// Copy the last published sample. Returns false if none is available yet.
+bool sys_health_get(sys_health_sample_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYS_HEALTH_H_
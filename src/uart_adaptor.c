@@ -1,18 +1,58 @@
+// ESP-IDF UART driver backend (see uart_backend.h).
+
 #include "main.h"
 
+#if (UPS_HOST_BUILD == 0)
+
+#include "driver/uart_vfs.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
+#include <fcntl.h>
+#include <stdio.h>
+
 static const char *TAG = "ups_uart";
 
-static SemaphoreHandle_t s_uart_lock;
-static bool s_uart_ready;
-static bool s_tx_inflight;
+#if (UPS_UNIT_COUNT > 1) && (configUSE_QUEUE_SETS != 1)
+#error "UPS_UNIT_COUNT > 1 needs FreeRTOS queue sets (configUSE_QUEUE_SETS)"
+#endif
+
+// One UART per UPS unit.
+typedef struct
+{
+    uart_port_t port;
+    int tx_gpio;
+    int rx_gpio;
+    SemaphoreHandle_t lock;
+    bool ready;
+    bool tx_inflight;
+    int select_fd;
+    QueueHandle_t event_queue;
+    ups_uart_event_stats_t event_stats;
+    bool pattern_enabled;
+} ups_uart_t;
+
+static ups_uart_t s_uarts[UPS_UNIT_COUNT] = {
+    [0] = {.port = UPS_UART_PORT, .tx_gpio = UPS_UART_TX_GPIO, .rx_gpio = UPS_UART_RX_GPIO, .select_fd = -1},
+#if (UPS_UNIT_COUNT > 1)
+    [1] = {.port = UPS_UNIT1_UART_PORT, .tx_gpio = UPS_UNIT1_UART_TX_GPIO, .rx_gpio = UPS_UNIT1_UART_RX_GPIO, .select_fd = -1},
+#endif
+#if (UPS_UNIT_COUNT > 2)
+    [2] = {.port = UPS_UNIT2_UART_PORT, .tx_gpio = UPS_UNIT2_UART_TX_GPIO, .rx_gpio = UPS_UNIT2_UART_RX_GPIO, .select_fd = -1},
+#endif
+};
+
+#if (UPS_UNIT_COUNT > 1)
+// Event queues of all units, so one task can block on every bus at once.
+static QueueSetHandle_t s_event_set;
+#endif
 
-static void ups_uart_init_if_needed(void)
+static void ups_uart_init_if_needed(ups_uart_t *u)
 {
-    if (s_uart_ready)
+    if (u->ready)
     {
         return;
     }
@@ -27,11 +67,11 @@ static void ups_uart_init_if_needed(void)
         .source_clk = UART_SCLK_XTAL,
     };
 
-    esp_err_t err = uart_driver_install(UPS_UART_PORT,
+    esp_err_t err = uart_driver_install(u->port,
                                         UPS_UART_BUFFER_SIZE,
                                         UPS_UART_BUFFER_SIZE,
-                                        0,
-                                        NULL,
+                                        UPS_UART_EVENT_QUEUE_LEN,
+                                        &u->event_queue,
                                         0);
     if (err != ESP_OK)
     {
@@ -39,16 +79,28 @@ static void ups_uart_init_if_needed(void)
         return;
     }
 
-    err = uart_param_config(UPS_UART_PORT, &config);
+#if (UPS_UNIT_COUNT > 1)
+    // Queue is still empty here, as xQueueAddToSet() requires.
+    if (s_event_set == NULL)
+    {
+        s_event_set = xQueueCreateSet((UBaseType_t)(UPS_UNIT_COUNT * UPS_UART_EVENT_QUEUE_LEN));
+    }
+    if ((s_event_set == NULL) || (xQueueAddToSet(u->event_queue, s_event_set) != pdPASS))
+    {
+        ESP_LOGE(TAG, "uart%u: adding event queue to the queue set failed", (unsigned int)u->port);
+    }
+#endif
+
+    err = uart_param_config(u->port, &config);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "uart_param_config failed: %s", esp_err_to_name(err));
         return;
     }
 
-    err = uart_set_pin(UPS_UART_PORT,
-                       UPS_UART_TX_GPIO,
-                       UPS_UART_RX_GPIO,
+    err = uart_set_pin(u->port,
+                       u->tx_gpio,
+                       u->rx_gpio,
                        UART_PIN_NO_CHANGE,
                        UART_PIN_NO_CHANGE);
     if (err != ESP_OK)
@@ -57,6 +109,30 @@ static void ups_uart_init_if_needed(void)
         return;
     }
 
+    err = uart_set_rx_timeout(u->port, UPS_UART_RX_TOUT_SYMBOLS);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "uart_set_rx_timeout failed: %s", esp_err_to_name(err));
+    }
+
+#if (UPS_UART_PATTERN_DETECT != 0)
+    // Single-character pattern, no idle guard: LF may arrive back-to-back
+    // with the payload.
+    err = uart_enable_pattern_det_baud_intr(u->port, (char)UPS_UART_PATTERN_CHAR, 1, 9, 0, 0);
+    if (err == ESP_OK)
+    {
+        err = uart_pattern_queue_reset(u->port, UPS_UART_PATTERN_QUEUE_LEN);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "pattern detect setup failed: %s (software terminator matching)", esp_err_to_name(err));
+    }
+    else
+    {
+        u->pattern_enabled = true;
+    }
+#endif
+
 #if (UPS_UART_TX_INVERT != 0) || (UPS_UART_RX_INVERT != 0)
     uint32_t inverse_mask = 0U;
 #if (UPS_UART_TX_INVERT != 0)
@@ -65,7 +141,7 @@ static void ups_uart_init_if_needed(void)
 #if (UPS_UART_RX_INVERT != 0)
     inverse_mask |= UART_SIGNAL_RXD_INV;
 #endif
-    err = uart_set_line_inverse(UPS_UART_PORT, inverse_mask);
+    err = uart_set_line_inverse(u->port, inverse_mask);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "uart_set_line_inverse failed: %s", esp_err_to_name(err));
@@ -73,67 +149,100 @@ static void ups_uart_init_if_needed(void)
     }
 #endif
 
-    s_uart_lock = xSemaphoreCreateMutex();
-    if (s_uart_lock == NULL)
+    u->lock = xSemaphoreCreateMutex();
+    if (u->lock == NULL)
     {
         ESP_LOGE(TAG, "xSemaphoreCreateMutex failed");
         return;
     }
 
     uint32_t real_baud = 0U;
-    (void)uart_get_baudrate(UPS_UART_PORT, &real_baud);
+    (void)uart_get_baudrate(u->port, &real_baud);
     ESP_LOGI(TAG,
              "ready: uart=%u tx=%d rx=%d baud=%lu",
-             (unsigned int)UPS_UART_PORT,
-             UPS_UART_TX_GPIO,
-             UPS_UART_RX_GPIO,
+             (unsigned int)u->port,
+             u->tx_gpio,
+             u->rx_gpio,
              (unsigned long)real_baud);
 
-    s_tx_inflight = false;
-    s_uart_ready = true;
+    u->tx_inflight = false;
+    u->ready = true;
+}
+
+// Drop buffered RX bytes together with their stale pattern positions.
+static void ups_uart_flush_rx(ups_uart_t *u)
+{
+    (void)uart_flush_input(u->port);
+    if (u->pattern_enabled)
+    {
+        (void)uart_pattern_queue_reset(u->port, UPS_UART_PATTERN_QUEUE_LEN);
+    }
+}
+
+// NULL for an unknown unit; the UART is installed on first use.
+static ups_uart_t *ups_uart_get(uint8_t unit)
+{
+    if (unit >= (uint8_t)UPS_UNIT_COUNT)
+    {
+        return NULL;
+    }
+
+    ups_uart_t *u = &s_uarts[unit];
+    ups_uart_init_if_needed(u);
+    return u->ready ? u : NULL;
 }
 
-uint32_t ups_tick_ms(void)
+uint32_t UART2_TickMs(void)
 {
     return (uint32_t)pdTICKS_TO_MS(xTaskGetTickCount());
 }
 
-void UART2_RxStartIT(void)
+uint32_t UART2_TickUs(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+void UART2_DelayUs(uint32_t us)
+{
+    esp_rom_delay_us(us);
+}
+
+void UART2_RxStartIT(uint8_t unit)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready)
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
     {
         return;
     }
 
-    (void)uart_flush_input(UPS_UART_PORT);
+    ups_uart_flush_rx(u);
 }
 
-bool UART2_TryLock(void)
+bool UART2_TryLock(uint8_t unit)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready || (s_uart_lock == NULL))
+    ups_uart_t *u = ups_uart_get(unit);
+    if ((u == NULL) || (u->lock == NULL))
     {
         return false;
     }
 
-    return (xSemaphoreTake(s_uart_lock, 0) == pdTRUE);
+    return (xSemaphoreTake(u->lock, 0) == pdTRUE);
 }
 
-void UART2_Unlock(void)
+void UART2_Unlock(uint8_t unit)
 {
-    if (s_uart_lock == NULL)
+    if ((unit >= (uint8_t)UPS_UNIT_COUNT) || (s_uarts[unit].lock == NULL))
     {
         return;
     }
 
-    (void)xSemaphoreGive(s_uart_lock);
+    (void)xSemaphoreGive(s_uarts[unit].lock);
 }
 
-esp_err_t UART2_SendBytes(const uint8_t *data, uint16_t len, uint32_t timeout_ms)
+esp_err_t UART2_SendBytes(uint8_t unit, const uint8_t *data, uint16_t len, uint32_t timeout_ms)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready)
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
     {
         return ESP_ERR_INVALID_STATE;
     }
@@ -143,7 +252,7 @@ esp_err_t UART2_SendBytes(const uint8_t *data, uint16_t len, uint32_t timeout_ms
         return ESP_OK;
     }
 
-    int const written = uart_write_bytes(UPS_UART_PORT, data, len);
+    int const written = uart_write_bytes(u->port, data, len);
     if (written != (int)len)
     {
         return ESP_FAIL;
@@ -155,19 +264,19 @@ esp_err_t UART2_SendBytes(const uint8_t *data, uint16_t len, uint32_t timeout_ms
         wait_ticks = 1;
     }
 
-    if (uart_wait_tx_done(UPS_UART_PORT, wait_ticks) != ESP_OK)
+    if (uart_wait_tx_done(u->port, wait_ticks) != ESP_OK)
     {
         return ESP_ERR_TIMEOUT;
     }
 
-    s_tx_inflight = false;
+    u->tx_inflight = false;
     return ESP_OK;
 }
 
-esp_err_t UART2_SendBytesDMA(const uint8_t *data, uint16_t len)
+esp_err_t UART2_SendBytesDMA(uint8_t unit, const uint8_t *data, uint16_t len)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready)
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
     {
         return ESP_ERR_INVALID_STATE;
     }
@@ -177,58 +286,62 @@ esp_err_t UART2_SendBytesDMA(const uint8_t *data, uint16_t len)
         return ESP_OK;
     }
 
-    int const written = uart_write_bytes(UPS_UART_PORT, data, len);
+    int const written = uart_write_bytes(u->port, data, len);
     if (written != (int)len)
     {
         ESP_LOGE(TAG,
-                 "uart_write_bytes short write: wrote=%d need=%u",
+                 "uart_write_bytes short write: uart=%u wrote=%d need=%u",
+                 (unsigned int)u->port,
                  written,
                  (unsigned int)len);
-        s_tx_inflight = false;
+        u->tx_inflight = false;
         return ESP_FAIL;
     }
 
-    s_tx_inflight = true;
+    u->tx_inflight = true;
     return ESP_OK;
 }
 
-bool UART2_TxDone(void)
+bool UART2_TxDone(uint8_t unit)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready)
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
     {
         return true;
     }
 
-    if (!s_tx_inflight)
+    if (!u->tx_inflight)
     {
         return true;
     }
 
-    if (uart_wait_tx_done(UPS_UART_PORT, 0) == ESP_OK)
+    if (uart_wait_tx_done(u->port, 0) == ESP_OK)
     {
-        s_tx_inflight = false;
+        u->tx_inflight = false;
         return true;
     }
 
     return false;
 }
 
-void UART2_TxDoneClear(void)
+void UART2_TxDoneClear(uint8_t unit)
 {
-    s_tx_inflight = false;
+    if (unit < (uint8_t)UPS_UNIT_COUNT)
+    {
+        s_uarts[unit].tx_inflight = false;
+    }
 }
 
-uint16_t UART2_Available(void)
+uint16_t UART2_Available(uint8_t unit)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready)
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
     {
         return 0U;
     }
 
     size_t buffered = 0U;
-    if (uart_get_buffered_data_len(UPS_UART_PORT, &buffered) != ESP_OK)
+    if (uart_get_buffered_data_len(u->port, &buffered) != ESP_OK)
     {
         return 0U;
     }
@@ -241,25 +354,25 @@ uint16_t UART2_Available(void)
     return (uint16_t)buffered;
 }
 
-int UART2_ReadByte(uint8_t *out)
+int UART2_ReadByte(uint8_t unit, uint8_t *out)
 {
     if (out == NULL)
     {
         return 0;
     }
 
-    return (UART2_Read(out, 1U) == 1U) ? 1 : 0;
+    return (UART2_Read(unit, out, 1U) == 1U) ? 1 : 0;
 }
 
-uint16_t UART2_Read(uint8_t *dst, uint16_t len)
+uint16_t UART2_Read(uint8_t unit, uint8_t *dst, uint16_t len)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready || (dst == NULL) || (len == 0U))
+    ups_uart_t *u = ups_uart_get(unit);
+    if ((u == NULL) || (dst == NULL) || (len == 0U))
     {
         return 0U;
     }
 
-    int const got = uart_read_bytes(UPS_UART_PORT, dst, len, 0);
+    int const got = uart_read_bytes(u->port, dst, len, 0);
     if (got <= 0)
     {
         return 0U;
@@ -268,18 +381,225 @@ uint16_t UART2_Read(uint8_t *dst, uint16_t len)
     return (uint16_t)got;
 }
 
-void UART2_DiscardBuffered(void)
+// Pending events describe bytes that were just flushed. A queue in a queue
+// set must only be read through the set, so there they are counted instead.
+static void ups_uart_drop_events(ups_uart_t *u)
 {
-    ups_uart_init_if_needed();
-    if (!s_uart_ready)
+#if (UPS_UNIT_COUNT > 1)
+    if (s_event_set != NULL)
     {
         return;
     }
+#endif
+    (void)xQueueReset(u->event_queue);
+}
 
-    (void)uart_flush_input(UPS_UART_PORT);
+static void ups_uart_handle_event(ups_uart_t *u, const uart_event_t *event)
+{
+    switch (event->type)
+    {
+    case UART_DATA:
+        u->event_stats.data++;
+        break;
+    case UART_FIFO_OVF:
+        // Bytes were lost; whatever is buffered is no longer a valid frame.
+        u->event_stats.fifo_overflow++;
+        ups_uart_flush_rx(u);
+        ups_uart_drop_events(u);
+        break;
+    case UART_BUFFER_FULL:
+        u->event_stats.buffer_full++;
+        ups_uart_flush_rx(u);
+        ups_uart_drop_events(u);
+        break;
+    case UART_BREAK:
+        u->event_stats.line_break++;
+        break;
+    case UART_FRAME_ERR:
+        u->event_stats.frame_error++;
+        break;
+    case UART_PARITY_ERR:
+        u->event_stats.parity_error++;
+        break;
+    case UART_PATTERN_DET:
+        // Position stays in the driver's pattern queue for UART2_PatternPopPos().
+        u->event_stats.pattern++;
+        break;
+    default:
+        break;
+    }
 }
 
-bool UART2_ReadExactTimeout(uint8_t *dst, uint16_t len, uint32_t timeout_ms)
+bool UART2_WaitEvent(uint32_t timeout_ms)
+{
+    bool all_ready = true;
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        if (ups_uart_get(unit) == NULL)
+        {
+            all_ready = false;
+        }
+    }
+
+#if (UPS_UNIT_COUNT > 1)
+    bool const can_wait = all_ready && (s_event_set != NULL);
+#else
+    bool const can_wait = all_ready && (s_uarts[0].event_queue != NULL);
+#endif
+    if (!can_wait)
+    {
+        if (timeout_ms > 0U)
+        {
+            TickType_t ticks = pdMS_TO_TICKS(timeout_ms);
+            vTaskDelay((ticks == 0) ? 1 : ticks);
+        }
+        return false;
+    }
+
+    TickType_t wait_ticks = 0;
+    if (timeout_ms == UINT32_MAX)
+    {
+        wait_ticks = portMAX_DELAY;
+    }
+    else if (timeout_ms > 0U)
+    {
+        wait_ticks = pdMS_TO_TICKS(timeout_ms);
+        if (wait_ticks == 0)
+        {
+            wait_ticks = 1;
+        }
+    }
+
+    uart_event_t event;
+#if (UPS_UNIT_COUNT > 1)
+    QueueSetMemberHandle_t member = xQueueSelectFromSet(s_event_set, wait_ticks);
+    if (member == NULL)
+    {
+        return false;
+    }
+
+    // One set entry per queued event: take exactly one event per select.
+    do
+    {
+        for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+        {
+            ups_uart_t *u = &s_uarts[unit];
+            if ((QueueSetMemberHandle_t)u->event_queue == member)
+            {
+                if (xQueueReceive(u->event_queue, &event, 0) == pdTRUE)
+                {
+                    ups_uart_handle_event(u, &event);
+                }
+                break;
+            }
+        }
+    } while ((member = xQueueSelectFromSet(s_event_set, 0)) != NULL);
+#else
+    ups_uart_t *u = &s_uarts[0];
+    if (xQueueReceive(u->event_queue, &event, wait_ticks) != pdTRUE)
+    {
+        return false;
+    }
+
+    ups_uart_handle_event(u, &event);
+    while (xQueueReceive(u->event_queue, &event, 0) == pdTRUE)
+    {
+        ups_uart_handle_event(u, &event);
+    }
+#endif
+
+    return true;
+}
+
+void UART2_Wake(uint8_t unit)
+{
+    if ((unit >= (uint8_t)UPS_UNIT_COUNT) || !s_uarts[unit].ready || (s_uarts[unit].event_queue == NULL))
+    {
+        return;
+    }
+
+    // Not a driver event type: ups_uart_handle_event() ignores it.
+    uart_event_t const wake = {
+        .type = UART_EVENT_MAX,
+        .size = 0U,
+    };
+    if (xPortInIsrContext())
+    {
+        BaseType_t higher_prio_woken = pdFALSE;
+        (void)xQueueSendFromISR(s_uarts[unit].event_queue, &wake, &higher_prio_woken);
+        if (higher_prio_woken == pdTRUE)
+        {
+            portYIELD_FROM_ISR(higher_prio_woken);
+        }
+        return;
+    }
+    (void)xQueueSend(s_uarts[unit].event_queue, &wake, 0);
+}
+
+void UART2_GetEventStats(uint8_t unit, ups_uart_event_stats_t *out)
+{
+    if ((out != NULL) && (unit < (uint8_t)UPS_UNIT_COUNT))
+    {
+        *out = s_uarts[unit].event_stats;
+    }
+}
+
+int UART2_PatternPopPos(uint8_t unit)
+{
+    if ((unit >= (uint8_t)UPS_UNIT_COUNT) || !s_uarts[unit].ready || !s_uarts[unit].pattern_enabled)
+    {
+        return -1;
+    }
+
+    return uart_pattern_pop_pos(s_uarts[unit].port);
+}
+
+bool UART2_PatternEnabled(uint8_t unit)
+{
+    ups_uart_t const *u = ups_uart_get(unit);
+    return (u != NULL) && u->pattern_enabled;
+}
+
+int UART2_SelectFd(uint8_t unit)
+{
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
+    {
+        return -1;
+    }
+
+    if (u->select_fd >= 0)
+    {
+        return u->select_fd;
+    }
+
+    // Only used for select(); data is still read through the driver API.
+    uart_vfs_dev_register();
+    uart_vfs_dev_use_driver(u->port);
+
+    char path[16];
+    (void)snprintf(path, sizeof(path), "/dev/uart/%u", (unsigned int)u->port);
+    u->select_fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (u->select_fd < 0)
+    {
+        ESP_LOGE(TAG, "open %s for select failed", path);
+    }
+
+    return u->select_fd;
+}
+
+void UART2_DiscardBuffered(uint8_t unit)
+{
+    ups_uart_t *u = ups_uart_get(unit);
+    if (u == NULL)
+    {
+        return;
+    }
+
+    ups_uart_flush_rx(u);
+}
+
+bool UART2_ReadExactTimeout(uint8_t unit, uint8_t *dst, uint16_t len, uint32_t timeout_ms)
 {
     if ((dst == NULL) || (len == 0U))
     {
@@ -291,7 +611,7 @@ bool UART2_ReadExactTimeout(uint8_t *dst, uint16_t len, uint32_t timeout_ms)
 
     while (got < len)
     {
-        got += UART2_Read(&dst[got], (uint16_t)(len - got));
+        got += UART2_Read(unit, &dst[got], (uint16_t)(len - got));
         if (got >= len)
         {
             return true;
@@ -307,3 +627,5 @@ bool UART2_ReadExactTimeout(uint8_t *dst, uint16_t len, uint32_t timeout_ms)
 
     return true;
 }
+
+#endif // UPS_HOST_BUILD == 0
@@ -0,0 +1,100 @@
+#ifndef UART_BACKEND_H_
+#define UART_BACKEND_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// UART backend: the byte transport and tick source under the request engine.
+// unit selects the UPS unit (0..UPS_UNIT_COUNT-1); each unit has its own
+// port, lock and RX buffer.
+//
+// Exactly one backend is linked, so the engine calls it directly:
+// - uart_adaptor.c      ESP-IDF UART driver (firmware build)
+// - uart_backend_pty.c  POSIX termios device or pseudo-terminal
+//                       (UPS_HOST_BUILD != 0, see tools/ups_sim)
+// A backend that has no pattern detection, event queue or select fd returns
+// false / -1 from those calls; the engine then falls back to polling.
+
+// Build for a POSIX host instead of ESP-IDF.
+#ifndef UPS_HOST_BUILD
+#define UPS_HOST_BUILD 0
+#endif
+
+// Tick source: monotonic milliseconds, wrapping at 2^32. Read it through
+// ups_tick_ms() (ups_clock.h), which a test may redirect to a virtual clock.
+uint32_t UART2_TickMs(void);
+// Microsecond clock (wrapping at 2^32) and a busy-wait on it, for gaps
+// shorter than the tick; the wait blocks the calling task, keep it short.
+uint32_t UART2_TickUs(void);
+void UART2_DelayUs(uint32_t us);
+
+// Lock: one transaction at a time per unit. Non-blocking.
+bool UART2_TryLock(uint8_t unit);
+void UART2_Unlock(uint8_t unit);
+
+// TX. SendBytesDMA() queues the bytes and returns; TxDone() reports when the
+// last one has left the wire. SendBytes() blocks until then.
+esp_err_t UART2_SendBytes(uint8_t unit, const uint8_t *data, uint16_t len, uint32_t timeout_ms);
+esp_err_t UART2_SendBytesDMA(uint8_t unit, const uint8_t *data, uint16_t len);
+bool UART2_TxDone(uint8_t unit);
+void UART2_TxDoneClear(uint8_t unit);
+
+// RX. All reads are non-blocking except ReadExactTimeout().
+void UART2_RxStartIT(uint8_t unit);
+uint16_t UART2_Available(uint8_t unit);
+int UART2_ReadByte(uint8_t unit, uint8_t *out);
+uint16_t UART2_Read(uint8_t unit, uint8_t *dst, uint16_t len);
+void UART2_DiscardBuffered(uint8_t unit);
+bool UART2_ReadExactTimeout(uint8_t unit, uint8_t *dst, uint16_t len, uint32_t timeout_ms);
+
+// Block until a UART event (RX data, overflow, wake) arrives on any unit or
+// timeout_ms elapses. Overflow/framing events are handled and counted here.
+// Pass 0 to only drain pending events. Returns true if any event was received.
+bool UART2_WaitEvent(uint32_t timeout_ms);
+// Wake a task blocked in UART2_WaitEvent() (e.g. work submitted from another
+// task or an ISR). Safe to call from any task or ISR.
+void UART2_Wake(uint8_t unit);
+
+typedef struct
+{
+    uint32_t data;
+    uint32_t fifo_overflow;
+    uint32_t buffer_full;
+    uint32_t line_break;
+    uint32_t frame_error;
+    uint32_t parity_error;
+    uint32_t pattern;
+} ups_uart_event_stats_t;
+
+void UART2_GetEventStats(uint8_t unit, ups_uart_event_stats_t *out);
+
+// Offset of the next detected UPS_UART_PATTERN_CHAR in the RX buffer, relative
+// to the current read position, consumed from the pattern queue. Returns -1
+// if none is pending or pattern detection is disabled.
+int UART2_PatternPopPos(uint8_t unit);
+bool UART2_PatternEnabled(uint8_t unit);
+
+// File descriptor for select() on RX readiness (reactor build), -1 on error.
+int UART2_SelectFd(uint8_t unit);
+
+#if (UPS_HOST_BUILD != 0)
+// pty backend: attach unit to an existing serial device or pty (raw 8N1 at
+// UPS_UART_BAUDRATE). Returns false if it cannot be opened.
+bool uart_backend_pty_open(uint8_t unit, const char *path);
+// pty backend: create a pseudo-terminal, attach unit to its slave side and
+// return the master fd for a simulated UPS (-1 on error). The slave's path is
+// copied to name when name is not NULL.
+int uart_backend_pty_create(uint8_t unit, char *name, uint32_t name_cap);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UART_BACKEND_H_
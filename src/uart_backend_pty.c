@@ -0,0 +1,579 @@
+// POSIX termios backend (see uart_backend.h): runs the engine and LUTs on a
+// host against a serial device or a pseudo-terminal with a simulated UPS.
+
+#include "main.h"
+
+#if (UPS_HOST_BUILD != 0)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest WaitEvent() sleep while a unit has unread bytes: poll() cannot wait
+// for more data on a descriptor that is already readable.
+#ifndef UPS_PTY_STALE_POLL_MS
+#define UPS_PTY_STALE_POLL_MS 10
+#endif
+
+// Wire time of one 8N1 character.
+#define UPS_PTY_CHAR_US (10000000ULL / (uint64_t)UPS_UART_BAUDRATE)
+
+typedef struct
+{
+    int fd;
+    bool ready;
+    pthread_mutex_t lock;
+    bool tx_inflight;
+    uint64_t tx_done_us; // when the last queued byte has left the wire
+    uint32_t rx_seen;    // bytes buffered at the last WaitEvent() return
+    ups_uart_event_stats_t event_stats;
+} ups_pty_t;
+
+static ups_pty_t s_ptys[UPS_UNIT_COUNT];
+static int s_wake_pipe[2] = {-1, -1};
+static pthread_once_t s_init_once = PTHREAD_ONCE_INIT;
+
+static void ups_pty_init_once(void)
+{
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        s_ptys[unit].fd = -1;
+        (void)pthread_mutex_init(&s_ptys[unit].lock, NULL);
+    }
+
+    if (pipe(s_wake_pipe) == 0)
+    {
+        (void)fcntl(s_wake_pipe[0], F_SETFL, O_NONBLOCK);
+        (void)fcntl(s_wake_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+static uint64_t ups_pty_now_us(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL);
+}
+
+static void ups_pty_sleep_ms(uint32_t ms)
+{
+    struct timespec const ts = {
+        .tv_sec = (time_t)(ms / 1000U),
+        .tv_nsec = (long)(ms % 1000U) * 1000000L,
+    };
+    (void)nanosleep(&ts, NULL);
+}
+
+static speed_t ups_pty_speed(uint32_t baud)
+{
+    switch (baud)
+    {
+    case 1200U:
+        return B1200;
+    case 4800U:
+        return B4800;
+    case 9600U:
+        return B9600;
+    case 19200U:
+        return B19200;
+    case 38400U:
+        return B38400;
+    case 115200U:
+        return B115200;
+    case 2400U:
+    default:
+        return B2400;
+    }
+}
+
+// Raw 8N1, non-blocking reads.
+static bool ups_pty_configure(int fd)
+{
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= (tcflag_t)(CLOCAL | CREAD);
+    tio.c_cflag &= ~(tcflag_t)(CSTOPB | PARENB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    (void)cfsetispeed(&tio, ups_pty_speed((uint32_t)UPS_UART_BAUDRATE));
+    (void)cfsetospeed(&tio, ups_pty_speed((uint32_t)UPS_UART_BAUDRATE));
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        return false;
+    }
+
+    (void)tcflush(fd, TCIOFLUSH);
+    return true;
+}
+
+static bool ups_pty_attach(uint8_t unit, int fd)
+{
+    ups_pty_t *u = &s_ptys[unit];
+    if (!ups_pty_configure(fd))
+    {
+        fprintf(stderr, "ups_uart: unit %u: termios setup failed: %s\n", (unsigned int)unit, strerror(errno));
+        (void)close(fd);
+        return false;
+    }
+
+    if (u->fd >= 0)
+    {
+        (void)close(u->fd);
+    }
+    u->fd = fd;
+    u->tx_inflight = false;
+    u->rx_seen = 0U;
+    u->ready = true;
+    return true;
+}
+
+// NULL for an unknown or unattached unit.
+static ups_pty_t *ups_pty_get(uint8_t unit)
+{
+    (void)pthread_once(&s_init_once, ups_pty_init_once);
+    if ((unit >= (uint8_t)UPS_UNIT_COUNT) || !s_ptys[unit].ready)
+    {
+        return NULL;
+    }
+
+    return &s_ptys[unit];
+}
+
+static uint32_t ups_pty_buffered(const ups_pty_t *u)
+{
+    int n = 0;
+    if (ioctl(u->fd, FIONREAD, &n) != 0)
+    {
+        return 0U;
+    }
+    return (n > 0) ? (uint32_t)n : 0U;
+}
+
+bool uart_backend_pty_open(uint8_t unit, const char *path)
+{
+    (void)pthread_once(&s_init_once, ups_pty_init_once);
+    if ((unit >= (uint8_t)UPS_UNIT_COUNT) || (path == NULL))
+    {
+        return false;
+    }
+
+    int const fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        fprintf(stderr, "ups_uart: open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    return ups_pty_attach(unit, fd);
+}
+
+int uart_backend_pty_create(uint8_t unit, char *name, uint32_t name_cap)
+{
+    (void)pthread_once(&s_init_once, ups_pty_init_once);
+    if (unit >= (uint8_t)UPS_UNIT_COUNT)
+    {
+        return -1;
+    }
+
+    int const master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0)
+    {
+        fprintf(stderr, "ups_uart: posix_openpt failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char const *slave_name = NULL;
+    if ((grantpt(master) != 0) || (unlockpt(master) != 0) || ((slave_name = ptsname(master)) == NULL))
+    {
+        fprintf(stderr, "ups_uart: pty setup failed: %s\n", strerror(errno));
+        (void)close(master);
+        return -1;
+    }
+
+    if ((name != NULL) && (name_cap > 0U))
+    {
+        (void)snprintf(name, name_cap, "%s", slave_name);
+    }
+
+    if (!uart_backend_pty_open(unit, slave_name))
+    {
+        (void)close(master);
+        return -1;
+    }
+
+    return master;
+}
+
+uint32_t UART2_TickMs(void)
+{
+    return (uint32_t)(ups_pty_now_us() / 1000ULL);
+}
+
+uint32_t UART2_TickUs(void)
+{
+    return (uint32_t)ups_pty_now_us();
+}
+
+void UART2_DelayUs(uint32_t us)
+{
+    uint64_t const until_us = ups_pty_now_us() + us;
+    while (ups_pty_now_us() < until_us)
+    {
+    }
+}
+
+void UART2_RxStartIT(uint8_t unit)
+{
+    UART2_DiscardBuffered(unit);
+}
+
+bool UART2_TryLock(uint8_t unit)
+{
+    ups_pty_t *u = ups_pty_get(unit);
+    if (u == NULL)
+    {
+        return false;
+    }
+
+    return (pthread_mutex_trylock(&u->lock) == 0);
+}
+
+void UART2_Unlock(uint8_t unit)
+{
+    if (unit >= (uint8_t)UPS_UNIT_COUNT)
+    {
+        return;
+    }
+
+    (void)pthread_mutex_unlock(&s_ptys[unit].lock);
+}
+
+esp_err_t UART2_SendBytes(uint8_t unit, const uint8_t *data, uint16_t len, uint32_t timeout_ms)
+{
+    esp_err_t const err = UART2_SendBytesDMA(unit, data, len);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    uint32_t const start_ms = ups_tick_ms();
+    while (!UART2_TxDone(unit))
+    {
+        if ((ups_tick_ms() - start_ms) >= timeout_ms)
+        {
+            return ESP_ERR_TIMEOUT;
+        }
+        ups_pty_sleep_ms(1U);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t UART2_SendBytesDMA(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    ups_pty_t *u = ups_pty_get(unit);
+    if (u == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if ((data == NULL) || (len == 0U))
+    {
+        return ESP_OK;
+    }
+
+    ssize_t const written = write(u->fd, data, len);
+    if (written != (ssize_t)len)
+    {
+        fprintf(stderr,
+                "ups_uart: unit %u: short write %ld of %u\n",
+                (unsigned int)unit,
+                (long)written,
+                (unsigned int)len);
+        u->tx_inflight = false;
+        return ESP_FAIL;
+    }
+
+    // A pty drains instantly; hold TxDone() for the bytes' wire time so the
+    // engine sees the same TX timing as on a real UART.
+    uint64_t const now_us = ups_pty_now_us();
+    uint64_t const start_us = (u->tx_inflight && (u->tx_done_us > now_us)) ? u->tx_done_us : now_us;
+    u->tx_done_us = start_us + ((uint64_t)len * UPS_PTY_CHAR_US);
+    u->tx_inflight = true;
+    return ESP_OK;
+}
+
+bool UART2_TxDone(uint8_t unit)
+{
+    ups_pty_t *u = ups_pty_get(unit);
+    if ((u == NULL) || !u->tx_inflight)
+    {
+        return true;
+    }
+
+    if (ups_pty_now_us() < u->tx_done_us)
+    {
+        return false;
+    }
+
+    // Serial devices: also wait for the driver's output queue to drain.
+    int queued = 0;
+    if ((ioctl(u->fd, TIOCOUTQ, &queued) == 0) && (queued > 0))
+    {
+        return false;
+    }
+
+    u->tx_inflight = false;
+    return true;
+}
+
+void UART2_TxDoneClear(uint8_t unit)
+{
+    if (unit < (uint8_t)UPS_UNIT_COUNT)
+    {
+        s_ptys[unit].tx_inflight = false;
+    }
+}
+
+uint16_t UART2_Available(uint8_t unit)
+{
+    ups_pty_t *u = ups_pty_get(unit);
+    if (u == NULL)
+    {
+        return 0U;
+    }
+
+    uint32_t const buffered = ups_pty_buffered(u);
+    return (buffered > UINT16_MAX) ? (uint16_t)UINT16_MAX : (uint16_t)buffered;
+}
+
+int UART2_ReadByte(uint8_t unit, uint8_t *out)
+{
+    if (out == NULL)
+    {
+        return 0;
+    }
+
+    return (UART2_Read(unit, out, 1U) == 1U) ? 1 : 0;
+}
+
+uint16_t UART2_Read(uint8_t unit, uint8_t *dst, uint16_t len)
+{
+    ups_pty_t *u = ups_pty_get(unit);
+    if ((u == NULL) || (dst == NULL) || (len == 0U))
+    {
+        return 0U;
+    }
+
+    ssize_t const got = read(u->fd, dst, len);
+    if (got <= 0)
+    {
+        return 0U;
+    }
+
+    u->rx_seen = ((uint32_t)got < u->rx_seen) ? (u->rx_seen - (uint32_t)got) : 0U;
+    return (uint16_t)got;
+}
+
+void UART2_DiscardBuffered(uint8_t unit)
+{
+    ups_pty_t *u = ups_pty_get(unit);
+    if (u == NULL)
+    {
+        return;
+    }
+
+    (void)tcflush(u->fd, TCIFLUSH);
+    u->rx_seen = 0U;
+}
+
+bool UART2_ReadExactTimeout(uint8_t unit, uint8_t *dst, uint16_t len, uint32_t timeout_ms)
+{
+    if ((dst == NULL) || (len == 0U))
+    {
+        return true;
+    }
+
+    uint32_t const start_ms = ups_tick_ms();
+    uint16_t got = 0U;
+
+    while (got < len)
+    {
+        got += UART2_Read(unit, &dst[got], (uint16_t)(len - got));
+        if (got >= len)
+        {
+            return true;
+        }
+
+        if ((ups_tick_ms() - start_ms) >= timeout_ms)
+        {
+            return false;
+        }
+
+        ups_pty_sleep_ms(1U);
+    }
+
+    return true;
+}
+
+// The peer closed the pty or the device went away: stop polling the unit.
+static void ups_pty_hangup(uint8_t unit, ups_pty_t *u)
+{
+    fprintf(stderr, "ups_uart: unit %u: device hung up\n", (unsigned int)unit);
+    u->event_stats.line_break++;
+    u->ready = false;
+    (void)close(u->fd);
+    u->fd = -1;
+}
+
+// Edge-triggered like the driver's event queue: only RX that arrived since
+// the previous call counts as an event.
+bool UART2_WaitEvent(uint32_t timeout_ms)
+{
+    (void)pthread_once(&s_init_once, ups_pty_init_once);
+
+    struct pollfd fds[UPS_UNIT_COUNT + 1U];
+    uint8_t fd_unit[UPS_UNIT_COUNT];
+    nfds_t nfds = 0U;
+    bool stale = false;
+    bool event = false;
+
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        ups_pty_t const *u = &s_ptys[unit];
+        if (!u->ready)
+        {
+            continue;
+        }
+
+        uint32_t const buffered = ups_pty_buffered(u);
+        if (buffered > u->rx_seen)
+        {
+            event = true;
+        }
+        else if (buffered > 0U)
+        {
+            stale = true;
+        }
+        else
+        {
+            fds[nfds].fd = u->fd;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            fd_unit[nfds] = unit;
+            nfds++;
+        }
+    }
+
+    nfds_t const unit_fds = nfds;
+    if (s_wake_pipe[0] >= 0)
+    {
+        fds[nfds].fd = s_wake_pipe[0];
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+
+    int wait_ms = -1;
+    if (event)
+    {
+        wait_ms = 0;
+    }
+    else if (timeout_ms != UINT32_MAX)
+    {
+        wait_ms = (timeout_ms > (uint32_t)INT32_MAX) ? INT32_MAX : (int)timeout_ms;
+    }
+    if (stale && ((wait_ms < 0) || (wait_ms > UPS_PTY_STALE_POLL_MS)))
+    {
+        wait_ms = UPS_PTY_STALE_POLL_MS;
+    }
+
+    if (poll(fds, nfds, wait_ms) > 0)
+    {
+        for (nfds_t i = 0U; i < unit_fds; i++)
+        {
+            if ((fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+            {
+                ups_pty_hangup(fd_unit[i], &s_ptys[fd_unit[i]]);
+            }
+        }
+
+        if ((nfds > unit_fds) && ((fds[unit_fds].revents & POLLIN) != 0))
+        {
+            uint8_t drain[16];
+            while (read(s_wake_pipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+            event = true;
+        }
+    }
+
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        ups_pty_t *u = &s_ptys[unit];
+        if (!u->ready)
+        {
+            continue;
+        }
+
+        uint32_t const buffered = ups_pty_buffered(u);
+        if (buffered > u->rx_seen)
+        {
+            u->event_stats.data++;
+            event = true;
+        }
+        u->rx_seen = buffered;
+    }
+
+    return event;
+}
+
+void UART2_Wake(uint8_t unit)
+{
+    (void)unit;
+    if (s_wake_pipe[1] >= 0)
+    {
+        uint8_t const token = 1U;
+        (void)write(s_wake_pipe[1], &token, 1U);
+    }
+}
+
+void UART2_GetEventStats(uint8_t unit, ups_uart_event_stats_t *out)
+{
+    if ((out != NULL) && (unit < (uint8_t)UPS_UNIT_COUNT))
+    {
+        *out = s_ptys[unit].event_stats;
+    }
+}
+
+int UART2_PatternPopPos(uint8_t unit)
+{
+    (void)unit;
+    return -1;
+}
+
+bool UART2_PatternEnabled(uint8_t unit)
+{
+    (void)unit;
+    return false;
+}
+
+int UART2_SelectFd(uint8_t unit)
+{
+    ups_pty_t const *u = ups_pty_get(unit);
+    return (u != NULL) ? u->fd : -1;
+}
+
+#endif // UPS_HOST_BUILD != 0
@@ -1,696 +1,2864 @@
 #include "uart_engine.h"
 
 #include "main.h"
+#include "uart_trace.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdatomic.h>
 #include <string.h>
 
+#ifndef UART_ENGINE_QUEUE_SIZE_CRITICAL
+#define UART_ENGINE_QUEUE_SIZE_CRITICAL 4U
+#endif
+
+#ifndef UART_ENGINE_QUEUE_SIZE_INTERACTIVE
+#define UART_ENGINE_QUEUE_SIZE_INTERACTIVE 8U
+#endif
+
 #ifndef UART_ENGINE_QUEUE_SIZE
 #define UART_ENGINE_QUEUE_SIZE 32U
 #endif
 
+// Slots for ad-hoc requests passed to uart_engine_enqueue(); LUT entries
+// queued with uart_engine_enqueue_static() do not use the pool.
+#ifndef UART_ENGINE_REQ_POOL_SIZE
+#define UART_ENGINE_REQ_POOL_SIZE 4U
+#endif
+
+// Transactions pending per unit; uart_engine_enqueue_transaction() copies the
+// steps into one of these slots of UART_ENGINE_MAX_TXN_STEPS requests.
+#ifndef UART_ENGINE_TXN_POOL_SIZE
+#define UART_ENGINE_TXN_POOL_SIZE 2U
+#endif
+
+// Wait after which a non-critical head is served ahead of the other
+// non-critical class.
+#ifndef UART_ENGINE_AGING_MS
+#define UART_ENGINE_AGING_MS 2000U
+#endif
+
 #ifndef UART_ENGINE_MAX_EXPECTED_LEN
 #define UART_ENGINE_MAX_EXPECTED_LEN 256U
 #endif
 
+// Per-unit RX ring holding received frames; a power of two, at least
+// UART_ENGINE_MAX_EXPECTED_LEN.
+#ifndef UART_ENGINE_RX_RING_SIZE
+#define UART_ENGINE_RX_RING_SIZE 512U
+#endif
+
+#if ((UART_ENGINE_RX_RING_SIZE & (UART_ENGINE_RX_RING_SIZE - 1U)) != 0U) || \
+    (UART_ENGINE_RX_RING_SIZE < UART_ENGINE_MAX_EXPECTED_LEN) || (UART_ENGINE_RX_RING_SIZE > 32768U)
+#error "UART_ENGINE_RX_RING_SIZE must be a power of two in [UART_ENGINE_MAX_EXPECTED_LEN, 32768]"
+#endif
+
 #ifndef UART_ENGINE_TX_TIMEOUT_MS
 #define UART_ENGINE_TX_TIMEOUT_MS 250U
 #endif
 
+// Retry cooldown after the first failed attempt; it doubles with every
+// further failed attempt of the job up to UART_ENGINE_RETRY_COOLDOWN_MAX_MS,
+// plus up to 50 % jitter so retries do not stay in step with a periodic
+// disturbance on the line.
 #ifndef UART_ENGINE_RETRY_COOLDOWN_MS
 #define UART_ENGINE_RETRY_COOLDOWN_MS 25U
 #endif
 
+#ifndef UART_ENGINE_RETRY_COOLDOWN_MAX_MS
+#define UART_ENGINE_RETRY_COOLDOWN_MAX_MS 400U
+#endif
+
+// Circuit breaker (see uart_engine.h): consecutive failed jobs that open it,
+// and the open period, doubled per failed probe, plus up to 25 % jitter.
+#ifndef UART_ENGINE_BREAKER_THRESHOLD
+#define UART_ENGINE_BREAKER_THRESHOLD 5U
+#endif
+
+#ifndef UART_ENGINE_BREAKER_BASE_MS
+#define UART_ENGINE_BREAKER_BASE_MS 30000U
+#endif
+
+#ifndef UART_ENGINE_BREAKER_MAX_MS
+#define UART_ENGINE_BREAKER_MAX_MS 600000U
+#endif
+
+// Consecutive failed jobs over all commands after which the link is taken to
+// be down (UPS off or unplugged) and failures are no longer held against the
+// individual commands.
+#ifndef UART_ENGINE_LINK_DOWN_FAILS
+#define UART_ENGINE_LINK_DOWN_FAILS 8U
+#endif
+
+// Period of the loop's timed wakeups (the FreeRTOS tick). A zero-gap
+// turnaround is slept through in whole ticks; only the rest is busy-waited.
+#ifndef UART_ENGINE_LOOP_TICK_US
+#define UART_ENGINE_LOOP_TICK_US (1000000U / (uint32_t)configTICK_RATE_HZ)
+#endif
+
 #ifndef UART_ENGINE_MAX_STEPS_PER_TICK
 #define UART_ENGINE_MAX_STEPS_PER_TICK 8U
 #endif
 
-typedef enum
-{
-    UART_ENGINE_STATE_IDLE = 0,
-    UART_ENGINE_STATE_TX_START,
-    UART_ENGINE_STATE_TX_WAIT,
-    UART_ENGINE_STATE_RX_WAIT,
-    UART_ENGINE_STATE_PROCESS,
-} uart_engine_state_t;
+// Adaptive RX timeouts: per command, a smoothed reply latency and its mean
+// deviation (Jacobson/Karels, as in TCP) give timeout = srtt + 4 * rttvar +
+// granularity, clamped to [UART_ENGINE_TIMEOUT_FLOOR_MS, req->timeout_ms].
+// req->timeout_ms stays the ceiling and is used until enough samples exist.
+#ifndef UART_ENGINE_ADAPTIVE_TIMEOUT
+#define UART_ENGINE_ADAPTIVE_TIMEOUT 1
+#endif
+
+#ifndef UART_ENGINE_TIMEOUT_FLOOR_MS
+#define UART_ENGINE_TIMEOUT_FLOOR_MS 100U
+#endif
 
+// Tick resolution of ups_tick_ms() plus scheduling slack.
+#ifndef UART_ENGINE_TIMEOUT_GRANULARITY_MS
+#define UART_ENGINE_TIMEOUT_GRANULARITY_MS 20U
+#endif
+
+#ifndef UART_ENGINE_RTT_MIN_SAMPLES
+#define UART_ENGINE_RTT_MIN_SAMPLES 4U
+#endif
+
+// Distinct commands tracked for timeouts and statistics.
+#ifndef UART_ENGINE_CMD_TABLE_SIZE
+#define UART_ENGINE_CMD_TABLE_SIZE 32U
+#endif
+
+// Rolling bus-busy window: UART_ENGINE_BUSY_SLOTS slots of
+// UART_ENGINE_BUSY_SLOT_MS each.
+#ifndef UART_ENGINE_BUSY_SLOT_MS
+#define UART_ENGINE_BUSY_SLOT_MS 1000U
+#endif
+
+#ifndef UART_ENGINE_BUSY_SLOTS
+#define UART_ENGINE_BUSY_SLOTS 10U
+#endif
+
+// Slots for uart_engine_submit() jobs, per unit.
+#ifndef UART_ENGINE_TRACKED_JOBS
+#define UART_ENGINE_TRACKED_JOBS 4U
+#endif
+
+// Entries of the per-unit post ring (uart_engine_post()); a power of two.
+#ifndef UART_ENGINE_POST_RING_SIZE
+#define UART_ENGINE_POST_RING_SIZE 16U
+#endif
+
+#if (UART_ENGINE_POST_RING_SIZE & (UART_ENGINE_POST_RING_SIZE - 1U)) != 0U
+#error "UART_ENGINE_POST_RING_SIZE must be a power of two"
+#endif
+
+#if (UART_ENGINE_TRACKED_JOBS > 16U) || (UPS_UNIT_COUNT > 16)
+#error "handle layout holds at most 16 tracked jobs and 16 units"
+#endif
+
+#if (configTASK_NOTIFICATION_ARRAY_ENTRIES <= UART_ENGINE_NOTIFY_INDEX)
+#error "UART_ENGINE_NOTIFY_INDEX needs more CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES"
+#endif
+
+// Queued job: a reference to the request, not a copy. req points at a const
+// LUT entry, the heartbeat config, or a slot in the unit's req_pool.
 typedef struct
 {
-    uart_engine_request_t req;
+    const uart_engine_request_t *req;
+    uint32_t enqueued_ms;
     uint8_t retries_left;
+    uint8_t prio;
+    uint8_t waiters; // 1 + requests merged into this job
     bool is_heartbeat;
+    bool in_txn;        // transaction step: retried in place, UART held throughout
+    uint8_t steps_left; // transaction steps after this one (req + 1 onwards)
+    uint8_t attempts_failed; // failed attempts so far, sets the retry cooldown
+    uint16_t id; // transcript job id, assigned at the first dispatch
+    uart_engine_done_fn done_fn; // uart_engine_enqueue_static_cb() completion, or NULL
+    void *done_ctx;
 } uart_engine_job_t;
 
-static uart_engine_job_t s_queue[UART_ENGINE_QUEUE_SIZE];
-static uint8_t s_q_head;
-static uint8_t s_q_tail;
-static uint8_t s_q_count;
+typedef struct
+{
+    uart_engine_job_t *slots;
+    uint8_t size;
+    uint8_t head;
+    uint8_t tail;
+    uint8_t count;
+} uart_engine_ring_t;
 
-static uart_engine_job_t s_active;
-static uart_engine_state_t s_state;
-static uint32_t s_state_start_ms;
-static uint32_t s_retry_not_before_ms;
+typedef struct
+{
+    uart_engine_cmd_stats_t stats; // cmd/cmd_bits key and counters
+    uint32_t ceiling_ms;           // req->timeout_ms at the last dispatch
+    uint8_t samples;               // saturates at 255
+    bool backoff;                  // last attempt timed out: use the ceiling until the next sample
+    uint32_t srtt_x8;              // smoothed latency, ms * 8
+    uint32_t rttvar_x4;            // mean deviation, ms * 4
+    uint32_t probe_at_ms;          // OPEN: when the next job becomes the probe
+    uint8_t trips;                 // failed probes since the breaker last closed
+} uart_engine_cmd_entry_t;
+
+// Tracking slot life cycle. FREE -> SUBMITTED is done by the submitting task,
+// SUBMITTED -> QUEUED -> PROCESSING -> COMPLETE by the engine task. A waiter
+// that gives up moves a queued or processing job to ABANDONED; the engine
+// frees it instead of sending it, calling process_fn again or retrying it, and
+// notifies the cancelling task if it is blocked on a running process_fn. All
+// changes hold s_tracked_lock.
+typedef enum
+{
+    TRACKED_FREE = 0,
+    TRACKED_SUBMITTED,
+    TRACKED_QUEUED,
+    TRACKED_PROCESSING,
+    TRACKED_COMPLETE,
+    TRACKED_ABANDONED,
+} uart_engine_tracked_state_t;
 
-static uint8_t s_rx_buf[UART_ENGINE_MAX_EXPECTED_LEN];
-static uint16_t s_rx_got;
-static uint8_t s_tx_buf[8U];
+typedef struct
+{
+    uart_engine_request_t req; // owned copy, queued by reference
+    uart_engine_handle_t handle;
+    uint8_t state;
+    uint8_t prio;
+    bool auto_release;
+    uart_engine_result_t result;
+    uart_engine_done_fn done_fn;
+    void *done_ctx;
+    TaskHandle_t waiter;
+} uart_engine_tracked_t;
+
+// Bounded MPSC ring (Vyukov): producers claim a position with a CAS on
+// enqueue_pos, fill the cell, then publish it by storing pos + 1 to its seq.
+// The engine task is the only consumer. A producer interrupted between claim
+// and publish holds back the cells behind it until it resumes.
+typedef struct
+{
+    atomic_uint seq;
+    const uart_engine_request_t *req;
+    uint8_t prio;
+} uart_engine_post_cell_t;
 
-static bool s_enabled;
+typedef struct
+{
+    uart_engine_post_cell_t cells[UART_ENGINE_POST_RING_SIZE];
+    atomic_uint enqueue_pos;
+    unsigned int dequeue_pos; // engine task only
+    atomic_uint rejected;     // posts refused because the ring was full
+} uart_engine_post_ring_t;
 
-static bool s_hb_enabled;
-static uart_engine_heartbeat_cfg_t s_hb_cfg;
-static uint32_t s_hb_next_due_ms;
-static uint8_t s_hb_consecutive_failures;
-static bool s_hb_queued_or_active;
+// Engine instance, one per UPS unit / UART.
+typedef struct
+{
+    uint8_t unit;
+
+    uart_engine_job_t queue_critical[UART_ENGINE_QUEUE_SIZE_CRITICAL];
+    uart_engine_job_t queue_interactive[UART_ENGINE_QUEUE_SIZE_INTERACTIVE];
+    uart_engine_job_t queue[UART_ENGINE_QUEUE_SIZE];
+    uart_engine_ring_t rings[UART_ENGINE_PRIO_COUNT];
+    uart_engine_class_stats_t class_stats[UART_ENGINE_PRIO_COUNT];
+
+    uart_engine_request_t req_pool[UART_ENGINE_REQ_POOL_SIZE];
+    bool req_pool_used[UART_ENGINE_REQ_POOL_SIZE];
+    uart_engine_request_t txn_pool[UART_ENGINE_TXN_POOL_SIZE][UART_ENGINE_MAX_TXN_STEPS];
+    bool txn_pool_used[UART_ENGINE_TXN_POOL_SIZE];
+    uint8_t q_count; // total over all classes
+
+    uart_engine_job_t active;
+    uart_engine_state_t state;
+    uint32_t state_start_ms;
+    uint32_t retry_not_before_ms;
+    bool retry_not_before_armed; // retry_not_before_ms is a pending deadline
+
+    uint32_t active_timeout_ms; // RX timeout of the active attempt
+
+    uint32_t tx_start_ms;       // TX start of the active attempt
+    uint32_t rx_wire_ms;        // zero-gap: command wire time inside RX_WAIT
+
+    // Turnaround: end of the last job (UART2_TickUs()) to the next TX; a
+    // sample when the next job was already waiting.
+    uint32_t turnaround_from_us;
+    bool turnaround_pending;
+    uint32_t turnarounds;
+    uint64_t turnaround_sum_us;
+    uint32_t turnaround_max_us;
+
+    uint32_t rng;              // xorshift32 state for retry and breaker jitter
+    uint8_t link_fail_streak;  // consecutive failed jobs over all commands
+
+    uart_engine_cmd_entry_t cmd_table[UART_ENGINE_CMD_TABLE_SIZE];
+    uint8_t cmd_count;
+    uart_engine_cmd_entry_t cmd_other;   // commands beyond the table (counters only)
+    uart_engine_cmd_entry_t *active_cmd;
+
+    uint32_t state_ms[UART_ENGINE_STATE_COUNT];
+    uint32_t acct_ms;
+    uint32_t busy_slot_ms[UART_ENGINE_BUSY_SLOTS];
+    uint32_t busy_slot_start_ms;
+    uint8_t busy_slot;
+    uint8_t busy_slots_filled;
+
+    // Received bytes are written once into rx_ring and handed to process_fn
+    // as a span. Indices are free-running; mask with the ring size.
+    uint8_t rx_ring[UART_ENGINE_RX_RING_SIZE];
+    uint16_t rx_head;        // next write position
+    uint16_t rx_frame_start; // first byte of the active frame
+    uint16_t rx_got;         // bytes of the active frame received so far
+    uint16_t rx_frame_len;   // set once the terminator is found (ending mode)
+    uint16_t rx_scanned;     // frame bytes already searched for the terminator
+    bool rx_use_pattern;
+    uint8_t tx_buf[8U];
+    const uint8_t *tx_data; // command bytes of the active attempt (tx_buf or req->tx_bytes)
+    uint16_t tx_len;
+    uint16_t tx_sent;       // bytes handed to the UART so far
+    uint16_t last_job_id;
+
+    bool enabled;
+
+    uart_engine_oob_fn oob_fn;
+    void *oob_ctx;
+    const uart_engine_request_t *oob_refresh_lut;
+    size_t oob_refresh_count;
+    size_t oob_refresh_idx;
+    bool oob_refresh_pending;
+    uint32_t oob_bytes;
+
+    bool hb_enabled;
+    uart_engine_heartbeat_cfg_t hb_cfg;
+    uint32_t hb_next_due_ms;
+    uint8_t hb_consecutive_failures;
+    bool hb_queued_or_active;
+    uint32_t stats_heartbeats;
+
+    uart_engine_tracked_t tracked[UART_ENGINE_TRACKED_JOBS];
+    uint32_t tracked_seq;
+
+    uart_engine_post_ring_t post;
+} uart_engine_unit_t;
+
+static uart_engine_unit_t s_units[UPS_UNIT_COUNT];
+
+static portMUX_TYPE s_tracked_lock = portMUX_INITIALIZER_UNLOCKED;
+// Task running uart_engine_tick(); it must never block on its own jobs.
+static TaskHandle_t s_engine_task = NULL;
+
+static uart_engine_unit_t *engine_unit(uint8_t unit)
+{
+    return (unit < (uint8_t)UPS_UNIT_COUNT) ? &s_units[unit] : NULL;
+}
 
 static uint32_t engine_now_ms(void)
 {
     return ups_tick_ms();
 }
 
-static void set_not_before_ms(uint32_t candidate_ms)
+static uint32_t ms_until(uint32_t now_ms, uint32_t due_ms)
+{
+    int32_t const delta = (int32_t)(due_ms - now_ms);
+    return (delta > 0) ? (uint32_t)delta : 0U;
+}
+
+// A passed deadline is disarmed instead of kept: 2^31 ms later the stale
+// timestamp would compare as a future one and stall dispatch.
+static void arm_not_before_ms(uart_engine_unit_t *eng, uint32_t due_ms)
+{
+    eng->retry_not_before_ms = due_ms;
+    eng->retry_not_before_armed = true;
+}
+
+static void set_not_before_ms(uart_engine_unit_t *eng, uint32_t candidate_ms)
 {
-    if ((int32_t)(candidate_ms - s_retry_not_before_ms) > 0)
+    if (!eng->retry_not_before_armed || ((int32_t)(candidate_ms - eng->retry_not_before_ms) > 0))
     {
-        s_retry_not_before_ms = candidate_ms;
+        arm_not_before_ms(eng, candidate_ms);
     }
 }
 
-static void apply_interjob_cooldown(uint32_t now_ms)
+static void apply_interjob_cooldown(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    // A retry cooldown already armed is backoff, not turnaround.
+    eng->turnaround_pending = !eng->retry_not_before_armed &&
+                              ((eng->q_count != 0U) || (eng->state == UART_ENGINE_STATE_TX_START));
+    eng->turnaround_from_us = UART2_TickUs();
+#if (UART_ENGINE_ZERO_GAP != 0)
+    (void)now_ms;
+#elif (UART_ENGINE_INTERJOB_COOLDOWN_MS > 0U)
+    set_not_before_ms(eng, now_ms + UART_ENGINE_INTERJOB_COOLDOWN_MS);
+#else
+    (void)now_ms;
+#endif
+}
+
+// Zero-gap: false while at least one loop tick of the UPS turnaround is
+// left, with the not-before deadline armed so the engine sleeps through it;
+// only the sub-tick rest is busy-waited before returning true.
+static bool turnaround_ready(uart_engine_unit_t *eng, uint32_t now_ms)
 {
-#if (UART_ENGINE_INTERJOB_COOLDOWN_MS > 0U)
-    set_not_before_ms(now_ms + UART_ENGINE_INTERJOB_COOLDOWN_MS);
+#if (UART_ENGINE_ZERO_GAP != 0) && (UART_ENGINE_TURNAROUND_US > 0U)
+    uint32_t const gap_us = UART2_TickUs() - eng->turnaround_from_us;
+    if (gap_us >= UART_ENGINE_TURNAROUND_US)
+    {
+        return true;
+    }
+
+    uint32_t const left_us = UART_ENGINE_TURNAROUND_US - gap_us;
+    if (left_us >= UART_ENGINE_LOOP_TICK_US)
+    {
+        arm_not_before_ms(eng, now_ms + (((left_us / UART_ENGINE_LOOP_TICK_US) * UART_ENGINE_LOOP_TICK_US) / 1000U));
+        return false;
+    }
+    UART2_DelayUs(left_us);
 #else
+    (void)eng;
     (void)now_ms;
 #endif
+    return true;
+}
+
+// Right before a TX: record the gap if this job was queued behind the
+// previous one.
+static void turnaround_sample(uart_engine_unit_t *eng)
+{
+    if (!eng->turnaround_pending)
+    {
+        return;
+    }
+
+    uint32_t const gap_us = UART2_TickUs() - eng->turnaround_from_us;
+    eng->turnaround_pending = false;
+    eng->turnarounds++;
+    eng->turnaround_sum_us += gap_us;
+    eng->turnaround_max_us = (gap_us > eng->turnaround_max_us) ? gap_us : eng->turnaround_max_us;
+}
+
+#if (UART_ENGINE_ZERO_GAP != 0)
+// Time on the wire of len bytes (8N1), rounded up.
+static uint32_t engine_wire_ms(uint16_t len)
+{
+    return (((uint32_t)len * 10000U) + (uint32_t)UPS_UART_BAUDRATE - 1U) / (uint32_t)UPS_UART_BAUDRATE;
+}
+#endif
+
+// Uniform in [0, max_ms].
+static uint32_t engine_jitter_ms(uart_engine_unit_t *eng, uint32_t max_ms)
+{
+    uint32_t x = eng->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    eng->rng = x;
+    return x % (max_ms + 1U);
+}
+
+// Cooldown before retrying the active job, which has just failed an attempt.
+static void arm_retry_cooldown(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    uint8_t const failed = eng->active.attempts_failed;
+    uint8_t const shift = (failed > 1U) ? (uint8_t)(((failed - 1U) < 8U) ? (failed - 1U) : 8U) : 0U;
+    uint32_t cooldown = (uint32_t)UART_ENGINE_RETRY_COOLDOWN_MS << shift;
+    if (cooldown > UART_ENGINE_RETRY_COOLDOWN_MAX_MS)
+    {
+        cooldown = UART_ENGINE_RETRY_COOLDOWN_MAX_MS;
+    }
+    arm_not_before_ms(eng, now_ms + cooldown + engine_jitter_ms(eng, cooldown / 2U));
 }
 
-static void uart_engine_debug_print_raw_rx(const char *reason, const uint8_t *rx, uint16_t rx_len)
+static void uart_engine_debug_print_raw_rx(const uart_engine_unit_t *eng,
+                                           const char *reason,
+                                           const uart_engine_span_t *rx)
 {
     if (!g_ups_debug_status_print_enabled)
     {
         return;
     }
 
-    printf("UART_ENG raw rx: %s len=%u",
+    uint16_t const rx_len = uart_engine_span_len(rx);
+    printf("UART_ENG%u raw rx: %s len=%u",
+           (unsigned int)eng->unit,
            (reason != NULL) ? reason : "unknown",
            (unsigned int)rx_len);
 
-    if ((rx == NULL) || (rx_len == 0U))
+    if (rx_len == 0U)
+    {
+        printf(" (empty)\r\n");
+        return;
+    }
+
+    printf(" data=");
+    for (uint16_t i = 0U; i < rx_len; i++)
+    {
+        printf("%02X", uart_engine_span_at(rx, i));
+        if ((uint16_t)(i + 1U) < rx_len)
+        {
+            printf(" ");
+        }
+    }
+    printf("\r\n");
+}
+
+static void uart_engine_debug_print_failure(const uart_engine_unit_t *eng,
+                                            const uart_engine_job_t *job,
+                                            const char *reason)
+{
+    if (!g_ups_debug_status_print_enabled || (job == NULL))
+    {
+        return;
+    }
+
+    printf("UART_ENG%u failure: %s cmd=0x%04X hb=%u retries_left=%u q=%u\r\n",
+           (unsigned int)eng->unit,
+           (reason != NULL) ? reason : "unknown",
+           (unsigned int)job->req->cmd,
+           job->is_heartbeat ? 1U : 0U,
+           (unsigned int)job->retries_left,
+           (unsigned int)eng->q_count);
+}
+
+static void uart_engine_debug_print_retry(const uart_engine_unit_t *eng,
+                                          const uart_engine_job_t *job,
+                                          const char *reason)
+{
+    if (!g_ups_debug_status_print_enabled || (job == NULL))
+    {
+        return;
+    }
+
+    printf("UART_ENG%u retry: %s cmd=0x%04X hb=%u retries_left=%u q=%u\r\n",
+           (unsigned int)eng->unit,
+           (reason != NULL) ? reason : "unknown",
+           (unsigned int)job->req->cmd,
+           job->is_heartbeat ? 1U : 0U,
+           (unsigned int)job->retries_left,
+           (unsigned int)eng->q_count);
+}
+
+static void uart_engine_debug_print_timeout(const uart_engine_unit_t *eng,
+                                            const uart_engine_job_t *job,
+                                            const char *phase,
+                                            uint32_t elapsed_ms,
+                                            uint32_t timeout_ms)
+{
+    if (!g_ups_debug_status_print_enabled || (job == NULL))
+    {
+        return;
+    }
+
+    printf("UART_ENG%u timeout: %s cmd=0x%04X hb=%u elapsed=%lu timeout=%lu retries_left=%u\r\n",
+           (unsigned int)eng->unit,
+           (phase != NULL) ? phase : "unknown",
+           (unsigned int)job->req->cmd,
+           job->is_heartbeat ? 1U : 0U,
+           (unsigned long)elapsed_ms,
+           (unsigned long)timeout_ms,
+           (unsigned int)job->retries_left);
+}
+
+static const uart_engine_request_t *request_pool_alloc(uart_engine_unit_t *eng, const uart_engine_request_t *req)
+{
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_REQ_POOL_SIZE; i++)
+    {
+        if (!eng->req_pool_used[i])
+        {
+            eng->req_pool_used[i] = true;
+            eng->req_pool[i] = *req;
+            return &eng->req_pool[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const uart_engine_request_t *txn_pool_alloc(uart_engine_unit_t *eng,
+                                                   const uart_engine_request_t *steps,
+                                                   size_t count)
+{
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_TXN_POOL_SIZE; i++)
+    {
+        if (!eng->txn_pool_used[i])
+        {
+            eng->txn_pool_used[i] = true;
+            (void)memcpy(eng->txn_pool[i], steps, count * sizeof(steps[0]));
+            return &eng->txn_pool[i][0];
+        }
+    }
+
+    return NULL;
+}
+
+// No-op for requests that do not live in a pool. Any step of a transaction
+// releases its whole slot.
+static void request_release(uart_engine_unit_t *eng, const uart_engine_request_t *req)
+{
+    if ((req >= &eng->req_pool[0]) && (req < &eng->req_pool[UART_ENGINE_REQ_POOL_SIZE]))
+    {
+        eng->req_pool_used[req - &eng->req_pool[0]] = false;
+        return;
+    }
+
+    const uart_engine_request_t *const txn_first = &eng->txn_pool[0][0];
+    if ((req >= txn_first) && (req < (txn_first + (UART_ENGINE_TXN_POOL_SIZE * UART_ENGINE_MAX_TXN_STEPS))))
+    {
+        eng->txn_pool_used[(size_t)(req - txn_first) / UART_ENGINE_MAX_TXN_STEPS] = false;
+    }
+}
+
+// Tracking slot owning req, or NULL for LUT, heartbeat and pooled requests.
+static uart_engine_tracked_t *tracked_slot(uart_engine_unit_t *eng, const uart_engine_request_t *req)
+{
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_TRACKED_JOBS; i++)
+    {
+        if (req == &eng->tracked[i].req)
+        {
+            return &eng->tracked[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Report the end of a tracked job. Runs in the engine task.
+static void tracked_complete(uart_engine_tracked_t *tr, uart_engine_result_t result)
+{
+    if (tr == NULL)
+    {
+        return;
+    }
+
+    uart_engine_handle_t handle = 0U;
+    uart_engine_done_fn done_fn = NULL;
+    void *done_ctx = NULL;
+    TaskHandle_t waiter = NULL;
+
+    portENTER_CRITICAL(&s_tracked_lock);
+    if (tr->state == TRACKED_ABANDONED)
+    {
+        waiter = tr->waiter;
+        tr->waiter = NULL;
+        tr->state = TRACKED_FREE;
+    }
+    else if (tr->state != TRACKED_FREE)
+    {
+        handle = tr->handle;
+        done_fn = tr->done_fn;
+        done_ctx = tr->done_ctx;
+        waiter = tr->waiter;
+        tr->waiter = NULL;
+        tr->result = result;
+        tr->state = tr->auto_release ? TRACKED_FREE : TRACKED_COMPLETE;
+    }
+    portEXIT_CRITICAL(&s_tracked_lock);
+
+    if (done_fn != NULL)
+    {
+        done_fn(handle, result, done_ctx);
+    }
+    if (waiter != NULL)
+    {
+        (void)xTaskNotifyGiveIndexed(waiter, UART_ENGINE_NOTIFY_INDEX);
+    }
+}
+
+// Move a tracked job from one engine-side state to another. Returns false if
+// the waiter abandoned it meanwhile; the slot is then freed.
+static bool tracked_advance(uart_engine_tracked_t *tr, uint8_t from, uint8_t to)
+{
+    bool ok = false;
+    TaskHandle_t waiter = NULL;
+
+    portENTER_CRITICAL(&s_tracked_lock);
+    if (tr->state == from)
+    {
+        tr->state = to;
+        ok = true;
+    }
+    else if (tr->state == TRACKED_ABANDONED)
+    {
+        waiter = tr->waiter;
+        tr->waiter = NULL;
+        tr->state = TRACKED_FREE;
+    }
+    portEXIT_CRITICAL(&s_tracked_lock);
+
+    if (waiter != NULL)
+    {
+        // uart_engine_job_cancel() blocked on process_fn.
+        (void)xTaskNotifyGiveIndexed(waiter, UART_ENGINE_NOTIFY_INDEX);
+    }
+    return ok;
+}
+
+// Jobs still pending when the queues are flushed (engine disabled).
+static void tracked_drop_all(uart_engine_unit_t *eng)
+{
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_TRACKED_JOBS; i++)
+    {
+        uint8_t const state = eng->tracked[i].state;
+        if ((state == TRACKED_SUBMITTED) || (state == TRACKED_QUEUED) ||
+            (state == TRACKED_PROCESSING) || (state == TRACKED_ABANDONED))
+        {
+            tracked_complete(&eng->tracked[i], UART_ENGINE_ERR_DISABLED);
+        }
+    }
+}
+
+static void queue_reset_all(uart_engine_unit_t *eng)
+{
+    for (uint8_t c = 0U; c < (uint8_t)UART_ENGINE_PRIO_COUNT; c++)
+    {
+        eng->rings[c].head = 0U;
+        eng->rings[c].tail = 0U;
+        eng->rings[c].count = 0U;
+        eng->class_stats[c].depth = 0U;
+    }
+    eng->q_count = 0U;
+    (void)memset(eng->req_pool_used, 0, sizeof(eng->req_pool_used));
+    (void)memset(eng->txn_pool_used, 0, sizeof(eng->txn_pool_used));
+}
+
+// Append a job to its class ring, queued since enqueued_ms.
+static bool queue_push_job_at(uart_engine_unit_t *eng, const uart_engine_job_t *job, uint32_t enqueued_ms)
+{
+    if ((job == NULL) || (job->prio >= (uint8_t)UART_ENGINE_PRIO_COUNT))
+    {
+        return false;
+    }
+
+    uart_engine_ring_t *ring = &eng->rings[job->prio];
+    uart_engine_class_stats_t *st = &eng->class_stats[job->prio];
+    if (ring->count >= ring->size)
+    {
+        st->rejected_full++;
+        return false;
+    }
+
+    ring->slots[ring->tail] = *job;
+    ring->slots[ring->tail].enqueued_ms = enqueued_ms;
+    ring->tail = (uint8_t)((ring->tail + 1U) % ring->size);
+    ring->count++;
+    eng->q_count++;
+
+    st->enqueued++;
+    st->depth = ring->count;
+    if (ring->count > st->depth_max)
+    {
+        st->depth_max = ring->count;
+    }
+    return true;
+}
+
+// Append a job queued from now. Retries pass the active job so its remaining
+// retry budget is kept.
+static bool queue_push_job(uart_engine_unit_t *eng, const uart_engine_job_t *job)
+{
+    return queue_push_job_at(eng, job, engine_now_ms());
+}
+
+static bool queue_push_cb(uart_engine_unit_t *eng,
+                          const uart_engine_request_t *req,
+                          bool is_heartbeat,
+                          uart_engine_priority_t prio,
+                          uart_engine_done_fn done_fn,
+                          void *done_ctx)
+{
+    if (req == NULL)
+    {
+        return false;
+    }
+
+    uart_engine_job_t job;
+    job.req = req;
+    job.enqueued_ms = 0U;
+    job.retries_left = req->max_retries;
+    job.prio = (uint8_t)prio;
+    job.waiters = 1U;
+    job.is_heartbeat = is_heartbeat;
+    job.in_txn = false;
+    job.steps_left = 0U;
+    job.attempts_failed = 0U;
+    job.id = 0U;
+    job.done_fn = done_fn;
+    job.done_ctx = done_ctx;
+    return queue_push_job(eng, &job);
+}
+
+static bool queue_push(uart_engine_unit_t *eng, const uart_engine_request_t *req, bool is_heartbeat, uart_engine_priority_t prio)
+{
+    return queue_push_cb(eng, req, is_heartbeat, prio, NULL, NULL);
+}
+
+// Remove the job at slot pos, closing the gap towards the tail.
+static void ring_remove_at(uart_engine_unit_t *eng, uart_engine_ring_t *ring, uint8_t pos)
+{
+    uint8_t idx = pos;
+    for (;;)
+    {
+        uint8_t const next = (uint8_t)((idx + 1U) % ring->size);
+        if (next == ring->tail)
+        {
+            break;
+        }
+        ring->slots[idx] = ring->slots[next];
+        idx = next;
+    }
+
+    ring->tail = idx;
+    ring->count--;
+    eng->q_count--;
+}
+
+// Same bytes on the wire, same reply framing and the same process_fn and
+// output binding: one exchange serves both requests. max_retries is not part
+// of the identity (a merge keeps the larger budget).
+static bool request_same_exchange(const uart_engine_request_t *a, const uart_engine_request_t *b)
+{
+    if ((a->cmd != b->cmd) || (a->cmd_bits != b->cmd_bits) || (a->tx_len != b->tx_len) ||
+        (a->tx_gap_ms != b->tx_gap_ms) || ((a->tx_bytes == NULL) != (b->tx_bytes == NULL)) ||
+        (a->expected_len != b->expected_len) || (a->expected_ending != b->expected_ending) ||
+        (a->timeout_ms != b->timeout_ms) || (a->process_fn != b->process_fn) ||
+        (a->out_value != b->out_value) || (a->out_field != b->out_field) || (a->out_offset != b->out_offset))
+    {
+        return false;
+    }
+
+    if ((a->tx_bytes != NULL) && (a->tx_bytes != b->tx_bytes) && (memcmp(a->tx_bytes, b->tx_bytes, a->tx_len) != 0))
+    {
+        return false;
+    }
+
+    if (a->expected_ending)
+    {
+        return (a->expected_ending_len == b->expected_ending_len) &&
+               (a->expected_ending_len <= UART_ENGINE_MAX_ENDING_LEN) &&
+               (memcmp(a->expected_ending_bytes, b->expected_ending_bytes, a->expected_ending_len) == 0);
+    }
+    return true;
+}
+
+// Merge req into a queued, not yet sent job for the same exchange
+// (request_same_exchange()): that job's single response then serves both
+// callers. A merge
+// from a higher class moves the job up to that class. A job carries one
+// completion callback: done_fn is handed to a job without one, and a job
+// that already has one is not merged with another.
+static bool queue_try_merge(uart_engine_unit_t *eng,
+                            const uart_engine_request_t *req,
+                            uart_engine_priority_t prio,
+                            uart_engine_done_fn done_fn,
+                            void *done_ctx)
+{
+    for (uint8_t c = 0U; c < (uint8_t)UART_ENGINE_PRIO_COUNT; c++)
+    {
+        uart_engine_ring_t *ring = &eng->rings[c];
+        for (uint8_t i = 0U; i < ring->count; i++)
+        {
+            uint8_t const pos = (uint8_t)((ring->head + i) % ring->size);
+            uart_engine_job_t *job = &ring->slots[pos];
+            if (job->is_heartbeat || job->in_txn ||
+                (tracked_slot(eng, job->req) != NULL) ||
+                ((done_fn != NULL) && (job->done_fn != NULL)) ||
+                !request_same_exchange(job->req, req))
+            {
+                continue;
+            }
+
+            if (done_fn != NULL)
+            {
+                job->done_fn = done_fn;
+                job->done_ctx = done_ctx;
+            }
+
+            if (job->waiters < UINT8_MAX)
+            {
+                job->waiters++;
+            }
+            if (req->max_retries > job->retries_left)
+            {
+                job->retries_left = req->max_retries;
+            }
+
+            if (((uint8_t)prio < c) && (eng->rings[prio].count < eng->rings[prio].size))
+            {
+                uart_engine_job_t moved = *job;
+                ring_remove_at(eng, ring, pos);
+                eng->class_stats[c].depth = ring->count;
+                moved.prio = (uint8_t)prio;
+                // Keeps its queued time: wait stats and aging count from the first enqueue.
+                (void)queue_push_job_at(eng, &moved, moved.enqueued_ms);
+                eng->class_stats[prio].promoted++;
+            }
+
+            eng->class_stats[(uint8_t)prio < c ? (uint8_t)prio : c].merged++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void post_ring_init(uart_engine_post_ring_t *r)
+{
+    for (unsigned int i = 0U; i < UART_ENGINE_POST_RING_SIZE; i++)
+    {
+        atomic_init(&r->cells[i].seq, i);
+    }
+    atomic_init(&r->enqueue_pos, 0U);
+    atomic_init(&r->rejected, 0U);
+    r->dequeue_pos = 0U;
+}
+
+// Any producer context (task or ISR).
+static bool post_ring_push(uart_engine_post_ring_t *r, const uart_engine_request_t *req, uint8_t prio)
+{
+    unsigned int pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    uart_engine_post_cell_t *cell;
+    for (;;)
+    {
+        cell = &r->cells[pos & (UART_ENGINE_POST_RING_SIZE - 1U)];
+        unsigned int const seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int const diff = (int)(seq - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos,
+                                                      &pos,
+                                                      pos + 1U,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            (void)atomic_fetch_add_explicit(&r->rejected, 1U, memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->req = req;
+    cell->prio = prio;
+    atomic_store_explicit(&cell->seq, pos + 1U, memory_order_release);
+    return true;
+}
+
+// Consumer side: the oldest published cell, or NULL. Stays in place until
+// post_ring_release().
+static const uart_engine_post_cell_t *post_ring_peek(const uart_engine_post_ring_t *r)
+{
+    uart_engine_post_cell_t const *cell = &r->cells[r->dequeue_pos & (UART_ENGINE_POST_RING_SIZE - 1U)];
+    unsigned int const seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    return (seq == (r->dequeue_pos + 1U)) ? cell : NULL;
+}
+
+static void post_ring_release(uart_engine_post_ring_t *r)
+{
+    uart_engine_post_cell_t *cell = &r->cells[r->dequeue_pos & (UART_ENGINE_POST_RING_SIZE - 1U)];
+    atomic_store_explicit(&cell->seq, r->dequeue_pos + UART_ENGINE_POST_RING_SIZE, memory_order_release);
+    r->dequeue_pos++;
+}
+
+// Move posted requests into the class rings (merging duplicates, as
+// uart_engine_enqueue_static() does). Stops at the first one whose class is
+// full; it stays posted for a later step.
+static void post_ring_drain(uart_engine_unit_t *eng)
+{
+    uart_engine_post_cell_t const *cell;
+    while ((cell = post_ring_peek(&eng->post)) != NULL)
+    {
+        uart_engine_priority_t const prio = (uart_engine_priority_t)cell->prio;
+        if (!queue_try_merge(eng, cell->req, prio, NULL, NULL))
+        {
+            if (eng->rings[prio].count >= eng->rings[prio].size)
+            {
+                return;
+            }
+            (void)queue_push(eng, cell->req, false, prio);
+        }
+        post_ring_release(&eng->post);
+    }
+}
+
+// Queue jobs submitted by other tasks. A job that does not fit (class ring
+// full) is retried on the next step.
+static void tracked_admit(uart_engine_unit_t *eng)
+{
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_TRACKED_JOBS; i++)
+    {
+        uart_engine_tracked_t *tr = &eng->tracked[i];
+        if ((tr->state != TRACKED_SUBMITTED) || !tracked_advance(tr, TRACKED_SUBMITTED, TRACKED_QUEUED))
+        {
+            continue;
+        }
+
+        if (!queue_push(eng, &tr->req, false, (uart_engine_priority_t)tr->prio))
+        {
+            (void)tracked_advance(tr, TRACKED_QUEUED, TRACKED_SUBMITTED);
+            return;
+        }
+    }
+}
+
+// Highest non-empty class, unless a non-critical head has aged past
+// UART_ENGINE_AGING_MS; then the oldest such head wins.
+static int8_t queue_select_class(uart_engine_unit_t *eng, uint32_t now_ms, bool *out_aged)
+{
+    *out_aged = false;
+    if (eng->rings[UART_ENGINE_PRIO_CRITICAL].count != 0U)
+    {
+        return (int8_t)UART_ENGINE_PRIO_CRITICAL;
+    }
+
+    int8_t best = -1;
+    int8_t aged = -1;
+    uint32_t aged_wait = 0U;
+    for (uint8_t c = (uint8_t)UART_ENGINE_PRIO_INTERACTIVE; c < (uint8_t)UART_ENGINE_PRIO_COUNT; c++)
+    {
+        uart_engine_ring_t const *ring = &eng->rings[c];
+        if (ring->count == 0U)
+        {
+            continue;
+        }
+
+        if (best < 0)
+        {
+            best = (int8_t)c;
+        }
+
+        uint32_t const wait = now_ms - ring->slots[ring->head].enqueued_ms;
+        if ((wait >= UART_ENGINE_AGING_MS) && (wait > aged_wait))
+        {
+            aged = (int8_t)c;
+            aged_wait = wait;
+        }
+    }
+
+    if ((aged >= 0) && (aged != best))
+    {
+        *out_aged = true;
+        return aged;
+    }
+    return best;
+}
+
+static bool queue_pop(uart_engine_unit_t *eng, uart_engine_job_t *out, uint32_t now_ms)
+{
+    if ((out == NULL) || (eng->q_count == 0U))
+    {
+        return false;
+    }
+
+    bool aged = false;
+    int8_t const c = queue_select_class(eng, now_ms, &aged);
+    if (c < 0)
+    {
+        return false;
+    }
+
+    uart_engine_ring_t *ring = &eng->rings[c];
+    *out = ring->slots[ring->head];
+    ring->head = (uint8_t)((ring->head + 1U) % ring->size);
+    ring->count--;
+    eng->q_count--;
+
+    uart_engine_class_stats_t *st = &eng->class_stats[c];
+    uint32_t const wait = now_ms - out->enqueued_ms;
+    st->dispatched++;
+    st->wait_last_ms = wait;
+    st->wait_total_ms += wait;
+    if (wait > st->wait_max_ms)
+    {
+        st->wait_max_ms = wait;
+    }
+    if (aged)
+    {
+        st->aged++;
+    }
+    st->depth = ring->count;
+    return true;
+}
+
+static uint16_t build_cmd_bytes(uint8_t *tx, uint16_t tx_cap, uint16_t cmd, uint8_t cmd_bits)
+{
+    if ((tx == NULL) || (tx_cap == 0U))
+    {
+        return 0U;
+    }
+
+    if (cmd_bits == 8U)
+    {
+        if (tx_cap < 1U)
+        {
+            return 0U;
+        }
+        tx[0] = (uint8_t)(cmd & 0xFFU);
+        return 1U;
+    }
+
+    if (cmd_bits == 16U)
+    {
+        if (tx_cap < 2U)
+        {
+            return 0U;
+        }
+        tx[0] = (uint8_t)((cmd >> 8) & 0xFFU);
+        tx[1] = (uint8_t)(cmd & 0xFFU);
+        return 2U;
+    }
+
+    return 0U;
+}
+
+static bool request_is_valid(const uart_engine_request_t *req)
+{
+    if (req == NULL)
+    {
+        return false;
+    }
+
+    if (req->tx_bytes != NULL)
+    {
+        if (req->tx_len == 0U)
+        {
+            return false;
+        }
+    }
+    else if ((req->cmd_bits != 8U) && (req->cmd_bits != 16U))
+    {
+        return false;
+    }
+
+    if (req->expected_len > UART_ENGINE_MAX_EXPECTED_LEN)
+    {
+        return false;
+    }
+
+    if (req->expected_ending)
+    {
+        if ((req->expected_ending_len == 0U) || (req->expected_ending_len > UART_ENGINE_MAX_ENDING_LEN))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint16_t request_rx_cap(const uart_engine_request_t *req)
+{
+    if (req == NULL)
+    {
+        return 0U;
+    }
+
+    if (!req->expected_ending)
+    {
+        return req->expected_len;
+    }
+
+    if (req->expected_len == 0U)
+    {
+        return UART_ENGINE_MAX_EXPECTED_LEN;
+    }
+
+    return req->expected_len;
+}
+
+static uart_engine_cmd_entry_t *cmd_lookup(uart_engine_unit_t *eng, const uart_engine_request_t *req, bool create)
+{
+    for (uint8_t i = 0U; i < eng->cmd_count; i++)
+    {
+        if ((eng->cmd_table[i].stats.cmd == req->cmd) && (eng->cmd_table[i].stats.cmd_bits == req->cmd_bits))
+        {
+            return &eng->cmd_table[i];
+        }
+    }
+
+    if (!create || (eng->cmd_count >= UART_ENGINE_CMD_TABLE_SIZE))
+    {
+        return NULL;
+    }
+
+    uart_engine_cmd_entry_t *e = &eng->cmd_table[eng->cmd_count++];
+    (void)memset(e, 0, sizeof(*e));
+    e->stats.cmd = req->cmd;
+    e->stats.cmd_bits = req->cmd_bits;
+    return e;
+}
+
+static uint8_t latency_bucket(uint32_t latency_ms)
+{
+    uint8_t i = 0U;
+    while ((i < (uint8_t)(UART_ENGINE_LATENCY_BUCKETS - 1U)) && (latency_ms >= (16UL << i)))
+    {
+        i++;
+    }
+    return i;
+}
+
+#if (UART_ENGINE_ADAPTIVE_TIMEOUT != 0)
+static void rtt_sample(uart_engine_cmd_entry_t *e, uint32_t latency_ms)
+{
+    if (e->samples == 0U)
+    {
+        e->srtt_x8 = latency_ms << 3;
+        e->rttvar_x4 = latency_ms << 1;
+    }
+    else
+    {
+        int32_t const err = (int32_t)latency_ms - (int32_t)(e->srtt_x8 >> 3);
+        uint32_t const abs_err = (err < 0) ? (uint32_t)(-err) : (uint32_t)err;
+        e->srtt_x8 = (uint32_t)((int32_t)e->srtt_x8 + err);
+        e->rttvar_x4 = e->rttvar_x4 + abs_err - (e->rttvar_x4 >> 2);
+    }
+
+    if (e->samples < UINT8_MAX)
+    {
+        e->samples++;
+    }
+    e->backoff = false;
+}
+#endif
+
+static uint32_t cmd_rx_timeout_ms(const uart_engine_cmd_entry_t *e, uint32_t ceiling)
+{
+#if (UART_ENGINE_ADAPTIVE_TIMEOUT != 0)
+    if ((e == NULL) || e->backoff || (e->samples < UART_ENGINE_RTT_MIN_SAMPLES))
+    {
+        return ceiling;
+    }
+
+    uint32_t timeout = (e->srtt_x8 >> 3) + e->rttvar_x4 + UART_ENGINE_TIMEOUT_GRANULARITY_MS;
+    if (timeout < UART_ENGINE_TIMEOUT_FLOOR_MS)
+    {
+        timeout = UART_ENGINE_TIMEOUT_FLOOR_MS;
+    }
+    return (timeout < ceiling) ? timeout : ceiling;
+#else
+    (void)e;
+    return ceiling;
+#endif
+}
+
+static void cmd_note_failure(uart_engine_cmd_entry_t *e, uart_engine_fail_t kind)
+{
+    if (kind == UART_ENGINE_FAIL_TIMEOUT)
+    {
+        e->stats.timeout++;
+    }
+    else if (kind == UART_ENGINE_FAIL_PARSE)
+    {
+        e->stats.parse_fail++;
+    }
+    e->stats.last_fail = (uint8_t)kind;
+}
+
+// True if the active job may go out. An open breaker whose period has passed
+// turns half-open and lets this job through as the probe, without retries.
+static bool breaker_admit(uart_engine_unit_t *eng, uart_engine_cmd_entry_t *e, uint32_t now_ms)
+{
+    if (eng->active.is_heartbeat || (e == &eng->cmd_other) || (e->stats.breaker == UART_ENGINE_BREAKER_CLOSED))
+    {
+        return true;
+    }
+
+    if (e->stats.breaker == UART_ENGINE_BREAKER_OPEN)
+    {
+        // A wait beyond the longest open period is a stale timestamp, not a
+        // pending one (the command was not requested for 2^31 ms).
+        uint32_t const wait_ms = ms_until(now_ms, e->probe_at_ms);
+        if ((wait_ms > 0U) && (wait_ms <= (UART_ENGINE_BREAKER_MAX_MS + (UART_ENGINE_BREAKER_MAX_MS / 4U))))
+        {
+            return false;
+        }
+        e->stats.breaker = UART_ENGINE_BREAKER_HALF_OPEN;
+    }
+
+    eng->active.retries_left = 0U;
+    return true;
+}
+
+static void breaker_open(uart_engine_unit_t *eng, uart_engine_cmd_entry_t *e, uint32_t now_ms)
+{
+    uint32_t open_ms = UART_ENGINE_BREAKER_MAX_MS;
+    if ((e->trips < 16U) && (((uint32_t)UART_ENGINE_BREAKER_BASE_MS << e->trips) < UART_ENGINE_BREAKER_MAX_MS))
+    {
+        open_ms = (uint32_t)UART_ENGINE_BREAKER_BASE_MS << e->trips;
+    }
+
+    if (e->stats.breaker == UART_ENGINE_BREAKER_CLOSED)
+    {
+        e->stats.breaker_trips++;
+    }
+    e->stats.breaker = UART_ENGINE_BREAKER_OPEN;
+    e->probe_at_ms = now_ms + open_ms + engine_jitter_ms(eng, open_ms / 4U);
+    if (e->trips < UINT8_MAX)
+    {
+        e->trips++;
+    }
+}
+
+// The active job failed for good.
+static void breaker_on_failure(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    uart_engine_cmd_entry_t *e = eng->active_cmd;
+    if (eng->link_fail_streak < UINT8_MAX)
+    {
+        eng->link_fail_streak++;
+    }
+    if ((e == NULL) || (e == &eng->cmd_other) || eng->active.is_heartbeat ||
+        (eng->link_fail_streak >= UART_ENGINE_LINK_DOWN_FAILS))
+    {
+        return;
+    }
+
+    if (e->stats.fail_streak < UINT8_MAX)
+    {
+        e->stats.fail_streak++;
+    }
+    if ((e->stats.breaker == UART_ENGINE_BREAKER_HALF_OPEN) || (e->stats.fail_streak >= UART_ENGINE_BREAKER_THRESHOLD))
+    {
+        breaker_open(eng, e, now_ms);
+    }
+}
+
+// An attempt of the active job succeeded (each transaction step counts).
+static void breaker_on_success(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    uart_engine_cmd_entry_t *e = eng->active_cmd;
+    if ((e != NULL) && (e != &eng->cmd_other))
+    {
+        e->stats.fail_streak = 0U;
+        e->stats.breaker = UART_ENGINE_BREAKER_CLOSED;
+        e->trips = 0U;
+    }
+
+    if (eng->link_fail_streak >= UART_ENGINE_LINK_DOWN_FAILS)
+    {
+        // Link back up: what failed during the outage gets a fresh start.
+        for (uint8_t i = 0U; i < eng->cmd_count; i++)
+        {
+            eng->cmd_table[i].stats.fail_streak = 0U;
+            if (eng->cmd_table[i].stats.breaker == UART_ENGINE_BREAKER_OPEN)
+            {
+                eng->cmd_table[i].probe_at_ms = now_ms;
+            }
+        }
+    }
+    eng->link_fail_streak = 0U;
+}
+
+// Attribute the time since the last call to the current state and to the
+// busy-window slots.
+static void bus_account(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    uint32_t delta = now_ms - eng->acct_ms;
+    bool const busy = (eng->state != UART_ENGINE_STATE_IDLE);
+    eng->state_ms[eng->state] += delta;
+
+    uint32_t const window_ms = UART_ENGINE_BUSY_SLOTS * UART_ENGINE_BUSY_SLOT_MS;
+    if (delta >= window_ms)
+    {
+        // Gap longer than the whole window: every slot saw the same state.
+        for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_BUSY_SLOTS; i++)
+        {
+            eng->busy_slot_ms[i] = busy ? UART_ENGINE_BUSY_SLOT_MS : 0U;
+        }
+        eng->busy_slots_filled = (uint8_t)UART_ENGINE_BUSY_SLOTS;
+        eng->busy_slot_ms[eng->busy_slot] = 0U;
+        eng->busy_slot_start_ms = now_ms;
+        eng->acct_ms = now_ms;
+        return;
+    }
+
+    while (delta > 0U)
+    {
+        uint32_t const room = (eng->busy_slot_start_ms + UART_ENGINE_BUSY_SLOT_MS) - eng->acct_ms;
+        uint32_t const part = (delta < room) ? delta : room;
+        if (busy)
+        {
+            eng->busy_slot_ms[eng->busy_slot] += part;
+        }
+        eng->acct_ms += part;
+        delta -= part;
+
+        if ((eng->acct_ms - eng->busy_slot_start_ms) >= UART_ENGINE_BUSY_SLOT_MS)
+        {
+            eng->busy_slot = (uint8_t)((eng->busy_slot + 1U) % UART_ENGINE_BUSY_SLOTS);
+            eng->busy_slot_ms[eng->busy_slot] = 0U;
+            eng->busy_slot_start_ms += UART_ENGINE_BUSY_SLOT_MS;
+            if (eng->busy_slots_filled < UART_ENGINE_BUSY_SLOTS)
+            {
+                eng->busy_slots_filled++;
+            }
+        }
+    }
+}
+
+// Terminator ends in the byte the UART hardware pattern-detects: frame ends
+// are reported by the driver instead of rescanning the buffer every tick.
+static bool request_uses_hw_pattern(uart_engine_unit_t *eng, const uart_engine_request_t *req)
+{
+    if ((req == NULL) || !req->expected_ending || (req->expected_ending_len == 0U))
+    {
+        return false;
+    }
+
+    if (req->expected_ending_bytes[req->expected_ending_len - 1U] != (uint8_t)UPS_UART_PATTERN_CHAR)
+    {
+        return false;
+    }
+
+    return UART2_PatternEnabled(eng->unit);
+}
+
+// Bytes up to and including the next detected pattern byte (at most max_len).
+// Returns 0 while no pattern is pending.
+static uint16_t rx_pattern_len(uart_engine_unit_t *eng, uint16_t max_len)
+{
+    int const pos = UART2_PatternPopPos(eng->unit);
+    if (pos < 0)
+    {
+        return 0U;
+    }
+
+    uint32_t const len = (uint32_t)pos + 1U;
+    return (len > max_len) ? max_len : (uint16_t)len;
+}
+
+// Remove out-of-band bytes from buf in place; returns the remaining length.
+// In a response only the bytes ahead of its first payload byte are offered
+// to the handler: after that everything is reply data, as model, serial and
+// firmware strings may contain alert characters.
+static uint16_t rx_filter_oob(uart_engine_unit_t *eng, uint8_t *buf, uint16_t len, bool in_response)
+{
+    if (eng->oob_fn == NULL)
+    {
+        return len;
+    }
+
+    bool payload = in_response && (eng->rx_got != 0U);
+    uint16_t w = 0U;
+    for (uint16_t r = 0U; r < len; r++)
+    {
+        if (!payload && eng->oob_fn(buf[r], in_response, eng->oob_ctx))
+        {
+            eng->oob_bytes++;
+            eng->oob_refresh_pending = true;
+            eng->oob_refresh_idx = 0U;
+        }
+        else
+        {
+            buf[w++] = buf[r];
+            payload = in_response;
+        }
+    }
+    return w;
+}
+
+// Clear RX before a new command. With an OOB handler, buffered bytes are
+// classified first so alerts that arrived between jobs are not lost.
+static void rx_drain_oob(uart_engine_unit_t *eng)
+{
+    if (eng->oob_fn != NULL)
+    {
+        uint8_t tmp[16];
+        uint16_t n;
+        while ((n = UART2_Read(eng->unit, tmp, (uint16_t)sizeof(tmp))) > 0U)
+        {
+            uart_trace_rx(eng->unit, tmp, n);
+            (void)rx_filter_oob(eng, tmp, n, false);
+        }
+    }
+
+    UART2_DiscardBuffered(eng->unit);
+}
+
+static uint8_t rx_ring_at(const uart_engine_unit_t *eng, uint16_t pos)
+{
+    return eng->rx_ring[pos & (UART_ENGINE_RX_RING_SIZE - 1U)];
+}
+
+// View of len bytes starting at ring position start.
+static void rx_ring_span(const uart_engine_unit_t *eng, uint16_t start, uint16_t len, uart_engine_span_t *out)
+{
+    uint16_t const off = (uint16_t)(start & (UART_ENGINE_RX_RING_SIZE - 1U));
+    uint16_t const first = (uint16_t)(UART_ENGINE_RX_RING_SIZE - off);
+
+    out->seg[0] = &eng->rx_ring[off];
+    out->seg[1] = &eng->rx_ring[0];
+    out->seg_len[0] = (len < first) ? len : first;
+    out->seg_len[1] = (uint16_t)(len - out->seg_len[0]);
+}
+
+// Bytes of the active frame: up to the terminator once found, else all
+// received so far.
+static void rx_frame_span(const uart_engine_unit_t *eng, uart_engine_span_t *out)
+{
+    uint16_t const len = (eng->rx_frame_len != 0U) ? eng->rx_frame_len : eng->rx_got;
+    rx_ring_span(eng, eng->rx_frame_start, len, out);
+}
+
+// Start a new frame at the write position; anything left over behind the
+// previous frame is dropped.
+static void rx_frame_reset(uart_engine_unit_t *eng)
+{
+    eng->rx_frame_start = eng->rx_head;
+    eng->rx_got = 0U;
+    eng->rx_frame_len = 0U;
+    eng->rx_scanned = 0U;
+}
+
+// Read up to max_len bytes from the UART straight into the ring (at most two
+// contiguous reads around the wrap), dropping OOB bytes in place. Returns the
+// number of raw bytes taken from the UART.
+static uint16_t rx_ring_fill(uart_engine_unit_t *eng, uint16_t max_len)
+{
+    uint16_t total = 0U;
+    while (total < max_len)
+    {
+        uint16_t const off = (uint16_t)(eng->rx_head & (UART_ENGINE_RX_RING_SIZE - 1U));
+        uint16_t chunk = (uint16_t)(UART_ENGINE_RX_RING_SIZE - off);
+        if (chunk > (uint16_t)(max_len - total))
+        {
+            chunk = (uint16_t)(max_len - total);
+        }
+
+        uint16_t const got = UART2_Read(eng->unit, &eng->rx_ring[off], chunk);
+        if (got == 0U)
+        {
+            break;
+        }
+
+        uart_trace_rx(eng->unit, &eng->rx_ring[off], got);
+        uint16_t const kept = rx_filter_oob(eng, &eng->rx_ring[off], got, true);
+        eng->rx_head = (uint16_t)(eng->rx_head + kept);
+        eng->rx_got = (uint16_t)(eng->rx_got + kept);
+        total = (uint16_t)(total + got);
+        if (got < chunk)
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
+// Search the newly received frame bytes for the terminator. On a match the
+// frame ends right after it; later bytes stay unread in the ring.
+static bool rx_find_expected_ending(uart_engine_unit_t *eng, const uart_engine_request_t *req)
+{
+    if ((req == NULL) || !req->expected_ending)
+    {
+        return false;
+    }
+
+    uint8_t const ending_len = req->expected_ending_len;
+    if ((ending_len == 0U) || (ending_len > UART_ENGINE_MAX_ENDING_LEN))
+    {
+        return false;
+    }
+
+    uint8_t const last = req->expected_ending_bytes[ending_len - 1U];
+    for (uint16_t end = eng->rx_scanned; end < eng->rx_got; end++)
+    {
+        if ((end + 1U < ending_len) || (rx_ring_at(eng, (uint16_t)(eng->rx_frame_start + end)) != last))
+        {
+            continue;
+        }
+
+        uint16_t const begin = (uint16_t)(eng->rx_frame_start + end + 1U - ending_len);
+        uint8_t i = 0U;
+        while ((i < ending_len) && (rx_ring_at(eng, (uint16_t)(begin + i)) == req->expected_ending_bytes[i]))
+        {
+            i++;
+        }
+        if (i == ending_len)
+        {
+            eng->rx_frame_len = (uint16_t)(end + 1U);
+            return true;
+        }
+    }
+
+    eng->rx_scanned = eng->rx_got;
+    return false;
+}
+
+// Argument for req->process_fn: the bound field of this unit's telemetry
+// block, or out_value as given.
+static void *engine_out_value(const uart_engine_unit_t *eng, const uart_engine_request_t *req)
+{
+    if (!req->out_field)
+    {
+        return req->out_value;
+    }
+
+    return (uint8_t *)&g_ups[eng->unit] + req->out_offset;
+}
+
+// Ends the active job. A job handed back to the queue for a retry has
+// eng->active.req cleared first, so its pooled request stays allocated.
+static void active_clear(uart_engine_unit_t *eng)
+{
+    request_release(eng, eng->active.req);
+    (void)memset(&eng->active, 0, sizeof(eng->active));
+    eng->active_cmd = NULL;
+    eng->tx_sent = 0U;
+    rx_frame_reset(eng);
+    eng->rx_use_pattern = false;
+}
+
+static uint32_t hb_interval_ms(const uart_engine_unit_t *eng)
+{
+    return (eng->hb_cfg.interval_ms != 0U) ? eng->hb_cfg.interval_ms : 1000U;
+}
+
+// Any accepted reply proves the link: the heartbeat is only sent after a
+// full interval without one.
+static void hb_on_success(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    eng->hb_consecutive_failures = 0U;
+    g_ups[eng->unit].present_status.comm_lost = false;
+    if (eng->hb_enabled && !eng->hb_queued_or_active)
+    {
+        eng->hb_next_due_ms = now_ms + hb_interval_ms(eng);
+    }
+}
+
+// Report the end of a job to its tracking slot or completion callback.
+static void job_complete(uart_engine_unit_t *eng, const uart_engine_job_t *job, uart_engine_result_t result)
+{
+    tracked_complete(tracked_slot(eng, job->req), result);
+    if (job->done_fn != NULL)
+    {
+        job->done_fn(0U, result, job->done_ctx);
+    }
+}
+
+static void on_job_success(uart_engine_unit_t *eng, const uart_engine_job_t *job)
+{
+    if (job == NULL)
+    {
+        return;
+    }
+
+    job_complete(eng, job, UART_ENGINE_OK);
+}
+
+static void on_job_final_failure(uart_engine_unit_t *eng, const uart_engine_job_t *job)
+{
+    if (job == NULL)
+    {
+        return;
+    }
+
+    breaker_on_failure(eng, engine_now_ms());
+    job_complete(eng, job, UART_ENGINE_ERR_FAILED);
+    if (!job->is_heartbeat)
+    {
+        return;
+    }
+
+    if (eng->hb_consecutive_failures < 255U)
+    {
+        eng->hb_consecutive_failures++;
+    }
+
+    uint8_t threshold = eng->hb_cfg.failure_threshold;
+    if (threshold == 0U)
+    {
+        threshold = 5U;
+    }
+
+    if (eng->hb_consecutive_failures < threshold)
+    {
+        return;
+    }
+
+    ups_telemetry_t *t = &g_ups[eng->unit];
+    t->present_status.comm_lost = true;
+    if (eng->hb_cfg.battery_failsafe)
+    {
+        t->battery.remaining_capacity = 1U;
+        t->battery.remaining_time_limit_s = 1U;
+        t->present_status.fully_charged = false;
+        t->present_status.below_remaining_capacity_limit = true;
+        t->present_status.shutdown_imminent = true;
+        t->present_status.charging = false;
+        t->present_status.discharging = true;
+        t->present_status.ac_present = false;
+    }
+}
+
+static void engine_unit_init(uart_engine_unit_t *eng, uint8_t unit)
+{
+    (void)memset(eng, 0, sizeof(*eng));
+    eng->unit = unit;
+    eng->rings[UART_ENGINE_PRIO_CRITICAL] = (uart_engine_ring_t){eng->queue_critical, (uint8_t)UART_ENGINE_QUEUE_SIZE_CRITICAL, 0U, 0U, 0U};
+    eng->rings[UART_ENGINE_PRIO_INTERACTIVE] = (uart_engine_ring_t){eng->queue_interactive, (uint8_t)UART_ENGINE_QUEUE_SIZE_INTERACTIVE, 0U, 0U, 0U};
+    eng->rings[UART_ENGINE_PRIO_BACKGROUND] = (uart_engine_ring_t){eng->queue, (uint8_t)UART_ENGINE_QUEUE_SIZE, 0U, 0U, 0U};
+
+    queue_reset_all(eng);
+    (void)memset(eng->class_stats, 0, sizeof(eng->class_stats));
+    post_ring_init(&eng->post);
+
+    (void)memset(eng->state_ms, 0, sizeof(eng->state_ms));
+    (void)memset(eng->busy_slot_ms, 0, sizeof(eng->busy_slot_ms));
+    eng->acct_ms = engine_now_ms();
+    eng->busy_slot_start_ms = eng->acct_ms;
+    eng->busy_slot = 0U;
+    eng->busy_slots_filled = 0U;
+
+    eng->state = UART_ENGINE_STATE_IDLE;
+    eng->state_start_ms = 0U;
+    eng->retry_not_before_ms = 0U;
+    eng->retry_not_before_armed = false;
+
+    eng->rng = 0x9E3779B9U ^ ((uint32_t)unit << 16) ^ eng->acct_ms;
+    eng->rng = (eng->rng == 0U) ? 1U : eng->rng;
+    eng->link_fail_streak = 0U;
+
+    eng->hb_enabled = false;
+    (void)memset(&eng->hb_cfg, 0, sizeof(eng->hb_cfg));
+    eng->hb_next_due_ms = 0U;
+    eng->hb_consecutive_failures = 0U;
+    eng->hb_queued_or_active = false;
+    eng->stats_heartbeats = 0U;
+
+    eng->enabled = true;
+    active_clear(eng);
+}
+
+void uart_engine_init(void)
+{
+    for (uint8_t unit = 0U; unit < (uint8_t)UPS_UNIT_COUNT; unit++)
+    {
+        engine_unit_init(&s_units[unit], unit);
+    }
+}
+
+// Completion callbacks of the static jobs still pending when the queues are
+// flushed (engine disabled).
+static void queue_drop_callbacks(uart_engine_unit_t *eng)
+{
+    if ((eng->active.req != NULL) && (eng->active.done_fn != NULL))
+    {
+        eng->active.done_fn(0U, UART_ENGINE_ERR_DISABLED, eng->active.done_ctx);
+    }
+
+    for (uint8_t c = 0U; c < (uint8_t)UART_ENGINE_PRIO_COUNT; c++)
+    {
+        uart_engine_ring_t const *ring = &eng->rings[c];
+        for (uint8_t i = 0U; i < ring->count; i++)
+        {
+            uart_engine_job_t const *job = &ring->slots[(uint8_t)((ring->head + i) % ring->size)];
+            if (job->done_fn != NULL)
+            {
+                job->done_fn(0U, UART_ENGINE_ERR_DISABLED, job->done_ctx);
+            }
+        }
+    }
+}
+
+static void uart_engine_reset_internal(uart_engine_unit_t *eng)
+{
+    bus_account(eng, engine_now_ms());
+    queue_drop_callbacks(eng);
+    queue_reset_all(eng);
+    tracked_drop_all(eng);
+    while (post_ring_peek(&eng->post) != NULL)
+    {
+        post_ring_release(&eng->post);
+    }
+
+    eng->state = UART_ENGINE_STATE_IDLE;
+    eng->state_start_ms = 0U;
+    eng->retry_not_before_ms = 0U;
+    eng->retry_not_before_armed = false;
+
+    eng->hb_enabled = false;
+    (void)memset(&eng->hb_cfg, 0, sizeof(eng->hb_cfg));
+    eng->hb_next_due_ms = 0U;
+    eng->hb_consecutive_failures = 0U;
+    eng->hb_queued_or_active = false;
+
+    active_clear(eng);
+    UART2_Unlock(eng->unit);
+}
+
+void uart_engine_set_enabled(uint8_t unit, bool enable)
+{
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if ((eng == NULL) || (enable == eng->enabled))
+    {
+        return;
+    }
+
+    eng->enabled = enable;
+    if (!eng->enabled)
+    {
+        uart_engine_reset_internal(eng);
+    }
+}
+
+bool uart_engine_is_enabled(uint8_t unit)
+{
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    return (eng != NULL) && eng->enabled;
+}
+
+bool uart_engine_is_busy(uint8_t unit)
+{
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    if (eng == NULL)
+    {
+        return false;
+    }
+
+    return (eng->state != UART_ENGINE_STATE_IDLE) || (eng->q_count != 0U);
+}
+
+uart_engine_result_t uart_engine_enqueue(uint8_t unit, const uart_engine_request_t *req, uart_engine_priority_t prio)
+{
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if (eng == NULL)
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (!eng->enabled)
+    {
+        return UART_ENGINE_ERR_DISABLED;
+    }
+
+    if (!request_is_valid(req) || ((unsigned)prio >= (unsigned)UART_ENGINE_PRIO_COUNT))
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (queue_try_merge(eng, req, prio, NULL, NULL))
+    {
+        return UART_ENGINE_OK;
+    }
+
+    const uart_engine_request_t *const pooled = request_pool_alloc(eng, req);
+    if (pooled == NULL)
+    {
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    if (!queue_push(eng, pooled, false, prio))
+    {
+        request_release(eng, pooled);
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    return UART_ENGINE_OK;
+}
+
+uart_engine_result_t uart_engine_enqueue_static(uint8_t unit, const uart_engine_request_t *req, uart_engine_priority_t prio)
+{
+    return uart_engine_enqueue_static_cb(unit, req, prio, NULL, NULL);
+}
+
+uart_engine_result_t uart_engine_enqueue_static_cb(uint8_t unit,
+                                                   const uart_engine_request_t *req,
+                                                   uart_engine_priority_t prio,
+                                                   uart_engine_done_fn done_fn,
+                                                   void *ctx)
+{
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if (eng == NULL)
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (!eng->enabled)
+    {
+        return UART_ENGINE_ERR_DISABLED;
+    }
+
+    if (!request_is_valid(req) || ((unsigned)prio >= (unsigned)UART_ENGINE_PRIO_COUNT))
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (queue_try_merge(eng, req, prio, done_fn, ctx))
+    {
+        return UART_ENGINE_OK;
+    }
+
+    if (!queue_push_cb(eng, req, false, prio, done_fn, ctx))
+    {
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    return UART_ENGINE_OK;
+}
+
+uart_engine_result_t uart_engine_enqueue_transaction(uint8_t unit,
+                                                     const uart_engine_request_t *steps,
+                                                     size_t count,
+                                                     uart_engine_priority_t prio)
+{
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if (eng == NULL)
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (!eng->enabled)
+    {
+        return UART_ENGINE_ERR_DISABLED;
+    }
+
+    if ((steps == NULL) || (count == 0U) || (count > UART_ENGINE_MAX_TXN_STEPS) ||
+        ((unsigned)prio >= (unsigned)UART_ENGINE_PRIO_COUNT))
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    for (size_t i = 0U; i < count; i++)
+    {
+        if (!request_is_valid(&steps[i]))
+        {
+            return UART_ENGINE_ERR_BAD_PARAM;
+        }
+    }
+
+    const uart_engine_request_t *const pooled = txn_pool_alloc(eng, steps, count);
+    if (pooled == NULL)
+    {
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    uart_engine_job_t job;
+    job.req = pooled;
+    job.enqueued_ms = 0U;
+    job.retries_left = steps[0].max_retries;
+    job.prio = (uint8_t)prio;
+    job.waiters = 1U;
+    job.is_heartbeat = false;
+    job.in_txn = true;
+    job.steps_left = (uint8_t)(count - 1U);
+    job.attempts_failed = 0U;
+    job.id = 0U;
+    job.done_fn = NULL;
+    job.done_ctx = NULL;
+    if (!queue_push_job(eng, &job))
+    {
+        request_release(eng, pooled);
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    return UART_ENGINE_OK;
+}
+
+uart_engine_result_t uart_engine_post(uint8_t unit, const uart_engine_request_t *req, uart_engine_priority_t prio)
+{
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if (eng == NULL)
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (!eng->enabled)
+    {
+        return UART_ENGINE_ERR_DISABLED;
+    }
+
+    if (!request_is_valid(req) || ((unsigned)prio >= (unsigned)UART_ENGINE_PRIO_COUNT))
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (!post_ring_push(&eng->post, req, (uint8_t)prio))
+    {
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    UART2_Wake(unit);
+    return UART_ENGINE_OK;
+}
+
+// Handle layout: sequence << 8 | unit << 4 | slot. The sequence is never 0.
+static uart_engine_tracked_t *tracked_from_handle(uart_engine_handle_t handle)
+{
+    uint8_t const unit = (uint8_t)((handle >> 4) & 0x0FU);
+    uint8_t const idx = (uint8_t)(handle & 0x0FU);
+    if ((handle == 0U) || (unit >= (uint8_t)UPS_UNIT_COUNT) || (idx >= (uint8_t)UART_ENGINE_TRACKED_JOBS))
+    {
+        return NULL;
+    }
+
+    uart_engine_tracked_t *tr = &s_units[unit].tracked[idx];
+    return ((tr->handle == handle) && (tr->state != TRACKED_FREE)) ? tr : NULL;
+}
+
+uart_engine_result_t uart_engine_submit(uint8_t unit,
+                                        const uart_engine_request_t *req,
+                                        uart_engine_priority_t prio,
+                                        uart_engine_done_fn done_fn,
+                                        void *ctx,
+                                        uart_engine_handle_t *out_handle)
+{
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if (eng == NULL)
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    if (!eng->enabled)
+    {
+        return UART_ENGINE_ERR_DISABLED;
+    }
+
+    if (!request_is_valid(req) || ((unsigned)prio >= (unsigned)UART_ENGINE_PRIO_COUNT))
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    uart_engine_handle_t handle = 0U;
+
+    portENTER_CRITICAL(&s_tracked_lock);
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_TRACKED_JOBS; i++)
+    {
+        uart_engine_tracked_t *tr = &eng->tracked[i];
+        if (tr->state != TRACKED_FREE)
+        {
+            continue;
+        }
+
+        eng->tracked_seq = (eng->tracked_seq + 1U) & 0x00FFFFFFU;
+        if (eng->tracked_seq == 0U)
+        {
+            eng->tracked_seq = 1U;
+        }
+        handle = (eng->tracked_seq << 8) | ((uint32_t)unit << 4) | (uint32_t)i;
+
+        tr->req = *req;
+        tr->handle = handle;
+        tr->prio = (uint8_t)prio;
+        tr->auto_release = (out_handle == NULL);
+        tr->result = UART_ENGINE_OK;
+        tr->done_fn = done_fn;
+        tr->done_ctx = ctx;
+        tr->waiter = NULL;
+        tr->state = TRACKED_SUBMITTED;
+        break;
+    }
+    portEXIT_CRITICAL(&s_tracked_lock);
+
+    if (handle == 0U)
+    {
+        return UART_ENGINE_ERR_QUEUE_FULL;
+    }
+
+    if (out_handle != NULL)
+    {
+        *out_handle = handle;
+    }
+    UART2_Wake(unit);
+    return UART_ENGINE_OK;
+}
+
+uart_engine_result_t uart_engine_job_wait(uart_engine_handle_t handle, uint32_t deadline_ms)
+{
+    TaskHandle_t const self = xTaskGetCurrentTaskHandle();
+
+    for (;;)
+    {
+        uart_engine_result_t result = UART_ENGINE_ERR_TIMEOUT;
+        bool done = false;
+
+        portENTER_CRITICAL(&s_tracked_lock);
+        uart_engine_tracked_t *tr = tracked_from_handle(handle);
+        if ((tr == NULL) || (tr->state == TRACKED_ABANDONED))
+        {
+            result = UART_ENGINE_ERR_BAD_PARAM;
+            done = true;
+        }
+        else if (tr->state == TRACKED_COMPLETE)
+        {
+            result = tr->result;
+            tr->state = TRACKED_FREE;
+            done = true;
+        }
+        else
+        {
+            tr->waiter = self;
+        }
+        portEXIT_CRITICAL(&s_tracked_lock);
+
+        if (done)
+        {
+            return result;
+        }
+
+        uint32_t const remaining_ms = ms_until(engine_now_ms(), deadline_ms);
+        if ((remaining_ms == 0U) || (self == s_engine_task))
+        {
+            portENTER_CRITICAL(&s_tracked_lock);
+            tr = tracked_from_handle(handle);
+            if ((tr != NULL) && (tr->waiter == self))
+            {
+                tr->waiter = NULL;
+            }
+            portEXIT_CRITICAL(&s_tracked_lock);
+            // Blocking here would stall the engine that has to finish the job.
+            return (remaining_ms == 0U) ? UART_ENGINE_ERR_TIMEOUT : UART_ENGINE_ERR_BAD_PARAM;
+        }
+
+        TickType_t ticks = pdMS_TO_TICKS(remaining_ms);
+        (void)ulTaskNotifyTakeIndexed(UART_ENGINE_NOTIFY_INDEX, pdTRUE, (ticks == 0) ? 1 : ticks);
+    }
+}
+
+void uart_engine_job_cancel(uart_engine_handle_t handle)
+{
+    TaskHandle_t const self = xTaskGetCurrentTaskHandle();
+    bool in_process = false;
+
+    portENTER_CRITICAL(&s_tracked_lock);
+    uart_engine_tracked_t *tr = tracked_from_handle(handle);
+    if (tr != NULL)
+    {
+        switch (tr->state)
+        {
+        case TRACKED_SUBMITTED:
+        case TRACKED_COMPLETE:
+            tr->state = TRACKED_FREE;
+            break;
+        case TRACKED_QUEUED:
+            // Still referenced by a queue slot or the active job.
+            tr->state = TRACKED_ABANDONED;
+            tr->waiter = NULL;
+            break;
+        case TRACKED_PROCESSING:
+            // The engine frees the slot once process_fn returns and notifies us.
+            tr->state = TRACKED_ABANDONED;
+            tr->waiter = (self == s_engine_task) ? NULL : self;
+            in_process = (self != s_engine_task);
+            break;
+        default:
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_tracked_lock);
+
+    // out_value may be written until then, so the caller must not free it yet.
+    while (in_process)
+    {
+        (void)ulTaskNotifyTakeIndexed(UART_ENGINE_NOTIFY_INDEX, pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&s_tracked_lock);
+        in_process = (tr->handle == handle) && (tr->state == TRACKED_ABANDONED) && (tr->waiter == self);
+        portEXIT_CRITICAL(&s_tracked_lock);
+    }
+}
+
+uart_engine_result_t uart_engine_submit_and_wait(uint8_t unit,
+                                                 const uart_engine_request_t *req,
+                                                 uart_engine_priority_t prio,
+                                                 uint32_t deadline_ms)
+{
+    if (xTaskGetCurrentTaskHandle() == s_engine_task)
+    {
+        return UART_ENGINE_ERR_BAD_PARAM;
+    }
+
+    uart_engine_handle_t handle = 0U;
+    uart_engine_result_t result = uart_engine_submit(unit, req, prio, NULL, NULL, &handle);
+    if (result != UART_ENGINE_OK)
     {
-        printf(" (empty)\r\n");
-        return;
+        return result;
     }
 
-    printf(" data=");
-    for (uint16_t i = 0U; i < rx_len; i++)
+    result = uart_engine_job_wait(handle, deadline_ms);
+    if (result == UART_ENGINE_ERR_TIMEOUT)
     {
-        printf("%02X", rx[i]);
-        if ((uint16_t)(i + 1U) < rx_len)
-        {
-            printf(" ");
-        }
+        uart_engine_job_cancel(handle);
     }
-    printf("\r\n");
+    return result;
 }
 
-static void uart_engine_debug_print_failure(const uart_engine_job_t *job, const char *reason)
+void uart_engine_set_heartbeat(uint8_t unit, const uart_engine_heartbeat_cfg_t *cfg)
 {
-    if (!g_ups_debug_status_print_enabled || (job == NULL))
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if ((eng == NULL) || !eng->enabled)
     {
         return;
     }
 
-    printf("UART_ENG failure: %s cmd=0x%04X hb=%u retries_left=%u q=%u\r\n",
-           (reason != NULL) ? reason : "unknown",
-           (unsigned int)job->req.cmd,
-           job->is_heartbeat ? 1U : 0U,
-           (unsigned int)job->retries_left,
-           (unsigned int)s_q_count);
-}
-
-static void uart_engine_debug_print_retry(const uart_engine_job_t *job, const char *reason)
-{
-    if (!g_ups_debug_status_print_enabled || (job == NULL))
+    if (cfg == NULL)
     {
+        eng->hb_enabled = false;
+        eng->hb_queued_or_active = false;
+        eng->hb_consecutive_failures = 0U;
         return;
     }
 
-    printf("UART_ENG retry: %s cmd=0x%04X hb=%u retries_left=%u q=%u\r\n",
-           (reason != NULL) ? reason : "unknown",
-           (unsigned int)job->req.cmd,
-           job->is_heartbeat ? 1U : 0U,
-           (unsigned int)job->retries_left,
-           (unsigned int)s_q_count);
-}
-
-static void uart_engine_debug_print_timeout(const uart_engine_job_t *job,
-                                            const char *phase,
-                                            uint32_t elapsed_ms,
-                                            uint32_t timeout_ms)
-{
-    if (!g_ups_debug_status_print_enabled || (job == NULL))
+    eng->hb_cfg = *cfg;
+    if (!request_is_valid(&eng->hb_cfg.req))
     {
+        eng->hb_enabled = false;
         return;
     }
 
-    printf("UART_ENG timeout: %s cmd=0x%04X hb=%u elapsed=%lu timeout=%lu retries_left=%u\r\n",
-           (phase != NULL) ? phase : "unknown",
-           (unsigned int)job->req.cmd,
-           job->is_heartbeat ? 1U : 0U,
-           (unsigned long)elapsed_ms,
-           (unsigned long)timeout_ms,
-           (unsigned int)job->retries_left);
-}
-
-static bool queue_is_full(void)
-{
-    return (s_q_count >= UART_ENGINE_QUEUE_SIZE);
-}
-
-static bool queue_push(const uart_engine_request_t *req, bool is_heartbeat)
-{
-    if ((req == NULL) || queue_is_full())
+    if (eng->hb_cfg.failure_threshold == 0U)
     {
-        return false;
+        eng->hb_cfg.failure_threshold = 5U;
     }
 
-    s_queue[s_q_tail].req = *req;
-    s_queue[s_q_tail].retries_left = req->max_retries;
-    s_queue[s_q_tail].is_heartbeat = is_heartbeat;
+    eng->hb_enabled = true;
+    eng->hb_next_due_ms = engine_now_ms() + hb_interval_ms(eng);
+    eng->hb_consecutive_failures = 0U;
+    eng->hb_queued_or_active = false;
+}
 
-    s_q_tail = (uint8_t)((s_q_tail + 1U) % UART_ENGINE_QUEUE_SIZE);
-    s_q_count++;
-    return true;
+size_t uart_engine_cmd_stats_count(uint8_t unit)
+{
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    return (eng != NULL) ? (size_t)eng->cmd_count : 0U;
 }
 
-static bool queue_pop(uart_engine_job_t *out)
+bool uart_engine_get_cmd_stats(uint8_t unit, size_t index, uart_engine_cmd_stats_t *out)
 {
-    if ((out == NULL) || (s_q_count == 0U))
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    if ((eng == NULL) || (out == NULL) || (index >= (size_t)eng->cmd_count))
     {
         return false;
     }
 
-    *out = s_queue[s_q_head];
-    s_q_head = (uint8_t)((s_q_head + 1U) % UART_ENGINE_QUEUE_SIZE);
-    s_q_count--;
+    uart_engine_cmd_entry_t const *e = &eng->cmd_table[index];
+    *out = e->stats;
+    out->srtt_ms = e->srtt_x8 >> 3;
+    out->rttvar_ms = e->rttvar_x4 >> 2;
+    out->rx_timeout_ms = cmd_rx_timeout_ms(e, e->ceiling_ms);
+    out->probe_in_ms = (e->stats.breaker == UART_ENGINE_BREAKER_OPEN) ? ms_until(engine_now_ms(), e->probe_at_ms) : 0U;
     return true;
 }
 
-static uint16_t build_cmd_bytes(uint8_t *tx, uint16_t tx_cap, uint16_t cmd, uint8_t cmd_bits)
+void uart_engine_get_bus_stats(uint8_t unit, uart_engine_bus_stats_t *out)
 {
-    if ((tx == NULL) || (tx_cap == 0U))
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if ((eng == NULL) || (out == NULL))
     {
-        return 0U;
+        return;
     }
 
-    if (cmd_bits == 8U)
-    {
-        if (tx_cap < 1U)
-        {
-            return 0U;
-        }
-        tx[0] = (uint8_t)(cmd & 0xFFU);
-        return 1U;
-    }
+    bus_account(eng, engine_now_ms());
+    (void)memcpy(out->state_ms, eng->state_ms, sizeof(out->state_ms));
 
-    if (cmd_bits == 16U)
+    // Completed slots only; the current one is still filling.
+    uint32_t busy_ms = 0U;
+    uint8_t counted = 0U;
+    for (uint8_t i = 1U; (i <= (uint8_t)UART_ENGINE_BUSY_SLOTS) && (counted < eng->busy_slots_filled); i++)
     {
-        if (tx_cap < 2U)
+        uint8_t const slot = (uint8_t)((eng->busy_slot + UART_ENGINE_BUSY_SLOTS - i) % UART_ENGINE_BUSY_SLOTS);
+        if (slot == eng->busy_slot)
         {
-            return 0U;
+            break;
         }
-        tx[0] = (uint8_t)((cmd >> 8) & 0xFFU);
-        tx[1] = (uint8_t)(cmd & 0xFFU);
-        return 2U;
+        busy_ms += eng->busy_slot_ms[slot];
+        counted++;
     }
 
-    return 0U;
+    out->oob_bytes = eng->oob_bytes;
+    out->post_rejected = atomic_load_explicit(&eng->post.rejected, memory_order_relaxed);
+    out->heartbeats = eng->stats_heartbeats;
+    out->turnarounds = eng->turnarounds;
+    out->turnaround_sum_us = eng->turnaround_sum_us;
+    out->turnaround_max_us = eng->turnaround_max_us;
+    out->busy_window_ms = (uint32_t)counted * UART_ENGINE_BUSY_SLOT_MS;
+    out->busy_percent = (out->busy_window_ms != 0U) ? (uint8_t)((busy_ms * 100U) / out->busy_window_ms) : 0U;
 }
 
-static bool request_is_valid(const uart_engine_request_t *req)
+bool uart_engine_get_class_stats(uint8_t unit, uart_engine_priority_t prio, uart_engine_class_stats_t *out)
 {
-    if (req == NULL)
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    if ((eng == NULL) || (out == NULL) || ((unsigned)prio >= (unsigned)UART_ENGINE_PRIO_COUNT))
     {
         return false;
     }
 
-    if ((req->cmd_bits != 8U) && (req->cmd_bits != 16U))
-    {
-        return false;
-    }
+    *out = eng->class_stats[prio];
+    return true;
+}
 
-    if (req->expected_len > UART_ENGINE_MAX_EXPECTED_LEN)
+uint16_t uart_engine_span_copy(const uart_engine_span_t *span, uint8_t *dst, uint16_t cap)
+{
+    if ((span == NULL) || (dst == NULL))
     {
-        return false;
+        return 0U;
     }
 
-    if (req->expected_ending)
+    uint16_t n = 0U;
+    for (uint8_t seg = 0U; (seg < 2U) && (n < cap); seg++)
     {
-        if ((req->expected_ending_len == 0U) || (req->expected_ending_len > UART_ENGINE_MAX_ENDING_LEN))
+        uint16_t len = span->seg_len[seg];
+        if (len > (uint16_t)(cap - n))
         {
-            return false;
+            len = (uint16_t)(cap - n);
+        }
+        if (len > 0U)
+        {
+            memcpy(&dst[n], span->seg[seg], len);
+            n = (uint16_t)(n + len);
         }
     }
-
-    return true;
+    return n;
 }
 
-static uint16_t request_rx_cap(const uart_engine_request_t *req)
+bool uart_engine_span_equals(const uart_engine_span_t *span, const uint8_t *bytes, uint16_t len)
 {
-    if (req == NULL)
+    if ((span == NULL) || (uart_engine_span_len(span) != len))
     {
-        return 0U;
+        return false;
     }
 
-    if (!req->expected_ending)
+    if (len == 0U)
     {
-        return req->expected_len;
+        return true;
     }
 
-    if (req->expected_len == 0U)
+    if (bytes == NULL)
     {
-        return UART_ENGINE_MAX_EXPECTED_LEN;
+        return false;
     }
 
-    return req->expected_len;
+    uint16_t const first = span->seg_len[0];
+    return (memcmp(span->seg[0], bytes, first) == 0) &&
+           ((span->seg_len[1] == 0U) || (memcmp(span->seg[1], &bytes[first], span->seg_len[1]) == 0));
 }
 
-static bool rx_has_expected_ending(const uart_engine_request_t *req, const uint8_t *rx, uint16_t rx_len)
+bool uart_engine_process_expect_exact(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
 {
-    if ((req == NULL) || !req->expected_ending)
-    {
-        return false;
-    }
+    (void)cmd;
 
-    uint8_t const ending_len = req->expected_ending_len;
-    if ((ending_len == 0U) || (ending_len > UART_ENGINE_MAX_ENDING_LEN) || (rx == NULL) || (rx_len < ending_len))
+    const uart_engine_expect_bytes_t *exp = (const uart_engine_expect_bytes_t *)out_value;
+    if ((exp == NULL) || (exp->expected == NULL))
     {
         return false;
     }
 
-    return (memcmp(&rx[rx_len - ending_len], req->expected_ending_bytes, ending_len) == 0);
-}
-
-static void active_clear(void)
-{
-    (void)memset(&s_active, 0, sizeof(s_active));
-    s_rx_got = 0U;
-}
-
-static void on_job_success(const uart_engine_job_t *job)
-{
-    if ((job != NULL) && job->is_heartbeat)
-    {
-        s_hb_consecutive_failures = 0U;
-    }
+    return uart_engine_span_equals(rx, exp->expected, exp->expected_len);
 }
 
-static void on_job_final_failure(const uart_engine_job_t *job)
+static void maybe_enqueue_heartbeat(uart_engine_unit_t *eng, uint32_t now_ms)
 {
-    if ((job == NULL) || !job->is_heartbeat)
+    if (!eng->hb_enabled || eng->hb_queued_or_active)
     {
         return;
     }
 
-    if (s_hb_consecutive_failures < 255U)
-    {
-        s_hb_consecutive_failures++;
-    }
-
-    uint8_t threshold = s_hb_cfg.failure_threshold;
-    if (threshold == 0U)
+    // A job in flight settles liveness one way or the other first.
+    if ((eng->state != UART_ENGINE_STATE_IDLE) || ((int32_t)(now_ms - eng->hb_next_due_ms) < 0))
     {
-        threshold = 5U;
+        return;
     }
 
-    if (s_hb_consecutive_failures >= threshold)
+    if (queue_push(eng, &eng->hb_cfg.req, true, UART_ENGINE_PRIO_CRITICAL))
     {
-        g_battery.remaining_capacity = 1U;
-        g_battery.remaining_time_limit_s = 1U;
-        g_power_summary_present_status.fully_charged = false;
-        g_power_summary_present_status.below_remaining_capacity_limit = true;
-        g_power_summary_present_status.shutdown_imminent = true;
-        g_power_summary_present_status.charging = false;
-        g_power_summary_present_status.discharging = true;
-        g_power_summary_present_status.ac_present = false;
+        eng->hb_queued_or_active = true;
+        eng->stats_heartbeats++;
+        eng->hb_next_due_ms = now_ms + hb_interval_ms(eng);
     }
 }
 
-void uart_engine_init(void)
-{
-    s_q_head = 0U;
-    s_q_tail = 0U;
-    s_q_count = 0U;
-
-    s_state = UART_ENGINE_STATE_IDLE;
-    s_state_start_ms = 0U;
-    s_retry_not_before_ms = 0U;
-
-    s_hb_enabled = false;
-    (void)memset(&s_hb_cfg, 0, sizeof(s_hb_cfg));
-    s_hb_next_due_ms = 0U;
-    s_hb_consecutive_failures = 0U;
-    s_hb_queued_or_active = false;
-
-    s_enabled = true;
-    active_clear();
-}
-
-static void uart_engine_reset_internal(void)
-{
-    s_q_head = 0U;
-    s_q_tail = 0U;
-    s_q_count = 0U;
-
-    s_state = UART_ENGINE_STATE_IDLE;
-    s_state_start_ms = 0U;
-    s_retry_not_before_ms = 0U;
-
-    s_hb_enabled = false;
-    (void)memset(&s_hb_cfg, 0, sizeof(s_hb_cfg));
-    s_hb_next_due_ms = 0U;
-    s_hb_consecutive_failures = 0U;
-    s_hb_queued_or_active = false;
-
-    active_clear();
-    UART2_Unlock();
-}
-
-void uart_engine_set_enabled(bool enable)
+// Queue the OOB refresh LUT as CRITICAL. Entries already pending are merged;
+// if the ring is full the rest is queued on a later step.
+static void maybe_enqueue_oob_refresh(uart_engine_unit_t *eng)
 {
-    if (enable == s_enabled)
+    if (!eng->oob_refresh_pending)
     {
         return;
     }
 
-    s_enabled = enable;
-    if (!s_enabled)
+    while (eng->oob_refresh_idx < eng->oob_refresh_count)
     {
-        uart_engine_reset_internal();
+        const uart_engine_request_t *req = &eng->oob_refresh_lut[eng->oob_refresh_idx];
+        if (!queue_try_merge(eng, req, UART_ENGINE_PRIO_CRITICAL, NULL, NULL) &&
+            !queue_push(eng, req, false, UART_ENGINE_PRIO_CRITICAL))
+        {
+            return;
+        }
+        eng->oob_refresh_idx++;
     }
-}
-
-bool uart_engine_is_enabled(void)
-{
-    return s_enabled;
-}
 
-bool uart_engine_is_busy(void)
-{
-    return (s_state != UART_ENGINE_STATE_IDLE) || (s_q_count != 0U);
+    eng->oob_refresh_pending = false;
+    eng->oob_refresh_idx = 0U;
 }
 
-uart_engine_result_t uart_engine_enqueue(const uart_engine_request_t *req)
+void uart_engine_set_oob_handler(uint8_t unit,
+                                 uart_engine_oob_fn fn,
+                                 void *ctx,
+                                 const uart_engine_request_t *refresh_lut,
+                                 size_t refresh_count)
 {
-    if (!s_enabled)
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if (eng == NULL)
     {
-        return UART_ENGINE_ERR_DISABLED;
+        return;
     }
 
-    if (!request_is_valid(req))
-    {
-        return UART_ENGINE_ERR_BAD_PARAM;
-    }
+    eng->oob_fn = fn;
+    eng->oob_ctx = ctx;
+    eng->oob_refresh_lut = refresh_lut;
+    eng->oob_refresh_count = (refresh_lut != NULL) ? refresh_count : 0U;
+    eng->oob_refresh_idx = 0U;
+    eng->oob_refresh_pending = false;
+}
 
-    if (!queue_push(req, false))
+static bool tracked_submitted(const uart_engine_unit_t *eng)
+{
+    for (uint8_t i = 0U; i < (uint8_t)UART_ENGINE_TRACKED_JOBS; i++)
     {
-        return UART_ENGINE_ERR_QUEUE_FULL;
+        if (eng->tracked[i].state == TRACKED_SUBMITTED)
+        {
+            return true;
+        }
     }
 
-    return UART_ENGINE_OK;
+    return false;
 }
 
-void uart_engine_set_heartbeat(const uart_engine_heartbeat_cfg_t *cfg)
+uint32_t uart_engine_time_to_next_ms(uint8_t unit, uint32_t now_ms)
 {
-    if (!s_enabled)
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    if ((eng == NULL) || !eng->enabled)
     {
-        return;
+        return UINT32_MAX;
     }
 
-    if (cfg == NULL)
+    uint32_t next = UINT32_MAX;
+    if (eng->hb_enabled && !eng->hb_queued_or_active && (eng->state == UART_ENGINE_STATE_IDLE))
     {
-        s_hb_enabled = false;
-        s_hb_queued_or_active = false;
-        s_hb_consecutive_failures = 0U;
-        return;
+        next = ms_until(now_ms, eng->hb_next_due_ms);
     }
 
-    s_hb_cfg = *cfg;
-    if (!request_is_valid(&s_hb_cfg.req))
+    uint32_t state_next = UINT32_MAX;
+    switch (eng->state)
     {
-        s_hb_enabled = false;
-        return;
+    case UART_ENGINE_STATE_IDLE:
+        if ((eng->q_count != 0U) || tracked_submitted(eng) || (post_ring_peek(&eng->post) != NULL))
+        {
+            state_next = 0U;
+        }
+        break;
+    case UART_ENGINE_STATE_TX_WAIT:
+        // TX completion has no event; poll at the next opportunity.
+        state_next = 1U;
+        break;
+    case UART_ENGINE_STATE_RX_WAIT:
+        state_next = ms_until(now_ms, eng->state_start_ms + eng->active_timeout_ms);
+        break;
+    default:
+        state_next = 0U;
+        break;
     }
 
-    if (s_hb_cfg.failure_threshold == 0U)
+    if (state_next != UINT32_MAX)
     {
-        s_hb_cfg.failure_threshold = 5U;
+        uint32_t const not_before = eng->retry_not_before_armed ? ms_until(now_ms, eng->retry_not_before_ms) : 0U;
+        if (state_next < not_before)
+        {
+            state_next = not_before;
+        }
     }
 
-    s_hb_enabled = true;
-    s_hb_next_due_ms = engine_now_ms();
-    s_hb_consecutive_failures = 0U;
-    s_hb_queued_or_active = false;
+    return (state_next < next) ? state_next : next;
 }
 
-bool uart_engine_process_expect_exact(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value)
+bool uart_engine_wants_rx(uint8_t unit)
 {
-    (void)cmd;
-
-    const uart_engine_expect_bytes_t *exp = (const uart_engine_expect_bytes_t *)out_value;
-    if ((exp == NULL) || (exp->expected == NULL))
+    uart_engine_unit_t const *eng = engine_unit(unit);
+    if ((eng == NULL) || !eng->enabled)
     {
         return false;
     }
 
-    if (rx_len != exp->expected_len)
-    {
-        return false;
-    }
+    // Idle bytes are drained through the OOB handler, so they are worth a wakeup.
+    return (eng->state == UART_ENGINE_STATE_RX_WAIT) ||
+           ((eng->state == UART_ENGINE_STATE_IDLE) && (eng->oob_fn != NULL));
+}
 
-    if ((rx == NULL) && (rx_len != 0U))
+// Send the active step again without releasing the UART.
+static void txn_retry_step(uart_engine_unit_t *eng, uint32_t now_ms, const char *reason)
+{
+    eng->active.retries_left--;
+    eng->active.attempts_failed++;
+    uart_engine_debug_print_retry(eng, &eng->active, reason);
+    if (eng->active_cmd != NULL)
     {
-        return false;
+        eng->active_cmd->stats.retry++;
     }
 
-    return (memcmp(rx, exp->expected, rx_len) == 0);
+    eng->tx_sent = 0U;
+    eng->state = UART_ENGINE_STATE_TX_START;
+    eng->state_start_ms = now_ms;
+    arm_retry_cooldown(eng, now_ms);
 }
 
-static void maybe_enqueue_heartbeat(uint32_t now_ms)
+// Step done: the next one follows under the same UART lock.
+static void txn_next_step(uart_engine_unit_t *eng, uint32_t now_ms)
 {
-    if (!s_hb_enabled || s_hb_queued_or_active)
-    {
-        return;
-    }
+    eng->active.req++;
+    eng->active.steps_left--;
+    eng->active.retries_left = eng->active.req->max_retries;
+    eng->active.attempts_failed = 0U;
+    eng->active.id = 0U;
+
+    eng->tx_sent = 0U;
+    eng->state = UART_ENGINE_STATE_TX_START;
+    eng->state_start_ms = now_ms;
+    apply_interjob_cooldown(eng, now_ms);
+}
 
-    if ((int32_t)(now_ms - s_hb_next_due_ms) < 0)
+static void job_finish_failure(uart_engine_unit_t *eng, uint32_t now_ms, const char *reason)
+{
+    uart_trace_end(eng->unit, eng->active.id, UART_TRACE_END_FAILED);
+    if (eng->active.in_txn && (eng->active.retries_left > 0U))
     {
+        txn_retry_step(eng, now_ms, reason);
         return;
     }
 
-    if (queue_push(&s_hb_cfg.req, true))
-    {
-        s_hb_queued_or_active = true;
-
-        uint32_t interval = s_hb_cfg.interval_ms;
-        if (interval == 0U)
-        {
-            interval = 1000U;
-        }
-        s_hb_next_due_ms = now_ms + interval;
-    }
-}
-
-static void job_finish_failure(uint32_t now_ms, const char *reason)
-{
-    UART2_Unlock();
-
-    if (s_active.retries_left > 0U)
+    UART2_Unlock(eng->unit);
+    if (eng->active.retries_left > 0U)
     {
-        s_active.retries_left--;
-        if (queue_push(&s_active.req, s_active.is_heartbeat))
+        eng->active.retries_left--;
+        eng->active.attempts_failed++;
+        if (queue_push_job(eng, &eng->active))
         {
-            uart_engine_debug_print_retry(&s_active, reason);
-            s_retry_not_before_ms = now_ms + UART_ENGINE_RETRY_COOLDOWN_MS;
+            uart_engine_debug_print_retry(eng, &eng->active, reason);
+            arm_retry_cooldown(eng, now_ms);
+            if (eng->active_cmd != NULL)
+            {
+                eng->active_cmd->stats.retry++;
+            }
+            eng->active.req = NULL;
         }
         else
         {
-            uart_engine_debug_print_failure(&s_active, "retry enqueue failed");
-            on_job_final_failure(&s_active);
-            if (s_active.is_heartbeat)
+            uart_engine_debug_print_failure(eng, &eng->active, "retry enqueue failed");
+            on_job_final_failure(eng, &eng->active);
+            if (eng->active.is_heartbeat)
             {
-                s_hb_queued_or_active = false;
+                eng->hb_queued_or_active = false;
             }
         }
     }
     else
     {
-        uart_engine_debug_print_failure(&s_active, reason);
-        on_job_final_failure(&s_active);
-        if (s_active.is_heartbeat)
+        uart_engine_debug_print_failure(eng, &eng->active, reason);
+        on_job_final_failure(eng, &eng->active);
+        if (eng->active.is_heartbeat)
         {
-            s_hb_queued_or_active = false;
+            eng->hb_queued_or_active = false;
         }
     }
 
-    s_state = UART_ENGINE_STATE_IDLE;
-    apply_interjob_cooldown(now_ms);
-    active_clear();
+    eng->state = UART_ENGINE_STATE_IDLE;
+    apply_interjob_cooldown(eng, now_ms);
+    active_clear(eng);
+}
+
+// The command is out (or, zero-gap, still wire_ms on the wire): wait for the
+// reply. The RX timeout covers the remaining wire time on top.
+static void enter_rx_wait(uart_engine_unit_t *eng, uint32_t now_ms, uint32_t wire_ms)
+{
+    eng->state = UART_ENGINE_STATE_RX_WAIT;
+    eng->state_start_ms = now_ms;
+    eng->rx_wire_ms = wire_ms;
+    rx_frame_reset(eng);
+    eng->rx_use_pattern = request_uses_hw_pattern(eng, eng->active.req);
+    eng->active_timeout_ms = wire_ms + cmd_rx_timeout_ms((eng->active_cmd != &eng->cmd_other) ? eng->active_cmd : NULL,
+                                                         eng->active.req->timeout_ms);
+}
+
+// Hand the rest of the command to the UART, or only its next byte when the
+// request asks for gaps between bytes.
+static void tx_send_next(uart_engine_unit_t *eng, uint32_t now_ms)
+{
+    uint16_t const remaining = (uint16_t)(eng->tx_len - eng->tx_sent);
+    uint16_t const len = (eng->active.req->tx_gap_ms != 0U) ? 1U : remaining;
+    const uint8_t *const data = &eng->tx_data[eng->tx_sent];
+
+    UART2_TxDoneClear(eng->unit);
+    uart_trace_tx(eng->unit, eng->active.id, data, len);
+    if (UART2_SendBytesDMA(eng->unit, data, len) != ESP_OK)
+    {
+        cmd_note_failure(eng->active_cmd, UART_ENGINE_FAIL_TX);
+        job_finish_failure(eng, now_ms, "tx start failed");
+        return;
+    }
+
+    eng->tx_sent = (uint16_t)(eng->tx_sent + len);
+#if (UART_ENGINE_ZERO_GAP != 0)
+    if (eng->active.req->tx_gap_ms == 0U)
+    {
+        // Whole command queued in one piece: nothing left to pace.
+        enter_rx_wait(eng, now_ms, engine_wire_ms(len));
+        return;
+    }
+#endif
+    eng->state = UART_ENGINE_STATE_TX_WAIT;
+    eng->state_start_ms = now_ms;
 }
 
-static void job_start_tx(uint32_t now_ms)
+static void job_start_tx(uart_engine_unit_t *eng, uint32_t now_ms)
 {
-    uint16_t const tx_len = build_cmd_bytes(s_tx_buf,
-                                            (uint16_t)sizeof(s_tx_buf),
-                                            s_active.req.cmd,
-                                            s_active.req.cmd_bits);
-    if (tx_len == 0U)
+    uart_engine_tracked_t *const tr = tracked_slot(eng, eng->active.req);
+    if ((tr != NULL) && !tracked_advance(tr, TRACKED_QUEUED, TRACKED_QUEUED))
     {
-        job_finish_failure(now_ms, "build tx bytes failed");
+        // Waiter gave up before the command went out.
+        UART2_Unlock(eng->unit);
+        eng->state = UART_ENGINE_STATE_IDLE;
+        eng->turnaround_pending = eng->turnaround_pending && (eng->q_count != 0U);
+        active_clear(eng);
         return;
     }
 
-    UART2_DiscardBuffered();
-    UART2_TxDoneClear();
-    UPS_DebugPrintTxCommand(s_tx_buf, tx_len);
+    eng->active_cmd = cmd_lookup(eng, eng->active.req, true);
+    if (eng->active_cmd == NULL)
+    {
+        eng->active_cmd = &eng->cmd_other;
+    }
+    if (!breaker_admit(eng, eng->active_cmd, now_ms))
+    {
+        // Suspended: complete the job (and skip a transaction's remaining
+        // steps) without touching the bus.
+        eng->active_cmd->stats.suspended++;
+        UART2_Unlock(eng->unit);
+        job_complete(eng, &eng->active, UART_ENGINE_ERR_SUSPENDED);
+        eng->state = UART_ENGINE_STATE_IDLE;
+        eng->turnaround_pending = eng->turnaround_pending && (eng->q_count != 0U);
+        active_clear(eng);
+        return;
+    }
+    eng->active_cmd->ceiling_ms = eng->active.req->timeout_ms;
+    eng->tx_start_ms = now_ms;
+    if (eng->active.id == 0U)
+    {
+        eng->last_job_id = (uint16_t)((eng->last_job_id == UINT16_MAX) ? 1U : (eng->last_job_id + 1U));
+        eng->active.id = eng->last_job_id;
+    }
 
-    if (UART2_SendBytesDMA(s_tx_buf, tx_len) != ESP_OK)
+    const uart_engine_request_t *const req = eng->active.req;
+    if (req->tx_bytes != NULL)
+    {
+        eng->tx_data = req->tx_bytes;
+        eng->tx_len = req->tx_len;
+    }
+    else
+    {
+        eng->tx_data = eng->tx_buf;
+        eng->tx_len = build_cmd_bytes(eng->tx_buf, (uint16_t)sizeof(eng->tx_buf), req->cmd, req->cmd_bits);
+    }
+    eng->tx_sent = 0U;
+    if (eng->tx_len == 0U)
     {
-        job_finish_failure(now_ms, "tx start failed");
+        cmd_note_failure(eng->active_cmd, UART_ENGINE_FAIL_TX);
+        job_finish_failure(eng, now_ms, "build tx bytes failed");
         return;
     }
 
-    s_state = UART_ENGINE_STATE_TX_WAIT;
-    s_state_start_ms = now_ms;
+    rx_drain_oob(eng);
+    UPS_DebugPrintTxCommand(eng->unit, eng->tx_data, eng->tx_len);
+    turnaround_sample(eng);
+    tx_send_next(eng, now_ms);
 }
 
-void uart_engine_tick(void)
+void uart_engine_tick(uint8_t unit)
 {
-    if (!s_enabled)
+    uart_engine_unit_t *eng = engine_unit(unit);
+    if ((eng == NULL) || !eng->enabled)
     {
         return;
     }
 
+    s_engine_task = xTaskGetCurrentTaskHandle();
+
     for (uint8_t step = 0U; step < UART_ENGINE_MAX_STEPS_PER_TICK; ++step)
     {
         uint32_t const now_ms = engine_now_ms();
-        maybe_enqueue_heartbeat(now_ms);
+        bus_account(eng, now_ms);
+        maybe_enqueue_heartbeat(eng, now_ms);
+        maybe_enqueue_oob_refresh(eng);
+        post_ring_drain(eng);
+        tracked_admit(eng);
 
-        if ((int32_t)(now_ms - s_retry_not_before_ms) < 0)
+        if (eng->retry_not_before_armed)
         {
-            return;
+            if ((int32_t)(now_ms - eng->retry_not_before_ms) < 0)
+            {
+                return;
+            }
+            eng->retry_not_before_armed = false;
         }
 
         bool progressed = false;
 
-        switch (s_state)
+        switch (eng->state)
         {
         case UART_ENGINE_STATE_IDLE:
         {
-            if (s_q_count == 0U)
+            if ((eng->oob_fn != NULL) && (UART2_Available(eng->unit) > 0U) && UART2_TryLock(eng->unit))
+            {
+                // Unsolicited bytes between jobs: classify, then drop.
+                rx_drain_oob(eng);
+                UART2_Unlock(eng->unit);
+                maybe_enqueue_oob_refresh(eng);
+            }
+
+            if (eng->q_count == 0U)
             {
                 return;
             }
 
-            if (!UART2_TryLock())
+            if (!UART2_TryLock(eng->unit))
             {
                 return;
             }
 
-            if (!queue_pop(&s_active))
+            if (!queue_pop(eng, &eng->active, now_ms))
             {
-                UART2_Unlock();
+                UART2_Unlock(eng->unit);
                 return;
             }
 
-            s_state = UART_ENGINE_STATE_TX_START;
-            s_state_start_ms = now_ms;
-            if (s_active.is_heartbeat)
+            eng->state = UART_ENGINE_STATE_TX_START;
+            eng->state_start_ms = now_ms;
+            if (eng->active.is_heartbeat)
             {
-                s_hb_queued_or_active = true;
+                eng->hb_queued_or_active = true;
             }
             progressed = true;
             break;
         }
 
         case UART_ENGINE_STATE_TX_START:
-            job_start_tx(now_ms);
+            if (eng->tx_sent == 0U)
+            {
+                if (!turnaround_ready(eng, now_ms))
+                {
+                    return;
+                }
+                job_start_tx(eng, engine_now_ms());
+            }
+            else
+            {
+                tx_send_next(eng, now_ms);
+            }
             progressed = true;
             break;
 
         case UART_ENGINE_STATE_TX_WAIT:
-            if (UART2_TxDone())
+            if (UART2_TxDone(eng->unit) && (eng->tx_sent < eng->tx_len))
+            {
+                // Inter-byte gap; TX_START sends the next byte once it has passed.
+                eng->state = UART_ENGINE_STATE_TX_START;
+                eng->state_start_ms = now_ms;
+                set_not_before_ms(eng, now_ms + eng->active.req->tx_gap_ms);
+                progressed = true;
+            }
+            else if (UART2_TxDone(eng->unit))
             {
-                s_state = UART_ENGINE_STATE_RX_WAIT;
-                s_state_start_ms = now_ms;
-                s_rx_got = 0U;
+                enter_rx_wait(eng, now_ms, 0U);
                 progressed = true;
             }
-            else if ((now_ms - s_state_start_ms) >= UART_ENGINE_TX_TIMEOUT_MS)
+            else if ((now_ms - eng->state_start_ms) >= UART_ENGINE_TX_TIMEOUT_MS)
             {
-                uart_engine_debug_print_timeout(&s_active,
+                uart_engine_debug_print_timeout(eng,
+                                                &eng->active,
                                                 "tx wait",
-                                                (uint32_t)(now_ms - s_state_start_ms),
+                                                (uint32_t)(now_ms - eng->state_start_ms),
                                                 UART_ENGINE_TX_TIMEOUT_MS);
-                job_finish_failure(now_ms, "tx timeout");
+                cmd_note_failure(eng->active_cmd, UART_ENGINE_FAIL_TIMEOUT);
+                job_finish_failure(eng, now_ms, "tx timeout");
                 progressed = true;
             }
             break;
 
         case UART_ENGINE_STATE_RX_WAIT:
         {
-            uint16_t const rx_cap = request_rx_cap(&s_active.req);
+            uint16_t const rx_cap = request_rx_cap(eng->active.req);
             if (rx_cap == 0U)
             {
-                s_state = UART_ENGINE_STATE_PROCESS;
+                eng->state = UART_ENGINE_STATE_PROCESS;
                 progressed = true;
                 break;
             }
 
-            if (s_rx_got < rx_cap)
+            if (eng->rx_got < rx_cap)
             {
-                uint16_t const want = (uint16_t)(rx_cap - s_rx_got);
-                uint16_t const got = UART2_Read(&s_rx_buf[s_rx_got], want);
-                if (got > 0U)
+                uint16_t want = (uint16_t)(rx_cap - eng->rx_got);
+                if (eng->rx_use_pattern)
+                {
+                    want = rx_pattern_len(eng, want);
+                }
+                if ((want > 0U) && (rx_ring_fill(eng, want) > 0U))
                 {
-                    s_rx_got = (uint16_t)(s_rx_got + got);
                     progressed = true;
                 }
             }
 
-            if (s_active.req.expected_ending)
+            if (eng->active.req->expected_ending)
             {
-                if (rx_has_expected_ending(&s_active.req, s_rx_buf, s_rx_got))
+                if (rx_find_expected_ending(eng, eng->active.req))
                 {
-                    s_state = UART_ENGINE_STATE_PROCESS;
+                    eng->state = UART_ENGINE_STATE_PROCESS;
                     progressed = true;
                     break;
                 }
 
-                if (s_rx_got >= rx_cap)
+                if (eng->rx_got >= rx_cap)
                 {
-                    uart_engine_debug_print_failure(&s_active, "rx reached cap before ending");
-                    uart_engine_debug_print_raw_rx("rx cap", s_rx_buf, s_rx_got);
-                    job_finish_failure(now_ms, "rx ending not found");
+                    uart_engine_span_t frame;
+                    rx_frame_span(eng, &frame);
+                    uart_engine_debug_print_failure(eng, &eng->active, "rx reached cap before ending");
+                    uart_engine_debug_print_raw_rx(eng, "rx cap", &frame);
+                    cmd_note_failure(eng->active_cmd, UART_ENGINE_FAIL_PARSE);
+                    job_finish_failure(eng, now_ms, "rx ending not found");
                     progressed = true;
                     break;
                 }
             }
-            else if (s_rx_got >= rx_cap)
+            else if (eng->rx_got >= rx_cap)
             {
-                s_state = UART_ENGINE_STATE_PROCESS;
+                eng->state = UART_ENGINE_STATE_PROCESS;
                 progressed = true;
                 break;
             }
 
-            if ((now_ms - s_state_start_ms) >= s_active.req.timeout_ms)
+            if ((now_ms - eng->state_start_ms) >= eng->active_timeout_ms)
             {
-                uart_engine_debug_print_timeout(&s_active,
+                if (eng->rx_use_pattern && (eng->rx_got < rx_cap))
+                {
+                    // A lost pattern position must not fail a complete line:
+                    // take whatever is buffered and check once in software.
+                    (void)rx_ring_fill(eng, (uint16_t)(rx_cap - eng->rx_got));
+                    if (rx_find_expected_ending(eng, eng->active.req))
+                    {
+                        eng->state = UART_ENGINE_STATE_PROCESS;
+                        progressed = true;
+                        break;
+                    }
+                }
+
+                uart_engine_debug_print_timeout(eng,
+                                                &eng->active,
                                                 "rx wait",
-                                                (uint32_t)(now_ms - s_state_start_ms),
-                                                s_active.req.timeout_ms);
-                uart_engine_debug_print_raw_rx("rx timeout", s_rx_buf, s_rx_got);
-                job_finish_failure(now_ms, "rx timeout");
+                                                (uint32_t)(now_ms - eng->state_start_ms),
+                                                eng->active_timeout_ms);
+                uart_engine_span_t frame;
+                rx_frame_span(eng, &frame);
+                uart_engine_debug_print_raw_rx(eng, "rx timeout", &frame);
+                cmd_note_failure(eng->active_cmd, UART_ENGINE_FAIL_TIMEOUT);
+                eng->active_cmd->backoff = true;
+                job_finish_failure(eng, now_ms, "rx timeout");
                 progressed = true;
             }
             break;
@@ -698,68 +2866,136 @@ void uart_engine_tick(void)
 
         case UART_ENGINE_STATE_PROCESS:
         {
+            uart_engine_tracked_t *const tr = tracked_slot(eng, eng->active.req);
+            if ((tr != NULL) && !tracked_advance(tr, TRACKED_QUEUED, TRACKED_PROCESSING))
+            {
+                // Waiter gave up; its out_value may be gone.
+                UART2_Unlock(eng->unit);
+                uart_trace_end(eng->unit, eng->active.id, UART_TRACE_END_ABANDONED);
+                eng->state = UART_ENGINE_STATE_IDLE;
+                apply_interjob_cooldown(eng, now_ms);
+                active_clear(eng);
+                progressed = true;
+                break;
+            }
+
+            uart_engine_span_t frame;
+            rx_frame_span(eng, &frame);
+
             bool ok = true;
-            if (s_active.req.process_fn != NULL)
+            if (eng->active.req->process_fn != NULL)
             {
-                ok = s_active.req.process_fn(s_active.req.cmd,
-                                             s_rx_buf,
-                                             s_rx_got,
-                                             s_active.req.out_value);
+                ok = eng->active.req->process_fn(eng->active.req->cmd,
+                                                 &frame,
+                                                 engine_out_value(eng, eng->active.req));
             }
 
-            UART2_Unlock();
+            // A transaction keeps the UART for its next step or an in-place retry.
+            bool const txn_continues = eng->active.in_txn &&
+                                       (ok ? (eng->active.steps_left > 0U) : (eng->active.retries_left > 0U));
+            if (!txn_continues)
+            {
+                UART2_Unlock(eng->unit);
+            }
+            if (!ok && (tr != NULL) && !tracked_advance(tr, TRACKED_PROCESSING, TRACKED_QUEUED))
+            {
+                // Cancelled while process_fn ran: the slot is freed, so no retry.
+                if (txn_continues)
+                {
+                    UART2_Unlock(eng->unit);
+                }
+                uart_trace_end(eng->unit, eng->active.id, UART_TRACE_END_ABANDONED);
+                eng->state = UART_ENGINE_STATE_IDLE;
+                apply_interjob_cooldown(eng, now_ms);
+                active_clear(eng);
+                progressed = true;
+                break;
+            }
+            // Otherwise a failure is back to queued for a retry; final failure
+            // completes it below.
 
             if (ok)
             {
-                on_job_success(&s_active);
-                if (s_active.is_heartbeat)
+                uart_trace_end(eng->unit, eng->active.id, UART_TRACE_END_OK);
+                eng->active_cmd->stats.success++;
+                eng->active_cmd->stats.latency_hist[latency_bucket(now_ms - eng->tx_start_ms)]++;
+#if (UART_ENGINE_ADAPTIVE_TIMEOUT != 0)
+                if (eng->active_cmd != &eng->cmd_other)
+                {
+                    // eng->state_start_ms still marks the start of RX_WAIT.
+                    uint32_t const waited_ms = (uint32_t)(now_ms - eng->state_start_ms);
+                    rtt_sample(eng->active_cmd, (waited_ms > eng->rx_wire_ms) ? (waited_ms - eng->rx_wire_ms) : 0U);
+                }
+#endif
+                breaker_on_success(eng, now_ms);
+                hb_on_success(eng, now_ms);
+                if (eng->active.steps_left > 0U)
+                {
+                    txn_next_step(eng, now_ms);
+                    progressed = true;
+                    break;
+                }
+
+                on_job_success(eng, &eng->active);
+                if (eng->active.is_heartbeat)
                 {
-                    s_hb_queued_or_active = false;
+                    eng->hb_queued_or_active = false;
                 }
 
-                s_state = UART_ENGINE_STATE_IDLE;
-                apply_interjob_cooldown(now_ms);
-                active_clear();
+                eng->state = UART_ENGINE_STATE_IDLE;
+                apply_interjob_cooldown(eng, now_ms);
+                active_clear(eng);
                 progressed = true;
                 break;
             }
 
-            uart_engine_debug_print_raw_rx("process callback returned false", s_rx_buf, s_rx_got);
-            if (s_active.is_heartbeat)
+            uart_engine_debug_print_raw_rx(eng, "process callback returned false", &frame);
+            uart_trace_end(eng->unit, eng->active.id, UART_TRACE_END_FAILED);
+            cmd_note_failure(eng->active_cmd, UART_ENGINE_FAIL_PARSE);
+            if (txn_continues)
+            {
+                txn_retry_step(eng, now_ms, "process callback returned false");
+                progressed = true;
+                break;
+            }
+            if (eng->active.is_heartbeat)
             {
-                s_hb_queued_or_active = false;
+                eng->hb_queued_or_active = false;
             }
 
-            if (s_active.retries_left > 0U)
+            if (eng->active.retries_left > 0U)
             {
-                s_active.retries_left--;
-                if (queue_push(&s_active.req, s_active.is_heartbeat))
+                eng->active.retries_left--;
+                eng->active.attempts_failed++;
+                if (queue_push_job(eng, &eng->active))
                 {
-                    uart_engine_debug_print_retry(&s_active, "process callback returned false");
-                    s_retry_not_before_ms = now_ms + UART_ENGINE_RETRY_COOLDOWN_MS;
+                    uart_engine_debug_print_retry(eng, &eng->active, "process callback returned false");
+                    arm_retry_cooldown(eng, now_ms);
+                    eng->active_cmd->stats.retry++;
+                    eng->active.req = NULL;
                 }
                 else
                 {
-                    uart_engine_debug_print_failure(&s_active, "parse failed and retry enqueue failed");
-                    on_job_final_failure(&s_active);
+                    uart_engine_debug_print_failure(eng, &eng->active, "parse failed and retry enqueue failed");
+                    on_job_final_failure(eng, &eng->active);
                 }
             }
             else
             {
-                uart_engine_debug_print_failure(&s_active, "process callback returned false");
-                on_job_final_failure(&s_active);
+                uart_engine_debug_print_failure(eng, &eng->active, "process callback returned false");
+                on_job_final_failure(eng, &eng->active);
             }
 
-            s_state = UART_ENGINE_STATE_IDLE;
-            apply_interjob_cooldown(now_ms);
-            active_clear();
+            eng->state = UART_ENGINE_STATE_IDLE;
+            apply_interjob_cooldown(eng, now_ms);
+            active_clear(eng);
             progressed = true;
             break;
         }
 
         default:
-            s_state = UART_ENGINE_STATE_IDLE;
-            active_clear();
+            eng->state = UART_ENGINE_STATE_IDLE;
+            active_clear(eng);
             progressed = true;
             break;
         }
@@ -17,12 +17,36 @@ extern "C" {
 #define UART_ENGINE_INTERJOB_COOLDOWN_MS 1U
 #endif
 
+// Zero-gap issuing: the next queued job starts in the same tick its
+// predecessor's reply is processed, without UART_ENGINE_INTERJOB_COOLDOWN_MS
+// and the wait for the next loop tick that comes with it, and a command
+// handed to the UART in one piece goes straight to RX_WAIT instead of
+// polling UART2_TxDone() (its wire time is added to the RX timeout).
+// UART_ENGINE_TURNAROUND_US is then the only gap: the quiet time the UPS
+// needs after a reply before it takes the next command, timed on the
+// microsecond clock from the step the reply was processed in. Whole loop
+// ticks of it are slept through on the engine's not-before deadline; only
+// the part shorter than a tick is busy-waited with UART2_DelayUs().
+#ifndef UART_ENGINE_ZERO_GAP
+#define UART_ENGINE_ZERO_GAP 0
+#endif
+
+#ifndef UART_ENGINE_TURNAROUND_US
+#define UART_ENGINE_TURNAROUND_US 0U
+#endif
+
 // Non-blocking UART request engine.
 //
-// - Enqueue requests (cmd 8/16-bit, expected response length) paired with a
-//   process callback.
+// - Enqueue requests (cmd 8/16-bit or a byte string, expected response
+//   length) paired with a process callback, alone or as a transaction.
 // - Call uart_engine_tick() frequently from the main loop.
 // - Engine uses UART2_* adapter functions (DMA TX, ring-buffer RX).
+//
+// There is one independent engine instance per UPS unit (UPS_UNIT_COUNT),
+// selected by the unit argument; each owns its queues, statistics and UART.
+// A request bound with UART_ENGINE_OUT_FIELD() names a field of the polled
+// unit's g_ups entry instead of an address, so one const LUT serves every
+// unit.
 
 typedef enum
 {
@@ -30,9 +54,60 @@ typedef enum
     UART_ENGINE_ERR_QUEUE_FULL,
     UART_ENGINE_ERR_BAD_PARAM,
     UART_ENGINE_ERR_DISABLED,
+    UART_ENGINE_ERR_TIMEOUT, // deadline passed before the job completed
+    UART_ENGINE_ERR_FAILED,  // job failed after all retries
+    UART_ENGINE_ERR_SUSPENDED, // not sent: the command's circuit breaker is open
 } uart_engine_result_t;
 
-typedef bool (*uart_engine_process_fn)(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
+// Queue classes, highest priority first. Each class has its own FIFO ring.
+// Dispatch takes the highest non-empty class, except that an INTERACTIVE or
+// BACKGROUND head waiting UART_ENGINE_AGING_MS or longer is served ahead of
+// the other non-critical class (oldest aged head first), so a steady stream
+// of one class cannot starve the other. CRITICAL always goes first.
+typedef enum
+{
+    UART_ENGINE_PRIO_CRITICAL = 0, // heartbeat, urgent status re-reads
+    UART_ENGINE_PRIO_INTERACTIVE,  // on-demand refreshes (e.g. SNMP-driven)
+    UART_ENGINE_PRIO_BACKGROUND,   // routine LUT polling
+    UART_ENGINE_PRIO_COUNT,
+} uart_engine_priority_t;
+
+typedef enum
+{
+    UART_ENGINE_STATE_IDLE = 0,
+    UART_ENGINE_STATE_TX_START,
+    UART_ENGINE_STATE_TX_WAIT,
+    UART_ENGINE_STATE_RX_WAIT,
+    UART_ENGINE_STATE_PROCESS,
+    UART_ENGINE_STATE_COUNT,
+} uart_engine_state_t;
+
+// Received frame: a view into the unit's RX ring, valid only during the
+// process_fn call. seg[1] is non-empty when the frame wraps around the end
+// of the ring.
+typedef struct
+{
+    const uint8_t *seg[2];
+    uint16_t seg_len[2];
+} uart_engine_span_t;
+
+static inline uint16_t uart_engine_span_len(const uart_engine_span_t *span)
+{
+    return (uint16_t)(span->seg_len[0] + span->seg_len[1]);
+}
+
+static inline uint8_t uart_engine_span_at(const uart_engine_span_t *span, uint16_t index)
+{
+    return (index < span->seg_len[0]) ? span->seg[0][index] : span->seg[1][index - span->seg_len[0]];
+}
+
+// Copy at most cap bytes of span to dst; returns the number copied.
+uint16_t uart_engine_span_copy(const uart_engine_span_t *span, uint8_t *dst, uint16_t cap);
+
+// True if span holds exactly bytes[0..len).
+bool uart_engine_span_equals(const uart_engine_span_t *span, const uint8_t *bytes, uint16_t len);
+
+typedef bool (*uart_engine_process_fn)(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
 
 // Request struct. See uart_engine_enqueue().
 // 
@@ -41,6 +116,9 @@ typedef struct
     void *out_value;
     uint16_t cmd;
     uint8_t cmd_bits;      // 8 or 16. For 16-bit, bytes are sent MSB then LSB.
+    const uint8_t *tx_bytes; // non-NULL: send these tx_len bytes instead of cmd
+    uint16_t tx_len;
+    uint16_t tx_gap_ms;    // pause between command bytes, 0 = send them at once
     uint16_t expected_len; // fixed mode: exact bytes; ending mode: max bytes before fail
     bool expected_ending;  // false: fixed-length mode, true: stop once expected_ending_bytes is seen
     uint8_t expected_ending_len; // 1..UART_ENGINE_MAX_ENDING_LEN when expected_ending=true, length is in bytes
@@ -49,8 +127,19 @@ typedef struct
     uint8_t max_retries;   // max retries after a failure (engine will attempt 1 + max_retries total)
 
     uart_engine_process_fn process_fn;
+
+    // out_field: process_fn gets &g_ups[unit] + out_offset for the unit being
+    // polled, and out_value is unused. Set both with the macros below.
+    bool out_field;
+    uint16_t out_offset;
 } uart_engine_request_t;
 
+// Initialisers binding a request to a field of the polled unit's
+// ups_telemetry_t, e.g. UART_ENGINE_OUT_FIELD(battery.temperature), or to the
+// whole block for parsers that update several fields.
+#define UART_ENGINE_OUT_FIELD(member) .out_field = true, .out_offset = (uint16_t)offsetof(ups_telemetry_t, member)
+#define UART_ENGINE_OUT_TELEMETRY .out_field = true, .out_offset = 0U
+
 void uart_engine_init(void);
 
 // Enable/disable the engine at runtime.
@@ -60,36 +149,71 @@ void uart_engine_init(void);
 // - queued/active jobs are dropped
 // - heartbeat scheduling is stopped
 // - UART lock is released (so other code won't deadlock)
-void uart_engine_set_enabled(bool enable);
-bool uart_engine_is_enabled(void);
-bool uart_engine_is_busy(void);
+void uart_engine_set_enabled(uint8_t unit, bool enable);
+bool uart_engine_is_enabled(uint8_t unit);
+bool uart_engine_is_busy(uint8_t unit);
 
-// Call frequently (e.g., each main loop iteration).
-void uart_engine_tick(void);
+// Call frequently (e.g., each main loop iteration), once per unit.
+void uart_engine_tick(uint8_t unit);
 
-// Enqueue a request that will call process_fn(cmd, rx, rx_len, out_value).
+// Event-driven callers (reactor build): milliseconds until uart_engine_tick()
+// has time-based work again. 0 means "tick now", UINT32_MAX means nothing is
+// pending. RX arrival is not covered; wait for UART readability when
+// uart_engine_wants_rx() is true (a reply is expected, or idle with an OOB
+// handler installed).
+uint32_t uart_engine_time_to_next_ms(uint8_t unit, uint32_t now_ms);
+bool uart_engine_wants_rx(uint8_t unit);
+
+// Enqueue a request that will call process_fn(cmd, rx, out_value).
 // If process_fn returns true, the value is considered successfully updated.
 // Note: process_fn should only write to out_value on success.
 //
-// cmd_bits must be 8 or 16.
+// cmd_bits must be 8 or 16, unless tx_bytes is set.
 // Command framing/suffix bytes (e.g., CRLF) should be handled by caller-side
 // protocol code, not by this engine.
 //
+// Byte-string commands: with tx_bytes != NULL the engine sends tx_len bytes
+// from tx_bytes and cmd only names the command (statistics, merging,
+// process_fn); cmd_bits is ignored. tx_bytes is referenced, not copied, so it
+// must stay valid until the job completes, like out_value. With tx_gap_ms > 0
+// the bytes go out one at a time, tx_gap_ms apart (e.g. APC 'K' pause 'K');
+// anything the UPS sends during the gaps is part of the reply frame.
+//
 // RX modes:
 // - expected_ending=false: fixed-length mode (wait until expected_len bytes).
-// - expected_ending=true: terminator mode (wait until expected_ending_bytes;
-//   expected_len becomes the maximum capture length).
+// - expected_ending=true: terminator mode (the frame ends with the first
+//   expected_ending_bytes; expected_len becomes the maximum capture length).
+//   Bytes received after the terminator stay in the RX ring and are
+//   discarded before the next command.
+
+//
+// uart_engine_enqueue() copies *req into a small request pool
+// (UART_ENGINE_REQ_POOL_SIZE), so req may live on the caller's stack; it
+// returns UART_ENGINE_ERR_QUEUE_FULL when the pool is exhausted.
+// uart_engine_enqueue_static() queues a reference only: *req must stay valid
+// and unchanged until the job completes (e.g. const LUT entries).
+//
+// A request identical to a job that is still queued (not yet sent) in every
+// field but max_retries (same command or tx_bytes content, framing, timeout,
+// process_fn and output) is merged into it instead of queued again: the one
+// response updates out_value for every caller. The pending job keeps the
+// larger retry budget and moves up to the higher of the two classes.
 
-uart_engine_result_t uart_engine_enqueue(const uart_engine_request_t *req);
+uart_engine_result_t uart_engine_enqueue(uint8_t unit, const uart_engine_request_t *req, uart_engine_priority_t prio);
+uart_engine_result_t uart_engine_enqueue_static(uint8_t unit,
+                                                const uart_engine_request_t *req,
+                                                uart_engine_priority_t prio);
 
 // Convenience for common usage.
-static inline uart_engine_result_t uart_engine_enqueue_value(void *out_value,
+static inline uart_engine_result_t uart_engine_enqueue_value(uint8_t unit,
+                                                            void *out_value,
                                                             uint16_t cmd,
                                                             uint8_t cmd_bits,
                                                             uint16_t expected_len,
                                                             uint32_t timeout_ms,
                                                             uint8_t max_retries,
-                                                            uart_engine_process_fn process_fn)
+                                                            uart_engine_process_fn process_fn,
+                                                            uart_engine_priority_t prio)
 {
     uart_engine_request_t req = {
         .out_value = out_value,
@@ -102,24 +226,247 @@ static inline uart_engine_result_t uart_engine_enqueue_value(void *out_value,
         .max_retries = max_retries,
         .process_fn = process_fn,
     };
-    return uart_engine_enqueue(&req);
+    return uart_engine_enqueue(unit, &req, prio);
 }
 
+// Transactions: count requests sent back to back while the unit's UART is
+// held, so no other job (heartbeat, OOB refresh, CRITICAL) runs between two
+// steps, e.g. an APC '-' value edit followed by the read-back. The steps are
+// copied into a per-unit transaction pool, so the array may live on the
+// caller's stack (as with uart_engine_enqueue(), out_value and tx_bytes are
+// still referenced); UART_ENGINE_ERR_QUEUE_FULL when the pool is exhausted.
+// A failed step is retried in place within its own max_retries; once it has
+// finally failed the remaining steps are skipped. Transactions are never
+// merged. count is 1..UART_ENGINE_MAX_TXN_STEPS.
+#ifndef UART_ENGINE_MAX_TXN_STEPS
+#define UART_ENGINE_MAX_TXN_STEPS 16U
+#endif
+
+uart_engine_result_t uart_engine_enqueue_transaction(uint8_t unit,
+                                                     const uart_engine_request_t *steps,
+                                                     size_t count,
+                                                     uart_engine_priority_t prio);
+
+// Posting from other tasks and from ISRs.
+//
+// uart_engine_enqueue*() must only be called from the engine task.
+// uart_engine_post() may be called from any task or ISR: it queues a
+// reference (same lifetime rule as uart_engine_enqueue_static()) in a
+// lock-free per-unit ring of UART_ENGINE_POST_RING_SIZE entries, which the
+// engine task moves into the class queues on its next tick, merging
+// duplicates. Returns UART_ENGINE_ERR_QUEUE_FULL when the ring is full.
+// Not placed in IRAM: do not call it from ESP_INTR_FLAG_IRAM handlers.
+uart_engine_result_t uart_engine_post(uint8_t unit, const uart_engine_request_t *req, uart_engine_priority_t prio);
+
+// Awaitable jobs, for tasks other than the one calling uart_engine_tick().
+//
+// Other tasks use uart_engine_submit(): *req is copied into one of
+// UART_ENGINE_TRACKED_JOBS tracking slots of the unit and queued by the
+// engine task on its next tick (the event-driven loop is woken for it).
+// Tracked jobs are never merged with other requests.
+//
+// Completion is reported once, from the engine task: done_fn (if not NULL)
+// gets UART_ENGINE_OK, UART_ENGINE_ERR_FAILED, UART_ENGINE_ERR_SUSPENDED
+// (see the circuit breaker below) or UART_ENGINE_ERR_DISABLED (dropped
+// because the engine was disabled), and a task blocked in
+// uart_engine_job_wait() is woken by a direct-to-task notification on index
+// UART_ENGINE_NOTIFY_INDEX, so the default notification (index 0) stays free
+// for the task's own use.
+//
+// With out_handle == NULL the slot is released after done_fn. Otherwise the
+// caller owns the handle and must end it with uart_engine_job_wait()
+// returning a final result, or with uart_engine_job_cancel(). out_value must
+// stay valid until then.
+//
+// Deadlines are absolute times on the ups_tick_ms() clock.
+
+// Task notification index used by uart_engine_job_wait() and
+// uart_engine_job_cancel(); needs CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES
+// greater than it.
+#ifndef UART_ENGINE_NOTIFY_INDEX
+#define UART_ENGINE_NOTIFY_INDEX 1U
+#endif
+
+typedef uint32_t uart_engine_handle_t; // 0 is never a valid handle
+
+typedef void (*uart_engine_done_fn)(uart_engine_handle_t handle, uart_engine_result_t result, void *ctx);
+
+// Engine task only: uart_engine_enqueue_static() with a completion callback,
+// for periodic reads of const LUT entries (lut_sched). done_fn gets handle 0
+// and the results listed below. Unlike a tracked job it takes no tracking
+// slot and merges like any static request: an alert refresh of the same
+// command joins it. A job holds one callback, so a second callback request
+// for the same command is queued separately.
+uart_engine_result_t uart_engine_enqueue_static_cb(uint8_t unit,
+                                                   const uart_engine_request_t *req,
+                                                   uart_engine_priority_t prio,
+                                                   uart_engine_done_fn done_fn,
+                                                   void *ctx);
+
+uart_engine_result_t uart_engine_submit(uint8_t unit,
+                                        const uart_engine_request_t *req,
+                                        uart_engine_priority_t prio,
+                                        uart_engine_done_fn done_fn,
+                                        void *ctx,
+                                        uart_engine_handle_t *out_handle);
+
+// Block until the job completes or deadline_ms passes. Returns the job result
+// (the handle is then released), UART_ENGINE_ERR_TIMEOUT (handle still valid:
+// wait again or cancel), or UART_ENGINE_ERR_BAD_PARAM for an unknown handle
+// or when called with a future deadline from the engine task itself.
+uart_engine_result_t uart_engine_job_wait(uart_engine_handle_t handle, uint32_t deadline_ms);
+
+// Give up on a job. The slot is marked and this returns at once: a job still
+// queued is dropped by the engine without touching out_value. Only if
+// process_fn is running for it right now does this block, until the engine
+// notifies that it is done (from the engine task itself it returns at once).
+void uart_engine_job_cancel(uart_engine_handle_t handle);
+
+// submit + wait on this job only. On timeout the job is cancelled, so out_value
+// is not written after this returns.
+uart_engine_result_t uart_engine_submit_and_wait(uint8_t unit,
+                                                 const uart_engine_request_t *req,
+                                                 uart_engine_priority_t prio,
+                                                 uint32_t deadline_ms);
+
+// Per-class queue statistics. Wait is measured from enqueue (or re-enqueue
+// for a retry) until the job is dispatched to the bus.
+typedef struct
+{
+    uint32_t enqueued;
+    uint32_t dispatched;
+    uint32_t rejected_full;
+    uint32_t aged;          // dispatched ahead of a higher class by aging
+    uint32_t merged;        // enqueues coalesced into a pending job of this class
+    uint32_t promoted;      // pending jobs moved up into this class by a merge
+    uint32_t wait_last_ms;
+    uint32_t wait_max_ms;
+    uint32_t wait_total_ms; // divide by dispatched for the mean
+    uint8_t depth;
+    uint8_t depth_max;
+} uart_engine_class_stats_t;
+
+bool uart_engine_get_class_stats(uint8_t unit, uart_engine_priority_t prio, uart_engine_class_stats_t *out);
+
+// Per-command statistics, one entry per distinct (cmd, cmd_bits) seen.
+// latency_hist[i] counts TX start -> successful parse latencies below
+// (16 << i) ms; the last bucket is open-ended.
+#ifndef UART_ENGINE_LATENCY_BUCKETS
+#define UART_ENGINE_LATENCY_BUCKETS 8U
+#endif
+
+// Failures and circuit breaker.
+//
+// A failed attempt is retried (within max_retries) after a cooldown that
+// doubles with each failed attempt of the job, plus random jitter. After
+// UART_ENGINE_BREAKER_THRESHOLD consecutive failed jobs the command's breaker
+// opens: its jobs complete with UART_ENGINE_ERR_SUSPENDED without being sent
+// (e.g. a command the UPS firmware does not support no longer costs a full RX
+// timeout every cycle). Once the open period has passed, the next job is a
+// single-attempt probe: success closes the breaker, failure opens it again
+// for twice as long (UART_ENGINE_BREAKER_BASE_MS up to
+// UART_ENGINE_BREAKER_MAX_MS, plus jitter). The heartbeat bypasses the
+// breaker. While every job fails the link itself is down, not the commands:
+// breakers stop counting, and the first success afterwards makes every open
+// breaker probe again.
+typedef enum
+{
+    UART_ENGINE_BREAKER_CLOSED = 0, // command sent normally
+    UART_ENGINE_BREAKER_OPEN,       // suspended until probe_in_ms passes
+    UART_ENGINE_BREAKER_HALF_OPEN,  // next job is the probe
+} uart_engine_breaker_t;
+
+typedef enum
+{
+    UART_ENGINE_FAIL_NONE = 0,
+    UART_ENGINE_FAIL_TIMEOUT, // TX or RX timeout
+    UART_ENGINE_FAIL_PARSE,   // terminator not found or process_fn returned false
+    UART_ENGINE_FAIL_TX,      // command could not be handed to the UART
+} uart_engine_fail_t;
+
+typedef struct
+{
+    uint16_t cmd;
+    uint8_t cmd_bits;
+    uint32_t success;
+    uint32_t timeout;    // TX or RX timeout
+    uint32_t parse_fail; // terminator not found or process_fn returned false
+    uint32_t retry;      // attempts re-queued after a failure
+    uint32_t latency_hist[UART_ENGINE_LATENCY_BUCKETS];
+    uint32_t srtt_ms;       // smoothed RX latency (adaptive timeouts)
+    uint32_t rttvar_ms;
+    uint32_t rx_timeout_ms; // RX timeout the next attempt would use
+    uint32_t suspended;     // jobs completed unsent while the breaker was open
+    uint32_t breaker_trips; // CLOSED -> OPEN transitions
+    uint32_t probe_in_ms;   // OPEN: time until the next probe
+    uint8_t breaker;        // uart_engine_breaker_t
+    uint8_t fail_streak;    // consecutive failed jobs, 0 after a success
+    uint8_t last_fail;      // uart_engine_fail_t of the most recent failure
+} uart_engine_cmd_stats_t;
+
+size_t uart_engine_cmd_stats_count(uint8_t unit);
+bool uart_engine_get_cmd_stats(uint8_t unit, size_t index, uart_engine_cmd_stats_t *out);
+
+typedef struct
+{
+    uint32_t state_ms[UART_ENGINE_STATE_COUNT]; // cumulative time per state
+    uint32_t busy_window_ms;                    // span covered by busy_percent
+    uint8_t busy_percent;                       // non-IDLE share of the window
+    uint32_t oob_bytes;                         // bytes taken by the OOB handler
+    uint32_t post_rejected;                     // uart_engine_post() calls refused (ring full)
+    uint32_t heartbeats;                        // heartbeat jobs queued (none while replies keep coming)
+    uint32_t turnarounds;                       // back-to-back jobs: end of one to TX of the next
+    uint64_t turnaround_sum_us;
+    uint32_t turnaround_max_us;
+} uart_engine_bus_stats_t;
+
+void uart_engine_get_bus_stats(uint8_t unit, uart_engine_bus_stats_t *out);
+
+// Out-of-band bytes (e.g. UPS alert characters sent unsolicited).
+//
+// fn is called for every byte received between jobs, and for the bytes of a
+// response ahead of its first payload byte (an alert sent just as the
+// command went out); once a reply has started, its bytes are data and never
+// classified. Returning true removes the byte from the stream (it never
+// reaches a process_fn or a length/terminator check). After any such byte the engine
+// queues refresh_lut as CRITICAL (merged with pending duplicates). Keep
+// refresh_count below UART_ENGINE_QUEUE_SIZE_CRITICAL. Pass fn=NULL to
+// disable; buffered bytes are then discarded before each command as before.
+// in_response is true while a reply is awaited, so the handler can leave
+// bytes that may also start a reply (e.g. a sign) alone. ctx is passed through
+// from uart_engine_set_oob_handler() (e.g. the unit's telemetry block).
+typedef bool (*uart_engine_oob_fn)(uint8_t byte, bool in_response, void *ctx);
+
+void uart_engine_set_oob_handler(uint8_t unit,
+                                 uart_engine_oob_fn fn,
+                                 void *ctx,
+                                 const uart_engine_request_t *refresh_lut,
+                                 size_t refresh_count);
+
 // Heartbeat monitor.
 //
-// The heartbeat is scheduled periodically by the engine.
-// If the heartbeat request fails (after its internal retries) consecutively
-// failure_threshold times (default 5), battery fields are forced to 0.
+// The heartbeat is queued by the engine in the CRITICAL class once interval_ms
+// has passed without an accepted reply to any job; while regular polling
+// succeeds it is never sent. Any accepted reply also resets the failure
+// count. If the heartbeat request fails (after its internal retries)
+// consecutively failure_threshold times (default 5), that unit's
+// present_status.comm_lost is set; the next accepted reply clears it.
+//
+// battery_failsafe (opt-in) additionally forces the unit's battery state to
+// exhausted and on battery (capacity 1, shutdown_imminent, ac_present
+// false), so SNMP managers shut their hosts down when the UPS can no longer
+// be read. A pulled serial cable then looks like a power failure.
 
 typedef struct
 {
     uart_engine_request_t req;
     uint32_t interval_ms;
     uint8_t failure_threshold;
+    bool battery_failsafe;
 } uart_engine_heartbeat_cfg_t;
 
 // Enable heartbeat scheduling. Pass NULL to disable.
-void uart_engine_set_heartbeat(const uart_engine_heartbeat_cfg_t *cfg);
+void uart_engine_set_heartbeat(uint8_t unit, const uart_engine_heartbeat_cfg_t *cfg);
 
 // Helper process function: exact match against expected bytes.
 // out_value should point to a uart_engine_expect_bytes_t.
@@ -130,7 +477,7 @@ typedef struct
     uint16_t expected_len;
 } uart_engine_expect_bytes_t;
 
-bool uart_engine_process_expect_exact(uint16_t cmd, const uint8_t *rx, uint16_t rx_len, void *out_value);
+bool uart_engine_process_expect_exact(uint16_t cmd, const uart_engine_span_t *rx, void *out_value);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,385 @@
+#include "uart_trace.h"
+
+#include "ups_data.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lwip/sockets.h"
+#include "lwip/inet.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "uart_trace";
+
+// Bytes of transcript kept per unit; a power of two.
+#ifndef UART_TRACE_RING_SIZE
+#define UART_TRACE_RING_SIZE 2048U
+#endif
+
+// Longest byte run stored in one TX/RX record.
+#ifndef UART_TRACE_MAX_RUN
+#define UART_TRACE_MAX_RUN 64U
+#endif
+
+#ifndef UART_TRACE_TASK_STACK
+#define UART_TRACE_TASK_STACK 3072U
+#endif
+
+#ifndef UART_TRACE_TASK_PRIO
+#define UART_TRACE_TASK_PRIO (tskIDLE_PRIORITY + 1U)
+#endif
+
+#if (UART_TRACE_RING_SIZE & (UART_TRACE_RING_SIZE - 1U)) != 0U
+#error "UART_TRACE_RING_SIZE must be a power of two"
+#endif
+
+#if (UART_TRACE_MAX_RUN > 127U) || ((UART_TRACE_MAX_RUN * 4U) > UART_TRACE_RING_SIZE)
+#error "UART_TRACE_MAX_RUN must be at most 127 and a quarter of UART_TRACE_RING_SIZE"
+#endif
+
+// u8 type + varint dt (u64) + two varints (u32).
+#define UART_TRACE_HDR_MAX 21U
+// u8 unit, u32 dropped, u64 base_us, u32 len.
+#define UART_TRACE_SECTION_HDR 17U
+
+#if (UART_TRACE_ENABLED != 0)
+
+// Records are appended at head and evicted whole from tail. Indices are
+// free-running; mask with the ring size.
+typedef struct
+{
+    uint8_t buf[UART_TRACE_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    int64_t base_us; // time the record at tail counts its delta from
+    int64_t last_us; // time of the newest record
+    uint32_t dropped;
+    bool started;
+} uart_trace_ring_t;
+
+// Writers are the engine task, the reader is the dump server; records are
+// short, so both just hold the lock.
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uart_trace_ring_t s_rings[UPS_UNIT_COUNT];
+static bool s_server_started = false;
+
+static uint8_t trace_varint(uint8_t *dst, uint64_t v)
+{
+    uint8_t n = 0U;
+    while (v >= 0x80U)
+    {
+        dst[n++] = (uint8_t)(v | 0x80U);
+        v >>= 7;
+    }
+    dst[n++] = (uint8_t)v;
+    return n;
+}
+
+static uint8_t trace_byte_at(const uart_trace_ring_t *r, uint32_t pos)
+{
+    return r->buf[pos & (UART_TRACE_RING_SIZE - 1U)];
+}
+
+// Decode a varint at *pos and advance past it.
+static uint64_t trace_read_varint(const uart_trace_ring_t *r, uint32_t *pos)
+{
+    uint64_t v = 0U;
+    uint8_t shift = 0U;
+    uint8_t b;
+    do
+    {
+        b = trace_byte_at(r, (*pos)++);
+        v |= (uint64_t)(b & 0x7FU) << shift;
+        shift = (uint8_t)(shift + 7U);
+    } while (((b & 0x80U) != 0U) && (shift < 64U));
+    return v;
+}
+
+// Drop the oldest record; its delta moves into base_us.
+static void trace_evict(uart_trace_ring_t *r)
+{
+    uint32_t pos = r->tail;
+    uint8_t const type = trace_byte_at(r, pos++);
+    r->base_us += (int64_t)trace_read_varint(r, &pos);
+
+    switch (type)
+    {
+    case UART_TRACE_REC_TX:
+        (void)trace_read_varint(r, &pos);
+        pos += (uint32_t)trace_read_varint(r, &pos);
+        break;
+    case UART_TRACE_REC_RX:
+        pos += (uint32_t)trace_read_varint(r, &pos);
+        break;
+    case UART_TRACE_REC_END:
+    default:
+        (void)trace_read_varint(r, &pos);
+        pos++;
+        break;
+    }
+
+    r->tail = pos;
+    r->dropped++;
+}
+
+static void trace_copy_in(uart_trace_ring_t *r, const uint8_t *src, uint32_t len)
+{
+    uint32_t const off = r->head & (UART_TRACE_RING_SIZE - 1U);
+    uint32_t const first = ((UART_TRACE_RING_SIZE - off) < len) ? (UART_TRACE_RING_SIZE - off) : len;
+
+    memcpy(&r->buf[off], src, first);
+    memcpy(&r->buf[0], src + first, len - first);
+    r->head += len;
+}
+
+// Append one record: type, dt, then up to two varint fields, then payload.
+static void trace_append(uint8_t unit,
+                         uint8_t type,
+                         const uint32_t *fields,
+                         uint8_t field_count,
+                         const uint8_t *payload,
+                         uint8_t payload_len)
+{
+    if (unit >= (uint8_t)UPS_UNIT_COUNT)
+    {
+        return;
+    }
+
+    int64_t const now_us = esp_timer_get_time();
+    uart_trace_ring_t *const r = &s_rings[unit];
+
+    portENTER_CRITICAL(&s_lock);
+    if (!r->started)
+    {
+        r->base_us = now_us;
+        r->last_us = now_us;
+        r->started = true;
+    }
+
+    uint8_t hdr[UART_TRACE_HDR_MAX];
+    uint8_t n = 0U;
+    hdr[n++] = type;
+    n = (uint8_t)(n + trace_varint(&hdr[n], (uint64_t)(now_us - r->last_us)));
+    for (uint8_t i = 0U; i < field_count; i++)
+    {
+        n = (uint8_t)(n + trace_varint(&hdr[n], fields[i]));
+    }
+
+    uint32_t const rec_len = (uint32_t)n + payload_len;
+    while ((UART_TRACE_RING_SIZE - (r->head - r->tail)) < rec_len)
+    {
+        trace_evict(r);
+    }
+
+    trace_copy_in(r, hdr, n);
+    trace_copy_in(r, payload, payload_len);
+    r->last_us = now_us;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void uart_trace_tx(uint8_t unit, uint16_t job_id, const uint8_t *data, uint16_t len)
+{
+    if ((data == NULL) || (len == 0U))
+    {
+        return;
+    }
+
+    uint8_t const run = (len > UART_TRACE_MAX_RUN) ? (uint8_t)UART_TRACE_MAX_RUN : (uint8_t)len;
+    uint32_t const fields[2] = {job_id, run};
+    trace_append(unit, (uint8_t)UART_TRACE_REC_TX, fields, 2U, data, run);
+}
+
+void uart_trace_rx(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    if (data == NULL)
+    {
+        return;
+    }
+
+    while (len > 0U)
+    {
+        uint8_t const run = (len > UART_TRACE_MAX_RUN) ? (uint8_t)UART_TRACE_MAX_RUN : (uint8_t)len;
+        uint32_t const fields[1] = {run};
+        trace_append(unit, (uint8_t)UART_TRACE_REC_RX, fields, 1U, data, run);
+        data += run;
+        len = (uint16_t)(len - run);
+    }
+}
+
+void uart_trace_end(uint8_t unit, uint16_t job_id, uart_trace_end_t status)
+{
+    uint32_t const fields[1] = {job_id};
+    uint8_t const payload = (uint8_t)status;
+    trace_append(unit, (uint8_t)UART_TRACE_REC_END, fields, 1U, &payload, 1U);
+}
+
+static void trace_put_le(uint8_t *dst, uint64_t v, uint8_t bytes)
+{
+    for (uint8_t i = 0U; i < bytes; i++)
+    {
+        dst[i] = (uint8_t)(v >> (8U * i));
+    }
+}
+
+uint32_t uart_trace_snapshot(uint8_t unit, uint8_t *dst, uint32_t cap)
+{
+    if ((unit >= (uint8_t)UPS_UNIT_COUNT) || (dst == NULL) ||
+        (cap < (UART_TRACE_SECTION_HDR + UART_TRACE_RING_SIZE)))
+    {
+        return 0U;
+    }
+
+    uart_trace_ring_t const *const r = &s_rings[unit];
+    uint8_t *const body = &dst[UART_TRACE_SECTION_HDR];
+
+    portENTER_CRITICAL(&s_lock);
+    uint32_t const len = r->head - r->tail;
+    uint32_t const off = r->tail & (UART_TRACE_RING_SIZE - 1U);
+    uint32_t const first = ((UART_TRACE_RING_SIZE - off) < len) ? (UART_TRACE_RING_SIZE - off) : len;
+    memcpy(body, &r->buf[off], first);
+    memcpy(body + first, &r->buf[0], len - first);
+    uint32_t const dropped = r->dropped;
+    int64_t const base_us = r->base_us;
+    portEXIT_CRITICAL(&s_lock);
+
+    dst[0] = unit;
+    trace_put_le(&dst[1], dropped, 4U);
+    trace_put_le(&dst[5], (uint64_t)base_us, 8U);
+    trace_put_le(&dst[13], len, 4U);
+    return UART_TRACE_SECTION_HDR + len;
+}
+
+static bool trace_send_all(int sock, const uint8_t *data, uint32_t len)
+{
+    while (len > 0U)
+    {
+        int const sent = lwip_send(sock, data, len, 0);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        len -= (uint32_t)sent;
+    }
+    return true;
+}
+
+static void uart_trace_server_task(void *arg)
+{
+    (void)arg;
+
+    // One section at a time; the dump task is the only user.
+    static uint8_t s_section[UART_TRACE_SECTION_HDR + UART_TRACE_RING_SIZE];
+
+    int const listen_sock = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_sock < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create trace TCP socket");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct sockaddr_in bind_addr;
+    memset(&bind_addr, 0, sizeof(bind_addr));
+    bind_addr.sin_family = AF_INET;
+    bind_addr.sin_port = htons(UART_TRACE_TCP_PORT);
+    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if ((lwip_bind(listen_sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) != 0) ||
+        (lwip_listen(listen_sock, 1) != 0))
+    {
+        ESP_LOGE(TAG, "Failed to listen on TCP/%u", (unsigned int)UART_TRACE_TCP_PORT);
+        lwip_close(listen_sock);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ESP_LOGI(TAG, "UART transcript dump on TCP/%u", (unsigned int)UART_TRACE_TCP_PORT);
+
+    while (1)
+    {
+        int const sock = lwip_accept(listen_sock, NULL, NULL);
+        if (sock < 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(100U));
+            continue;
+        }
+
+        uint8_t hdr[6] = {'U', 'T', 'R', 'C', (uint8_t)UART_TRACE_VERSION, (uint8_t)UPS_UNIT_COUNT};
+        bool ok = trace_send_all(sock, hdr, sizeof(hdr));
+        for (uint8_t unit = 0U; ok && (unit < (uint8_t)UPS_UNIT_COUNT); unit++)
+        {
+            uint32_t const n = uart_trace_snapshot(unit, s_section, sizeof(s_section));
+            ok = trace_send_all(sock, s_section, n);
+        }
+
+        lwip_close(sock);
+    }
+}
+
+esp_err_t uart_trace_server_start(void)
+{
+    if (s_server_started)
+    {
+        return ESP_OK;
+    }
+
+    BaseType_t const task_ok = xTaskCreate(uart_trace_server_task,
+                                           "uart_trace",
+                                           UART_TRACE_TASK_STACK,
+                                           NULL,
+                                           UART_TRACE_TASK_PRIO,
+                                           NULL);
+    if (task_ok != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create trace task");
+        return ESP_FAIL;
+    }
+
+    s_server_started = true;
+    return ESP_OK;
+}
+
+#else
+
+void uart_trace_tx(uint8_t unit, uint16_t job_id, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)job_id;
+    (void)data;
+    (void)len;
+}
+
+void uart_trace_rx(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)data;
+    (void)len;
+}
+
+void uart_trace_end(uint8_t unit, uint16_t job_id, uart_trace_end_t status)
+{
+    (void)unit;
+    (void)job_id;
+    (void)status;
+}
+
+uint32_t uart_trace_snapshot(uint8_t unit, uint8_t *dst, uint32_t cap)
+{
+    (void)unit;
+    (void)dst;
+    (void)cap;
+    return 0U;
+}
+
+esp_err_t uart_trace_server_start(void)
+{
+    return ESP_OK;
+}
+
+#endif
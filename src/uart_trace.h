@@ -0,0 +1,78 @@
+#ifndef UART_TRACE_H_
+#define UART_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// UART transcript: every command sent and every byte run read from each UPS
+// UART, kept in a per-unit RAM ring (oldest records are overwritten).
+//
+// - The engine calls uart_trace_tx()/_rx()/_end() from its task.
+// - uart_trace_server_start() serves the rings on TCP port UART_TRACE_TCP_PORT:
+//   every connection receives one dump, then the bridge closes it
+//   (e.g. `nc <bridge> 7161 > trace.bin`).
+//
+// Dump format (integers little-endian, varint = unsigned LEB128):
+//   "UTRC"  u8 version (1)  u8 unit_count
+//   per unit:
+//     u8 unit  u32 dropped_records  u64 base_us  u32 len  len bytes of records
+//   base_us is the esp_timer time (us since boot) the first record's delta
+//   counts from; dropped_records counts records overwritten since boot.
+//
+// Record: u8 type, varint dt_us (since the previous record / base_us), body:
+//   UART_TRACE_REC_TX   varint job_id, varint n, n bytes sent
+//   UART_TRACE_REC_RX   varint n, n bytes as read from the driver (alert
+//                       characters included); long runs are split into
+//                       several records with dt_us = 0
+//   UART_TRACE_REC_END  varint job_id, u8 uart_trace_end_t
+// job_id numbers jobs per unit from 1 (wrapping, 0 skipped); retries of a job
+// keep its id. A command sent with inter-byte gaps gives one TX record per
+// byte, and each step of a transaction is a job of its own.
+
+#ifndef UART_TRACE_ENABLED
+#define UART_TRACE_ENABLED 1
+#endif
+
+#ifndef UART_TRACE_TCP_PORT
+#define UART_TRACE_TCP_PORT 7161U
+#endif
+
+#define UART_TRACE_MAGIC "UTRC"
+#define UART_TRACE_VERSION 1U
+
+typedef enum
+{
+    UART_TRACE_REC_TX = 1,
+    UART_TRACE_REC_RX = 2,
+    UART_TRACE_REC_END = 3,
+} uart_trace_rec_t;
+
+typedef enum
+{
+    UART_TRACE_END_OK = 0,
+    UART_TRACE_END_FAILED = 1,    // attempt failed (timeout, parse, TX error); a retry may follow
+    UART_TRACE_END_ABANDONED = 2, // waiter gave up, reply dropped
+} uart_trace_end_t;
+
+void uart_trace_tx(uint8_t unit, uint16_t job_id, const uint8_t *data, uint16_t len);
+void uart_trace_rx(uint8_t unit, const uint8_t *data, uint16_t len);
+void uart_trace_end(uint8_t unit, uint16_t job_id, uart_trace_end_t status);
+
+// Copy unit's ring as one dump section (see above) into dst. Returns the
+// number of bytes written, 0 if dst is too small or tracing is disabled.
+uint32_t uart_trace_snapshot(uint8_t unit, uint8_t *dst, uint32_t cap);
+
+// Start the TCP dump server task. Call once the network is up.
+esp_err_t uart_trace_server_start(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UART_TRACE_H_
@@ -0,0 +1,20 @@
+#include "ups_clock.h"
+
+#include "uart_backend.h"
+
+#include <stddef.h>
+
+static ups_clock_fn s_now_fn;
+static void *s_now_ctx;
+
+void ups_clock_set(ups_clock_fn now_fn, void *ctx)
+{
+    s_now_ctx = ctx;
+    s_now_fn = now_fn;
+}
+
+uint32_t ups_tick_ms(void)
+{
+    ups_clock_fn const now_fn = s_now_fn;
+    return (now_fn != NULL) ? now_fn(s_now_ctx) : UART2_TickMs();
+}
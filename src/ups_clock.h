@@ -0,0 +1,30 @@
+#ifndef UPS_CLOCK_H_
+#define UPS_CLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Millisecond clock of the engine, the schedulers in main.c and the SNMP
+// walker cache. It reads the UART backend's tick (UART2_TickMs()) unless a
+// source is injected, e.g. the virtual clock of a discrete-event simulation
+// (tools/ups_sim/des.c).
+//
+// The value wraps at 2^32 ms (~49.7 days): compare times only through their
+// signed difference, (int32_t)(a - b).
+
+typedef uint32_t (*ups_clock_fn)(void *ctx);
+
+// Replace the time source; NULL restores the backend tick. Set it before the
+// engine starts: readers do not synchronise with the switch.
+void ups_clock_set(ups_clock_fn now_fn, void *ctx);
+
+uint32_t ups_tick_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UPS_CLOCK_H_
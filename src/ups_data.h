@@ -8,6 +8,12 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
+// Number of UPS units served by this bridge, each on its own UART with its
+// own engine instance and telemetry block (g_ups[unit]).
+#ifndef UPS_UNIT_COUNT
+#define UPS_UNIT_COUNT 1
+#endif
+
 // Report IDs used by the UPS HID report descriptor.
 enum
 {
@@ -28,6 +34,7 @@ typedef struct
     bool battery_present;
     bool overload;
     bool shutdown_imminent;
+    bool comm_lost; // heartbeat failed repeatedly: the other fields are stale
 } ups_present_status_t;
 
 // Battery System Info
@@ -82,12 +89,30 @@ typedef struct
     uint16_t frequency;
 } ups_output_t;
 
-// Global UPS state (defined in src/main.c)
-extern ups_present_status_t g_power_summary_present_status;
-extern ups_summary_t g_power_summary;
-extern ups_battery_t g_battery;
-extern ups_input_t g_input;
-extern ups_output_t g_output;
+// All telemetry of one UPS unit.
+typedef struct
+{
+    ups_present_status_t present_status;
+    ups_summary_t summary;
+    ups_battery_t battery;
+    ups_input_t input;
+    ups_output_t output;
+} ups_telemetry_t;
+
+// Point-in-time copy of all telemetry blocks.
+// Published once per sampling cycle so readers see values from one cycle only.
+typedef struct
+{
+    uint32_t generation;
+    ups_present_status_t present_status;
+    ups_summary_t summary;
+    ups_battery_t battery;
+    ups_input_t input;
+    ups_output_t output;
+} ups_snapshot_t;
+
+// Global UPS state, one block per unit (defined in src/main.c)
+extern ups_telemetry_t g_ups[UPS_UNIT_COUNT];
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,14 @@
+#ifndef HOST_DRIVER_UART_H_
+#define HOST_DRIVER_UART_H_
+
+// Host build: port numbers only. The UART backend is src/uart_backend_pty.c
+// or the tool's own (see src/uart_backend.h).
+
+#include "esp_err.h"
+
+typedef int uart_port_t;
+
+#define UART_NUM_0 0
+#define UART_NUM_1 1
+
+#endif // HOST_DRIVER_UART_H_
@@ -0,0 +1,33 @@
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+// Host build: the subset of FreeRTOS the engine and parsers use. There is one
+// task and no interrupts, so critical sections are empty.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void *TaskHandle_t;
+
+typedef struct
+{
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portMAX_DELAY 0xFFFFFFFFU
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+
+#define configTICK_RATE_HZ 100
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES 2
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+
+#endif // HOST_FREERTOS_H_
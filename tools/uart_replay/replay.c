@@ -0,0 +1,968 @@
+// Host replay of a recorded UART transcript (see src/uart_trace.h) through
+// src/uart_engine.c and the SPM2K parsers, on a virtual clock.
+//
+//   uart_replay [-u unit] [-q] [-b] [-d] trace.bin
+//
+// Every recorded command is matched to its SPM2K request and queued; the
+// bytes recorded after it are handed to the engine at the same offsets from
+// the engine's own TX. The output is a telemetry timeline (field changes and
+// failed attempts) and a per-command table of capture vs. replay outcomes and
+// latencies. Without -b the output is deterministic, so two builds can be
+// compared with diff on the same capture.
+//
+//   -u unit  section of the dump to replay (default 0)
+//   -q       summary only, no timeline
+//   -b       also report host CPU time spent in the engine and parsers
+//   -d       print the decoded capture and exit
+
+#include "main.h"
+#include "spm2k.h"
+#include "uart_engine.h"
+#include "uart_trace.h"
+#include "ups_data.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_FIFO_SIZE 4096U
+#define REPLAY_MAX_CMDS 64U
+// Give up on a recorded command the engine did not send within this time.
+#define REPLAY_TX_WAIT_US 5000000LL
+// Keep running this long after the last record so retries and timeouts end.
+#define REPLAY_TAIL_US 10000000LL
+
+typedef struct
+{
+    uint8_t type;
+    int64_t t_us;
+    uint16_t job_id;
+    uint8_t status;
+    uint16_t len;
+    const uint8_t *data;
+} replay_rec_t;
+
+typedef struct
+{
+    uint32_t ok;
+    uint32_t failed;
+    uint32_t abandoned;
+    int64_t lat_min_us;
+    int64_t lat_max_us;
+    int64_t lat_total_us;
+} replay_outcomes_t;
+
+typedef struct
+{
+    uint16_t key;
+    replay_outcomes_t capture;
+    replay_outcomes_t replay;
+} replay_cmd_t;
+
+typedef enum
+{
+    FIELD_BOOL,
+    FIELD_UNSIGNED,
+    FIELD_SIGNED,
+} replay_field_kind_t;
+
+typedef struct
+{
+    const char *name;
+    size_t offset;
+    size_t size;
+    replay_field_kind_t kind;
+} replay_field_t;
+
+#define FIELD(path, kind) {#path, offsetof(ups_telemetry_t, path), sizeof(((ups_telemetry_t *)0)->path), kind}
+
+static const replay_field_t k_fields[] = {
+    FIELD(present_status.ac_present, FIELD_BOOL),
+    FIELD(present_status.charging, FIELD_BOOL),
+    FIELD(present_status.discharging, FIELD_BOOL),
+    FIELD(present_status.fully_charged, FIELD_BOOL),
+    FIELD(present_status.need_replacement, FIELD_BOOL),
+    FIELD(present_status.below_remaining_capacity_limit, FIELD_BOOL),
+    FIELD(present_status.battery_present, FIELD_BOOL),
+    FIELD(present_status.overload, FIELD_BOOL),
+    FIELD(present_status.shutdown_imminent, FIELD_BOOL),
+    FIELD(summary.rechargeable, FIELD_BOOL),
+    FIELD(summary.capacity_mode, FIELD_UNSIGNED),
+    FIELD(summary.design_capacity, FIELD_UNSIGNED),
+    FIELD(summary.full_charge_capacity, FIELD_UNSIGNED),
+    FIELD(summary.warning_capacity_limit, FIELD_UNSIGNED),
+    FIELD(summary.remaining_capacity_limit, FIELD_UNSIGNED),
+    FIELD(summary.i_device_chemistry, FIELD_UNSIGNED),
+    FIELD(summary.capacity_granularity_1, FIELD_UNSIGNED),
+    FIELD(summary.capacity_granularity_2, FIELD_UNSIGNED),
+    FIELD(summary.i_manufacturer_2bit, FIELD_UNSIGNED),
+    FIELD(summary.i_product_2bit, FIELD_UNSIGNED),
+    FIELD(summary.i_serial_number_2bit, FIELD_UNSIGNED),
+    FIELD(summary.i_name_2bit, FIELD_UNSIGNED),
+    FIELD(battery.battery_voltage, FIELD_UNSIGNED),
+    FIELD(battery.battery_current, FIELD_SIGNED),
+    FIELD(battery.config_voltage, FIELD_UNSIGNED),
+    FIELD(battery.run_time_to_empty_s, FIELD_UNSIGNED),
+    FIELD(battery.remaining_time_limit_s, FIELD_UNSIGNED),
+    FIELD(battery.temperature, FIELD_UNSIGNED),
+    FIELD(battery.manufacturer_date, FIELD_UNSIGNED),
+    FIELD(battery.remaining_capacity, FIELD_UNSIGNED),
+    FIELD(input.voltage, FIELD_UNSIGNED),
+    FIELD(input.frequency, FIELD_UNSIGNED),
+    FIELD(input.config_voltage, FIELD_UNSIGNED),
+    FIELD(input.low_voltage_transfer, FIELD_UNSIGNED),
+    FIELD(input.high_voltage_transfer, FIELD_UNSIGNED),
+    FIELD(output.percent_load, FIELD_UNSIGNED),
+    FIELD(output.config_active_power, FIELD_UNSIGNED),
+    FIELD(output.config_voltage, FIELD_UNSIGNED),
+    FIELD(output.voltage, FIELD_UNSIGNED),
+    FIELD(output.current, FIELD_SIGNED),
+    FIELD(output.frequency, FIELD_UNSIGNED),
+};
+
+ups_telemetry_t g_ups[UPS_UNIT_COUNT];
+const bool g_ups_debug_status_print_enabled = false;
+
+static int64_t s_now_us;
+static int64_t s_t0_us;
+static int64_t s_shift_us;
+
+static uint8_t s_fifo[REPLAY_FIFO_SIZE];
+static uint32_t s_fifo_head;
+static uint32_t s_fifo_tail;
+
+static const replay_rec_t *s_recs;
+static long s_rec_count;
+static long s_next; // first record not yet released
+static uint16_t s_last_job; // capture job id of the last recorded TX released
+static bool s_have_job;
+static const replay_rec_t *s_wait_tx; // recorded TX the engine has yet to send
+static int64_t s_wait_since_us;
+static uint16_t s_tx_key;
+static int64_t s_tx_start_us;
+
+static replay_cmd_t s_cmds[REPLAY_MAX_CMDS];
+static size_t s_cmd_count;
+static ups_telemetry_t s_prev_telemetry;
+static bool s_timeline = true;
+
+static uint32_t s_unmatched_tx;
+static uint32_t s_skipped_tx;
+static uint32_t s_enqueue_failed;
+static uint32_t s_fifo_overflow;
+
+// ---- host shims for the firmware interfaces -------------------------------
+
+uint32_t UART2_TickMs(void)
+{
+    return (uint32_t)(s_now_us / 1000);
+}
+
+uint32_t UART2_TickUs(void)
+{
+    return (uint32_t)s_now_us;
+}
+
+// A busy-wait: replay time passes while the engine step blocks.
+void UART2_DelayUs(uint32_t us)
+{
+    s_now_us += (int64_t)us;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t)&s_now_us;
+}
+
+BaseType_t xTaskNotifyGiveIndexed(TaskHandle_t task, UBaseType_t index)
+{
+    (void)task;
+    (void)index;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    (void)index;
+    (void)clear_on_exit;
+    (void)ticks_to_wait;
+    return 0U;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    (void)ticks;
+}
+
+void UART2_Wake(uint8_t unit)
+{
+    (void)unit;
+}
+
+bool UART2_TryLock(uint8_t unit)
+{
+    (void)unit;
+    return true;
+}
+
+void UART2_Unlock(uint8_t unit)
+{
+    (void)unit;
+}
+
+void UART2_TxDoneClear(uint8_t unit)
+{
+    (void)unit;
+}
+
+bool UART2_TxDone(uint8_t unit)
+{
+    (void)unit;
+    return true;
+}
+
+uint16_t UART2_Available(uint8_t unit)
+{
+    (void)unit;
+    return (uint16_t)(s_fifo_head - s_fifo_tail);
+}
+
+uint16_t UART2_Read(uint8_t unit, uint8_t *dst, uint16_t len)
+{
+    (void)unit;
+    uint16_t n = 0U;
+    while ((n < len) && (s_fifo_tail != s_fifo_head))
+    {
+        dst[n++] = s_fifo[s_fifo_tail++ & (REPLAY_FIFO_SIZE - 1U)];
+    }
+    return n;
+}
+
+void UART2_DiscardBuffered(uint8_t unit)
+{
+    (void)unit;
+    s_fifo_tail = s_fifo_head;
+}
+
+int UART2_PatternPopPos(uint8_t unit)
+{
+    (void)unit;
+    return -1;
+}
+
+bool UART2_PatternEnabled(uint8_t unit)
+{
+    (void)unit;
+    return false;
+}
+
+void UPS_DebugPrintTxCommand(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)data;
+    (void)len;
+}
+
+// ---- per-command bookkeeping ----------------------------------------------
+
+static uint16_t replay_key(const uint8_t *data, uint16_t len)
+{
+    if (len == 0U)
+    {
+        return 0U;
+    }
+    return (len == 1U) ? data[0] : (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static const char *replay_key_name(uint16_t key)
+{
+    static char buf[8];
+    if ((key >= 0x20U) && (key < 0x7FU))
+    {
+        (void)snprintf(buf, sizeof(buf), "'%c'", (char)key);
+    }
+    else
+    {
+        (void)snprintf(buf, sizeof(buf), "0x%02X", (unsigned int)key);
+    }
+    return buf;
+}
+
+static replay_cmd_t *replay_cmd(uint16_t key)
+{
+    for (size_t i = 0U; i < s_cmd_count; i++)
+    {
+        if (s_cmds[i].key == key)
+        {
+            return &s_cmds[i];
+        }
+    }
+
+    if (s_cmd_count >= REPLAY_MAX_CMDS)
+    {
+        return NULL;
+    }
+
+    replay_cmd_t *const c = &s_cmds[s_cmd_count++];
+    memset(c, 0, sizeof(*c));
+    c->key = key;
+    return c;
+}
+
+static void replay_count(replay_outcomes_t *o, uint8_t status, int64_t latency_us)
+{
+    switch (status)
+    {
+    case UART_TRACE_END_OK:
+        if ((o->ok == 0U) || (latency_us < o->lat_min_us))
+        {
+            o->lat_min_us = latency_us;
+        }
+        if (latency_us > o->lat_max_us)
+        {
+            o->lat_max_us = latency_us;
+        }
+        o->lat_total_us += latency_us;
+        o->ok++;
+        break;
+    case UART_TRACE_END_ABANDONED:
+        o->abandoned++;
+        break;
+    default:
+        o->failed++;
+        break;
+    }
+}
+
+static int64_t replay_field_value(const ups_telemetry_t *t, const replay_field_t *f)
+{
+    uint8_t const *const p = (const uint8_t *)t + f->offset;
+    switch (f->size)
+    {
+    case 1U:
+        return (f->kind == FIELD_SIGNED) ? (int64_t)(int8_t)p[0] : (int64_t)p[0];
+    case 2U:
+    {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return (f->kind == FIELD_SIGNED) ? (int64_t)(int16_t)v : (int64_t)v;
+    }
+    default:
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return (f->kind == FIELD_SIGNED) ? (int64_t)(int32_t)v : (int64_t)v;
+    }
+    }
+}
+
+static void replay_print_time(void)
+{
+    int64_t const rel_us = s_now_us - s_t0_us;
+    printf("%9.3f ", (double)rel_us / 1e6);
+}
+
+// Print the telemetry fields that changed since the last call.
+static void replay_print_changes(const char *source)
+{
+    for (size_t i = 0U; i < (sizeof(k_fields) / sizeof(k_fields[0])); i++)
+    {
+        int64_t const before = replay_field_value(&s_prev_telemetry, &k_fields[i]);
+        int64_t const after = replay_field_value(&g_ups[0], &k_fields[i]);
+        if (before != after)
+        {
+            replay_print_time();
+            printf("%s %s %lld -> %lld\n", source, k_fields[i].name, (long long)before, (long long)after);
+        }
+    }
+    s_prev_telemetry = g_ups[0];
+}
+
+// Engine outcome of one attempt; process_fn has already run.
+void uart_trace_end(uint8_t unit, uint16_t job_id, uart_trace_end_t status)
+{
+    (void)unit;
+    (void)job_id;
+
+    replay_cmd_t *const c = replay_cmd(s_tx_key);
+    if (c != NULL)
+    {
+        replay_count(&c->replay, (uint8_t)status, s_now_us - s_tx_start_us);
+    }
+
+    if (!s_timeline)
+    {
+        s_prev_telemetry = g_ups[0];
+        return;
+    }
+
+    if (status != UART_TRACE_END_OK)
+    {
+        replay_print_time();
+        printf("%s %s\n", replay_key_name(s_tx_key), (status == UART_TRACE_END_ABANDONED) ? "abandoned" : "failed");
+    }
+    replay_print_changes(replay_key_name(s_tx_key));
+}
+
+void uart_trace_tx(uint8_t unit, uint16_t job_id, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)job_id;
+    (void)data;
+    (void)len;
+}
+
+void uart_trace_rx(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)data;
+    (void)len;
+}
+
+// The engine sends a command: if it is the recorded one we wait for, the
+// bytes recorded after it are scheduled relative to now.
+esp_err_t UART2_SendBytesDMA(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+
+    s_tx_key = replay_key(data, len);
+    s_tx_start_us = s_now_us;
+
+    if ((s_wait_tx != NULL) && (s_wait_tx->len == len) && (memcmp(s_wait_tx->data, data, len) == 0))
+    {
+        s_shift_us = s_now_us - s_wait_tx->t_us;
+        s_wait_tx = NULL;
+        return ESP_OK;
+    }
+
+    // Sent on the engine's own account (e.g. the refresh after an alert)
+    // ahead of the recorded command: take that record now.
+    replay_rec_t const *const r = (s_next < s_rec_count) ? &s_recs[s_next] : NULL;
+    if ((s_wait_tx == NULL) && (r != NULL) && (r->type == UART_TRACE_REC_TX) && (r->len == len) &&
+        (memcmp(r->data, data, len) == 0))
+    {
+        s_shift_us = s_now_us - r->t_us;
+        s_last_job = r->job_id;
+        s_have_job = true;
+        s_next++;
+        return ESP_OK;
+    }
+
+    s_unmatched_tx++;
+    return ESP_OK;
+}
+
+// ---- capture decoding -----------------------------------------------------
+
+static uint8_t *replay_load(const char *path, size_t *out_len)
+{
+    FILE *const f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+
+    size_t cap = 65536U;
+    size_t len = 0U;
+    uint8_t *buf = malloc(cap);
+    while (buf != NULL)
+    {
+        size_t const n = fread(buf + len, 1U, cap - len, f);
+        len += n;
+        if (len < cap)
+        {
+            break;
+        }
+        cap *= 2U;
+        uint8_t *const grown = realloc(buf, cap);
+        if (grown == NULL)
+        {
+            free(buf);
+            buf = NULL;
+        }
+        buf = grown;
+    }
+    fclose(f);
+
+    *out_len = len;
+    return buf;
+}
+
+static uint64_t replay_le(const uint8_t *p, uint8_t bytes)
+{
+    uint64_t v = 0U;
+    for (uint8_t i = 0U; i < bytes; i++)
+    {
+        v |= (uint64_t)p[i] << (8U * i);
+    }
+    return v;
+}
+
+static bool replay_varint(const uint8_t *buf, uint32_t len, uint32_t *pos, uint64_t *out)
+{
+    uint64_t v = 0U;
+    for (uint8_t shift = 0U; shift < 64U; shift = (uint8_t)(shift + 7U))
+    {
+        if (*pos >= len)
+        {
+            return false;
+        }
+        uint8_t const b = buf[(*pos)++];
+        v |= (uint64_t)(b & 0x7FU) << shift;
+        if ((b & 0x80U) == 0U)
+        {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decode one unit section into records. Returns the record count or -1.
+static long replay_decode(const uint8_t *dump,
+                          size_t dump_len,
+                          uint8_t unit,
+                          replay_rec_t **out,
+                          uint32_t *out_dropped)
+{
+    if ((dump_len < 6U) || (memcmp(dump, UART_TRACE_MAGIC, 4U) != 0) || (dump[4] != UART_TRACE_VERSION))
+    {
+        fprintf(stderr, "not a version %u UART transcript\n", (unsigned int)UART_TRACE_VERSION);
+        return -1;
+    }
+
+    size_t pos = 6U;
+    for (uint8_t s = 0U; s < dump[5]; s++)
+    {
+        if ((dump_len - pos) < 17U)
+        {
+            break;
+        }
+        uint8_t const sec_unit = dump[pos];
+        uint32_t const dropped = (uint32_t)replay_le(&dump[pos + 1U], 4U);
+        int64_t t = (int64_t)replay_le(&dump[pos + 5U], 8U);
+        uint32_t const len = (uint32_t)replay_le(&dump[pos + 13U], 4U);
+        const uint8_t *const body = &dump[pos + 17U];
+        if ((dump_len - pos - 17U) < len)
+        {
+            break;
+        }
+        pos += 17U + len;
+        if (sec_unit != unit)
+        {
+            continue;
+        }
+
+        replay_rec_t *recs = calloc((len / 3U) + 1U, sizeof(*recs));
+        long count = 0;
+        uint32_t p = 0U;
+        while ((recs != NULL) && (p < len))
+        {
+            replay_rec_t *const r = &recs[count];
+            uint64_t dt = 0U;
+            uint64_t v = 0U;
+            r->type = body[p++];
+            if (!replay_varint(body, len, &p, &dt))
+            {
+                break;
+            }
+            t += (int64_t)dt;
+            r->t_us = t;
+
+            bool ok = true;
+            switch (r->type)
+            {
+            case UART_TRACE_REC_TX:
+                ok = replay_varint(body, len, &p, &v);
+                r->job_id = (uint16_t)v;
+                ok = ok && replay_varint(body, len, &p, &v) && (v <= (len - p));
+                r->len = (uint16_t)v;
+                r->data = &body[p];
+                p += r->len;
+                break;
+            case UART_TRACE_REC_RX:
+                ok = replay_varint(body, len, &p, &v) && (v <= (len - p));
+                r->len = (uint16_t)v;
+                r->data = &body[p];
+                p += r->len;
+                break;
+            case UART_TRACE_REC_END:
+                ok = replay_varint(body, len, &p, &v) && (p < len);
+                r->job_id = (uint16_t)v;
+                r->status = ok ? body[p++] : 0U;
+                break;
+            default:
+                ok = false;
+                break;
+            }
+            if (!ok)
+            {
+                fprintf(stderr, "unit %u: corrupt record at offset %u\n", (unsigned int)unit, (unsigned int)p);
+                break;
+            }
+            count++;
+        }
+
+        *out = recs;
+        *out_dropped = dropped;
+        return (recs != NULL) ? count : -1;
+    }
+
+    fprintf(stderr, "unit %u not in the capture\n", (unsigned int)unit);
+    return -1;
+}
+
+static void replay_print_capture(const replay_rec_t *recs, long count)
+{
+    for (long i = 0; i < count; i++)
+    {
+        replay_rec_t const *const r = &recs[i];
+        printf("%9.3f ", (double)(r->t_us - recs[0].t_us) / 1e6);
+        switch (r->type)
+        {
+        case UART_TRACE_REC_TX:
+            printf("TX  job=%u", (unsigned int)r->job_id);
+            break;
+        case UART_TRACE_REC_RX:
+            printf("RX ");
+            break;
+        default:
+            printf("END job=%u status=%u\n", (unsigned int)r->job_id, (unsigned int)r->status);
+            continue;
+        }
+        for (uint16_t k = 0U; k < r->len; k++)
+        {
+            printf(" %02X", (unsigned int)r->data[k]);
+        }
+        printf("  \"");
+        for (uint16_t k = 0U; k < r->len; k++)
+        {
+            uint8_t const b = r->data[k];
+            putchar(((b >= 0x20U) && (b < 0x7FU)) ? (int)b : '.');
+        }
+        printf("\"\n");
+    }
+}
+
+// Capture outcomes per command: each END belongs to the TX before it.
+static void replay_count_capture(const replay_rec_t *recs, long count)
+{
+    const replay_rec_t *tx = NULL;
+    for (long i = 0; i < count; i++)
+    {
+        if (recs[i].type == UART_TRACE_REC_TX)
+        {
+            tx = &recs[i];
+        }
+        else if ((recs[i].type == UART_TRACE_REC_END) && (tx != NULL) && (tx->job_id == recs[i].job_id))
+        {
+            replay_cmd_t *const c = replay_cmd(replay_key(tx->data, tx->len));
+            if (c != NULL)
+            {
+                replay_count(&c->capture, recs[i].status, recs[i].t_us - tx->t_us);
+            }
+            tx = NULL;
+        }
+    }
+}
+
+// SPM2K request for a recorded command, or a line request without a parser.
+static const uart_engine_request_t *replay_lookup(const replay_rec_t *tx)
+{
+    static const struct
+    {
+        const uart_engine_request_t *lut;
+        const size_t *count;
+    } k_luts[] = {
+        {g_spm2k_constant_lut, &g_spm2k_constant_lut_count},
+        {g_spm2k_dynamic_lut, &g_spm2k_dynamic_lut_count},
+        {g_spm2k_alert_refresh_lut, &g_spm2k_alert_refresh_lut_count},
+        {&g_spm2k_constant_heartbeat, NULL},
+    };
+    static uart_engine_request_t s_unknown[REPLAY_MAX_CMDS];
+    static size_t s_unknown_count;
+
+    uint16_t const key = replay_key(tx->data, tx->len);
+    for (size_t l = 0U; l < (sizeof(k_luts) / sizeof(k_luts[0])); l++)
+    {
+        size_t const n = (k_luts[l].count != NULL) ? *k_luts[l].count : 1U;
+        for (size_t i = 0U; i < n; i++)
+        {
+            uart_engine_request_t const *const req = &k_luts[l].lut[i];
+            if ((req->cmd == key) && (req->cmd_bits == (uint8_t)(tx->len * 8U)))
+            {
+                return req;
+            }
+        }
+    }
+
+    for (size_t i = 0U; i < s_unknown_count; i++)
+    {
+        if (s_unknown[i].cmd == key)
+        {
+            return &s_unknown[i];
+        }
+    }
+    if (s_unknown_count >= REPLAY_MAX_CMDS)
+    {
+        return NULL;
+    }
+
+    uart_engine_request_t *const req = &s_unknown[s_unknown_count++];
+    memset(req, 0, sizeof(*req));
+    req->cmd = key;
+    req->cmd_bits = (uint8_t)(tx->len * 8U);
+    req->expected_len = 64U;
+    req->expected_ending = true;
+    req->expected_ending_len = 2U;
+    req->expected_ending_bytes[0] = 0x0DU;
+    req->expected_ending_bytes[1] = 0x0AU;
+    req->timeout_ms = 500U;
+    return req;
+}
+
+static void replay_fifo_push(const uint8_t *data, uint16_t len)
+{
+    for (uint16_t i = 0U; i < len; i++)
+    {
+        if ((s_fifo_head - s_fifo_tail) >= REPLAY_FIFO_SIZE)
+        {
+            s_fifo_overflow++;
+            return;
+        }
+        s_fifo[s_fifo_head++ & (REPLAY_FIFO_SIZE - 1U)] = data[i];
+    }
+}
+
+static int64_t replay_host_ns(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void replay_print_latency(const replay_outcomes_t *o)
+{
+    if (o->ok == 0U)
+    {
+        printf(" %7s %7s %7s", "-", "-", "-");
+        return;
+    }
+    printf(" %7.1f %7.1f %7.1f",
+           (double)o->lat_min_us / 1000.0,
+           (double)o->lat_total_us / (1000.0 * (double)o->ok),
+           (double)o->lat_max_us / 1000.0);
+}
+
+static void replay_usage(void)
+{
+    fprintf(stderr, "usage: uart_replay [-u unit] [-q] [-b] [-d] trace.bin\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t unit = 0U;
+    bool bench = false;
+    bool decode_only = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "u:qbd")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            unit = (uint8_t)atoi(optarg);
+            break;
+        case 'q':
+            s_timeline = false;
+            break;
+        case 'b':
+            bench = true;
+            break;
+        case 'd':
+            decode_only = true;
+            break;
+        default:
+            replay_usage();
+            return 2;
+        }
+    }
+    if (optind != (argc - 1))
+    {
+        replay_usage();
+        return 2;
+    }
+
+    size_t dump_len = 0U;
+    uint8_t *const dump = replay_load(argv[optind], &dump_len);
+    if (dump == NULL)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    replay_rec_t *recs = NULL;
+    uint32_t dropped = 0U;
+    long const count = replay_decode(dump, dump_len, unit, &recs, &dropped);
+    if (count < 0)
+    {
+        free(dump);
+        return 1;
+    }
+    if (decode_only)
+    {
+        replay_print_capture(recs, count);
+        free(recs);
+        free(dump);
+        return 0;
+    }
+
+    replay_count_capture(recs, count);
+
+    s_t0_us = (count > 0) ? recs[0].t_us : 0;
+    s_now_us = s_t0_us;
+    int64_t const end_us = ((count > 0) ? recs[count - 1].t_us : 0) + REPLAY_TAIL_US;
+
+    uart_engine_init();
+    uart_engine_set_enabled(0U, true);
+    uart_engine_set_oob_handler(0U,
+                                spm2k_process_alert_byte,
+                                &g_ups[0],
+                                g_spm2k_alert_refresh_lut,
+                                g_spm2k_alert_refresh_lut_count);
+    s_prev_telemetry = g_ups[0];
+
+    printf("# unit %u: %ld records over %.3f s, %u dropped before the capture start\n",
+           (unsigned int)unit,
+           count,
+           (count > 0) ? ((double)(recs[count - 1].t_us - recs[0].t_us) / 1e6) : 0.0,
+           (unsigned int)dropped);
+
+    s_recs = recs;
+    s_rec_count = count;
+    int64_t host_ns = 0;
+
+    while (s_now_us <= end_us)
+    {
+        while ((s_next < count) && (s_wait_tx == NULL) && ((recs[s_next].t_us + s_shift_us) <= s_now_us))
+        {
+            replay_rec_t const *const r = &recs[s_next++];
+            if (r->type == UART_TRACE_REC_RX)
+            {
+                replay_fifo_push(r->data, r->len);
+            }
+            else if (r->type == UART_TRACE_REC_TX)
+            {
+                if (!s_have_job || (r->job_id != s_last_job))
+                {
+                    // New job; a repeated id is a retry the engine does on its own.
+                    uart_engine_request_t const *const req = replay_lookup(r);
+                    if ((req == NULL) ||
+                        (uart_engine_enqueue_static(0U, req, UART_ENGINE_PRIO_BACKGROUND) != UART_ENGINE_OK))
+                    {
+                        s_enqueue_failed++;
+                    }
+                    s_last_job = r->job_id;
+                    s_have_job = true;
+                }
+                s_wait_tx = r;
+                s_wait_since_us = s_now_us;
+            }
+        }
+
+        int64_t const t0 = bench ? replay_host_ns() : 0;
+        uart_engine_tick(0U);
+        if (bench)
+        {
+            host_ns += replay_host_ns() - t0;
+        }
+        if (s_timeline)
+        {
+            // Changes outside a job end come from alert characters.
+            replay_print_changes("alert");
+        }
+
+        if ((s_wait_tx != NULL) &&
+            (!uart_engine_is_busy(0U) || ((s_now_us - s_wait_since_us) > REPLAY_TX_WAIT_US)))
+        {
+            // The engine will not send it (e.g. no retry needed): drop the
+            // recorded attempt up to its END, keep what arrived after it.
+            uint16_t const job_id = s_wait_tx->job_id;
+            s_skipped_tx++;
+            s_wait_tx = NULL;
+            while ((s_next < count) && (recs[s_next].type != UART_TRACE_REC_TX))
+            {
+                bool const attempt_end = (recs[s_next].type == UART_TRACE_REC_END) && (recs[s_next].job_id == job_id);
+                s_next++;
+                if (attempt_end)
+                {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        int64_t t_next = INT64_MAX;
+        if ((s_next < count) && (s_wait_tx == NULL))
+        {
+            t_next = recs[s_next].t_us + s_shift_us;
+        }
+        if (uart_engine_is_busy(0U))
+        {
+            uint32_t const ms = uart_engine_time_to_next_ms(0U, ups_tick_ms());
+            int64_t const t_engine = s_now_us + ((int64_t)((ms > 0U) ? ms : 1U) * 1000);
+            if (t_engine < t_next)
+            {
+                t_next = t_engine;
+            }
+        }
+        if (t_next == INT64_MAX)
+        {
+            break;
+        }
+        s_now_us = (t_next > s_now_us) ? t_next : (s_now_us + 1000);
+    }
+
+    printf("#\n# %-6s %17s %17s %23s %23s\n", "cmd", "capture ok/fail", "replay ok/fail", "capture ms min/avg/max", "replay ms min/avg/max");
+    for (size_t i = 0U; i < s_cmd_count; i++)
+    {
+        replay_cmd_t const *const c = &s_cmds[i];
+        printf("# %-6s %8u/%-8u %8u/%-8u",
+               replay_key_name(c->key),
+               (unsigned int)c->capture.ok,
+               (unsigned int)(c->capture.failed + c->capture.abandoned),
+               (unsigned int)c->replay.ok,
+               (unsigned int)(c->replay.failed + c->replay.abandoned));
+        replay_print_latency(&c->capture);
+        replay_print_latency(&c->replay);
+        printf("\n");
+    }
+    printf("# engine TX not in the capture: %u, recorded TX not re-sent: %u, enqueue failures: %u, RX overflow: %u\n",
+           (unsigned int)s_unmatched_tx,
+           (unsigned int)s_skipped_tx,
+           (unsigned int)s_enqueue_failed,
+           (unsigned int)s_fifo_overflow);
+
+    if (bench)
+    {
+        uint32_t attempts = 0U;
+        for (size_t i = 0U; i < s_cmd_count; i++)
+        {
+            attempts += s_cmds[i].replay.ok + s_cmds[i].replay.failed + s_cmds[i].replay.abandoned;
+        }
+        printf("# host: %.3f ms in uart_engine_tick, %.0f ns per attempt\n",
+               (double)host_ns / 1e6,
+               (attempts > 0U) ? ((double)host_ns / (double)attempts) : 0.0);
+    }
+
+    free(recs);
+    free(dump);
+    return 0;
+}
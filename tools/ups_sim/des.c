@@ -0,0 +1,663 @@
+// Discrete-event run of src/uart_engine.c and the SPM2K LUTs against the
+// simulated UPS of sim_common.c. Time is a virtual clock injected with
+// ups_clock_set() that jumps straight to the next event, so a day of polling
+// with timeouts takes seconds and every run with the same options is
+// identical.
+//
+//   ups_des [-h hours] [-s start_ms] [-l permille] [-o minutes] [-a seconds]
+//           [-u cmd]... [-g ms] [-t ms] [-p ms | -e] [-r seed] [-q]
+//
+//   -h hours     simulated time (default 24)
+//   -s start_ms  virtual clock at start (default 2^32 - 30 min: the clock
+//                wraps half an hour into the run)
+//   -l permille  share of commands the UPS ignores (default 5)
+//   -o minutes   the UPS goes silent for one minute every n minutes
+//                (default 60, 0 = never)
+//   -a seconds   toggle mains power every n seconds, with the '!' / '$'
+//                alert characters (default 600, 0 = never)
+//   -u cmd       the UPS never answers cmd (e.g. 0x9FD4, as older firmware);
+//                up to SIM_MAX_IGNORED times
+//   -g ms        the UPS ignores a command that starts less than ms after
+//                the end of its last reply (default 0)
+//   -t ms        loop tick: timed wakeups (cooldowns, TX polls, deadlines)
+//                land on multiples of ms, as a FreeRTOS tick; RX and alert
+//                bytes still wake at once (default 1)
+//   -p ms        dynamic LUT polling period (default 1000, 0 = back to back)
+//   -e           as the firmware: probe both LUTs once with lut_probe, then
+//                refresh the dynamic entries that answered with lut_sched
+//                and the per-entry periods of g_spm2k_dynamic_period_ms,
+//                instead of sweeps; the engine heartbeat covers quiet spells
+//   -r seed      seed of the loss pattern (default 1)
+//   -q           no hourly status lines
+//
+// Exit status 1 when a dynamic sweep (with -e: an entry the UPS answers,
+// beyond its period) did not come round within DES_STALL_MS, the engine
+// stopped advancing time, or its timeout/parse counters disagree with what
+// the UPS did.
+
+#include "sim_common.h"
+
+#include "lut_probe.h"
+#include "lut_sched.h"
+#include "main.h"
+#include "spm2k.h"
+#include "uart_engine.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest acceptable time between two completed dynamic sweeps.
+#define DES_STALL_MS 60000U
+// Outage length with -o.
+#define DES_OUTAGE_MS 60000U
+// -e: heartbeat interval, as UPS_HEARTBEAT_INTERVAL_MS in main.c.
+#define DES_HEARTBEAT_MS 10000U
+// Ticks in a row without the clock moving before the run is declared stuck.
+#define DES_MAX_ZERO_STEPS 10000U
+
+#define DES_FIFO_SIZE 1024U
+#define DES_MAX_EVENTS 8U
+
+typedef struct
+{
+    uint64_t due_ms;
+    uint8_t len;
+    char data[48];
+} des_event_t;
+
+static uint64_t s_now_ms; // virtual time, never wraps; the clock is its low 32 bits
+
+// Loopback UART: RX FIFO fed by scheduled events, TX handed to the UPS model.
+static uint8_t s_fifo[DES_FIFO_SIZE];
+static uint32_t s_fifo_head;
+static uint32_t s_fifo_tail;
+static uint64_t s_tx_done_ms;
+static des_event_t s_events[DES_MAX_EVENTS];
+static uint8_t s_event_count;
+
+static sim_ups_t s_ups;
+static uint32_t s_loss_permille = 5U;
+static uint32_t s_rng = 1U;
+static bool s_outage;
+
+static uint32_t s_turnaround_ms;
+static uint64_t s_reply_end_ms;
+
+static uint32_t s_lost;
+static uint32_t s_lost_outage;
+static uint32_t s_lost_turnaround;
+static uint32_t s_event_overflow;
+
+static uint32_t des_clock_ms(void *ctx)
+{
+    (void)ctx;
+    return (uint32_t)s_now_ms;
+}
+
+static uint32_t des_rand(void)
+{
+    // xorshift32: the same loss pattern for the same seed on every host.
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static void des_schedule(uint64_t due_ms, const char *data, size_t len)
+{
+    if ((s_event_count >= DES_MAX_EVENTS) || (len > sizeof(s_events[0].data)))
+    {
+        s_event_overflow++;
+        return;
+    }
+
+    // Keep the events ordered by due time (stable for equal times).
+    uint8_t i = s_event_count;
+    while ((i > 0U) && (s_events[i - 1U].due_ms > due_ms))
+    {
+        s_events[i] = s_events[i - 1U];
+        i--;
+    }
+    s_events[i].due_ms = due_ms;
+    s_events[i].len = (uint8_t)len;
+    memcpy(s_events[i].data, data, len);
+    s_event_count++;
+}
+
+static void des_deliver_due(void)
+{
+    while ((s_event_count > 0U) && (s_events[0].due_ms <= s_now_ms))
+    {
+        for (uint8_t i = 0U; i < s_events[0].len; i++)
+        {
+            if ((s_fifo_head - s_fifo_tail) < DES_FIFO_SIZE)
+            {
+                s_fifo[s_fifo_head++ & (DES_FIFO_SIZE - 1U)] = (uint8_t)s_events[0].data[i];
+            }
+        }
+        s_event_count--;
+        memmove(&s_events[0], &s_events[1], (size_t)s_event_count * sizeof(s_events[0]));
+    }
+}
+
+// ---- loopback UART backend ------------------------------------------------
+
+// The loopback has no clock of its own: ups_tick_ms() reads the injected
+// virtual clock. This is only the fallback before it is installed.
+uint32_t UART2_TickMs(void)
+{
+    return (uint32_t)s_now_ms;
+}
+
+uint32_t UART2_TickUs(void)
+{
+    return (uint32_t)(s_now_ms * 1000U);
+}
+
+// A busy-wait: virtual time passes while the engine step blocks.
+void UART2_DelayUs(uint32_t us)
+{
+    s_now_ms += (us + 999U) / 1000U;
+}
+
+bool UART2_TryLock(uint8_t unit)
+{
+    (void)unit;
+    return true;
+}
+
+void UART2_Unlock(uint8_t unit)
+{
+    (void)unit;
+}
+
+esp_err_t UART2_SendBytesDMA(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+
+    uint64_t const start_ms = (s_tx_done_ms > s_now_ms) ? s_tx_done_ms : s_now_ms;
+    bool const too_soon = (start_ms < (s_reply_end_ms + s_turnaround_ms));
+    s_tx_done_ms = start_ms + sim_wire_ms(len);
+
+    for (uint16_t i = 0U; i < len; i++)
+    {
+        char reply[48];
+        size_t const reply_len = sim_ups_feed(&s_ups, data[i], reply, sizeof(reply));
+        if (reply_len == 0U)
+        {
+            continue;
+        }
+
+        if (s_outage)
+        {
+            s_lost_outage++;
+        }
+        else if (too_soon)
+        {
+            s_lost_turnaround++;
+        }
+        else if ((des_rand() % 1000U) < s_loss_permille)
+        {
+            s_lost++;
+        }
+        else
+        {
+            s_reply_end_ms = s_tx_done_ms + SIM_REPLY_DELAY_MS + sim_wire_ms(reply_len);
+            des_schedule(s_reply_end_ms, reply, reply_len);
+        }
+    }
+    return ESP_OK;
+}
+
+bool UART2_TxDone(uint8_t unit)
+{
+    (void)unit;
+    return s_now_ms >= s_tx_done_ms;
+}
+
+void UART2_TxDoneClear(uint8_t unit)
+{
+    (void)unit;
+}
+
+uint16_t UART2_Available(uint8_t unit)
+{
+    (void)unit;
+    return (uint16_t)(s_fifo_head - s_fifo_tail);
+}
+
+uint16_t UART2_Read(uint8_t unit, uint8_t *dst, uint16_t len)
+{
+    (void)unit;
+    uint16_t n = 0U;
+    while ((n < len) && (s_fifo_tail != s_fifo_head))
+    {
+        dst[n++] = s_fifo[s_fifo_tail++ & (DES_FIFO_SIZE - 1U)];
+    }
+    return n;
+}
+
+void UART2_DiscardBuffered(uint8_t unit)
+{
+    (void)unit;
+    s_fifo_tail = s_fifo_head;
+}
+
+int UART2_PatternPopPos(uint8_t unit)
+{
+    (void)unit;
+    return -1;
+}
+
+bool UART2_PatternEnabled(uint8_t unit)
+{
+    (void)unit;
+    return false;
+}
+
+void UART2_Wake(uint8_t unit)
+{
+    (void)unit;
+}
+
+// ---- driver ---------------------------------------------------------------
+
+static uint64_t des_min(uint64_t a, uint64_t b)
+{
+    return (a < b) ? a : b;
+}
+
+// A timed wakeup at due_ms happens on the first tick at or after it.
+static uint64_t des_tick_align(uint64_t due_ms, uint32_t tick_ms)
+{
+    if ((due_ms == UINT64_MAX) || (due_ms <= s_now_ms) || (tick_ms <= 1U))
+    {
+        return due_ms;
+    }
+    return ((due_ms + tick_ms - 1U) / tick_ms) * tick_ms;
+}
+
+static double des_wall_s(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+static void des_usage(void)
+{
+    fprintf(stderr,
+            "usage: ups_des [-h hours] [-s start_ms] [-l permille] [-o minutes] [-a seconds] [-u cmd]... [-g ms] [-t ms] "
+            "[-p ms | -e] [-r seed] [-q]\n");
+}
+
+// Per-entry refresh report of the -e run. Returns false if an entry the UPS
+// answers went longer than its period plus DES_STALL_MS without completing.
+static bool des_print_sched(const lut_sched_t *sched)
+{
+    bool ok = true;
+    printf("#\n# entry   period ms       ok  failed  suspended  missed  late max  gap max ms\n");
+    for (size_t i = 0U; i < sched->count; i++)
+    {
+        lut_sched_entry_stats_t const *st = &sched->entries[i].stats;
+        printf("# 0x%-4X %9u %8u %7u %10u %7u %9u %11u\n",
+               (unsigned int)sched->lut[i].cmd,
+               (unsigned int)sched->period_ms[i],
+               (unsigned int)st->ok,
+               (unsigned int)st->failed,
+               (unsigned int)st->suspended,
+               (unsigned int)st->missed,
+               (unsigned int)st->late_max_ms,
+               (unsigned int)st->gap_max_ms);
+        if (!sim_ups_ignores(&s_ups, sched->lut[i].cmd) && (st->gap_max_ms > (sched->period_ms[i] + DES_STALL_MS)))
+        {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t run_ms = 24ULL * 3600000ULL;
+    uint64_t start_ms = 0x100000000ULL - 1800000ULL;
+    uint64_t outage_period_ms = 3600000ULL;
+    uint64_t alert_period_ms = 600000ULL;
+    uint32_t period_ms = 1000U;
+    uint32_t tick_ms = 1U;
+    bool hourly = true;
+    bool edf = false;
+    lut_sched_t sched;
+    lut_probe_t probe;
+    uint32_t dynamic_active = 0U;
+    uart_engine_expect_bytes_t heartbeat_expect = {
+        .expected = g_spm2k_constant_heartbeat_expect_return,
+        .expected_len = (uint16_t)g_spm2k_constant_heartbeat_expect_return_len,
+    };
+    uart_engine_heartbeat_cfg_t heartbeat = {
+        .req = g_spm2k_constant_heartbeat,
+        .interval_ms = DES_HEARTBEAT_MS,
+        .failure_threshold = 0U,
+    };
+    heartbeat.req.out_value = &heartbeat_expect;
+    heartbeat.req.process_fn = uart_engine_process_expect_exact;
+
+    sim_ups_init(&s_ups);
+    int opt;
+    while ((opt = getopt(argc, argv, "h:s:l:o:a:u:g:t:p:er:q")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            run_ms = strtoull(optarg, NULL, 0) * 3600000ULL;
+            break;
+        case 's':
+            start_ms = strtoull(optarg, NULL, 0) & 0xFFFFFFFFULL;
+            break;
+        case 'l':
+            s_loss_permille = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            outage_period_ms = strtoull(optarg, NULL, 0) * 60000ULL;
+            break;
+        case 'a':
+            alert_period_ms = strtoull(optarg, NULL, 0) * 1000ULL;
+            break;
+        case 'u':
+            if (!sim_ups_ignore(&s_ups, (uint16_t)strtoul(optarg, NULL, 0)))
+            {
+                des_usage();
+                return 2;
+            }
+            break;
+        case 'g':
+            s_turnaround_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            tick_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            period_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            edf = true;
+            break;
+        case 'r':
+            s_rng = (uint32_t)strtoul(optarg, NULL, 0);
+            s_rng = (s_rng == 0U) ? 1U : s_rng;
+            break;
+        case 'q':
+            hourly = false;
+            break;
+        default:
+            des_usage();
+            return 2;
+        }
+    }
+
+    s_now_ms = start_ms;
+    ups_clock_set(des_clock_ms, NULL);
+
+    uart_engine_init();
+    uart_engine_set_enabled(0U, true);
+    uart_engine_set_oob_handler(0U, spm2k_process_alert_byte, &g_ups[0], g_spm2k_alert_refresh_lut, g_spm2k_alert_refresh_lut_count);
+    (void)lut_sched_init(&sched, 0U, g_spm2k_dynamic_lut, g_spm2k_dynamic_period_ms, g_spm2k_dynamic_lut_count);
+
+    double const wall_start_s = des_wall_s();
+    uint64_t const end_ms = start_ms + run_ms;
+    uint64_t next_sweep_ms = start_ms;
+    uint64_t next_alert_ms = (alert_period_ms > 0U) ? (start_ms + alert_period_ms) : UINT64_MAX;
+    uint64_t next_hour_ms = start_ms + 3600000ULL;
+    uint64_t last_model_ms = start_ms;
+    uint64_t last_sweep_done_ms = start_ms;
+    uint64_t sweep_gap_max_ms = 0U;
+    uint64_t sweep_start_ms = start_ms;
+    uint64_t cycle_sum_ms = 0U;
+    uint64_t cycle_max_ms = 0U;
+    uint32_t sweeps = 0U;
+    uint32_t wraps = 0U;
+    uint32_t zero_steps = 0U;
+    bool stuck = false;
+
+    sim_sweep_t sweep;
+    sim_sweep_start(&sweep, g_spm2k_constant_lut, g_spm2k_constant_lut_count);
+    bool sweeping = !edf;
+    // -e: probing the constant LUT, then the dynamic one.
+    const uart_engine_request_t *probing = edf ? g_spm2k_constant_lut : NULL;
+    (void)lut_probe_start(&probe, 0U, g_spm2k_constant_lut, g_spm2k_constant_lut_count, LUT_PROBE_ALL);
+
+    // Past end_ms no new work is started; the loop runs on until the command
+    // in flight has completed or timed out, so the counters can be compared.
+    while ((s_now_ms < end_ms) || uart_engine_is_busy(0U))
+    {
+        bool const running = (s_now_ms < end_ms);
+        sim_ups_advance(&s_ups, (uint32_t)(s_now_ms - last_model_ms));
+        last_model_ms = s_now_ms;
+
+        if (running && (s_now_ms >= next_alert_ms))
+        {
+            char const alert = sim_ups_set_mains(&s_ups, s_ups.on_battery);
+            des_schedule(s_now_ms, &alert, 1U);
+            next_alert_ms += alert_period_ms;
+        }
+        s_outage = (outage_period_ms > 0U) && (((s_now_ms - start_ms) % outage_period_ms) >= (outage_period_ms - DES_OUTAGE_MS));
+        des_deliver_due();
+
+        if (sweeping)
+        {
+            sim_sweep_feed(&sweep);
+            if (sim_sweep_done(&sweep))
+            {
+                if (sweep.lut == g_spm2k_dynamic_lut)
+                {
+                    sweeps++;
+                    uint64_t const gap_ms = s_now_ms - last_sweep_done_ms;
+                    sweep_gap_max_ms = (gap_ms > sweep_gap_max_ms) ? gap_ms : sweep_gap_max_ms;
+                    last_sweep_done_ms = s_now_ms;
+                    uint64_t const cycle_ms = s_now_ms - sweep_start_ms;
+                    cycle_sum_ms += cycle_ms;
+                    cycle_max_ms = (cycle_ms > cycle_max_ms) ? cycle_ms : cycle_max_ms;
+                    if ((cycle_ms == 0U) && (next_sweep_ms <= s_now_ms))
+                    {
+                        // Every entry suspended: -p 0 must still let time pass.
+                        next_sweep_ms = s_now_ms + 1U;
+                    }
+                    if (hourly && (s_now_ms >= next_hour_ms))
+                    {
+                        sim_print_status((uint32_t)(s_now_ms - start_ms));
+                        next_hour_ms += 3600000ULL;
+                    }
+                }
+                sweeping = false;
+            }
+        }
+        else if ((probing != NULL) && lut_probe_tick(&probe))
+        {
+            if (probing == g_spm2k_constant_lut)
+            {
+                probing = g_spm2k_dynamic_lut;
+                (void)lut_probe_start(&probe, 0U, g_spm2k_dynamic_lut, g_spm2k_dynamic_lut_count, LUT_PROBE_ALL);
+            }
+            else
+            {
+                // From here on lut_sched owns the entries that answered.
+                probing = NULL;
+                dynamic_active = lut_probe_supported(&probe);
+                lut_sched_set_active(&sched, dynamic_active);
+                lut_sched_start(&sched, (uint32_t)s_now_ms);
+                uart_engine_set_heartbeat(0U, &heartbeat);
+                next_sweep_ms = UINT64_MAX;
+            }
+            continue;
+        }
+        else if (!edf && running && (s_now_ms >= next_sweep_ms))
+        {
+            sim_sweep_start(&sweep, g_spm2k_dynamic_lut, g_spm2k_dynamic_lut_count);
+            sweep_start_ms = s_now_ms;
+            next_sweep_ms = s_now_ms + period_ms;
+            sweeping = true;
+            continue;
+        }
+
+        if (!running)
+        {
+            lut_sched_stop(&sched);
+        }
+        (void)lut_sched_tick(&sched, ups_tick_ms());
+        uart_engine_tick(0U);
+
+        uint64_t next_ms = UINT64_MAX;
+        uint32_t const engine_next = uart_engine_time_to_next_ms(0U, ups_tick_ms());
+        if (engine_next != UINT32_MAX)
+        {
+            next_ms = des_tick_align(s_now_ms + engine_next, tick_ms);
+        }
+        uint32_t const sched_next = lut_sched_time_to_next_ms(&sched, ups_tick_ms());
+        if (sched_next != UINT32_MAX)
+        {
+            next_ms = des_min(next_ms, des_tick_align(s_now_ms + sched_next, tick_ms));
+        }
+        if (sweeping)
+        {
+            if ((sweep.index < sweep.count) || (engine_next == UINT32_MAX))
+            {
+                next_ms = s_now_ms;
+            }
+        }
+        else if (probing != NULL)
+        {
+            uint32_t const probe_next = lut_probe_time_to_next_ms(&probe);
+            if (probe_next != UINT32_MAX)
+            {
+                next_ms = des_min(next_ms, des_tick_align(s_now_ms + probe_next, tick_ms));
+            }
+        }
+        else if (running)
+        {
+            next_ms = des_min(next_ms, des_tick_align(next_sweep_ms, tick_ms));
+        }
+        if (s_event_count > 0U)
+        {
+            next_ms = des_min(next_ms, s_events[0].due_ms);
+        }
+        // Outage edges only change how the UPS treats the next command, so
+        // they need no wakeup of their own.
+        if (running)
+        {
+            next_ms = des_min(next_ms, next_alert_ms);
+        }
+
+        if (!running && (next_ms == UINT64_MAX))
+        {
+            // Drained: nothing left that could move the clock.
+            break;
+        }
+        if (next_ms <= s_now_ms)
+        {
+            if (++zero_steps > DES_MAX_ZERO_STEPS)
+            {
+                stuck = true;
+                break;
+            }
+            continue;
+        }
+
+        zero_steps = 0U;
+        if ((uint32_t)next_ms < (uint32_t)s_now_ms)
+        {
+            wraps++;
+        }
+        s_now_ms = running ? des_min(next_ms, end_ms) : next_ms;
+    }
+
+    double const wall_s = des_wall_s() - wall_start_s;
+
+    uint32_t timeouts = 0U;
+    uint32_t parse_fail = 0U;
+    uint64_t commands = 0U;
+    size_t const cmd_count = uart_engine_cmd_stats_count(0U);
+    for (size_t i = 0U; i < cmd_count; i++)
+    {
+        uart_engine_cmd_stats_t s;
+        if (uart_engine_get_cmd_stats(0U, i, &s))
+        {
+            timeouts += s.timeout;
+            parse_fail += s.parse_fail;
+            commands += (uint64_t)s.success + s.timeout + s.parse_fail;
+        }
+    }
+
+    sim_print_cmd_stats();
+    bool const sched_ok = !edf || des_print_sched(&sched);
+
+    uart_engine_bus_stats_t bus;
+    uart_engine_get_bus_stats(0U, &bus);
+    uint64_t bus_total_ms = 0U;
+    for (uint8_t st = 0U; st < (uint8_t)UART_ENGINE_STATE_COUNT; st++)
+    {
+        bus_total_ms += bus.state_ms[st];
+    }
+    uint64_t const bus_busy_ms = bus_total_ms - bus.state_ms[UART_ENGINE_STATE_IDLE];
+
+    printf("#\n# simulated %.1f h in %.2f s, clock 0x%08" PRIX32 " -> 0x%08" PRIX32 " (%u wrap%s)\n",
+           (double)(s_now_ms - start_ms) / 3600000.0,
+           wall_s,
+           (uint32_t)start_ms,
+           (uint32_t)s_now_ms,
+           (unsigned int)wraps,
+           (wraps == 1U) ? "" : "s");
+    if (!edf)
+    {
+        printf("# dynamic sweeps: %u, longest gap %" PRIu64 " ms, full cycle %.1f ms avg / %" PRIu64 " ms max\n",
+               (unsigned int)sweeps,
+               sweep_gap_max_ms,
+               (sweeps != 0U) ? ((double)cycle_sum_ms / (double)sweeps) : 0.0,
+               cycle_max_ms);
+    }
+    else
+    {
+        uint32_t answered = 0U;
+        for (size_t i = 0U; i < g_spm2k_dynamic_lut_count; i++)
+        {
+            answered += (dynamic_active >> i) & 1U;
+        }
+        printf("# probe: %u of %u dynamic entries answered\n", (unsigned int)answered, (unsigned int)g_spm2k_dynamic_lut_count);
+        printf("# heartbeats sent: %u\n", (unsigned int)bus.heartbeats);
+    }
+    printf("# bus busy %.1f%%, %.2f commands/s\n",
+           (bus_total_ms != 0U) ? ((100.0 * (double)bus_busy_ms) / (double)bus_total_ms) : 0.0,
+           (s_now_ms > start_ms) ? ((1000.0 * (double)commands) / (double)(s_now_ms - start_ms)) : 0.0);
+    printf("# turnaround (end of job to next TX): %.2f ms avg / %.1f ms max over %u back-to-back jobs\n",
+           (bus.turnarounds != 0U) ? ((double)bus.turnaround_sum_us / (1000.0 * (double)bus.turnarounds)) : 0.0,
+           (double)bus.turnaround_max_us / 1000.0,
+           (unsigned int)bus.turnarounds);
+    printf("# unanswered: %u lost + %u in outages + %u too soon + %u ignored, engine timeouts: %u, parse failures: %u\n",
+           (unsigned int)s_lost,
+           (unsigned int)s_lost_outage,
+           (unsigned int)s_lost_turnaround,
+           (unsigned int)s_ups.ignored,
+           (unsigned int)timeouts,
+           (unsigned int)parse_fail);
+
+    int rc = 0;
+    if (stuck)
+    {
+        printf("FAIL: clock stopped advancing at 0x%08" PRIX32 "\n", (uint32_t)s_now_ms);
+        rc = 1;
+    }
+    if (edf ? !sched_ok : ((sweep_gap_max_ms > DES_STALL_MS) || ((end_ms - last_sweep_done_ms) > DES_STALL_MS)))
+    {
+        printf("FAIL: dynamic polling stalled\n");
+        rc = 1;
+    }
+    if ((timeouts != (s_lost + s_lost_outage + s_lost_turnaround + s_ups.ignored)) || (parse_fail != 0U) || (s_event_overflow != 0U))
+    {
+        printf("FAIL: engine failures do not match the injected faults\n");
+        rc = 1;
+    }
+    return rc;
+}
@@ -0,0 +1,722 @@
+// Host checks of src/uart_engine.c behaviour that the simulations only show
+// statistically: merging, completion reports, the OOB filter. Each test runs
+// the engine against a scripted loopback UART on a virtual clock.
+//
+//   ups_test [-v]
+//
+//   -v  print every check, not just the failing ones
+//
+// Exit status 1 when a check failed.
+
+#include "sim_common.h"
+
+#include "lut_probe.h"
+#include "lut_sched.h"
+#include "main.h"
+#include "spm2k.h"
+#include "uart_engine.h"
+#include "ups_clock.h"
+#include "ups_data.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Time from the end of a command to the first reply byte.
+#define TEST_REPLY_DELAY_MS 5U
+// Upper bound for test_run_idle(), in virtual milliseconds.
+#define TEST_MAX_RUN_MS 10000U
+
+#define TEST_FIFO_SIZE 256U
+#define TEST_TX_LOG_SIZE 64U
+
+static uint32_t s_now_ms;
+static bool s_verbose;
+static unsigned int s_checks;
+static unsigned int s_failed;
+
+// Scripted UPS: the reply to each single-byte command, NULL = no reply.
+static const char *s_replies[256];
+static uint8_t s_fifo[TEST_FIFO_SIZE];
+static uint32_t s_fifo_head;
+static uint32_t s_fifo_tail;
+static uint32_t s_tx_done_ms;
+static const char *s_pending_reply;
+static uint32_t s_pending_due_ms;
+static char s_tx_log[TEST_TX_LOG_SIZE];
+static size_t s_tx_log_len;
+
+#define TEST_CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+static void test_check(bool ok, const char *what, const char *file, int line)
+{
+    s_checks++;
+    if (!ok)
+    {
+        s_failed++;
+    }
+    if (!ok || s_verbose)
+    {
+        printf("%s:%d: %s: %s\n", file, line, ok ? "ok" : "FAILED", what);
+    }
+}
+
+static uint32_t test_clock_ms(void *ctx)
+{
+    (void)ctx;
+    return s_now_ms;
+}
+
+// Unsolicited bytes from the UPS, available at once.
+static void test_inject(const char *bytes)
+{
+    for (size_t i = 0U; bytes[i] != '\0'; i++)
+    {
+        s_fifo[s_fifo_head++ & (TEST_FIFO_SIZE - 1U)] = (uint8_t)bytes[i];
+    }
+}
+
+static void test_deliver_due(void)
+{
+    if ((s_pending_reply != NULL) && ((int32_t)(s_now_ms - s_pending_due_ms) >= 0))
+    {
+        test_inject(s_pending_reply);
+        s_pending_reply = NULL;
+    }
+}
+
+// ---- scripted loopback UART backend ---------------------------------------
+
+uint32_t UART2_TickMs(void)
+{
+    return s_now_ms;
+}
+
+uint32_t UART2_TickUs(void)
+{
+    return s_now_ms * 1000U;
+}
+
+void UART2_DelayUs(uint32_t us)
+{
+    s_now_ms += (us + 999U) / 1000U;
+}
+
+bool UART2_TryLock(uint8_t unit)
+{
+    (void)unit;
+    return true;
+}
+
+void UART2_Unlock(uint8_t unit)
+{
+    (void)unit;
+}
+
+esp_err_t UART2_SendBytesDMA(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+
+    s_tx_done_ms = s_now_ms + sim_wire_ms(len);
+    for (uint16_t i = 0U; i < len; i++)
+    {
+        if (s_tx_log_len < (sizeof(s_tx_log) - 1U))
+        {
+            s_tx_log[s_tx_log_len++] = (char)data[i];
+        }
+        if (s_replies[data[i]] != NULL)
+        {
+            s_pending_reply = s_replies[data[i]];
+            s_pending_due_ms = s_tx_done_ms + TEST_REPLY_DELAY_MS;
+        }
+    }
+    return ESP_OK;
+}
+
+bool UART2_TxDone(uint8_t unit)
+{
+    (void)unit;
+    return (int32_t)(s_now_ms - s_tx_done_ms) >= 0;
+}
+
+void UART2_TxDoneClear(uint8_t unit)
+{
+    (void)unit;
+}
+
+uint16_t UART2_Available(uint8_t unit)
+{
+    (void)unit;
+    return (uint16_t)(s_fifo_head - s_fifo_tail);
+}
+
+uint16_t UART2_Read(uint8_t unit, uint8_t *dst, uint16_t len)
+{
+    (void)unit;
+    uint16_t n = 0U;
+    while ((n < len) && (s_fifo_tail != s_fifo_head))
+    {
+        dst[n++] = s_fifo[s_fifo_tail++ & (TEST_FIFO_SIZE - 1U)];
+    }
+    return n;
+}
+
+void UART2_DiscardBuffered(uint8_t unit)
+{
+    (void)unit;
+    s_fifo_tail = s_fifo_head;
+}
+
+int UART2_PatternPopPos(uint8_t unit)
+{
+    (void)unit;
+    return -1;
+}
+
+bool UART2_PatternEnabled(uint8_t unit)
+{
+    (void)unit;
+    return false;
+}
+
+void UART2_Wake(uint8_t unit)
+{
+    (void)unit;
+}
+
+// ---- harness --------------------------------------------------------------
+
+static void test_reset(void)
+{
+    s_now_ms = 1000U;
+    (void)memset(s_replies, 0, sizeof(s_replies));
+    s_fifo_head = 0U;
+    s_fifo_tail = 0U;
+    s_tx_done_ms = 0U;
+    s_pending_reply = NULL;
+    s_tx_log_len = 0U;
+    (void)memset(s_tx_log, 0, sizeof(s_tx_log));
+
+    ups_clock_set(test_clock_ms, NULL);
+    uart_engine_init();
+    uart_engine_set_enabled(0U, true);
+}
+
+// Tick the engine (and sched, if not NULL) until nothing is left to do.
+static void test_run_idle(lut_sched_t *sched)
+{
+    uint32_t const start_ms = s_now_ms;
+    while ((s_now_ms - start_ms) < TEST_MAX_RUN_MS)
+    {
+        test_deliver_due();
+        if (sched != NULL)
+        {
+            (void)lut_sched_tick(sched, ups_tick_ms());
+        }
+        uart_engine_tick(0U);
+        if (!uart_engine_is_busy(0U) && (s_pending_reply == NULL) &&
+            ((sched == NULL) || (sched->inflight == 0U)))
+        {
+            return;
+        }
+        s_now_ms++;
+    }
+}
+
+static bool test_count_read(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
+{
+    (void)cmd;
+    (void)rx;
+    (*(uint32_t *)out_value)++;
+    return true;
+}
+
+typedef struct
+{
+    char text[32];
+    uint16_t len;
+} test_capture_t;
+
+// Keeps the reply without its CR LF terminator.
+static bool test_capture(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
+{
+    (void)cmd;
+    test_capture_t *c = (test_capture_t *)out_value;
+    uint16_t n = uart_engine_span_copy(rx, (uint8_t *)c->text, (uint16_t)(sizeof(c->text) - 1U));
+    while ((n > 0U) && ((c->text[n - 1U] == '\r') || (c->text[n - 1U] == '\n')))
+    {
+        n--;
+    }
+    c->text[n] = '\0';
+    c->len = n;
+    return true;
+}
+
+static bool test_alert_byte(uint8_t byte, bool in_response, void *ctx)
+{
+    (void)in_response;
+    (void)ctx;
+    return byte == (uint8_t)'!';
+}
+
+// ---- tests ----------------------------------------------------------------
+
+static uint32_t s_status_reads;
+
+static const uart_engine_request_t k_status_lut[] = {
+    {
+        .out_value = &s_status_reads,
+        .cmd = (uint16_t)'Q',
+        .cmd_bits = 8U,
+        .expected_len = 3U,
+        .timeout_ms = 200U,
+        .max_retries = 0U,
+        .process_fn = test_count_read,
+    },
+};
+static const uint32_t k_status_period_ms[] = {1000U};
+
+// An alert arriving while lut_sched's read of the same command is still
+// queued joins that job: one 'Q' on the wire, and the scheduler still learns
+// that its read completed.
+static void test_alert_merges_with_scheduled_read(void)
+{
+    lut_sched_t sched;
+    uart_engine_class_stats_t crit;
+
+    test_reset();
+    s_status_reads = 0U;
+    s_replies['Q'] = "08\r";
+    uart_engine_set_oob_handler(0U, test_alert_byte, NULL, k_status_lut, 1U);
+    TEST_CHECK(lut_sched_init(&sched, 0U, k_status_lut, k_status_period_ms, 1U));
+    lut_sched_start(&sched, s_now_ms);
+    s_now_ms += k_status_period_ms[0];
+
+    (void)lut_sched_tick(&sched, ups_tick_ms());
+    TEST_CHECK(sched.inflight == 1U);
+    test_inject("!");
+    test_run_idle(&sched);
+
+    TEST_CHECK(strcmp(s_tx_log, "Q") == 0);
+    TEST_CHECK(s_status_reads == 1U);
+    TEST_CHECK(sched.entries[0].stats.ok == 1U);
+    TEST_CHECK(sched.inflight == 0U);
+    TEST_CHECK(uart_engine_get_class_stats(0U, UART_ENGINE_PRIO_CRITICAL, &crit));
+    TEST_CHECK(crit.merged == 1U);
+    TEST_CHECK(crit.promoted == 1U);
+}
+
+// The other order: the scheduled read joins a pending alert refresh and
+// takes over its completion report.
+static void test_scheduled_read_joins_alert_refresh(void)
+{
+    lut_sched_t sched;
+
+    test_reset();
+    s_status_reads = 0U;
+    s_replies['Q'] = "08\r";
+    TEST_CHECK(lut_sched_init(&sched, 0U, k_status_lut, k_status_period_ms, 1U));
+    lut_sched_start(&sched, s_now_ms);
+    s_now_ms += k_status_period_ms[0];
+
+    TEST_CHECK(uart_engine_enqueue_static(0U, &k_status_lut[0], UART_ENGINE_PRIO_CRITICAL) == UART_ENGINE_OK);
+    (void)lut_sched_tick(&sched, ups_tick_ms());
+    test_run_idle(&sched);
+
+    TEST_CHECK(strcmp(s_tx_log, "Q") == 0);
+    TEST_CHECK(s_status_reads == 1U);
+    TEST_CHECK(sched.entries[0].stats.ok == 1U);
+    TEST_CHECK(sched.inflight == 0U);
+}
+
+// Disabling the engine reports pending scheduled reads, so lut_sched does not
+// wait for them forever.
+static void test_disable_completes_scheduled_read(void)
+{
+    lut_sched_t sched;
+
+    test_reset();
+    TEST_CHECK(lut_sched_init(&sched, 0U, k_status_lut, k_status_period_ms, 1U));
+    lut_sched_start(&sched, s_now_ms);
+    s_now_ms += k_status_period_ms[0];
+
+    (void)lut_sched_tick(&sched, ups_tick_ms());
+    TEST_CHECK(sched.inflight == 1U);
+    uart_engine_set_enabled(0U, false);
+    TEST_CHECK(sched.inflight == 0U);
+    TEST_CHECK(s_tx_log_len == 0U);
+}
+
+// A refused enqueue makes lut_sched report a retry wait, not 0, so the main
+// loop does not spin until the engine accepts the read again.
+static void test_refused_scheduled_read_backs_off(void)
+{
+    lut_sched_t sched;
+
+    test_reset();
+    s_status_reads = 0U;
+    s_replies['Q'] = "08\r";
+    TEST_CHECK(lut_sched_init(&sched, 0U, k_status_lut, k_status_period_ms, 1U));
+    lut_sched_start(&sched, s_now_ms);
+    s_now_ms += k_status_period_ms[0];
+    uart_engine_set_enabled(0U, false);
+
+    (void)lut_sched_tick(&sched, ups_tick_ms());
+    TEST_CHECK(sched.inflight == 0U);
+    TEST_CHECK(lut_sched_time_to_next_ms(&sched, ups_tick_ms()) == LUT_SCHED_RETRY_MS);
+
+    uart_engine_set_enabled(0U, true);
+    s_now_ms += LUT_SCHED_RETRY_MS;
+    (void)lut_sched_tick(&sched, ups_tick_ms());
+    TEST_CHECK(sched.inflight == 1U);
+    test_run_idle(&sched);
+    TEST_CHECK(s_status_reads == 1U);
+    TEST_CHECK(lut_sched_time_to_next_ms(&sched, ups_tick_ms()) != 0U);
+}
+
+// The same for a probe that finds every tracking slot taken.
+static void test_refused_probe_backs_off(void)
+{
+    lut_probe_t probe;
+
+    test_reset();
+    s_status_reads = 0U;
+    s_replies['Q'] = "08\r";
+    for (uint8_t i = 0U; i < 4U; i++)
+    {
+        TEST_CHECK(uart_engine_submit(0U, &k_status_lut[0], UART_ENGINE_PRIO_BACKGROUND, NULL, NULL, NULL) ==
+                   UART_ENGINE_OK);
+    }
+    TEST_CHECK(lut_probe_start(&probe, 0U, k_status_lut, 1U, LUT_PROBE_ALL));
+    TEST_CHECK(!lut_probe_tick(&probe));
+    TEST_CHECK(lut_probe_time_to_next_ms(&probe) == LUT_PROBE_RETRY_MS);
+
+    test_run_idle(NULL);
+    TEST_CHECK(!lut_probe_tick(&probe));
+    TEST_CHECK(lut_probe_time_to_next_ms(&probe) == UINT32_MAX);
+    test_run_idle(NULL);
+    TEST_CHECK(lut_probe_tick(&probe));
+    TEST_CHECK(lut_probe_supported(&probe) == 1U);
+}
+
+static test_capture_t s_capture;
+
+static const uart_engine_request_t k_line_request = {
+    .out_value = &s_capture,
+    .cmd = (uint16_t)'n',
+    .cmd_bits = 8U,
+    .expected_len = 32U,
+    .expected_ending = true,
+    .expected_ending_len = 2U,
+    .expected_ending_bytes = {0x0DU, 0x0AU},
+    .timeout_ms = 200U,
+    .max_retries = 0U,
+    .process_fn = test_capture,
+};
+
+static const uart_engine_request_t k_fixed_request = {
+    .out_value = &s_capture,
+    .cmd = (uint16_t)'V',
+    .cmd_bits = 8U,
+    .expected_len = 6U,
+    .timeout_ms = 200U,
+    .max_retries = 0U,
+    .process_fn = test_capture,
+};
+
+// Reply to req with the SPM2K alert handler installed; false if the engine
+// did not accept the request.
+static bool test_reply_with_alerts(const uart_engine_request_t *req, const char *reply)
+{
+    test_reset();
+    (void)memset(&s_capture, 0, sizeof(s_capture));
+    (void)memset(&g_ups[0], 0, sizeof(g_ups[0]));
+    g_ups[0].present_status.ac_present = true;
+    s_replies[(uint8_t)req->cmd] = reply;
+    uart_engine_set_oob_handler(0U, spm2k_process_alert_byte, &g_ups[0], NULL, 0U);
+    if (uart_engine_enqueue_static(0U, req, UART_ENGINE_PRIO_INTERACTIVE) != UART_ENGINE_OK)
+    {
+        return false;
+    }
+    test_run_idle(NULL);
+    return true;
+}
+
+static uint32_t test_oob_bytes(void)
+{
+    uart_engine_bus_stats_t bus;
+    uart_engine_get_bus_stats(0U, &bus);
+    return bus.oob_bytes;
+}
+
+// Alert characters inside free-text replies (serial number, model) are data.
+static void test_alert_chars_in_strings_are_data(void)
+{
+    TEST_CHECK(test_reply_with_alerts(&k_line_request, "QS0#12+34\r\n"));
+    TEST_CHECK(strcmp(s_capture.text, "QS0#12+34") == 0);
+    TEST_CHECK(test_oob_bytes() == 0U);
+    TEST_CHECK(!g_ups[0].present_status.need_replacement);
+
+    TEST_CHECK(test_reply_with_alerts(&k_line_request, "Smart-UPS 1500 #2 !$%*?=&|\r\n"));
+    TEST_CHECK(strcmp(s_capture.text, "Smart-UPS 1500 #2 !$%*?=&|") == 0);
+    TEST_CHECK(test_oob_bytes() == 0U);
+    TEST_CHECK(g_ups[0].present_status.ac_present);
+    TEST_CHECK(!g_ups[0].present_status.shutdown_imminent);
+}
+
+// A fixed-length reply keeps its length when it contains alert characters.
+static void test_alert_chars_in_fixed_reply_are_data(void)
+{
+    TEST_CHECK(test_reply_with_alerts(&k_fixed_request, "4#+!$7"));
+    TEST_CHECK(strcmp(s_capture.text, "4#+!$7") == 0);
+    TEST_CHECK(test_oob_bytes() == 0U);
+    TEST_CHECK(g_ups[0].present_status.ac_present);
+}
+
+// An alert sent just ahead of the reply is still taken out and applied.
+static void test_alert_ahead_of_reply_is_filtered(void)
+{
+    TEST_CHECK(test_reply_with_alerts(&k_line_request, "!#QS0#12\r\n"));
+    TEST_CHECK(strcmp(s_capture.text, "QS0#12") == 0);
+    TEST_CHECK(test_oob_bytes() == 2U);
+    TEST_CHECK(!g_ups[0].present_status.ac_present);
+    TEST_CHECK(g_ups[0].present_status.need_replacement);
+
+    // Between jobs, as before (once the inter-job cooldown has passed).
+    s_now_ms += 10U;
+    test_inject("$");
+    test_run_idle(NULL);
+    TEST_CHECK(test_oob_bytes() == 3U);
+    TEST_CHECK(g_ups[0].present_status.ac_present);
+}
+
+static uint32_t test_merged(uart_engine_priority_t prio)
+{
+    uart_engine_class_stats_t st;
+    (void)uart_engine_get_class_stats(0U, prio, &st);
+    return st.merged;
+}
+
+// Requests merge only when the whole exchange is the same; a different
+// reply length, terminator or timeout is a different read of the command.
+static void test_merge_needs_same_exchange(void)
+{
+    test_reset();
+    s_replies['n'] = "QS0#12\r\n";
+
+    uart_engine_request_t same = k_line_request;
+    same.max_retries = 2U;
+    uart_engine_request_t longer = k_line_request;
+    longer.expected_len = 64U;
+    uart_engine_request_t cr_only = k_line_request;
+    cr_only.expected_ending_len = 1U;
+    uart_engine_request_t slower = k_line_request;
+    slower.timeout_ms = 1000U;
+
+    TEST_CHECK(uart_engine_enqueue_static(0U, &k_line_request, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_enqueue(0U, &same, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_enqueue(0U, &longer, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_enqueue(0U, &cr_only, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_enqueue(0U, &slower, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(test_merged(UART_ENGINE_PRIO_BACKGROUND) == 1U);
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(s_tx_log, "nnnn") == 0);
+}
+
+// Byte-string commands are compared by content and length.
+static void test_merge_compares_tx_bytes(void)
+{
+    static const uint8_t k_cmd_a[] = {'^', 'A'};
+    static const uint8_t k_cmd_b[] = {'^', 'A'};
+
+    test_reset();
+    s_replies['A'] = "OK\r\n";
+
+    uart_engine_request_t a = k_line_request;
+    a.tx_bytes = k_cmd_a;
+    a.tx_len = 2U;
+    uart_engine_request_t b = a;
+    b.tx_bytes = k_cmd_b;
+    uart_engine_request_t shorter = a;
+    shorter.tx_len = 1U;
+
+    TEST_CHECK(uart_engine_enqueue(0U, &a, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_enqueue(0U, &b, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_enqueue(0U, &shorter, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    TEST_CHECK(test_merged(UART_ENGINE_PRIO_BACKGROUND) == 1U);
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(s_tx_log, "^A^") == 0);
+}
+
+// A job promoted by a merge keeps its queued time, so the class wait stats
+// (and aging) count from the first enqueue.
+static void test_promotion_keeps_queued_time(void)
+{
+    uart_engine_class_stats_t crit;
+
+    test_reset();
+    s_replies['n'] = "QS0\r\n";
+    TEST_CHECK(uart_engine_enqueue_static(0U, &k_line_request, UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK);
+    s_now_ms += 50U;
+    TEST_CHECK(uart_engine_enqueue_static(0U, &k_line_request, UART_ENGINE_PRIO_CRITICAL) == UART_ENGINE_OK);
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(s_tx_log, "n") == 0);
+    TEST_CHECK(uart_engine_get_class_stats(0U, UART_ENGINE_PRIO_CRITICAL, &crit));
+    TEST_CHECK(crit.promoted == 1U);
+    TEST_CHECK(crit.dispatched == 1U);
+    TEST_CHECK(crit.wait_max_ms >= 50U);
+}
+
+// A job cancelled while queued is dropped without being sent.
+static void test_cancel_queued_job_is_not_sent(void)
+{
+    test_capture_t first = {0};
+    test_capture_t second = {0};
+    uart_engine_request_t a = k_line_request;
+    uart_engine_request_t b = k_fixed_request;
+    a.out_value = &first;
+    b.out_value = &second;
+    uart_engine_handle_t handle = 0U;
+
+    test_reset();
+    s_replies['n'] = "QS0\r\n";
+    s_replies['V'] = "123456";
+    TEST_CHECK(uart_engine_submit(0U, &a, UART_ENGINE_PRIO_INTERACTIVE, NULL, NULL, NULL) == UART_ENGINE_OK);
+    TEST_CHECK(uart_engine_submit(0U, &b, UART_ENGINE_PRIO_INTERACTIVE, NULL, NULL, &handle) == UART_ENGINE_OK);
+    uart_engine_tick(0U); // both queued, the first one sent
+    uart_engine_job_cancel(handle);
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(s_tx_log, "n") == 0);
+    TEST_CHECK(strcmp(first.text, "QS0") == 0);
+    TEST_CHECK(second.len == 0U);
+    TEST_CHECK(uart_engine_job_wait(handle, s_now_ms) == UART_ENGINE_ERR_BAD_PARAM);
+}
+
+static uart_engine_handle_t s_cancel_handle;
+static uint32_t s_cancel_calls;
+static uint32_t s_reuse_reads;
+
+static const uart_engine_request_t k_reuse_request = {
+    .out_value = &s_reuse_reads,
+    .cmd = (uint16_t)'V',
+    .cmd_bits = 8U,
+    .expected_len = 6U,
+    .timeout_ms = 200U,
+    .max_retries = 0U,
+    .process_fn = test_count_read,
+};
+
+// Cancels its own job while it runs, as another task could.
+static bool test_cancel_in_process(uint16_t cmd, const uart_engine_span_t *rx, void *out_value)
+{
+    (void)cmd;
+    (void)rx;
+    (void)out_value;
+    s_cancel_calls++;
+    uart_engine_job_cancel(s_cancel_handle);
+    return false;
+}
+
+// A job cancelled while process_fn runs is not retried, so nothing still
+// refers to its slot once it is reused.
+static void test_cancel_in_process_drops_retries(void)
+{
+    uart_engine_request_t req = k_line_request;
+    req.max_retries = 2U;
+    req.process_fn = test_cancel_in_process;
+    uart_engine_class_stats_t stats;
+
+    test_reset();
+    s_replies['n'] = "QS0\r\n";
+    s_replies['V'] = "123456";
+    s_cancel_calls = 0U;
+    s_reuse_reads = 0U;
+    TEST_CHECK(uart_engine_submit(0U, &req, UART_ENGINE_PRIO_INTERACTIVE, NULL, NULL, &s_cancel_handle) ==
+               UART_ENGINE_OK);
+    while ((s_cancel_calls == 0U) && (s_now_ms < (1000U + TEST_MAX_RUN_MS)))
+    {
+        test_deliver_due();
+        uart_engine_tick(0U);
+        s_now_ms++;
+    }
+    // Every slot, including the cancelled one, takes a new job.
+    for (uint8_t i = 0U; i < 4U; i++)
+    {
+        TEST_CHECK(uart_engine_submit(0U, &k_reuse_request, UART_ENGINE_PRIO_BACKGROUND, NULL, NULL, NULL) ==
+                   UART_ENGINE_OK);
+    }
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(s_tx_log, "nVVVV") == 0);
+    TEST_CHECK(s_cancel_calls == 1U);
+    TEST_CHECK(s_reuse_reads == 4U);
+    TEST_CHECK(uart_engine_get_class_stats(0U, UART_ENGINE_PRIO_INTERACTIVE, &stats));
+    TEST_CHECK(stats.dispatched == 1U);
+    TEST_CHECK(uart_engine_job_wait(s_cancel_handle, s_now_ms) == UART_ENGINE_ERR_BAD_PARAM);
+}
+
+// Queues an edit-and-read-back transaction from a stack array that is wiped
+// before returning, as a reused stack frame would be.
+static uart_engine_result_t test_enqueue_stack_transaction(test_capture_t *first, test_capture_t *second)
+{
+    uart_engine_request_t steps[2] = {k_line_request, k_fixed_request};
+    steps[0].out_value = first;
+    steps[1].out_value = second;
+    uart_engine_result_t const result = uart_engine_enqueue_transaction(0U, steps, 2U, UART_ENGINE_PRIO_INTERACTIVE);
+    (void)memset(steps, 0, sizeof(steps));
+    return result;
+}
+
+// Transaction steps are copied, and their pool slot is freed at the end.
+static void test_transaction_steps_are_copied(void)
+{
+    test_capture_t captures[6] = {0};
+
+    test_reset();
+    s_replies['n'] = "QS0\r\n";
+    s_replies['V'] = "123456";
+    TEST_CHECK(test_enqueue_stack_transaction(&captures[0], &captures[1]) == UART_ENGINE_OK);
+    TEST_CHECK(test_enqueue_stack_transaction(&captures[2], &captures[3]) == UART_ENGINE_OK);
+    TEST_CHECK(test_enqueue_stack_transaction(&captures[4], &captures[5]) == UART_ENGINE_ERR_QUEUE_FULL);
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(s_tx_log, "nVnV") == 0);
+    TEST_CHECK(strcmp(captures[0].text, "QS0") == 0);
+    TEST_CHECK(strcmp(captures[1].text, "123456") == 0);
+    TEST_CHECK(strcmp(captures[3].text, "123456") == 0);
+    TEST_CHECK(captures[4].len == 0U);
+
+    TEST_CHECK(test_enqueue_stack_transaction(&captures[4], &captures[5]) == UART_ENGINE_OK);
+    test_run_idle(NULL);
+    TEST_CHECK(strcmp(captures[5].text, "123456") == 0);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1)
+    {
+        if (opt != 'v')
+        {
+            fprintf(stderr, "usage: ups_test [-v]\n");
+            return 2;
+        }
+        s_verbose = true;
+    }
+
+    test_alert_merges_with_scheduled_read();
+    test_scheduled_read_joins_alert_refresh();
+    test_disable_completes_scheduled_read();
+    test_refused_scheduled_read_backs_off();
+    test_refused_probe_backs_off();
+    test_alert_chars_in_strings_are_data();
+    test_alert_chars_in_fixed_reply_are_data();
+    test_alert_ahead_of_reply_is_filtered();
+    test_merge_needs_same_exchange();
+    test_merge_compares_tx_bytes();
+    test_promotion_keeps_queued_time();
+    test_cancel_queued_job_is_not_sent();
+    test_cancel_in_process_drops_retries();
+    test_transaction_steps_are_copied();
+
+    printf("%u checks, %u failed\n", s_checks, s_failed);
+    return (s_failed == 0U) ? 0 : 1;
+}
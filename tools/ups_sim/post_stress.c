@@ -0,0 +1,172 @@
+// Multithreaded stress test of the engine's MPSC post ring (the lock-free
+// ring behind uart_engine_post()). The ring is internal to uart_engine.c, so
+// that file is compiled into this one.
+//
+//   ups_post_stress [-p producers] [-n posts]
+//
+//   -p producers  producer threads (default 4, at most POST_STRESS_MAX_PRODUCERS)
+//   -n posts      posts per producer (default 100000)
+//
+// Each producer posts its own requests in order, retrying while the ring is
+// full; the main thread consumes as the engine task does. Exit status 1 if
+// a post was lost or seen twice, or a producer's posts arrived out of order.
+
+#include "../../src/uart_engine.c"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define POST_STRESS_MAX_PRODUCERS 16U
+
+typedef struct
+{
+    pthread_t thread;
+    uint8_t id;
+    uart_engine_request_t *reqs; // reqs[i] is post i of this producer
+    uint32_t full;               // pushes refused because the ring was full
+} post_stress_producer_t;
+
+static uart_engine_post_ring_t s_ring;
+static uint32_t s_posts = 100000U;
+static atomic_bool s_go;
+static atomic_uint s_done; // producers that have posted everything
+
+static void *post_stress_produce(void *arg)
+{
+    post_stress_producer_t *p = (post_stress_producer_t *)arg;
+    while (!atomic_load_explicit(&s_go, memory_order_acquire))
+    {
+        sched_yield();
+    }
+
+    for (uint32_t i = 0U; i < s_posts; i++)
+    {
+        while (!post_ring_push(&s_ring, &p->reqs[i], p->id))
+        {
+            p->full++;
+            sched_yield();
+        }
+    }
+    (void)atomic_fetch_add(&s_done, 1U);
+    return NULL;
+}
+
+static void post_stress_usage(void)
+{
+    fprintf(stderr, "usage: ups_post_stress [-p producers] [-n posts]\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t producers = 4U;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            producers = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            s_posts = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            post_stress_usage();
+            return 2;
+        }
+    }
+    if ((producers == 0U) || (producers > POST_STRESS_MAX_PRODUCERS) || (s_posts == 0U))
+    {
+        post_stress_usage();
+        return 2;
+    }
+
+    post_stress_producer_t prod[POST_STRESS_MAX_PRODUCERS];
+    uint32_t next[POST_STRESS_MAX_PRODUCERS] = {0U};
+    post_ring_init(&s_ring);
+    atomic_init(&s_go, false);
+    atomic_init(&s_done, 0U);
+    for (uint32_t p = 0U; p < producers; p++)
+    {
+        prod[p].id = (uint8_t)p;
+        prod[p].full = 0U;
+        prod[p].reqs = calloc(s_posts, sizeof(uart_engine_request_t));
+        if ((prod[p].reqs == NULL) || (pthread_create(&prod[p].thread, NULL, post_stress_produce, &prod[p]) != 0))
+        {
+            fprintf(stderr, "ups_post_stress: cannot start producer %u\n", (unsigned int)p);
+            return 2;
+        }
+    }
+    atomic_store_explicit(&s_go, true, memory_order_release);
+
+    uint64_t const total = (uint64_t)producers * s_posts;
+    uint64_t seen = 0U;
+    uint32_t errors = 0U;
+    for (;;)
+    {
+        // Every producer's last publish happens before it counts itself done.
+        bool const all_done = (atomic_load(&s_done) == producers);
+        uart_engine_post_cell_t const *cell = post_ring_peek(&s_ring);
+        if (cell == NULL)
+        {
+            if (all_done)
+            {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        uint8_t const p = cell->prio;
+        bool const mine = (p < producers) && (cell->req >= prod[p].reqs) && (cell->req < &prod[p].reqs[s_posts]);
+        uint32_t const index = mine ? (uint32_t)(cell->req - prod[p].reqs) : 0U;
+        if (!mine || (index != next[p]))
+        {
+            // Lost, duplicated or reordered post.
+            if (errors++ < 10U)
+            {
+                printf("post %llu: producer %u post %u, expected post %u\n",
+                       (unsigned long long)seen,
+                       (unsigned int)p,
+                       (unsigned int)index,
+                       (unsigned int)(mine ? next[p] : 0U));
+            }
+        }
+        if (mine)
+        {
+            next[p] = index + 1U;
+        }
+        post_ring_release(&s_ring);
+        seen++;
+    }
+
+    uint64_t full = 0U;
+    for (uint32_t p = 0U; p < producers; p++)
+    {
+        (void)pthread_join(prod[p].thread, NULL);
+        full += prod[p].full;
+        if (next[p] != s_posts)
+        {
+            errors++;
+            printf("producer %u: %u of %u posts consumed\n", (unsigned int)p, (unsigned int)next[p],
+                   (unsigned int)s_posts);
+        }
+        free(prod[p].reqs);
+    }
+    if (seen != total)
+    {
+        errors++;
+        printf("%llu posts consumed, %llu made\n", (unsigned long long)seen, (unsigned long long)total);
+    }
+
+    printf("%u producers x %u posts through a %u-cell ring: %llu ring-full retries, %u errors\n",
+           (unsigned int)producers,
+           (unsigned int)s_posts,
+           (unsigned int)UART_ENGINE_POST_RING_SIZE,
+           (unsigned long long)full,
+           (unsigned int)errors);
+    return (errors == 0U) ? 0 : 1;
+}
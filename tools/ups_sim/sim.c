@@ -0,0 +1,222 @@
+// Host run of src/uart_engine.c and the SPM2K LUTs over the POSIX termios
+// UART backend (src/uart_backend_pty.c), in wall-clock time.
+//
+//   ups_sim [-d device] [-t seconds] [-a seconds] [-p ms]
+//
+// Without -d a pseudo-terminal is created and a simulated SPM2K UPS answers
+// on its master side. With -d the engine talks to that serial device instead
+// (a USB-serial adapter wired to a real UPS, or a pty from socat).
+//
+//   -d device   serial device or pty to poll
+//   -t seconds  run time (default 30)
+//   -a seconds  simulated UPS: toggle mains power every n seconds, with the
+//               '!' / '$' alert characters (default 10, 0 = never)
+//   -p ms       dynamic LUT polling period (default 1000)
+//
+// One status line is printed per completed dynamic sweep, and per-command
+// engine statistics at exit. See des.c for the same run on a virtual clock.
+
+#include "sim_common.h"
+
+#include "main.h"
+#include "spm2k.h"
+#include "uart_engine.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int s_sim_fd = -1;
+static uint32_t s_alert_period_ms = 10000U;
+
+static void sim_sleep_ms(uint32_t ms)
+{
+    struct timespec const ts = {
+        .tv_sec = (time_t)(ms / 1000U),
+        .tv_nsec = (long)(ms % 1000U) * 1000000L,
+    };
+    (void)nanosleep(&ts, NULL);
+}
+
+static void sim_write(const char *data, size_t len)
+{
+    // The UPS talks at UPS_UART_BAUDRATE: the reply takes its wire time.
+    sim_sleep_ms(sim_wire_ms(len));
+    if (write(s_sim_fd, data, len) != (ssize_t)len)
+    {
+        fprintf(stderr, "sim: write failed: %s\n", strerror(errno));
+    }
+}
+
+// Simulated UPS on the pty master, in its own thread.
+static void *sim_ups_thread(void *arg)
+{
+    (void)arg;
+
+    sim_ups_t ups;
+    sim_ups_init(&ups);
+    uint32_t next_toggle_ms = ups_tick_ms() + s_alert_period_ms;
+    uint32_t last_ms = ups_tick_ms();
+
+    while (1)
+    {
+        struct pollfd pfd = {.fd = s_sim_fd, .events = POLLIN, .revents = 0};
+        int const ready = poll(&pfd, 1U, 50);
+
+        uint32_t const now_ms = ups_tick_ms();
+        sim_ups_advance(&ups, now_ms - last_ms);
+        last_ms = now_ms;
+
+        if ((s_alert_period_ms > 0U) && ((int32_t)(now_ms - next_toggle_ms) >= 0))
+        {
+            next_toggle_ms = now_ms + s_alert_period_ms;
+            char const alert = sim_ups_set_mains(&ups, ups.on_battery);
+            sim_write(&alert, 1U);
+        }
+
+        if ((ready <= 0) || ((pfd.revents & POLLIN) == 0))
+        {
+            continue;
+        }
+
+        uint8_t buf[32];
+        ssize_t const got = read(s_sim_fd, buf, sizeof(buf));
+        if (got <= 0)
+        {
+            return NULL;
+        }
+
+        for (ssize_t i = 0; i < got; i++)
+        {
+            char reply[48];
+            size_t const len = sim_ups_feed(&ups, buf[i], reply, sizeof(reply));
+            if (len > 0U)
+            {
+                sim_sleep_ms(SIM_REPLY_DELAY_MS);
+                sim_write(reply, len);
+            }
+        }
+    }
+}
+
+static void sim_usage(void)
+{
+    fprintf(stderr, "usage: ups_sim [-d device] [-t seconds] [-a seconds] [-p ms]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL;
+    uint32_t run_ms = 30000U;
+    uint32_t period_ms = 1000U;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:t:a:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            device = optarg;
+            break;
+        case 't':
+            run_ms = (uint32_t)strtoul(optarg, NULL, 0) * 1000U;
+            break;
+        case 'a':
+            s_alert_period_ms = (uint32_t)strtoul(optarg, NULL, 0) * 1000U;
+            break;
+        case 'p':
+            period_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            sim_usage();
+            return 2;
+        }
+    }
+
+    if (device != NULL)
+    {
+        if (!uart_backend_pty_open(0U, device))
+        {
+            return 1;
+        }
+        printf("# polling %s\n", device);
+    }
+    else
+    {
+        char name[64];
+        s_sim_fd = uart_backend_pty_create(0U, name, sizeof(name));
+        pthread_t sim_thread;
+        if ((s_sim_fd < 0) || (pthread_create(&sim_thread, NULL, sim_ups_thread, NULL) != 0))
+        {
+            return 1;
+        }
+        printf("# simulated UPS on %s\n", name);
+    }
+
+    uart_engine_init();
+    UART2_RxStartIT(0U);
+    uart_engine_set_enabled(0U, true);
+    uart_engine_set_oob_handler(0U, spm2k_process_alert_byte, &g_ups[0], g_spm2k_alert_refresh_lut, g_spm2k_alert_refresh_lut_count);
+
+    uint32_t const start_ms = ups_tick_ms();
+    sim_sweep_t sweep;
+    sim_sweep_start(&sweep, g_spm2k_constant_lut, g_spm2k_constant_lut_count);
+    uint32_t next_sweep_ms = start_ms;
+    bool sweeping = true;
+
+    while ((ups_tick_ms() - start_ms) < run_ms)
+    {
+        uint32_t const now_ms = ups_tick_ms();
+        if (sweeping)
+        {
+            sim_sweep_feed(&sweep);
+            if (sim_sweep_done(&sweep))
+            {
+                if (sweep.lut == g_spm2k_dynamic_lut)
+                {
+                    sim_print_status(now_ms - start_ms);
+                }
+                sweeping = false;
+            }
+        }
+        else if ((int32_t)(now_ms - next_sweep_ms) >= 0)
+        {
+            sim_sweep_start(&sweep, g_spm2k_dynamic_lut, g_spm2k_dynamic_lut_count);
+            next_sweep_ms = now_ms + period_ms;
+            sweeping = true;
+            continue;
+        }
+
+        uart_engine_tick(0U);
+
+        uint32_t timeout_ms = uart_engine_time_to_next_ms(0U, ups_tick_ms());
+        if (sweeping)
+        {
+            timeout_ms = ((sweep.index < sweep.count) || (timeout_ms == UINT32_MAX)) ? 0U : timeout_ms;
+        }
+        else
+        {
+            int32_t const until_sweep_ms = (int32_t)(next_sweep_ms - ups_tick_ms());
+            if (until_sweep_ms <= 0)
+            {
+                timeout_ms = 0U;
+            }
+            else if ((uint32_t)until_sweep_ms < timeout_ms)
+            {
+                timeout_ms = (uint32_t)until_sweep_ms;
+            }
+        }
+        if (timeout_ms > 0U)
+        {
+            (void)UART2_WaitEvent(timeout_ms);
+        }
+    }
+
+    sim_print_cmd_stats();
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include "sim_common.h"
+
+#include "main.h"
+#include "uart_trace.h"
+#include "ups_data.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+ups_telemetry_t g_ups[UPS_UNIT_COUNT];
+const bool g_ups_debug_status_print_enabled = false;
+
+// ---- host shims for the firmware interfaces -------------------------------
+
+static int s_task_handle;
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t)&s_task_handle;
+}
+
+BaseType_t xTaskNotifyGiveIndexed(TaskHandle_t task, UBaseType_t index)
+{
+    (void)task;
+    (void)index;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    (void)index;
+    (void)clear_on_exit;
+    (void)ticks_to_wait;
+    return 0U;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec const ts = {
+        .tv_sec = (time_t)(ticks / configTICK_RATE_HZ),
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ),
+    };
+    (void)nanosleep(&ts, NULL);
+}
+
+void uart_trace_tx(uint8_t unit, uint16_t job_id, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)job_id;
+    (void)data;
+    (void)len;
+}
+
+void uart_trace_rx(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)data;
+    (void)len;
+}
+
+void uart_trace_end(uint8_t unit, uint16_t job_id, uart_trace_end_t status)
+{
+    (void)unit;
+    (void)job_id;
+    (void)status;
+}
+
+void UPS_DebugPrintTxCommand(uint8_t unit, const uint8_t *data, uint16_t len)
+{
+    (void)unit;
+    (void)data;
+    (void)len;
+}
+
+// ---- simulated SPM2K UPS --------------------------------------------------
+
+void sim_ups_init(sim_ups_t *ups)
+{
+    ups->on_battery = false;
+    ups->capacity_x10 = 1000U;
+    ups->charge_ms = 0U;
+    ups->prefix = 0U;
+    ups->ignored_count = 0U;
+    ups->ignored = 0U;
+}
+
+bool sim_ups_ignore(sim_ups_t *ups, uint16_t cmd)
+{
+    if (ups->ignored_count >= SIM_MAX_IGNORED)
+    {
+        return false;
+    }
+    ups->ignored_cmds[ups->ignored_count++] = cmd;
+    return true;
+}
+
+bool sim_ups_ignores(const sim_ups_t *ups, uint16_t cmd)
+{
+    for (uint8_t i = 0U; i < ups->ignored_count; i++)
+    {
+        if (ups->ignored_cmds[i] == cmd)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void sim_ups_advance(sim_ups_t *ups, uint32_t elapsed_ms)
+{
+    ups->charge_ms += elapsed_ms;
+    while (ups->charge_ms >= 1000U)
+    {
+        ups->charge_ms -= 1000U;
+        if (ups->on_battery)
+        {
+            ups->capacity_x10 -= (ups->capacity_x10 > SIM_DISCHARGE_PER_S) ? SIM_DISCHARGE_PER_S : ups->capacity_x10;
+        }
+        else
+        {
+            ups->capacity_x10 += SIM_CHARGE_PER_S;
+            ups->capacity_x10 = (ups->capacity_x10 > 1000U) ? 1000U : ups->capacity_x10;
+        }
+    }
+}
+
+char sim_ups_set_mains(sim_ups_t *ups, bool on)
+{
+    ups->on_battery = !on;
+    return on ? '$' : '!';
+}
+
+// Reply to one command, "NA\r\n" for commands the simulation does not know.
+static int sim_ups_reply(const sim_ups_t *ups, uint16_t cmd, char *out, size_t cap)
+{
+    uint32_t const capacity = ups->capacity_x10;
+    uint32_t const runtime_min = (capacity * 45U) / 1000U;
+
+    switch (cmd)
+    {
+    case 0x59U: // 'Y' smart mode
+        return snprintf(out, cap, "SM\r\n");
+    case 0x01U:
+        return snprintf(out, cap, "Smart-UPS 1500\r\n");
+    case 0x6EU: // 'n'
+        return snprintf(out, cap, "AS0000000000\r\n");
+    case 0x9FD1U:
+        return snprintf(out, cap, "1000,230.00,230.00,0,0,24.00\r\n");
+    case 0x78U: // 'x'
+        return snprintf(out, cap, "01/15/24\r\n");
+    case 0x6CU: // 'l'
+        return snprintf(out, cap, "196\r\n");
+    case 0x75U: // 'u'
+        return snprintf(out, cap, "253\r\n");
+    case 0x42U: // 'B'
+        return snprintf(out, cap, "%s\r\n", ups->on_battery ? "25.80" : "27.30");
+    case 0x9FD4U:
+        return snprintf(out, cap, "%s\r\n", ups->on_battery ? "-8.40" : ((capacity < 1000U) ? "1.20" : "0.00"));
+    case 0x6AU: // 'j'
+        return snprintf(out, cap, "%04u:\r\n", (unsigned int)runtime_min);
+    case 0x43U: // 'C'
+        return snprintf(out, cap, "031.5\r\n");
+    case 0x66U: // 'f'
+        return snprintf(out, cap, "%03u.%u\r\n", (unsigned int)(capacity / 10U), (unsigned int)(capacity % 10U));
+    case 0x39U: // '9' line quality, no terminator
+        return snprintf(out, cap, "%s", ups->on_battery ? "00" : "FF");
+    case 0x51U: // 'Q' status flags
+        return snprintf(out, cap, "%s\r\n", ups->on_battery ? "10" : "08");
+    case 0x4CU: // 'L'
+        return snprintf(out, cap, "%s\r\n", ups->on_battery ? "000.0" : "230.4");
+    case 0x9FD3U:
+        return snprintf(out, cap, "%s\r\n", ups->on_battery ? "0.00" : "50.00");
+    case 0x5CU: // '\'
+        return snprintf(out, cap, "023.4\r\n");
+    case 0x4FU: // 'O'
+        return snprintf(out, cap, "230.4\r\n");
+    case 0x2FU: // '/'
+        return snprintf(out, cap, "1.80\r\n");
+    case 0x46U: // 'F'
+        return snprintf(out, cap, "50.00\r\n");
+    default:
+        return snprintf(out, cap, "NA\r\n");
+    }
+}
+
+size_t sim_ups_feed(sim_ups_t *ups, uint8_t byte, char *reply, size_t cap)
+{
+    if ((ups->prefix == 0U) && (byte == 0x9FU))
+    {
+        ups->prefix = 0x9F00U;
+        return 0U;
+    }
+
+    uint16_t const cmd = (uint16_t)(ups->prefix | byte);
+    ups->prefix = 0U;
+    if (sim_ups_ignores(ups, cmd))
+    {
+        ups->ignored++;
+        return 0U;
+    }
+
+    int const len = sim_ups_reply(ups, cmd, reply, cap);
+    return ((len > 0) && ((size_t)len < cap)) ? (size_t)len : 0U;
+}
+
+uint32_t sim_wire_ms(size_t len)
+{
+    return (uint32_t)(((len * 10000U) + (uint32_t)UPS_UART_BAUDRATE - 1U) / (uint32_t)UPS_UART_BAUDRATE);
+}
+
+// ---- LUT sweeps and reports -----------------------------------------------
+
+void sim_sweep_start(sim_sweep_t *sweep, const uart_engine_request_t *lut, size_t count)
+{
+    sweep->lut = lut;
+    sweep->count = count;
+    sweep->index = 0U;
+}
+
+void sim_sweep_feed(sim_sweep_t *sweep)
+{
+    while ((sweep->index < sweep->count) &&
+           (uart_engine_enqueue_static(0U, &sweep->lut[sweep->index], UART_ENGINE_PRIO_BACKGROUND) == UART_ENGINE_OK))
+    {
+        sweep->index++;
+    }
+}
+
+bool sim_sweep_done(const sim_sweep_t *sweep)
+{
+    return (sweep->index >= sweep->count) && !uart_engine_is_busy(0U);
+}
+
+void sim_print_status(uint32_t elapsed_ms)
+{
+    ups_telemetry_t const *t = &g_ups[0];
+    printf("%6u.%u s  %-7s  in %3u.%02u V %2u.%02u Hz  out %3u%%  batt %3u%% %5u s %2u.%02u V %+d.%02d A\n",
+           (unsigned int)(elapsed_ms / 1000U),
+           (unsigned int)((elapsed_ms % 1000U) / 100U),
+           t->present_status.ac_present ? "line" : "battery",
+           (unsigned int)(t->input.voltage / 100U),
+           (unsigned int)(t->input.voltage % 100U),
+           (unsigned int)(t->input.frequency / 100U),
+           (unsigned int)(t->input.frequency % 100U),
+           (unsigned int)t->output.percent_load,
+           (unsigned int)t->battery.remaining_capacity,
+           (unsigned int)t->battery.run_time_to_empty_s,
+           (unsigned int)(t->battery.battery_voltage / 100U),
+           (unsigned int)(t->battery.battery_voltage % 100U),
+           t->battery.battery_current / 100,
+           abs(t->battery.battery_current % 100));
+    fflush(stdout);
+}
+
+void sim_print_cmd_stats(void)
+{
+    static const char *const k_breaker[] = {"closed", "open", "probe"};
+    printf("#\n# cmd          ok  timeout  parse  srtt ms  suspended  trips  breaker\n");
+    size_t const count = uart_engine_cmd_stats_count(0U);
+    for (size_t i = 0U; i < count; i++)
+    {
+        uart_engine_cmd_stats_t s;
+        if (!uart_engine_get_cmd_stats(0U, i, &s))
+        {
+            continue;
+        }
+        printf("# 0x%-4X %9u %8u %6u %8u %10u %6u  %s\n",
+               (unsigned int)s.cmd,
+               (unsigned int)s.success,
+               (unsigned int)s.timeout,
+               (unsigned int)s.parse_fail,
+               (unsigned int)s.srtt_ms,
+               (unsigned int)s.suspended,
+               (unsigned int)s.breaker_trips,
+               k_breaker[s.breaker]);
+    }
+}
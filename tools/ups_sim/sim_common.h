@@ -0,0 +1,62 @@
+#ifndef SIM_COMMON_H_
+#define SIM_COMMON_H_
+
+// Shared by the pseudo-terminal run (sim.c) and the discrete-event run
+// (des.c): a simulated SPM2K UPS, the LUT sweep driver and the reports.
+
+#include "uart_engine.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Time from the end of a command to the UPS's first reply byte.
+#define SIM_REPLY_DELAY_MS 20U
+// Battery charge change per second off / on mains, in 0.1 %.
+#define SIM_DISCHARGE_PER_S 10U
+#define SIM_CHARGE_PER_S 10U
+// Commands the UPS can be told to leave unanswered (older firmware).
+#define SIM_MAX_IGNORED 4U
+
+typedef struct
+{
+    bool on_battery;
+    uint32_t capacity_x10; // 0.1 %
+    uint32_t charge_ms;    // elapsed time not yet applied to capacity_x10
+    uint16_t prefix;       // first byte of a two-byte command, 0 if none
+    uint16_t ignored_cmds[SIM_MAX_IGNORED];
+    uint8_t ignored_count;
+    uint32_t ignored;      // commands left unanswered because of ignored_cmds
+} sim_ups_t;
+
+void sim_ups_init(sim_ups_t *ups);
+void sim_ups_advance(sim_ups_t *ups, uint32_t elapsed_ms);
+// Switch mains power. Returns the alert character the UPS sends for it.
+char sim_ups_set_mains(sim_ups_t *ups, bool on);
+// Leave cmd unanswered from now on. Returns false if the list is full.
+bool sim_ups_ignore(sim_ups_t *ups, uint16_t cmd);
+bool sim_ups_ignores(const sim_ups_t *ups, uint16_t cmd);
+// Feed one byte sent by the bridge. Returns the length of the reply written
+// to reply, 0 while a two-byte command is incomplete or ignored.
+size_t sim_ups_feed(sim_ups_t *ups, uint8_t byte, char *reply, size_t cap);
+
+// Wire time of len characters at UPS_UART_BAUDRATE, rounded up.
+uint32_t sim_wire_ms(size_t len);
+
+typedef struct
+{
+    const uart_engine_request_t *lut;
+    size_t count;
+    size_t index; // next entry to enqueue
+} sim_sweep_t;
+
+void sim_sweep_start(sim_sweep_t *sweep, const uart_engine_request_t *lut, size_t count);
+// Enqueue as many of the remaining entries as the engine accepts.
+void sim_sweep_feed(sim_sweep_t *sweep);
+// All entries queued and the engine idle.
+bool sim_sweep_done(const sim_sweep_t *sweep);
+
+void sim_print_status(uint32_t elapsed_ms);
+void sim_print_cmd_stats(void);
+
+#endif // SIM_COMMON_H_